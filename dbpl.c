@@ -0,0 +1,1211 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2017 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "dbpl.h"
+#include "metacache.h"
+#include "pltmeta.h"
+#include "common.h"
+
+// DBPL 2.x playlist format.
+//
+// The file consists of a header, a string table, fixed size track records,
+// and an array of metadata key/value pairs, referring to the string table by index.
+// All numbers are stored in native byte order, like in DBPL 1.x.
+//
+// The string table is an index of {offset, size} entries, followed by the string data.
+// Each string is stored once, and is NULL-terminated; multi-value metadata
+// is stored as a single string with embedded NULLs, with the total size in the index.
+//
+// The saver deduplicates strings by pointer, since all track metadata is interned
+// in the metacache. The loader maps the file into memory, interns each string once,
+// and adds the references for all of its uses at once, instead of calling pl_add_meta
+// for every field. The tracks are read into a detached playlist without holding pl_lock,
+// so several playlists can be read in parallel.
+
+#define DBPL2_MAX_COUNT 0x10000000
+
+typedef struct {
+    char magic[4];
+    uint8_t majorver;
+    uint8_t minorver;
+    uint16_t reserved;
+    uint32_t num_items;
+    uint32_t num_strings;
+    uint32_t num_meta; // track metadata pairs
+    uint32_t num_plt_meta; // playlist metadata pairs, following the track metadata
+    uint64_t strings_offset; // {offset, size} index of the strings
+    uint64_t string_data_offset;
+    uint64_t string_data_size;
+    uint64_t items_offset;
+    uint64_t meta_offset;
+    // 2.1
+    uint64_t generation; // unique id of the saved file, to match the journal, 0 if none
+} dbpl2_header_t;
+
+#define DBPL2_HEADER_SIZE_2_0 offsetof (dbpl2_header_t, generation)
+
+typedef struct {
+    uint32_t offset; // relative to string_data_offset
+    uint32_t size; // including the terminating NULL
+} dbpl2_string_t;
+
+#define DBPL2_ITEM_HAS_STARTSAMPLE64 1
+#define DBPL2_ITEM_HAS_ENDSAMPLE64 2
+
+typedef struct {
+    int64_t startsample;
+    int64_t endsample;
+    float duration;
+    uint32_t flags; // DDB_IS_SUBTRACK, etc
+    uint32_t meta_first; // index of the first metadata pair
+    uint32_t num_meta;
+    uint32_t bits; // DBPL2_ITEM_*
+    uint32_t reserved;
+} dbpl2_item_t;
+
+typedef struct {
+    uint32_t key;
+    uint32_t value;
+} dbpl2_meta_t;
+
+static void
+_item_from_track (dbpl2_item_t *item, playItem_t *it) {
+    item->startsample = it->has_startsample64 ? it->startsample64 : it->startsample;
+    item->endsample = it->has_endsample64 ? it->endsample64 : it->endsample;
+    item->duration = it->_duration;
+    item->flags = it->_flags;
+    item->bits = (it->has_startsample64 ? DBPL2_ITEM_HAS_STARTSAMPLE64 : 0) | (it->has_endsample64 ? DBPL2_ITEM_HAS_ENDSAMPLE64 : 0);
+}
+
+static void
+_item_to_track (const dbpl2_item_t *item, playItem_t *it) {
+    if (item->bits & DBPL2_ITEM_HAS_STARTSAMPLE64) {
+        it->startsample64 = item->startsample;
+        it->startsample = item->startsample >= 0x7fffffff ? 0x7fffffff : (int32_t)item->startsample;
+        it->has_startsample64 = 1;
+    }
+    else {
+        it->startsample = (int32_t)item->startsample;
+    }
+    if (item->bits & DBPL2_ITEM_HAS_ENDSAMPLE64) {
+        it->endsample64 = item->endsample;
+        it->endsample = item->endsample >= 0x7fffffff ? 0x7fffffff : (int32_t)item->endsample;
+        it->has_endsample64 = 1;
+    }
+    else {
+        it->endsample = (int32_t)item->endsample;
+    }
+    it->_duration = item->duration;
+    it->_flags = item->flags;
+}
+
+// {{{ string table builder
+typedef struct {
+    const char **strings;
+    dbpl2_string_t *index;
+    uint32_t count;
+    uint32_t alloc;
+    uint32_t data_size;
+
+    // open addressing hash of string pointers, storing index+1
+    uint32_t *hash;
+    uint32_t hash_size;
+} dbpl2_strtab_t;
+
+static inline uint32_t
+_strtab_hash (const char *str, uint32_t size) {
+    uint64_t h = ((uintptr_t)str >> 3) * 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(h >> 32) ^ size;
+}
+
+static int
+_strtab_grow_hash (dbpl2_strtab_t *tab) {
+    uint32_t size = tab->hash_size ? tab->hash_size * 2 : 4096;
+    uint32_t *hash = calloc (size, sizeof (uint32_t));
+    if (!hash) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < tab->count; i++) {
+        uint32_t h = _strtab_hash (tab->strings[i], tab->index[i].size) & (size-1);
+        while (hash[h]) {
+            h = (h + 1) & (size-1);
+        }
+        hash[h] = i + 1;
+    }
+    free (tab->hash);
+    tab->hash = hash;
+    tab->hash_size = size;
+    return 0;
+}
+
+// returns the index of the string, or -1 on error
+static int64_t
+_strtab_add (dbpl2_strtab_t *tab, const char *str, uint32_t size) {
+    if (tab->count * 2 >= tab->hash_size && _strtab_grow_hash (tab)) {
+        return -1;
+    }
+    uint32_t h = _strtab_hash (str, size) & (tab->hash_size-1);
+    while (tab->hash[h]) {
+        uint32_t i = tab->hash[h] - 1;
+        if (tab->strings[i] == str && tab->index[i].size == size) {
+            return i;
+        }
+        h = (h + 1) & (tab->hash_size-1);
+    }
+
+    if (tab->count == tab->alloc) {
+        uint32_t alloc = tab->alloc ? tab->alloc * 2 : 4096;
+        const char **strings = realloc (tab->strings, alloc * sizeof (const char *));
+        if (!strings) {
+            return -1;
+        }
+        tab->strings = strings;
+        dbpl2_string_t *index = realloc (tab->index, alloc * sizeof (dbpl2_string_t));
+        if (!index) {
+            return -1;
+        }
+        tab->index = index;
+        tab->alloc = alloc;
+    }
+    if (tab->data_size + (uint64_t)size > UINT32_MAX) {
+        return -1;
+    }
+    tab->strings[tab->count] = str;
+    tab->index[tab->count].offset = tab->data_size;
+    tab->index[tab->count].size = size;
+    tab->data_size += size;
+    tab->hash[h] = tab->count + 1;
+    return tab->count++;
+}
+
+static void
+_strtab_free (dbpl2_strtab_t *tab) {
+    free (tab->strings);
+    free (tab->index);
+    free (tab->hash);
+}
+// }}}
+
+static int
+_meta_add (dbpl2_meta_t **meta, uint32_t *count, uint32_t *alloc, int64_t key, int64_t value) {
+    if (key < 0 || value < 0) {
+        return -1;
+    }
+    if (*count == *alloc) {
+        *alloc = *alloc ? *alloc * 2 : 16384;
+        dbpl2_meta_t *m = realloc (*meta, *alloc * sizeof (dbpl2_meta_t));
+        if (!m) {
+            return -1;
+        }
+        *meta = m;
+    }
+    (*meta)[*count].key = (uint32_t)key;
+    (*meta)[*count].value = (uint32_t)value;
+    (*count)++;
+    return 0;
+}
+
+static int
+_dbpl2_save (playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data, uint64_t generation, int64_t *psize) {
+    int res = -1;
+    dbpl2_strtab_t tab;
+    memset (&tab, 0, sizeof (tab));
+    dbpl2_item_t *items = NULL;
+    dbpl2_meta_t *meta = NULL;
+    uint32_t num_meta = 0;
+    uint32_t meta_alloc = 0;
+    FILE *fp = NULL;
+
+    uint32_t num_items = plt->count[PL_MAIN];
+    items = calloc (num_items ? num_items : 1, sizeof (dbpl2_item_t));
+    if (!items) {
+        goto error;
+    }
+
+    uint32_t n = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it && n < num_items; it = it->next[PL_MAIN], n++) {
+        if (cb) {
+            cb (it, user_data);
+        }
+        dbpl2_item_t *item = &items[n];
+        _item_from_track (item, it);
+        item->meta_first = num_meta;
+        for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+            if (m->key[0] == '_' || m->key[0] == '!') {
+                continue; // skip reserved names
+            }
+            int64_t key = _strtab_add (&tab, m->key, (uint32_t)strlen (m->key) + 1);
+            int64_t value = _strtab_add (&tab, m->value, m->valuesize);
+            if (_meta_add (&meta, &num_meta, &meta_alloc, key, value)) {
+                goto error;
+            }
+        }
+        item->num_meta = num_meta - item->meta_first;
+    }
+    num_items = n;
+
+    uint32_t num_plt_meta = 0;
+    for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+        int64_t key = _strtab_add (&tab, m->key, (uint32_t)strlen (m->key) + 1);
+        int64_t value = _strtab_add (&tab, m->value, (uint32_t)strlen (m->value) + 1);
+        if (_meta_add (&meta, &num_meta, &meta_alloc, key, value)) {
+            goto error;
+        }
+        num_plt_meta++;
+    }
+
+    dbpl2_header_t hdr;
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, "DBPL", 4);
+    hdr.majorver = DBPL2_MAJOR_VER;
+    hdr.minorver = DBPL2_MINOR_VER;
+    hdr.num_items = num_items;
+    hdr.num_strings = tab.count;
+    hdr.num_meta = num_meta - num_plt_meta;
+    hdr.num_plt_meta = num_plt_meta;
+    hdr.strings_offset = sizeof (hdr);
+    hdr.string_data_offset = hdr.strings_offset + (uint64_t)tab.count * sizeof (dbpl2_string_t);
+    hdr.string_data_size = tab.data_size;
+    hdr.items_offset = (hdr.string_data_offset + hdr.string_data_size + 7) & ~7ULL;
+    hdr.meta_offset = hdr.items_offset + (uint64_t)num_items * sizeof (dbpl2_item_t);
+    hdr.generation = generation;
+
+    char tempfile[PATH_MAX];
+    if (snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname) >= sizeof (tempfile)) {
+        goto error;
+    }
+    fp = fopen (tempfile, "w+b");
+    if (!fp) {
+        goto error;
+    }
+
+    if (fwrite (&hdr, sizeof (hdr), 1, fp) != 1) {
+        goto write_error;
+    }
+    if (tab.count && fwrite (tab.index, sizeof (dbpl2_string_t), tab.count, fp) != tab.count) {
+        goto write_error;
+    }
+    for (uint32_t i = 0; i < tab.count; i++) {
+        if (fwrite (tab.strings[i], 1, tab.index[i].size, fp) != tab.index[i].size) {
+            goto write_error;
+        }
+    }
+    static const char padding[8];
+    size_t padsize = hdr.items_offset - hdr.string_data_offset - hdr.string_data_size;
+    if (padsize && fwrite (padding, 1, padsize, fp) != padsize) {
+        goto write_error;
+    }
+    if (num_items && fwrite (items, sizeof (dbpl2_item_t), num_items, fp) != num_items) {
+        goto write_error;
+    }
+    if (num_meta && fwrite (meta, sizeof (dbpl2_meta_t), num_meta, fp) != num_meta) {
+        goto write_error;
+    }
+
+    int err = fclose (fp);
+    fp = NULL;
+    if (err) {
+        goto write_error;
+    }
+    if (rename (tempfile, fname) != 0) {
+        fprintf (stderr, "playlist rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
+        goto write_error;
+    }
+    if (psize) {
+        *psize = hdr.meta_offset + (uint64_t)num_meta * sizeof (dbpl2_meta_t);
+    }
+    res = 0;
+    goto error;
+
+write_error:
+    if (fp) {
+        fclose (fp);
+        fp = NULL;
+    }
+    unlink (tempfile);
+error:
+    _strtab_free (&tab);
+    free (items);
+    free (meta);
+    return res;
+}
+
+int
+dbpl2_save (playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    return _dbpl2_save (plt, fname, cb, user_data, 0, NULL);
+}
+
+// {{{ journal
+//
+// Saving a playlist from the config folder appends the changes since the previous save
+// to "<n>.dbpl.journal", instead of rewriting the whole playlist file.
+// The journal header refers to the generation of the playlist file, and the journal
+// is ignored if it doesn't match, e.g. after a crash while the playlist file was rewritten.
+// Each save writes one batch with a single write call, protected by a checksum,
+// so that a partially written batch is dropped after a crash.
+//
+// A batch contains the track insertions and removals by index, in the order they were made,
+// followed by the complete data of every track which was added or changed since the previous save,
+// at its final index, and by the playlist metadata, if it changed.
+// The journal is compacted into the playlist file when it grows large, or has a broken batch,
+// and after bulk changes, such as sorting, which are not journaled.
+
+#define DBPL2_JOURNAL_VERSION 1
+#define DBPL2_JOURNAL_MAX_OPS 4096
+#define DBPL2_JOURNAL_MIN_SIZE 0x10000 // smaller journals are not compacted
+
+enum {
+    DBPL2_JOURNAL_INSERT = 1, // u32 idx; inserts an empty track, filled by a following TRACK record
+    DBPL2_JOURNAL_REMOVE = 2, // u32 idx
+    DBPL2_JOURNAL_TRACK = 3, // u32 idx, dbpl2_item_t, num_meta key/value strings; replaces the track
+    DBPL2_JOURNAL_PLT_META = 4, // u32 count, key/value strings; replaces the playlist metadata
+    DBPL2_JOURNAL_END = 5, // u32 number of tracks after the batch
+};
+
+typedef struct {
+    char magic[4]; // "DBJL"
+    uint32_t version;
+    uint64_t generation;
+} dbpl2_journal_header_t;
+
+typedef struct {
+    char magic[4]; // "DBJB"
+    uint32_t size; // of the records following the batch header
+    uint32_t checksum;
+    uint32_t reserved;
+} dbpl2_journal_batch_t;
+
+typedef struct {
+    int type;
+    int idx;
+} dbpl2_journal_op_t;
+
+typedef struct dbpl2_journal_s {
+    uint64_t generation; // of the playlist file
+    uint32_t stamp; // track modification stamp at the time of the last save
+    uint32_t plt_meta_hash;
+    int invalid; // the next save must rewrite the playlist file
+    int num_ops; // operations stored in the journal file
+    int64_t file_size; // of the playlist file
+    int64_t journal_size;
+
+    // operations since the last save
+    dbpl2_journal_op_t *ops;
+    int ops_count;
+    int ops_alloc;
+} dbpl2_journal_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t alloc;
+    int error;
+} dbpl2_buffer_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    int error;
+} dbpl2_reader_t;
+
+typedef struct {
+    playItem_t **items;
+    int count;
+    int alloc;
+} dbpl2_tracks_t;
+
+static uint32_t
+_fnv1a (uint32_t hash, const void *data, size_t size) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+static uint32_t
+_plt_meta_hash (playlist_t *plt) {
+    uint32_t hash = 0x811c9dc5;
+    for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+        hash = _fnv1a (hash, m->key, strlen (m->key) + 1);
+        hash = _fnv1a (hash, m->value, strlen (m->value) + 1);
+    }
+    return hash;
+}
+
+static uint64_t
+_new_generation (void) {
+    static uint32_t counter;
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    uint32_t n = __atomic_add_fetch (&counter, 1, __ATOMIC_RELAXED);
+    return ((uint64_t)tv.tv_sec << 32) | (((uint32_t)tv.tv_usec << 12) ^ ((uint32_t)getpid () << 20) ^ n);
+}
+
+static void
+_buffer_append (dbpl2_buffer_t *buf, const void *data, size_t size) {
+    if (buf->error) {
+        return;
+    }
+    if (buf->size + size > buf->alloc) {
+        size_t alloc = buf->alloc ? buf->alloc : 4096;
+        while (alloc < buf->size + size) {
+            alloc *= 2;
+        }
+        uint8_t *d = realloc (buf->data, alloc);
+        if (!d) {
+            buf->error = 1;
+            return;
+        }
+        buf->data = d;
+        buf->alloc = alloc;
+    }
+    memcpy (buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+static void
+_buffer_append_u32 (dbpl2_buffer_t *buf, uint32_t value) {
+    _buffer_append (buf, &value, sizeof (value));
+}
+
+static void
+_buffer_append_string (dbpl2_buffer_t *buf, const char *str, uint32_t size) {
+    _buffer_append_u32 (buf, size);
+    _buffer_append (buf, str, size);
+}
+
+static const void *
+_reader_get (dbpl2_reader_t *r, size_t size) {
+    if (r->error || size > r->size - r->pos) {
+        r->error = 1;
+        return NULL;
+    }
+    const void *p = r->data + r->pos;
+    r->pos += size;
+    return p;
+}
+
+static uint32_t
+_reader_get_u32 (dbpl2_reader_t *r) {
+    uint32_t value = 0;
+    const void *p = _reader_get (r, sizeof (value));
+    if (p) {
+        memcpy (&value, p, sizeof (value));
+    }
+    return value;
+}
+
+// returns a NULL-terminated string, or NULL on error
+static const char *
+_reader_get_string (dbpl2_reader_t *r, uint32_t *psize) {
+    uint32_t size = _reader_get_u32 (r);
+    const char *str = size ? _reader_get (r, size) : NULL;
+    if (!str || str[size-1]) {
+        r->error = 1;
+        return NULL;
+    }
+    if (psize) {
+        *psize = size;
+    }
+    return str;
+}
+
+static void
+_journal_write_track (dbpl2_buffer_t *buf, playItem_t *it, uint32_t idx) {
+    dbpl2_item_t item;
+    memset (&item, 0, sizeof (item));
+    _item_from_track (&item, it);
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (m->key[0] != '_' && m->key[0] != '!') {
+            item.num_meta++;
+        }
+    }
+    _buffer_append_u32 (buf, DBPL2_JOURNAL_TRACK);
+    _buffer_append_u32 (buf, idx);
+    _buffer_append (buf, &item, sizeof (item));
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (m->key[0] != '_' && m->key[0] != '!') {
+            _buffer_append_string (buf, m->key, (uint32_t)strlen (m->key) + 1);
+            _buffer_append_string (buf, m->value, m->valuesize);
+        }
+    }
+}
+
+static int
+_tracks_insert (dbpl2_tracks_t *tracks, int idx, playItem_t *it) {
+    if (tracks->count == tracks->alloc) {
+        int alloc = tracks->alloc ? tracks->alloc * 2 : 1024;
+        playItem_t **items = realloc (tracks->items, alloc * sizeof (playItem_t *));
+        if (!items) {
+            return -1;
+        }
+        tracks->items = items;
+        tracks->alloc = alloc;
+    }
+    memmove (tracks->items + idx + 1, tracks->items + idx, (tracks->count - idx) * sizeof (playItem_t *));
+    tracks->items[idx] = it;
+    tracks->count++;
+    return 0;
+}
+
+static void
+_tracks_remove (dbpl2_tracks_t *tracks, int idx) {
+    if (tracks->items[idx]) {
+        pl_item_unref (tracks->items[idx]);
+    }
+    memmove (tracks->items + idx, tracks->items + idx + 1, (tracks->count - idx - 1) * sizeof (playItem_t *));
+    tracks->count--;
+}
+
+// validates the batch records when apply is 0, otherwise applies them to the tracks of the detached playlist,
+// and adds the number of insert/remove operations to num_ops
+static int
+_journal_replay_batch (playlist_t *plt, dbpl2_tracks_t *tracks, const uint8_t *data, size_t size, int apply, int *num_ops) {
+    dbpl2_reader_t r = {
+        .data = data,
+        .size = size,
+    };
+    int64_t count = tracks->count;
+    int end = 0;
+    while (!r.error && !end && r.pos < r.size) {
+        uint32_t type = _reader_get_u32 (&r);
+        switch (type) {
+        case DBPL2_JOURNAL_INSERT: {
+            uint32_t idx = _reader_get_u32 (&r);
+            if (idx > count) {
+                r.error = 1;
+            }
+            else if (apply) {
+                if (_tracks_insert (tracks, idx, NULL)) {
+                    return -1;
+                }
+                (*num_ops)++;
+            }
+            count++;
+            break;
+        }
+        case DBPL2_JOURNAL_REMOVE: {
+            uint32_t idx = _reader_get_u32 (&r);
+            if (idx >= count) {
+                r.error = 1;
+            }
+            else if (apply) {
+                _tracks_remove (tracks, idx);
+                (*num_ops)++;
+            }
+            count--;
+            break;
+        }
+        case DBPL2_JOURNAL_TRACK: {
+            uint32_t idx = _reader_get_u32 (&r);
+            const dbpl2_item_t *item = _reader_get (&r, sizeof (dbpl2_item_t));
+            if (r.error || idx >= count) {
+                r.error = 1;
+                break;
+            }
+            playItem_t *it = apply ? pl_item_alloc () : NULL;
+            if (it) {
+                _item_to_track (item, it);
+            }
+            // keep the saved order of the metadata
+            DB_metaInfo_t *tail = NULL;
+            for (uint32_t i = 0; i < item->num_meta && !r.error; i++) {
+                uint32_t valuesize;
+                const char *key = _reader_get_string (&r, NULL);
+                const char *value = _reader_get_string (&r, &valuesize);
+                if (it && !r.error) {
+                    DB_metaInfo_t *m = calloc (1, sizeof (DB_metaInfo_t));
+                    if (!m) {
+                        r.error = 1;
+                        break;
+                    }
+                    m->key = metacache_add_key (key);
+                    m->value = metacache_add_value (value, valuesize);
+                    m->valuesize = valuesize;
+                    if (tail) {
+                        tail->next = m;
+                    }
+                    else {
+                        it->meta = m;
+                    }
+                    tail = m;
+                }
+            }
+            if (it) {
+                if (tracks->items[idx]) {
+                    pl_item_unref (tracks->items[idx]);
+                }
+                tracks->items[idx] = it;
+            }
+            break;
+        }
+        case DBPL2_JOURNAL_PLT_META: {
+            uint32_t n = _reader_get_u32 (&r);
+            if (apply) {
+                plt_delete_all_meta (plt);
+            }
+            for (uint32_t i = 0; i < n && !r.error; i++) {
+                const char *key = _reader_get_string (&r, NULL);
+                const char *value = _reader_get_string (&r, NULL);
+                if (apply && !r.error) {
+                    plt_add_meta (plt, key, value);
+                }
+            }
+            break;
+        }
+        case DBPL2_JOURNAL_END:
+            if (_reader_get_u32 (&r) != count) {
+                r.error = 1;
+            }
+            end = 1;
+            break;
+        default:
+            r.error = 1;
+            break;
+        }
+    }
+    return (r.error || !end || r.pos != r.size) ? -1 : 0;
+}
+
+// replays the journal of the playlist file, if it matches the generation
+static void
+_journal_load (playlist_t *plt, const char *fname, uint64_t generation, int64_t file_size) {
+    dbpl2_journal_t *j = calloc (1, sizeof (dbpl2_journal_t));
+    if (!j) {
+        return;
+    }
+    j->generation = generation;
+    j->file_size = file_size;
+    plt->journal = j;
+
+    char path[PATH_MAX];
+    if (snprintf (path, sizeof (path), "%s.journal", fname) >= sizeof (path)) {
+        goto done;
+    }
+    FILE *fp = fopen (path, "rb");
+    if (!fp) {
+        goto done;
+    }
+    uint8_t *data = NULL;
+    long size = 0;
+    if (!fseek (fp, 0, SEEK_END) && (size = ftell (fp)) > 0 && !fseek (fp, 0, SEEK_SET)) {
+        data = malloc (size);
+        if (data && fread (data, 1, size, fp) != size) {
+            free (data);
+            data = NULL;
+        }
+    }
+    fclose (fp);
+    if (!data) {
+        goto done;
+    }
+
+    dbpl2_journal_header_t jhdr;
+    if (size < sizeof (jhdr)) {
+        free (data);
+        goto done;
+    }
+    memcpy (&jhdr, data, sizeof (jhdr));
+    if (memcmp (jhdr.magic, "DBJL", 4) || jhdr.version != DBPL2_JOURNAL_VERSION || jhdr.generation != generation) {
+        trace ("dbpl2: ignoring stale journal %s\n", path);
+        free (data);
+        goto done;
+    }
+
+    dbpl2_tracks_t tracks;
+    memset (&tracks, 0, sizeof (tracks));
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        if (_tracks_insert (&tracks, tracks.count, it)) {
+            free (tracks.items);
+            free (data);
+            goto done;
+        }
+    }
+
+    size_t pos = sizeof (jhdr);
+    while (pos + sizeof (dbpl2_journal_batch_t) <= size) {
+        dbpl2_journal_batch_t batch;
+        memcpy (&batch, data + pos, sizeof (batch));
+        const uint8_t *records = data + pos + sizeof (batch);
+        if (memcmp (batch.magic, "DBJB", 4)
+            || batch.size > size - pos - sizeof (batch)
+            || batch.checksum != _fnv1a (0x811c9dc5, records, batch.size)
+            || _journal_replay_batch (plt, &tracks, records, batch.size, 0, NULL)
+            || _journal_replay_batch (plt, &tracks, records, batch.size, 1, &j->num_ops)) {
+            break;
+        }
+        pos += sizeof (batch) + batch.size;
+    }
+    free (data);
+
+    if (pos != size) {
+        // compact on the next save, instead of appending after the broken batch
+        trace ("dbpl2: dropped incomplete journal data at %d in %s\n", (int)pos, path);
+        j->invalid = 1;
+    }
+    else {
+        j->journal_size = size;
+    }
+
+    // relink the tracks, dropping the ones which were never filled
+    plt->head[PL_MAIN] = plt->tail[PL_MAIN] = NULL;
+    plt->count[PL_MAIN] = 0;
+    plt->totaltime = 0;
+    for (int i = 0; i < tracks.count; i++) {
+        playItem_t *it = tracks.items[i];
+        if (!it) {
+            continue;
+        }
+        it->in_playlist = 1;
+        it->next[PL_MAIN] = NULL;
+        it->prev[PL_MAIN] = plt->tail[PL_MAIN];
+        if (plt->tail[PL_MAIN]) {
+            plt->tail[PL_MAIN]->next[PL_MAIN] = it;
+        }
+        else {
+            plt->head[PL_MAIN] = it;
+        }
+        plt->tail[PL_MAIN] = it;
+        plt->count[PL_MAIN]++;
+        if (it->_duration > 0) {
+            plt->totaltime += it->_duration;
+        }
+    }
+    free (tracks.items);
+
+done:
+    j->stamp = pl_get_item_modification_idx ();
+    j->plt_meta_hash = _plt_meta_hash (plt);
+}
+
+static void
+_journal_add_op (playlist_t *plt, int type, int idx) {
+    dbpl2_journal_t *j = plt->journal;
+    if (!j || j->invalid) {
+        return;
+    }
+    if (j->num_ops + j->ops_count >= DBPL2_JOURNAL_MAX_OPS) {
+        dbpl2_journal_invalidate (plt);
+        return;
+    }
+    if (j->ops_count == j->ops_alloc) {
+        int alloc = j->ops_alloc ? j->ops_alloc * 2 : 64;
+        dbpl2_journal_op_t *ops = realloc (j->ops, alloc * sizeof (dbpl2_journal_op_t));
+        if (!ops) {
+            dbpl2_journal_invalidate (plt);
+            return;
+        }
+        j->ops = ops;
+        j->ops_alloc = alloc;
+    }
+    j->ops[j->ops_count].type = type;
+    j->ops[j->ops_count].idx = idx;
+    j->ops_count++;
+}
+
+void
+dbpl2_journal_insert (playlist_t *plt, playItem_t *it, int idx) {
+    if (!plt->journal || plt->journal->invalid) {
+        return;
+    }
+    _journal_add_op (plt, DBPL2_JOURNAL_INSERT, idx);
+    // make sure the track data is written on the next save
+    pl_item_modified (it);
+}
+
+void
+dbpl2_journal_remove (playlist_t *plt, int idx) {
+    _journal_add_op (plt, DBPL2_JOURNAL_REMOVE, idx);
+}
+
+void
+dbpl2_journal_invalidate (playlist_t *plt) {
+    dbpl2_journal_t *j = plt->journal;
+    if (j) {
+        j->invalid = 1;
+        free (j->ops);
+        j->ops = NULL;
+        j->ops_count = j->ops_alloc = 0;
+    }
+}
+
+void
+dbpl2_journal_free (playlist_t *plt) {
+    if (plt->journal) {
+        free (plt->journal->ops);
+        free (plt->journal);
+        plt->journal = NULL;
+    }
+}
+
+void
+dbpl2_journal_rename (const char *from, const char *to) {
+    char from_journal[PATH_MAX];
+    char to_journal[PATH_MAX];
+    if (snprintf (from_journal, sizeof (from_journal), "%s.journal", from) >= sizeof (from_journal)
+        || snprintf (to_journal, sizeof (to_journal), "%s.journal", to) >= sizeof (to_journal)) {
+        return;
+    }
+    if (rename (from_journal, to_journal) && errno == ENOENT) {
+        unlink (to_journal);
+    }
+}
+
+int
+dbpl2_journal_save (playlist_t *plt, const char *fname) {
+    dbpl2_journal_t *j = plt->journal;
+    uint32_t stamp = pl_get_item_modification_idx ();
+    uint32_t plt_meta_hash = _plt_meta_hash (plt);
+    dbpl2_buffer_t buf;
+    memset (&buf, 0, sizeof (buf));
+
+    char path[PATH_MAX];
+    if (snprintf (path, sizeof (path), "%s.journal", fname) >= sizeof (path)) {
+        return -1;
+    }
+
+    if (!j || j->invalid) {
+        goto compact;
+    }
+
+    // the journal header, for a new journal, and the batch header are filled in last
+    size_t header_size = (j->journal_size ? 0 : sizeof (dbpl2_journal_header_t)) + sizeof (dbpl2_journal_batch_t);
+    uint8_t zero[sizeof (dbpl2_journal_header_t) + sizeof (dbpl2_journal_batch_t)] = {0};
+    _buffer_append (&buf, zero, header_size);
+
+    int changes = j->ops_count;
+    for (int i = 0; i < j->ops_count; i++) {
+        _buffer_append_u32 (&buf, j->ops[i].type);
+        _buffer_append_u32 (&buf, j->ops[i].idx);
+    }
+    uint32_t idx = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], idx++) {
+        if ((int32_t)(it->_modification_idx - j->stamp) > 0) {
+            _journal_write_track (&buf, it, idx);
+            changes++;
+        }
+    }
+    if (plt_meta_hash != j->plt_meta_hash) {
+        uint32_t n = 0;
+        for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+            n++;
+        }
+        _buffer_append_u32 (&buf, DBPL2_JOURNAL_PLT_META);
+        _buffer_append_u32 (&buf, n);
+        for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+            _buffer_append_string (&buf, m->key, (uint32_t)strlen (m->key) + 1);
+            _buffer_append_string (&buf, m->value, (uint32_t)strlen (m->value) + 1);
+        }
+        changes++;
+    }
+    if (!changes) {
+        free (buf.data);
+        return 0;
+    }
+    _buffer_append_u32 (&buf, DBPL2_JOURNAL_END);
+    _buffer_append_u32 (&buf, idx);
+
+    int64_t max_size = j->file_size / 2 > DBPL2_JOURNAL_MIN_SIZE ? j->file_size / 2 : DBPL2_JOURNAL_MIN_SIZE;
+    if (buf.error
+        || j->num_ops + j->ops_count > DBPL2_JOURNAL_MAX_OPS
+        || j->journal_size + (int64_t)buf.size > max_size) {
+        goto compact;
+    }
+
+    uint8_t *p = buf.data;
+    if (!j->journal_size) {
+        dbpl2_journal_header_t jhdr;
+        memset (&jhdr, 0, sizeof (jhdr));
+        memcpy (jhdr.magic, "DBJL", 4);
+        jhdr.version = DBPL2_JOURNAL_VERSION;
+        jhdr.generation = j->generation;
+        memcpy (p, &jhdr, sizeof (jhdr));
+        p += sizeof (jhdr);
+    }
+    dbpl2_journal_batch_t batch;
+    memset (&batch, 0, sizeof (batch));
+    memcpy (batch.magic, "DBJB", 4);
+    batch.size = (uint32_t)(buf.size - header_size);
+    batch.checksum = _fnv1a (0x811c9dc5, buf.data + header_size, batch.size);
+    memcpy (p, &batch, sizeof (batch));
+
+    int fd = open (path, O_WRONLY | O_CREAT | O_APPEND | (j->journal_size ? 0 : O_TRUNC), 0644);
+    if (fd == -1) {
+        goto compact;
+    }
+    ssize_t written = write (fd, buf.data, buf.size);
+    if (close (fd) || written != buf.size) {
+        goto compact;
+    }
+    free (buf.data);
+
+    j->journal_size += buf.size;
+    j->num_ops += j->ops_count;
+    j->ops_count = 0;
+    j->stamp = stamp;
+    j->plt_meta_hash = plt_meta_hash;
+    return 0;
+
+compact:
+    free (buf.data);
+    uint64_t generation = _new_generation ();
+    int64_t file_size = 0;
+    if (_dbpl2_save (plt, fname, NULL, NULL, generation, &file_size)) {
+        return -1;
+    }
+    // the old journal doesn't match the new generation anymore
+    unlink (path);
+
+    if (!j) {
+        j = calloc (1, sizeof (dbpl2_journal_t));
+        if (!j) {
+            return 0;
+        }
+        plt->journal = j;
+    }
+    dbpl2_journal_invalidate (plt);
+    j->generation = generation;
+    j->stamp = stamp;
+    j->plt_meta_hash = plt_meta_hash;
+    j->invalid = 0;
+    j->num_ops = 0;
+    j->file_size = file_size;
+    j->journal_size = 0;
+    return 0;
+}
+// }}}
+
+int
+dbpl2_read (playlist_t *plt, const char *fname) {
+    int fd = open (fname, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat (fd, &st) || st.st_size < DBPL2_HEADER_SIZE_2_0) {
+        close (fd);
+        return -1;
+    }
+    uint64_t size = st.st_size;
+    const uint8_t *data = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+
+    int res = -1;
+    const char **keys = NULL;
+    const char **values = NULL;
+    uint32_t *key_refs = NULL;
+    uint32_t *value_refs = NULL;
+
+    const dbpl2_header_t *hdr = (const dbpl2_header_t *)data;
+    if (memcmp (hdr->magic, "DBPL", 4) || hdr->majorver != DBPL2_MAJOR_VER) {
+        goto error;
+    }
+    if (hdr->minorver >= 1 && size < sizeof (dbpl2_header_t)) {
+        goto error;
+    }
+    uint64_t generation = hdr->minorver >= 1 ? hdr->generation : 0;
+
+    // validate the layout
+    uint64_t num_meta = (uint64_t)hdr->num_meta + hdr->num_plt_meta;
+    if (hdr->num_items > DBPL2_MAX_COUNT || hdr->num_strings > DBPL2_MAX_COUNT || num_meta > DBPL2_MAX_COUNT
+        || hdr->strings_offset > size
+        || hdr->num_strings * sizeof (dbpl2_string_t) > size - hdr->strings_offset
+        || hdr->string_data_offset > size
+        || hdr->string_data_size > size - hdr->string_data_offset
+        || hdr->items_offset > size
+        || (hdr->items_offset & 7)
+        || hdr->num_items * sizeof (dbpl2_item_t) > size - hdr->items_offset
+        || hdr->meta_offset > size
+        || (hdr->meta_offset & 3)
+        || num_meta * sizeof (dbpl2_meta_t) > size - hdr->meta_offset) {
+        trace ("dbpl2: bad layout\n");
+        goto error;
+    }
+
+    const dbpl2_string_t *strings = (const dbpl2_string_t *)(data + hdr->strings_offset);
+    const char *string_data = (const char *)(data + hdr->string_data_offset);
+    const dbpl2_item_t *items = (const dbpl2_item_t *)(data + hdr->items_offset);
+    const dbpl2_meta_t *meta = (const dbpl2_meta_t *)(data + hdr->meta_offset);
+
+    for (uint32_t i = 0; i < hdr->num_strings; i++) {
+        if (!strings[i].size
+            || strings[i].offset > hdr->string_data_size
+            || strings[i].size > hdr->string_data_size - strings[i].offset
+            || string_data[strings[i].offset + strings[i].size - 1]) {
+            trace ("dbpl2: bad string %d\n", i);
+            goto error;
+        }
+    }
+    for (uint64_t i = 0; i < num_meta; i++) {
+        if (meta[i].key >= hdr->num_strings || meta[i].value >= hdr->num_strings) {
+            trace ("dbpl2: bad metadata %d\n", (int)i);
+            goto error;
+        }
+    }
+    for (uint32_t i = 0; i < hdr->num_items; i++) {
+        if (items[i].meta_first > hdr->num_meta || items[i].num_meta > hdr->num_meta - items[i].meta_first) {
+            trace ("dbpl2: bad track %d\n", i);
+            goto error;
+        }
+    }
+
+    // intern each string once, with all references
+    uint32_t nstr = hdr->num_strings ? hdr->num_strings : 1;
+    keys = calloc (nstr, sizeof (const char *));
+    values = calloc (nstr, sizeof (const char *));
+    key_refs = calloc (nstr, sizeof (uint32_t));
+    value_refs = calloc (nstr, sizeof (uint32_t));
+    if (!keys || !values || !key_refs || !value_refs) {
+        goto error;
+    }
+    for (uint32_t i = 0; i < hdr->num_items; i++) {
+        const dbpl2_meta_t *m = meta + items[i].meta_first;
+        for (uint32_t j = 0; j < items[i].num_meta; j++, m++) {
+            key_refs[m->key]++;
+            value_refs[m->value]++;
+        }
+    }
+    for (uint32_t i = 0; i < hdr->num_strings; i++) {
+        const char *s = string_data + strings[i].offset;
+        if (key_refs[i]) {
+            keys[i] = metacache_add_key (s);
+            if (key_refs[i] > 1) {
+                metacache_add_refs (keys[i], key_refs[i] - 1);
+            }
+        }
+        if (value_refs[i]) {
+            values[i] = metacache_add_value (s, strings[i].size);
+            if (value_refs[i] > 1) {
+                metacache_add_refs (values[i], value_refs[i] - 1);
+            }
+        }
+    }
+
+    uint32_t i;
+    uint32_t j = 0;
+    for (i = 0; i < hdr->num_items; i++) {
+        const dbpl2_item_t *item = &items[i];
+        playItem_t *it = pl_item_alloc ();
+        if (!it) {
+            j = 0;
+            goto alloc_error;
+        }
+
+        _item_to_track (item, it);
+
+        // the saved metadata is already ordered, and has no duplicates
+        DB_metaInfo_t *tail = NULL;
+        const dbpl2_meta_t *m = meta + item->meta_first;
+        for (j = 0; j < item->num_meta; j++, m++) {
+            DB_metaInfo_t *mi = calloc (1, sizeof (DB_metaInfo_t));
+            if (!mi) {
+                // the values attached so far are released with the track
+                pl_item_unref (it);
+                goto alloc_error;
+            }
+            mi->key = keys[m->key];
+            mi->value = values[m->value];
+            mi->valuesize = strings[m->value].size;
+            if (tail) {
+                tail->next = mi;
+            }
+            else {
+                it->meta = mi;
+            }
+            tail = mi;
+        }
+
+        // the playlist is detached, link the track without locking
+        it->in_playlist = 1;
+        it->prev[PL_MAIN] = plt->tail[PL_MAIN];
+        if (plt->tail[PL_MAIN]) {
+            plt->tail[PL_MAIN]->next[PL_MAIN] = it;
+        }
+        else {
+            plt->head[PL_MAIN] = it;
+        }
+        plt->tail[PL_MAIN] = it;
+        plt->count[PL_MAIN]++;
+        if (it->_duration > 0) {
+            plt->totaltime += it->_duration;
+        }
+    }
+
+    const dbpl2_meta_t *m = meta + hdr->num_meta;
+    for (uint32_t i = 0; i < hdr->num_plt_meta; i++, m++) {
+        plt_add_meta (plt, string_data + strings[m->key].offset, string_data + strings[m->value].offset);
+    }
+
+    res = 0;
+    goto error;
+
+alloc_error:
+    // release the refs added above for the metadata which wasn't attached to any track;
+    // the tracks loaded so far are freed by the caller with the playlist
+    for (; i < hdr->num_items; i++, j = 0) {
+        const dbpl2_meta_t *m = meta + items[i].meta_first + j;
+        for (; j < items[i].num_meta; j++, m++) {
+            metacache_remove_string (keys[m->key]);
+            metacache_remove_value (values[m->value], strings[m->value].size);
+        }
+    }
+
+error:
+    free (keys);
+    free (values);
+    free (key_refs);
+    free (value_refs);
+    munmap ((void *)data, size);
+    if (!res && generation) {
+        _journal_load (plt, fname, generation, size);
+    }
+    return res;
+}
+
+playItem_t *
+dbpl2_load (playlist_t *plt, const char *fname) {
+    playlist_t *detached = plt_alloc ("");
+    playItem_t *last_added = NULL;
+    if (!dbpl2_read (detached, fname)) {
+        last_added = plt_append_detached (plt, detached);
+    }
+    plt_free (detached);
+    return last_added;
+}
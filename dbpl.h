@@ -0,0 +1,74 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2017 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#ifndef dbpl_h
+#define dbpl_h
+
+#include "playlist.h"
+
+#define DBPL2_MAJOR_VER 2
+#define DBPL2_MINOR_VER 1
+
+// Saves the playlist in DBPL 2.x format, must be called with the playlist locked.
+// Returns 0 on success, -1 on error
+int
+dbpl2_save (playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data);
+
+// Reads the tracks and metadata from a DBPL 2.x file into a new detached playlist,
+// which must not be shared with other threads until it's attached with plt_append_detached.
+// The journal of the file is replayed, and its state is stored in plt->journal.
+// Returns 0 on success, -1 on error, including files in other formats
+int
+dbpl2_read (playlist_t *plt, const char *fname);
+
+// Appends the tracks from a DBPL 2.x file to the playlist.
+// Returns the last added track, or NULL on error
+playItem_t *
+dbpl2_load (playlist_t *plt, const char *fname);
+
+// Saves the playlist file from the config folder, by appending the changes since the last save
+// to the journal, or by rewriting the file when the journal needs to be compacted.
+// Must be called with the playlist locked. Returns 0 on success, -1 on error
+int
+dbpl2_journal_save (playlist_t *plt, const char *fname);
+
+// Record the changes to the track list of the playlist, must be called with the playlist locked
+void
+dbpl2_journal_insert (playlist_t *plt, playItem_t *it, int idx);
+
+void
+dbpl2_journal_remove (playlist_t *plt, int idx);
+
+// Forces the next save to rewrite the playlist file, for changes which are not journaled
+void
+dbpl2_journal_invalidate (playlist_t *plt);
+
+void
+dbpl2_journal_free (playlist_t *plt);
+
+// Renames the journal along with the playlist file
+void
+dbpl2_journal_rename (const char *from, const char *to);
+
+#endif /* dbpl_h */
@@ -599,6 +599,43 @@ typedef struct ddb_file_found_data_s {
     const char *filename;
     int is_dir;
 } ddb_file_found_data_t;
+
+// fill level of the streamer readahead buffer, see streamer_get_buffer_stats
+typedef struct {
+    int _size; // must be set to sizeof (ddb_streamer_buffer_stats_t)
+    int blocks_ready; // number of decoded blocks waiting to be played
+    int blocks_allocated; // number of blocks currently allocated, including the free ones
+    int64_t bytes_ready; // bytes of decoded data waiting to be played
+    int64_t bytes_allocated; // total size of the allocated block buffers
+    float seconds_ready; // duration of the decoded data waiting to be played
+    float seconds_readahead; // configured readahead duration (streamer.readahead_seconds)
+} ddb_streamer_buffer_stats_t;
+
+// visualization data types, see vis_subscribe
+enum {
+    DDB_VIS_WAVEFORM = 0,
+    DDB_VIS_SPECTRUM = 1,
+};
+
+// number of frames in a waveform snapshot, see vis_poll
+#define DDB_VIS_WAVEFORM_FRAMES 2048
+
+// snapshot of visualization data, see vis_poll
+typedef struct {
+    int _size; // must be set to sizeof (ddb_vis_frame_t)
+    ddb_waveformat_t fmt; // format of the played audio, up to DDB_FREQ_MAX_CHANNELS channels
+    // waveform: number of interleaved frames, up to DDB_VIS_WAVEFORM_FRAMES
+    // spectrum: DDB_FREQ_BANDS, stored non-interleaved, for each channel
+    int nframes;
+    uint32_t serial; // changes every time new data is published
+    float data[DDB_VIS_WAVEFORM_FRAMES * DDB_FREQ_MAX_CHANNELS];
+} ddb_vis_frame_t;
+
+// position of a packet, from which a decoder can start decoding, see seektable_load
+typedef struct {
+    int64_t sample; // first sample of the packet
+    int64_t offset; // position of the packet in the file, in bytes
+} ddb_seekpoint_t;
 #endif
 
 // context for title formatting interpreter
@@ -1426,6 +1463,45 @@ typedef struct {
     // returns 1 to tell that cuesheet is being loaded now.
     // this should be called by plugins to prevent running cuesheet code at a wrong time.
     int (*plt_is_loading_cue) (ddb_playlist_t *plt);
+
+    // get the fill level of the streamer readahead buffer.
+    // stats->_size must be set by the caller.
+    void (*streamer_get_buffer_stats) (ddb_streamer_buffer_stats_t *stats);
+
+    // Polling alternative to vis_waveform_listen / vis_spectrum_listen:
+    // the player publishes the most recent data, and visualizations copy it
+    // at their own frame rate, without ever blocking the audio thread.
+    // vis_subscribe enables publishing of DDB_VIS_WAVEFORM or DDB_VIS_SPECTRUM data,
+    // and must be balanced by vis_unsubscribe.
+    void (*vis_subscribe) (int type);
+    void (*vis_unsubscribe) (int type);
+
+    // Copies the most recent data of the given type.
+    // frame->_size must be set by the caller.
+    // Returns 0 on success, or -1 if no data was published yet.
+    // frame->serial can be compared with the previous value to skip redrawing.
+    int (*vis_poll) (int type, ddb_vis_frame_t *frame);
+
+    // Persistent seek tables, for decoders which otherwise need to scan
+    // the stream to seek, or to find the exact duration.
+    // The tables are stored in the cache folder, and are only valid while
+    // the file size and modification time stay the same.
+    // codec identifies the table format, e.g. the plugin id.
+    // Points must be sorted by sample and offset.
+    // seektable_load returns 0 on success, and the points in a malloc'd array,
+    // which must be freed by the caller; -1 if there's no valid table.
+    int (*seektable_load) (const char *fname, const char *codec, ddb_seekpoint_t **points, int *count, int64_t *totalsamples);
+    int (*seektable_save) (const char *fname, const char *codec, const ddb_seekpoint_t *points, int count, int64_t totalsamples);
+
+    // returns the index of the last point at or before the sample, or -1
+    int (*seektable_find) (const ddb_seekpoint_t *points, int count, int64_t sample);
+
+    // By default, the message callback of each plugin is called for every message.
+    // After the first plug_message_subscribe call, the plugin only receives
+    // the subscribed message ids, plus any ids outside of the DB_EV_* ranges.
+    // Pass the plugin's own DB_plugin_t, e.g. from the start function.
+    void (*plug_message_subscribe) (struct DB_plugin_s *plugin, const uint32_t *ids, int count);
+    void (*plug_message_unsubscribe) (struct DB_plugin_s *plugin, const uint32_t *ids, int count);
 #endif
 } DB_functions_t;
 
@@ -1577,7 +1653,8 @@ typedef struct DB_plugin_s {
     DB_plugin_action_t* (*get_actions) (DB_playItem_t *it);
 
     // mainloop will call this function for every plugin
-    // so that plugins may handle all events;
+    // so that plugins may handle all events,
+    // or only the subscribed ones, see plug_message_subscribe;
     // can be NULL
     int (*message) (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2);
 
@@ -1696,6 +1773,19 @@ typedef struct DB_decoder_s {
     // because existing code may rely on it.
     DB_fileinfo_t *(*open2) (uint32_t hints, DB_playItem_t *it);
 #endif
+
+#if (DDB_API_LEVEL >= 10)
+    // Optional: prepares an instance, which was successfully initialized
+    // with another track, to play the track `it`, keeping the allocated
+    // decoder state where possible.
+    // The previous file must be closed, and the new one opened, as in init.
+    // The player may fabort info->file while reinit runs, so it must be
+    // set to NULL before closing the previous file, and set to the new file
+    // as soon as it's opened.
+    // The hints passed to open / open2 stay in effect.
+    // Returns 0 on success. On failure, the instance must be freed with free.
+    int (*reinit) (DB_fileinfo_t *info, DB_playItem_t *it);
+#endif
 } DB_decoder_t;
 
 // output plugin
@@ -1782,6 +1872,15 @@ typedef struct DB_dsp_s {
     // 0 otherwise
     int (*can_bypass) (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt);
 #endif
+
+#if (DDB_API_LEVEL >= 10)
+    // can be NULL
+    // same as process, but with non-interleaved (planar) buffers:
+    // channels[i] points to maxframes floats of channel i, 32-byte aligned
+    // the plugin must not change the number of channels in fmt
+    // process is still required, and is used when planar is not possible
+    int (*process_planar) (ddb_dsp_context_t *ctx, float **channels, int frames, int maxframes, ddb_waveformat_t *fmt, float *ratio);
+#endif
 } DB_dsp_t;
 
 // misc plugin
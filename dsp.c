@@ -39,12 +39,16 @@ static DB_dsp_t *eqplug;
 static ddb_dsp_context_t *eq;
 static int dsp_on = 0;
 
-static char *dsp_input_buffer;
-static int dsp_input_buffer_size;
-
+// buffers only grow, and are 32-byte aligned for SIMD-friendly DSP plugins
 static char *dsp_temp_buffer;
 static int dsp_temp_buffer_size;
 
+static char *dsp_planar_buffer;
+static int dsp_planar_buffer_size;
+
+#define DSP_BUFFER_ALIGN 32
+#define DSP_MAX_PLANAR_CHANNELS 32
+
 // how much bigger should read-buffer be to allow upsampling.
 // e.g. 8000Hz -> 192000Hz upsampling requires 24x buffer size,
 // so if we originally request 4096 bytes blocks -
@@ -81,43 +85,68 @@ dsp_reset (void) {
 }
 
 static char *
-ensure_dsp_input_buffer (int size) {
+ensure_dsp_buffer (char **buffer, int *buffer_size, int size) {
     if (!size) {
-        if (dsp_input_buffer) {
-            free (dsp_input_buffer);
-            dsp_input_buffer = NULL;
-        }
-        return 0;
+        free (*buffer);
+        *buffer = NULL;
+        *buffer_size = 0;
+        return NULL;
     }
-    if (size != dsp_input_buffer_size) {
-        dsp_input_buffer = realloc (dsp_input_buffer, size);
-        dsp_input_buffer_size = size;
+    if (size > *buffer_size) {
+        // the contents don't need to be preserved
+        free (*buffer);
+        *buffer = NULL;
+        *buffer_size = 0;
+        void *ptr = NULL;
+        if (posix_memalign (&ptr, DSP_BUFFER_ALIGN, size)) {
+            return NULL;
+        }
+        *buffer = ptr;
+        *buffer_size = size;
     }
-    return dsp_input_buffer;
+    return *buffer;
 }
 
 static char *
 ensure_dsp_temp_buffer (int size) {
-    if (!size) {
-        if (dsp_temp_buffer) {
-            free (dsp_temp_buffer);
-            dsp_temp_buffer = NULL;
+    char *buffer = ensure_dsp_buffer (&dsp_temp_buffer, &dsp_temp_buffer_size, size);
+    assert (!size || buffer);
+    return buffer;
+}
+
+static void
+free_dsp_buffers (void) {
+    ensure_dsp_buffer (&dsp_temp_buffer, &dsp_temp_buffer_size, 0);
+    ensure_dsp_buffer (&dsp_planar_buffer, &dsp_planar_buffer_size, 0);
+}
+
+static int
+dsp_can_process_planar (ddb_dsp_context_t *dsp, ddb_waveformat_t *fmt) {
+    return dsp->plugin->plugin.api_vminor >= 10
+        && dsp->plugin->process_planar
+        && fmt->channels <= DSP_MAX_PLANAR_CHANNELS;
+}
+
+static void
+dsp_deinterleave (const float *in, float **channels, int nchannels, int nframes) {
+    for (int c = 0; c < nchannels; c++) {
+        float *out = channels[c];
+        const float *src = in + c;
+        for (int i = 0; i < nframes; i++, src += nchannels) {
+            out[i] = *src;
         }
-        dsp_temp_buffer_size = 0;
-        return NULL;
-    }
-    if (size != dsp_temp_buffer_size) {
-        dsp_temp_buffer = realloc (dsp_temp_buffer, size);
-        dsp_temp_buffer_size = size;
     }
-    assert (dsp_temp_buffer);
-    return dsp_temp_buffer;
 }
 
 static void
-free_dsp_buffers (void) {
-    ensure_dsp_input_buffer (0);
-    ensure_dsp_temp_buffer (0);
+dsp_interleave (float **channels, float *out, int nchannels, int nframes) {
+    for (int c = 0; c < nchannels; c++) {
+        const float *in = channels[c];
+        float *dst = out + c;
+        for (int i = 0; i < nframes; i++, dst += nchannels) {
+            *dst = in[i];
+        }
+    }
 }
 
 ddb_dsp_context_t *
@@ -434,14 +463,51 @@ dsp_apply (ddb_waveformat_t *input_fmt, char *input, int inputsize,
     ddb_dsp_context_t *dsp = dsp_chain;
     float ratio = 1.f;
     int maxframes = tempbuf_size / dspsamplesize;
+
+    // the data is converted to planar layout only between plugins which
+    // support it, and interleaved back before the next one which doesn't
+    float *channels[DSP_MAX_PLANAR_CHANNELS];
+    int planar = 0;
+    int planar_channels = 0;
     while (dsp) {
         if (dsp->enabled) {
             float r = 1;
-            nframes = dsp->plugin->process (dsp, (float *)tempbuf, nframes, maxframes, &dspfmt, &r);
+            int use_planar = dsp_can_process_planar (dsp, &dspfmt);
+            if (use_planar && !planar) {
+                // keep each channel aligned
+                int stride = (maxframes + DSP_BUFFER_ALIGN / sizeof (float) - 1) & ~(int)(DSP_BUFFER_ALIGN / sizeof (float) - 1);
+                float *planarbuf = (float *)ensure_dsp_buffer (&dsp_planar_buffer, &dsp_planar_buffer_size, stride * dspfmt.channels * sizeof (float));
+                if (!planarbuf) {
+                    use_planar = 0;
+                }
+                else {
+                    planar_channels = dspfmt.channels;
+                    for (int c = 0; c < planar_channels; c++) {
+                        channels[c] = planarbuf + c * stride;
+                    }
+                    dsp_deinterleave ((float *)tempbuf, channels, planar_channels, nframes);
+                    planar = 1;
+                }
+            }
+            else if (!use_planar && planar) {
+                dsp_interleave (channels, (float *)tempbuf, planar_channels, nframes);
+                planar = 0;
+            }
+
+            if (planar) {
+                nframes = dsp->plugin->process_planar (dsp, channels, nframes, maxframes, &dspfmt, &r);
+                assert (dspfmt.channels == planar_channels);
+            }
+            else {
+                nframes = dsp->plugin->process (dsp, (float *)tempbuf, nframes, maxframes, &dspfmt, &r);
+            }
             ratio *= r;
         }
         dsp = dsp->next;
     }
+    if (planar) {
+        dsp_interleave (channels, (float *)tempbuf, planar_channels, nframes);
+    }
 
     *out_dsp_ratio = ratio;
 
@@ -17,100 +17,159 @@
  * the use of this software.
  */
 
-// this version has few changes compared to the original audacious fft.c
-// please find the original file in audacious
+// this version is based on the audacious fft.c, but uses a real-input
+// transform of configurable size: the input is packed into a complex
+// sequence of half the size, which is then split into the real spectrum.
+// Data is stored as separate real/imaginary arrays, with contiguous twiddles
+// for each pass, so that the compiler can vectorize the butterflies.
 
 #ifdef HAVE_CONFIG_H
 #  include <config.h>
 #endif
-#include "deadbeef.h"
+#include <stdlib.h>
 #include <math.h>
-#include <complex.h>
-
-#define N (DDB_FREQ_BANDS * 2)
-
-static float hamming[N];              /* hamming window, scaled to sum to 1 */
-static int reversed[N];               /* bit-reversal table */
-static float complex roots[N / 2];    /* N-th roots of unity */
-static int generated = 0;
-static float LOGN; /* log N (base 2) */
+#include "fft.h"
+
+struct ddb_fft_s {
+    int size;           /* number of real input samples */
+    float *window;      /* hamming window */
+    int *reversed;      /* bit-reversal table for size/2 */
+    float *tw_re;       /* twiddles for each pass of the size/2 transform */
+    float *tw_im;
+    float *split_re;    /* e^(-2*pi*i*k/size) */
+    float *split_im;
+    float *re;          /* work buffers */
+    float *im;
+};
+
+ddb_fft_t *
+fft_alloc (int size) {
+    if (size < 4 || (size & (size - 1))) {
+        return NULL;
+    }
+    ddb_fft_t *fft = calloc (1, sizeof (ddb_fft_t));
+    int m = size / 2;
+    fft->size = size;
+    fft->window = malloc (size * sizeof (float));
+    fft->reversed = malloc (m * sizeof (int));
+    fft->tw_re = malloc (m * sizeof (float));
+    fft->tw_im = malloc (m * sizeof (float));
+    fft->split_re = malloc (m * sizeof (float));
+    fft->split_im = malloc (m * sizeof (float));
+    fft->re = malloc (m * sizeof (float));
+    fft->im = malloc (m * sizeof (float));
+
+    for (int n = 0; n < size; n++) {
+        fft->window[n] = 1 - 0.85 * cos (2 * M_PI * n / size);
+    }
 
-/* Reverse the order of the lowest LOGN bits in an integer. */
+    int logm = 0;
+    while ((1 << logm) < m) {
+        logm++;
+    }
+    for (int n = 0; n < m; n++) {
+        int x = n, y = 0;
+        for (int b = logm; b--; ) {
+            y = (y << 1) | (x & 1);
+            x >>= 1;
+        }
+        fft->reversed[n] = y;
+    }
 
-static int bit_reverse (int x)
-{
-    int y = 0;
+    for (int half = 1, t = 0; half < m; half <<= 1) {
+        for (int b = 0; b < half; b++, t++) {
+            fft->tw_re[t] = cos (M_PI * b / half);
+            fft->tw_im[t] = -sin (M_PI * b / half);
+        }
+    }
 
-    for (int n = LOGN; n --; )
-    {
-        y = (y << 1) | (x & 1);
-        x >>= 1;
+    for (int k = 0; k < m; k++) {
+        fft->split_re[k] = cos (2 * M_PI * k / size);
+        fft->split_im[k] = -sin (2 * M_PI * k / size);
     }
 
-    return y;
+    return fft;
 }
 
-#ifndef HAVE_LOG2
-static inline float log2(float x) {return (float)log(x)/M_LN2;}
-#endif
-
-/* Generate lookup tables. */
-
-static void generate_tables (void)
-{
-    if (generated)
+void
+fft_free (ddb_fft_t *fft) {
+    if (!fft) {
         return;
+    }
+    free (fft->window);
+    free (fft->reversed);
+    free (fft->tw_re);
+    free (fft->tw_im);
+    free (fft->split_re);
+    free (fft->split_im);
+    free (fft->re);
+    free (fft->im);
+    free (fft);
+}
 
-    LOGN = log2(N);
-    for (int n = 0; n < N; n ++)
-        hamming[n] = 1 - 0.85 * cosf (2 * M_PI * n / N);
-    for (int n = 0; n < N; n ++)
-        reversed[n] = bit_reverse (n);
-    for (int n = 0; n < N / 2; n ++)
-        roots[n] = cexpf (2 * M_PI * I * n / N);
-
-    generated = 1;
+int
+fft_get_size (ddb_fft_t *fft) {
+    return fft->size;
 }
 
-static void do_fft (float complex a[N])
-{
-    int half = 1;       /* (2^s)/2 */
-    int inv = N / 2;    /* N/(2^s) */
+static void
+do_fft (ddb_fft_t *fft) {
+    int m = fft->size / 2;
+    float * restrict re = fft->re;
+    float * restrict im = fft->im;
+    const float *tw_re = fft->tw_re;
+    const float *tw_im = fft->tw_im;
 
-    /* loop through steps */
-    while (inv)
-    {
+    /* loop through passes */
+    for (int half = 1; half < m; half <<= 1) {
         /* loop through groups */
-        for (int g = 0; g < N; g += half << 1)
-        {
+        for (int g = 0; g < m; g += half << 1) {
+            float * restrict ar = re + g;
+            float * restrict ai = im + g;
+            float * restrict br = re + g + half;
+            float * restrict bi = im + g + half;
             /* loop through butterflies */
-            for (int b = 0, r = 0; b < half; b ++, r += inv)
-            {
-                float complex even = a[g + b];
-                float complex odd = roots[r] * a[g + half + b];
-                a[g + b] = even + odd;
-                a[g + half + b] = even - odd;
+            for (int b = 0; b < half; b++) {
+                float odd_re = br[b] * tw_re[b] - bi[b] * tw_im[b];
+                float odd_im = br[b] * tw_im[b] + bi[b] * tw_re[b];
+                br[b] = ar[b] - odd_re;
+                bi[b] = ai[b] - odd_im;
+                ar[b] += odd_re;
+                ai[b] += odd_im;
             }
         }
-
-        half <<= 1;
-        inv >>= 1;
+        tw_re += half;
+        tw_im += half;
     }
 }
 
 void
-calc_freq (float *data, float *freq) {
-    generate_tables ();
-
-    // fft code shamelessly stolen from audacious
-    // thanks, John
-    float complex a[N];
-    for (int n = 0; n < N; n ++) {
-        a[reversed[n]] = data[n] * hamming[n];
+fft_calc_freq (ddb_fft_t *fft, const float *data, float *freq) {
+    int n = fft->size;
+    int m = n / 2;
+    const float *window = fft->window;
+
+    // pack even samples into the real part, odd into the imaginary part
+    for (int i = 0; i < m; i++) {
+        int r = fft->reversed[i];
+        fft->re[r] = data[2 * i] * window[2 * i];
+        fft->im[r] = data[2 * i + 1] * window[2 * i + 1];
     }
-    do_fft(a);
-
-    for (int n = 0; n < N / 2 - 1; n ++)
-        freq[n] = 2 * cabsf (a[1 + n]) / N;
-    freq[N / 2 - 1] = cabsf(a[N / 2]) / N;
+    do_fft (fft);
+
+    // split into the spectrum of the real input, bins 1 .. m
+    const float *re = fft->re;
+    const float *im = fft->im;
+    for (int k = 1; k < m; k++) {
+        float zr = re[k], zi = im[k];
+        float cr = re[m - k], ci = -im[m - k];
+        float er = (zr + cr) * 0.5f;
+        float ei = (zi + ci) * 0.5f;
+        float or = (zi - ci) * 0.5f;
+        float oi = (cr - zr) * 0.5f;
+        float xr = er + or * fft->split_re[k] - oi * fft->split_im[k];
+        float xi = ei + or * fft->split_im[k] + oi * fft->split_re[k];
+        freq[k - 1] = 2 * sqrtf (xr * xr + xi * xi) / n;
+    }
+    freq[m - 1] = fabsf (re[0] - im[0]) / n;
 }
@@ -20,6 +20,21 @@
 #ifndef AUDACIOUS_FFT_H
 #define AUDACIOUS_FFT_H
 
-void calc_freq (const float data[512], float freq[256]);
+typedef struct ddb_fft_s ddb_fft_t;
+
+// size must be a power of 2
+ddb_fft_t *
+fft_alloc (int size);
+
+void
+fft_free (ddb_fft_t *fft);
+
+int
+fft_get_size (ddb_fft_t *fft);
+
+// data: size samples
+// freq: size/2 magnitudes, from the first bin above DC, up to nyquist
+void
+fft_calc_freq (ddb_fft_t *fft, const float *data, float *freq);
 
 #endif
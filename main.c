@@ -58,6 +58,7 @@
 #include <unistd.h>
 #include "gettext.h"
 #include "playlist.h"
+#include "metacache.h"
 #include "threading.h"
 #include "messagepump.h"
 #include "streamer.h"
@@ -625,13 +626,8 @@ player_mainloop (void) {
         uint32_t p2;
         int term = 0;
         while (messagepump_pop(&msg, &ctx, &p1, &p2) != -1) {
-            // broadcast to all plugins
-            DB_plugin_t **plugs = plug_get_list ();
-            for (int n = 0; plugs[n]; n++) {
-                if (plugs[n]->message) {
-                    plugs[n]->message (msg, ctx, p1, p2);
-                }
-            }
+            // pass to the subscribed plugins
+            plug_message_dispatch (msg, ctx, p1, p2);
             if (!term) {
                 DB_output_t *output = plug_get_output ();
                 switch (msg) {
@@ -824,6 +820,7 @@ main_cleanup_and_quit (void) {
 
     // at this point we can simply do exit(0), but let's clean up for debugging
     pl_free (); // may access conf_*
+    metacache_free ();
     conf_free ();
 
     trace ("messagepump_free\n");
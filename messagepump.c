@@ -32,6 +32,9 @@
 #include "threading.h"
 #include "playlist.h"
 
+#define load_acquire(ptr) __atomic_load_n (ptr, __ATOMIC_ACQUIRE)
+#define store_release(ptr, val) __atomic_store_n (ptr, val, __ATOMIC_RELEASE)
+
 typedef struct message_s {
     uint32_t id;
     uintptr_t ctx;
@@ -40,20 +43,203 @@ typedef struct message_s {
     struct message_s *next;
 } message_t;
 
-enum { MAX_MESSAGES = 100 };
-static message_t pool[MAX_MESSAGES];
-static message_t *mfree;
-static message_t *mqueue;
-static message_t *mqtail;
+// intrusive multi-producer single-consumer queue (Vyukov):
+// producers swap themselves into mq_head, the consumer thread pops from mq_tail.
+// messages are malloc'd, so the queue is unbounded and nothing is ever dropped.
+static message_t mq_stub;
+static message_t *mq_head = &mq_stub;
+static message_t *mq_tail = &mq_stub;
+
+// messages taken from the queue by the consumer, after coalescing
+static message_t *ready_head;
+static message_t *ready_tail;
+
 static uintptr_t mutex;
 static uintptr_t cond;
+static int consumer_waiting;
+
+static void
+mq_push (message_t *msg) {
+    msg->next = NULL;
+    // seq_cst, to be ordered against consumer_waiting, see messagepump_wait
+    message_t *prev = __atomic_exchange_n (&mq_head, msg, __ATOMIC_SEQ_CST);
+    store_release (&prev->next, msg);
+}
+
+// returns NULL when empty, or when a producer is half-way through mq_push;
+// messagepump_hasmessages keeps returning 1 in the latter case
+static message_t *
+mq_pop (void) {
+    message_t *tail = mq_tail;
+    message_t *next = load_acquire (&tail->next);
+    if (tail == &mq_stub) {
+        if (!next) {
+            return NULL;
+        }
+        mq_tail = tail = next;
+        next = load_acquire (&tail->next);
+    }
+    if (next) {
+        mq_tail = next;
+        return tail;
+    }
+    if (tail != load_acquire (&mq_head)) {
+        return NULL;
+    }
+    mq_push (&mq_stub);
+    next = load_acquire (&tail->next);
+    if (next) {
+        mq_tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static void
+message_free (message_t *msg) {
+    if (msg->id >= DB_EV_FIRST && msg->ctx) {
+        messagepump_event_free ((ddb_event_t *)msg->ctx);
+    }
+    free (msg);
+}
 
+enum {
+    COALESCE_NONE,
+    COALESCE_DUPLICATES, // drop if an identical message comes later in the same batch
+    COALESCE_ADJACENT, // drop if immediately followed by the same message id
+};
+
+static int
+coalesce_type (message_t *msg) {
+    switch (msg->id) {
+    case DB_EV_CONFIGCHANGED:
+    case DB_EV_PLAYLISTCHANGED:
+    case DB_EV_VOLUMECHANGED:
+    case DB_EV_PLAYLISTSWITCHED:
+    case DB_EV_DSPCHAINCHANGED:
+    case DB_EV_SELCHANGED:
+        return COALESCE_DUPLICATES;
+    case DB_EV_TRACKINFOCHANGED:
+        return msg->ctx ? COALESCE_DUPLICATES : COALESCE_NONE;
+    case DB_EV_SEEK:
+        return COALESCE_ADJACENT;
+    }
+    return COALESCE_NONE;
+}
+
+// events are compared by track, not by the event pointer
+static uintptr_t
+coalesce_ctx (message_t *msg) {
+    if (msg->id == DB_EV_TRACKINFOCHANGED) {
+        return (uintptr_t)((ddb_event_track_t *)msg->ctx)->track;
+    }
+    return msg->ctx;
+}
+
+static uint32_t
+coalesce_hash (message_t *msg) {
+    uint64_t h = coalesce_ctx (msg);
+    h ^= ((uint64_t)msg->id << 32) ^ ((uint64_t)msg->p1 << 16) ^ msg->p2;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(h >> 32);
+}
+
+static int
+coalesce_equal (message_t *a, message_t *b) {
+    return a->id == b->id && a->p1 == b->p1 && a->p2 == b->p2 && coalesce_ctx (a) == coalesce_ctx (b);
+}
+
+// collapse bursts of idempotent notifications in the ready list, keeping the
+// last occurrence of each, so that it is delivered after everything it follows
 static void
-messagepump_reset (void);
+messagepump_coalesce (void) {
+    int count = 0;
+    for (message_t *m = ready_head; m; m = m->next) {
+        count++;
+    }
+    message_t **msgs = malloc (count * sizeof (message_t *));
+    size_t hsize = 16;
+    while (hsize < (size_t)count * 2) {
+        hsize <<= 1;
+    }
+    message_t **hash = calloc (hsize, sizeof (message_t *));
+    if (!msgs || !hash) {
+        free (msgs);
+        free (hash);
+        return;
+    }
+
+    int n = 0;
+    for (message_t *m = ready_head; m; m = m->next) {
+        msgs[n++] = m;
+    }
+
+    // walk backwards, so that the kept messages are seen first
+    message_t *next = NULL;
+    message_t *tail = NULL;
+    for (int i = count - 1; i >= 0; i--) {
+        message_t *m = msgs[i];
+        int drop = 0;
+        switch (coalesce_type (m)) {
+        case COALESCE_DUPLICATES:
+            {
+                size_t h = coalesce_hash (m) & (hsize - 1);
+                while (hash[h]) {
+                    if (coalesce_equal (hash[h], m)) {
+                        drop = 1;
+                        break;
+                    }
+                    h = (h + 1) & (hsize - 1);
+                }
+                if (!drop) {
+                    hash[h] = m;
+                }
+            }
+            break;
+        case COALESCE_ADJACENT:
+            drop = next && next->id == m->id;
+            break;
+        }
+        if (drop) {
+            message_free (m);
+            continue;
+        }
+        m->next = next;
+        next = m;
+        if (!tail) {
+            tail = m;
+        }
+    }
+    ready_head = next;
+    ready_tail = tail;
+
+    free (hash);
+    free (msgs);
+}
+
+// move everything queued so far to the ready list
+static void
+messagepump_fetch (void) {
+    int fetched = 0;
+    message_t *msg;
+    while ((msg = mq_pop ())) {
+        msg->next = NULL;
+        if (ready_tail) {
+            ready_tail->next = msg;
+        }
+        else {
+            ready_head = msg;
+        }
+        ready_tail = msg;
+        fetched++;
+    }
+    if (fetched > 1) {
+        messagepump_coalesce ();
+    }
+}
 
 int
 messagepump_init (void) {
-    messagepump_reset ();
     mutex = mutex_create ();
     cond = cond_create ();
     return 0;
@@ -61,10 +247,11 @@ messagepump_init (void) {
 
 void
 messagepump_free () {
-    mutex_lock (mutex);
+    messagepump_fetch ();
 
     // this helps catching any ref leaks caused by messages sent at exit
-    for (message_t *m = mqueue; m; m = m->next) {
+    while (ready_head) {
+        message_t *m = ready_head;
         switch (m->id) {
         case DB_EV_SONGCHANGED:
         case DB_EV_SONGSTARTED:
@@ -74,87 +261,78 @@ messagepump_free () {
         case DB_EV_SEEKED:
             assert (0);
         }
+        ready_head = m->next;
+        free (m);
     }
+    ready_tail = NULL;
 
-    messagepump_reset ();
-    mutex_unlock (mutex);
     mutex_free (mutex);
+    mutex = 0;
     cond_free (cond);
-}
-
-static void
-messagepump_reset (void) {
-    mqueue = NULL;
-    mfree = NULL;
-    mqtail = NULL;
-    memset (pool, 0, sizeof (pool));
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        pool[i].next = mfree;
-        mfree = &pool[i];
-    }
+    cond = 0;
 }
 
 int
 messagepump_push (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
-    if (!mfree) {
-        //fprintf (stderr, "WARNING: message queue is full! message ignored (%d %p %d %d)\n", id, (void*)ctx, p1, p2);
+    // nobody is going to receive messages sent before messagepump_init, or after messagepump_free
+    message_t *msg = mutex ? malloc (sizeof (message_t)) : NULL;
+    if (!msg) {
         if (id >= DB_EV_FIRST && ctx) {
             messagepump_event_free ((ddb_event_t *)ctx);
         }
         return -1;
     }
-    mutex_lock (mutex);
-    message_t *msg = mfree;
-    mfree = mfree->next;
-    if (mqtail) {
-        mqtail->next = msg;
-    }
-    mqtail = msg;
-    if (!mqueue) {
-        mqueue = msg;
-    }
-
-    msg->next = NULL;
     msg->id = id;
     msg->ctx = ctx;
     msg->p1 = p1;
     msg->p2 = p2;
-    mutex_unlock (mutex);
-    cond_signal (cond);
+    mq_push (msg);
+    if (__atomic_load_n (&consumer_waiting, __ATOMIC_SEQ_CST)) {
+        // the consumer is either waiting, or about to see the message
+        mutex_lock (mutex);
+        cond_signal (cond);
+        mutex_unlock (mutex);
+    }
     return 0;
 }
 
 void
 messagepump_wait (void) {
-    cond_wait (cond, mutex);
+    mutex_lock (mutex);
+    // a producer either sees the flag and signals under the mutex,
+    // or has pushed before the check below
+    __atomic_store_n (&consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    while (!messagepump_hasmessages ()) {
+        cond_wait_locked (cond, mutex);
+    }
+    __atomic_store_n (&consumer_waiting, 0, __ATOMIC_RELAXED);
     mutex_unlock (mutex);
 }
 
 int
 messagepump_pop (uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2) {
-    mutex_lock (mutex);
-    if (!mqueue) {
-        mutex_unlock (mutex);
-        return -1;
+    if (!ready_head) {
+        messagepump_fetch ();
+        if (!ready_head) {
+            return -1;
+        }
     }
-    *id = mqueue->id;
-    *ctx = mqueue->ctx;
-    *p1 = mqueue->p1;
-    *p2 = mqueue->p2;
-    message_t *next = mqueue->next;
-    mqueue->next = mfree;
-    mfree = mqueue;
-    mqueue = next;
-    if (!mqueue) {
-        mqtail = NULL;
+    message_t *msg = ready_head;
+    ready_head = msg->next;
+    if (!ready_head) {
+        ready_tail = NULL;
     }
-    mutex_unlock (mutex);
+    *id = msg->id;
+    *ctx = msg->ctx;
+    *p1 = msg->p1;
+    *p2 = msg->p2;
+    free (msg);
     return 0;
 }
 
 int
 messagepump_hasmessages (void) {
-    return mqueue ? 1 : 0;
+    return ready_head || __atomic_load_n (&mq_head, __ATOMIC_SEQ_CST) != &mq_stub;
 }
 
 ddb_event_t *
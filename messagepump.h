@@ -35,6 +35,7 @@ void messagepump_free (void);
 int messagepump_push (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2);
 int messagepump_pop (uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2);
 void messagepump_wait (void);
+int messagepump_hasmessages (void);
 
 ddb_event_t *messagepump_event_alloc (uint32_t id);
 void messagepump_event_free (ddb_event_t *ev);
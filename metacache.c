@@ -26,26 +26,105 @@
 */
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include "metacache.h"
+#include "threading.h"
 
+// NOTE: atom and refcount must immediately precede str,
+// metacache_key_atom_of depends on that layout
 typedef struct metacache_str_s {
     struct metacache_str_s *next;
     size_t value_length;
+    uint32_t hash;
+    uint32_t atom; // key atom, assigned by metacache_add_key
     uint32_t refcount;
-    char cmpidx; // positive means "equals", negative means "notequals"
     char str[1];
 } metacache_str_t;
 
+// The cache is split into shards by the top bits of the hash,
+// each shard having its own lock and its own growing bucket table,
+// so that it can be used from any thread without holding pl_lock.
+#define SHARD_BITS 4
+#define NUM_SHARDS (1<<SHARD_BITS)
+#define INITIAL_BUCKETS 256
+#define MAX_LOAD_FACTOR 2
+
 typedef struct {
-//    uint32_t hash;
-    metacache_str_t *chain;
-} metacache_hash_t;
+    uintptr_t mutex;
+    metacache_str_t **buckets;
+    uint32_t num_buckets; // power of 2
+    uint32_t num_strings;
+    uint64_t hits;
+    uint64_t misses;
+} metacache_shard_t;
+
+static metacache_shard_t shards[NUM_SHARDS];
+static int initialized;
+
+// Key atoms are small integers identifying metadata keys case-insensitively.
+// They're never freed, since the number of distinct keys is small.
+#define ATOM_HASH_SIZE 1024
+
+typedef struct metacache_atom_s {
+    struct metacache_atom_s *next;
+    uint32_t hash;
+    uint32_t atom;
+    char key[1];
+} metacache_atom_t;
 
-#define HASH_SIZE 4096
+static metacache_atom_t *atoms[ATOM_HASH_SIZE];
+static uint32_t num_atoms;
+static uintptr_t atoms_mutex;
+
+void
+metacache_init (void) {
+    if (initialized) {
+        return;
+    }
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        metacache_shard_t *shard = &shards[i];
+        shard->mutex = mutex_create_nonrecursive ();
+        shard->num_buckets = INITIAL_BUCKETS;
+        shard->buckets = calloc (shard->num_buckets, sizeof (metacache_str_t *));
+    }
+    atoms_mutex = mutex_create_nonrecursive ();
+    initialized = 1;
+}
 
-static metacache_hash_t hash[HASH_SIZE];
+void
+metacache_free (void) {
+    if (!initialized) {
+        return;
+    }
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        metacache_shard_t *shard = &shards[i];
+        for (uint32_t b = 0; b < shard->num_buckets; b++) {
+            metacache_str_t *chain = shard->buckets[b];
+            while (chain) {
+                metacache_str_t *next = chain->next;
+                free (chain);
+                chain = next;
+            }
+        }
+        free (shard->buckets);
+        mutex_free (shard->mutex);
+        memset (shard, 0, sizeof (metacache_shard_t));
+    }
+    for (int i = 0; i < ATOM_HASH_SIZE; i++) {
+        while (atoms[i]) {
+            metacache_atom_t *next = atoms[i]->next;
+            free (atoms[i]);
+            atoms[i] = next;
+        }
+    }
+    num_atoms = 0;
+    mutex_free (atoms_mutex);
+    atoms_mutex = 0;
+    initialized = 0;
+}
 
 static uint32_t
 metacache_get_hash_sdbm (const char *str, size_t len) {
@@ -59,15 +138,29 @@ metacache_get_hash_sdbm (const char *str, size_t len) {
         hash = c + (hash << 6) + (hash << 16) - hash;
     }
 
+    // sdbm leaves the high bits empty for short strings, which are used for sharding
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+
     return hash;
 }
 
+static inline metacache_shard_t *
+metacache_shard_for_hash (uint32_t h) {
+    return &shards[h >> (32 - SHARD_BITS)];
+}
+
+static inline metacache_str_t *
+metacache_str_for_value (const char *str) {
+    return (metacache_str_t *)(str - offsetof (metacache_str_t, str));
+}
+
 static metacache_str_t *
-metacache_find_in_bucket (uint32_t h, const char *value, size_t len) {
-    metacache_hash_t *bucket = &hash[h];
-    metacache_str_t *chain = bucket->chain;
+metacache_find_in_shard (metacache_shard_t *shard, uint32_t h, const char *value, size_t len) {
+    metacache_str_t *chain = shard->buckets[h & (shard->num_buckets-1)];
     while (chain) {
-        if (chain->value_length == len && !memcmp (chain->str, value, len)) {
+        if (chain->hash == h && chain->value_length == len && (chain->str == value || !memcmp (chain->str, value, len))) {
             return chain;
         }
         chain = chain->next;
@@ -75,32 +168,57 @@ metacache_find_in_bucket (uint32_t h, const char *value, size_t len) {
     return NULL;
 }
 
-static int n_strings = 0;
-static int n_inserts = 0;
-static int n_buckets = 0;
+static void
+metacache_grow_shard (metacache_shard_t *shard) {
+    uint32_t num_buckets = shard->num_buckets * 2;
+    metacache_str_t **buckets = calloc (num_buckets, sizeof (metacache_str_t *));
+    if (!buckets) {
+        return;
+    }
+    for (uint32_t b = 0; b < shard->num_buckets; b++) {
+        metacache_str_t *chain = shard->buckets[b];
+        while (chain) {
+            metacache_str_t *next = chain->next;
+            uint32_t idx = chain->hash & (num_buckets-1);
+            chain->next = buckets[idx];
+            buckets[idx] = chain;
+            chain = next;
+        }
+    }
+    free (shard->buckets);
+    shard->buckets = buckets;
+    shard->num_buckets = num_buckets;
+}
 
 const char *
 metacache_add_value (const char *value, size_t len) {
-    //    printf ("n_strings=%d, n_inserts=%d, n_buckets=%d\n", n_strings, n_inserts, n_buckets);
     uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
-    n_inserts++;
+    metacache_shard_t *shard = metacache_shard_for_hash (h);
+    mutex_lock (shard->mutex);
+    metacache_str_t *data = metacache_find_in_shard (shard, h, value, len);
     if (data) {
         data->refcount++;
+        shard->hits++;
+        mutex_unlock (shard->mutex);
         return data->str;
     }
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
-    if (!bucket->chain) {
-        n_buckets++;
+    shard->misses++;
+
+    if (shard->num_strings >= shard->num_buckets * MAX_LOAD_FACTOR) {
+        metacache_grow_shard (shard);
     }
+
     data = malloc (sizeof (metacache_str_t) + len);
     memset (data, 0, sizeof (metacache_str_t) + len);
     data->refcount = 1;
+    data->hash = h;
     memcpy (data->str, value, len);
     data->value_length = len;
-    data->next = bucket->chain;
-    bucket->chain = data;
-    n_strings++;
+    metacache_str_t **bucket = &shard->buckets[h & (shard->num_buckets-1)];
+    data->next = *bucket;
+    *bucket = data;
+    shard->num_strings++;
+    mutex_unlock (shard->mutex);
     return data->str;
 }
 
@@ -112,26 +230,23 @@ metacache_add_string (const char *str) {
 void
 metacache_remove_value (const char *value, size_t valuesize) {
     uint32_t h = metacache_get_hash_sdbm (value, valuesize);
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
-    metacache_str_t *chain = bucket->chain;
-    metacache_str_t *prev = NULL;
-    while (chain) {
-        if (chain->value_length == valuesize && !memcmp (chain->str, value, valuesize)) {
+    metacache_shard_t *shard = metacache_shard_for_hash (h);
+    mutex_lock (shard->mutex);
+    metacache_str_t **pchain = &shard->buckets[h & (shard->num_buckets-1)];
+    while (*pchain) {
+        metacache_str_t *chain = *pchain;
+        if (chain->hash == h && chain->value_length == valuesize && (chain->str == value || !memcmp (chain->str, value, valuesize))) {
             chain->refcount--;
             if (chain->refcount == 0) {
-                if (prev) {
-                    prev->next = chain->next;
-                }
-                else {
-                    bucket->chain = chain->next;
-                }
+                *pchain = chain->next;
                 free (chain);
+                shard->num_strings--;
             }
             break;
         }
-        prev = chain;
-        chain = chain->next;
+        pchain = &chain->next;
     }
+    mutex_unlock (shard->mutex);
 }
 
 void
@@ -141,14 +256,29 @@ metacache_remove_string (const char *str) {
 
 void
 metacache_ref (const char *str) {
-    uint32_t *refc = (uint32_t *)(str-5);
-    (*refc)++;
+    metacache_str_t *data = metacache_str_for_value (str);
+    metacache_shard_t *shard = metacache_shard_for_hash (data->hash);
+    mutex_lock (shard->mutex);
+    data->refcount++;
+    mutex_unlock (shard->mutex);
+}
+
+void
+metacache_add_refs (const char *str, int count) {
+    metacache_str_t *data = metacache_str_for_value (str);
+    metacache_shard_t *shard = metacache_shard_for_hash (data->hash);
+    mutex_lock (shard->mutex);
+    data->refcount += count;
+    mutex_unlock (shard->mutex);
 }
 
 void
 metacache_unref (const char *str) {
-    uint32_t *refc = (uint32_t *)(str-5);
-    (*refc)--;
+    metacache_str_t *data = metacache_str_for_value (str);
+    metacache_shard_t *shard = metacache_shard_for_hash (data->hash);
+    mutex_lock (shard->mutex);
+    data->refcount--;
+    mutex_unlock (shard->mutex);
 }
 
 const char *
@@ -159,12 +289,106 @@ metacache_get_string (const char *str) {
 const char *
 metacache_get_value (const char *value, size_t len) {
     uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
-    n_inserts++;
+    metacache_shard_t *shard = metacache_shard_for_hash (h);
+    mutex_lock (shard->mutex);
+    metacache_str_t *data = metacache_find_in_shard (shard, h, value, len);
     if (data) {
         data->refcount++;
+        shard->hits++;
+        mutex_unlock (shard->mutex);
         return data->str;
     }
+    shard->misses++;
+    mutex_unlock (shard->mutex);
 
     return NULL;
 }
+
+void
+metacache_get_stats (metacache_stats_t *stats) {
+    memset (stats, 0, sizeof (metacache_stats_t));
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        metacache_shard_t *shard = &shards[i];
+        if (!shard->mutex) {
+            continue;
+        }
+        mutex_lock (shard->mutex);
+        stats->num_strings += shard->num_strings;
+        stats->num_buckets += shard->num_buckets;
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        for (uint32_t b = 0; b < shard->num_buckets; b++) {
+            uint32_t len = 0;
+            for (metacache_str_t *chain = shard->buckets[b]; chain; chain = chain->next) {
+                len++;
+            }
+            if (len) {
+                stats->num_used_buckets++;
+            }
+            if (len > stats->max_chain_length) {
+                stats->max_chain_length = len;
+            }
+        }
+        mutex_unlock (shard->mutex);
+    }
+}
+
+static uint32_t
+metacache_get_key_hash (const char *key) {
+    uint32_t hash = 0;
+    while (*key) {
+        hash = tolower (*(const uint8_t *)key++) + (hash << 6) + (hash << 16) - hash;
+    }
+    return hash;
+}
+
+static uint32_t
+metacache_find_key_atom (const char *key, uint32_t h) {
+    for (metacache_atom_t *a = atoms[h & (ATOM_HASH_SIZE-1)]; a; a = a->next) {
+        if (a->hash == h && !strcasecmp (a->key, key)) {
+            return a->atom;
+        }
+    }
+    return 0;
+}
+
+uint32_t
+metacache_get_key_atom (const char *key) {
+    uint32_t h = metacache_get_key_hash (key);
+    mutex_lock (atoms_mutex);
+    uint32_t atom = metacache_find_key_atom (key, h);
+    mutex_unlock (atoms_mutex);
+    return atom;
+}
+
+uint32_t
+metacache_add_key_atom (const char *key) {
+    uint32_t h = metacache_get_key_hash (key);
+    mutex_lock (atoms_mutex);
+    uint32_t atom = metacache_find_key_atom (key, h);
+    if (!atom) {
+        size_t len = strlen (key);
+        metacache_atom_t *a = malloc (sizeof (metacache_atom_t) + len);
+        a->hash = h;
+        a->atom = atom = ++num_atoms;
+        memcpy (a->key, key, len+1);
+        a->next = atoms[h & (ATOM_HASH_SIZE-1)];
+        atoms[h & (ATOM_HASH_SIZE-1)] = a;
+    }
+    mutex_unlock (atoms_mutex);
+    return atom;
+}
+
+const char *
+metacache_add_key (const char *key) {
+    const char *str = metacache_add_string (key);
+    metacache_str_t *data = metacache_str_for_value (str);
+    if (!data->atom) {
+        uint32_t atom = metacache_add_key_atom (key);
+        metacache_shard_t *shard = metacache_shard_for_hash (data->hash);
+        mutex_lock (shard->mutex);
+        data->atom = atom;
+        mutex_unlock (shard->mutex);
+    }
+    return str;
+}
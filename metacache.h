@@ -27,6 +27,26 @@
 #ifndef __METACACHE_H
 #define __METACACHE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t num_strings;
+    uint32_t num_buckets;
+    uint32_t num_used_buckets;
+    uint32_t max_chain_length;
+    uint64_t hits; // lookups which found an existing value
+    uint64_t misses; // lookups which didn't, including new insertions
+} metacache_stats_t;
+
+// Must be called before any other metacache function, safe to call multiple times
+void
+metacache_init (void);
+
+// Frees all remaining values
+void
+metacache_free (void);
+
 // Adds a new NULL-terminated string, or finds an existing one
 const char *
 metacache_add_string (const char *str);
@@ -59,4 +79,32 @@ metacache_ref (const char *str);
 void
 metacache_unref (const char *str);
 
+// Increases reference count of the specified value by count
+void
+metacache_add_refs (const char *str, int count);
+
+// Adds a metadata key string, and assigns it a key atom.
+// Keys differing only by case get the same atom.
+const char *
+metacache_add_key (const char *key);
+
+// Returns the key atom for the specified key, or 0 if no such key was ever added
+uint32_t
+metacache_get_key_atom (const char *key);
+
+// Returns the key atom for the specified key, creating a new one if needed
+uint32_t
+metacache_add_key_atom (const char *key);
+
+// Returns the key atom of a string returned by metacache_add_key,
+// or 0 for strings which were only added as values
+static inline uint32_t
+metacache_key_atom_of (const char *key) {
+    return *(const uint32_t *)(key - 8);
+}
+
+// Fills the stats with the current counters, average chain length is num_strings/num_used_buckets
+void
+metacache_get_stats (metacache_stats_t *stats);
+
 #endif
@@ -0,0 +1,481 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "deadbeef.h"
+#include "playlist.h"
+#include "pltmeta.h"
+#include "dbpl.h"
+#include "logger.h"
+
+// offsets of items_offset and generation in the DBPL 2.x header
+#define DBPL2_ITEMS_OFFSET_POS 48
+#define DBPL2_GENERATION_POS 64
+
+static char tempdir[PATH_MAX];
+static char fname[PATH_MAX];
+static char journal[PATH_MAX];
+
+static playItem_t *
+add_track (playlist_t *plt, int i) {
+    char s[100];
+    snprintf (s, sizeof (s), "/music/%d.flac", i);
+    playItem_t *it = pl_item_alloc_init (s, "stdflac");
+    snprintf (s, sizeof (s), "Title %d", i);
+    pl_add_meta (it, "title", s);
+    pl_add_meta (it, "artist", i % 2 ? "Artist 1" : "Artist 2");
+    pl_add_meta (it, "genre", "Rock");
+    pl_append_meta (it, "genre", "Pop");
+    if (i % 3 == 0) {
+        pl_item_set_startsample (it, 0x100000000LL * i);
+        pl_item_set_endsample (it, 0x100000000LL * i + 44100);
+        pl_set_item_flags (it, DDB_IS_SUBTRACK);
+    }
+    plt_insert_item (plt, plt->tail[PL_MAIN], it);
+    plt_set_item_duration (plt, it, 100 + i);
+    pl_item_unref (it);
+    return it;
+}
+
+static int
+meta_equal (DB_metaInfo_t *a, DB_metaInfo_t *b) {
+    for (;;) {
+        while (a && (a->key[0] == '_' || a->key[0] == '!')) {
+            a = a->next;
+        }
+        while (b && (b->key[0] == '_' || b->key[0] == '!')) {
+            b = b->next;
+        }
+        if (!a || !b) {
+            return a == b;
+        }
+        if (strcmp (a->key, b->key) || a->valuesize != b->valuesize || memcmp (a->value, b->value, a->valuesize)) {
+            return 0;
+        }
+        a = a->next;
+        b = b->next;
+    }
+}
+
+// returns the index of the first mismatching track, the track count if the playlist metadata differs, or -1
+static int
+playlist_compare (playlist_t *a, playlist_t *b) {
+    playItem_t *x = a->head[PL_MAIN];
+    playItem_t *y = b->head[PL_MAIN];
+    int idx = 0;
+    for (; x && y; x = x->next[PL_MAIN], y = y->next[PL_MAIN], idx++) {
+        if (pl_item_get_startsample (x) != pl_item_get_startsample (y)
+            || pl_item_get_endsample (x) != pl_item_get_endsample (y)
+            || x->_duration != y->_duration
+            || x->_flags != y->_flags
+            || !meta_equal (x->meta, y->meta)) {
+            return idx;
+        }
+    }
+    if (x || y || a->count[PL_MAIN] != b->count[PL_MAIN]) {
+        return idx;
+    }
+    for (DB_metaInfo_t *m = a->meta; m; m = m->next) {
+        const char *value = plt_find_meta (b, m->key);
+        if (!value || strcmp (value, m->value)) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+static void
+patch_file (const char *path, long pos, const void *data, size_t size) {
+    FILE *fp = fopen (path, "r+b");
+    fseek (fp, pos, SEEK_SET);
+    fwrite (data, 1, size, fp);
+    fclose (fp);
+}
+
+static int
+journal_save (playlist_t *plt) {
+    pl_lock ();
+    int res = dbpl2_journal_save (plt, fname);
+    pl_unlock ();
+    return res;
+}
+
+static playlist_t *
+read_playlist (void) {
+    playlist_t *plt = plt_alloc ("loaded");
+    if (dbpl2_read (plt, fname)) {
+        plt_free (plt);
+        return NULL;
+    }
+    return plt;
+}
+
+static long
+file_size (const char *path) {
+    FILE *fp = fopen (path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    fseek (fp, 0, SEEK_END);
+    long size = ftell (fp);
+    fclose (fp);
+    return size;
+}
+
+// makes a journaled insert, remove, move and tag edit
+static void
+edit_playlist (playlist_t *plt, int n) {
+    playItem_t *after = plt_get_item_for_idx (plt, 10, PL_MAIN);
+    playItem_t *it = pl_item_alloc_init ("/music/new.flac", "stdflac");
+    pl_add_meta (it, "title", "New");
+    plt_insert_item (plt, after, it);
+    pl_item_unref (it);
+    pl_item_unref (after);
+
+    it = plt_get_item_for_idx (plt, 20 + n, PL_MAIN);
+    plt_remove_item (plt, it);
+    pl_item_unref (it);
+
+    uint32_t indexes[2] = { 30, 31 + n };
+    playItem_t *drop_before = plt_get_item_for_idx (plt, 5, PL_MAIN);
+    plt_move_items (plt, PL_MAIN, plt, drop_before, indexes, 2);
+    pl_item_unref (drop_before);
+
+    it = plt_get_item_for_idx (plt, 40 + n, PL_MAIN);
+    pl_replace_meta (it, "title", "Edited");
+    pl_item_unref (it);
+}
+
+static void
+write_u16_string (FILE *fp, const char *str) {
+    uint16_t l = (uint16_t)strlen (str);
+    fwrite (&l, 2, 1, fp);
+    fwrite (str, 1, l, fp);
+}
+
+@interface DBPLTest : XCTestCase
+
+@end
+
+@implementation DBPLTest
+
+- (void)setUp {
+    [super setUp];
+    ddb_logger_init ();
+    pl_init ();
+    strcpy (tempdir, "/tmp/dbpltest.XXXXXX");
+    mkdtemp (tempdir);
+    snprintf (fname, sizeof (fname), "%s/0.dbpl", tempdir);
+    snprintf (journal, sizeof (journal), "%s.journal", fname);
+}
+
+- (void)tearDown {
+    unlink (fname);
+    unlink (journal);
+    rmdir (tempdir);
+    pl_free ();
+    ddb_logger_free ();
+    [super tearDown];
+}
+
+- (void)test_SaveAndRead_SamePlaylist {
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < 100; i++) {
+        add_track (plt, i);
+    }
+    plt_add_meta (plt, "shuffle", "1");
+    plt_add_meta (plt, "title", "Test");
+
+    int res = dbpl2_save (plt, fname, NULL, NULL);
+    XCTAssert(res == 0);
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    res = dbpl2_read (loaded, fname);
+    XCTAssert(res == 0);
+    int diff = playlist_compare (plt, loaded);
+    XCTAssert(diff == -1, @"The actual output is: %d", diff);
+    XCTAssert(loaded->totaltime == plt->totaltime);
+
+    plt_free (loaded);
+    plt_free (plt);
+}
+
+- (void)test_LoadEmptyPlaylist_Succeeds {
+    playlist_t *plt = plt_alloc ("test");
+    int res = dbpl2_save (plt, fname, NULL, NULL);
+    XCTAssert(res == 0);
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    res = dbpl2_read (loaded, fname);
+    XCTAssert(res == 0);
+    XCTAssert(loaded->count[PL_MAIN] == 0);
+
+    plt_free (loaded);
+    plt_free (plt);
+}
+
+- (void)test_LoadVersion1File_TracksAndMetaLoaded {
+    FILE *fp = fopen (fname, "wb");
+    uint8_t ver[2] = { 1, 5 };
+    uint32_t count = 2;
+    fwrite ("DBPL", 1, 4, fp);
+    fwrite (ver, 1, 2, fp);
+    fwrite (&count, 4, 1, fp);
+    for (int i = 0; i < 2; i++) {
+        uint32_t startsample = i ? 44100 : 0;
+        uint32_t endsample = i ? 88199 : 0;
+        float duration = 1;
+        uint32_t flags = i ? DDB_IS_SUBTRACK : 0;
+        int16_t nm = 3;
+        fwrite (&startsample, 4, 1, fp);
+        fwrite (&endsample, 4, 1, fp);
+        fwrite (&duration, 4, 1, fp);
+        fwrite (&flags, 4, 1, fp);
+        fwrite (&nm, 2, 1, fp);
+        write_u16_string (fp, ":URI");
+        write_u16_string (fp, "/music/file.flac");
+        write_u16_string (fp, ":DECODER");
+        write_u16_string (fp, "stdflac");
+        write_u16_string (fp, "title");
+        write_u16_string (fp, i ? "Second" : "First");
+    }
+    int16_t nm = 1;
+    int16_t l = 7;
+    fwrite (&nm, 2, 1, fp);
+    fwrite (&l, 2, 1, fp);
+    fwrite ("shuffle", 1, 7, fp);
+    l = 1;
+    fwrite (&l, 2, 1, fp);
+    fwrite ("1", 1, 1, fp);
+    fclose (fp);
+
+    // DBPL 1.x isn't a DBPL 2.x file
+    playlist_t *plt = plt_alloc ("test");
+    int res = dbpl2_read (plt, fname);
+    XCTAssert(res == -1);
+    XCTAssert(plt->count[PL_MAIN] == 0);
+
+    playItem_t *last = plt_load (plt, NULL, fname, NULL, NULL, NULL);
+    XCTAssert(last != NULL);
+    XCTAssert(plt->count[PL_MAIN] == 2, @"The actual output is: %d", plt->count[PL_MAIN]);
+
+    playItem_t *it = plt->head[PL_MAIN];
+    XCTAssert(!strcmp (pl_find_meta (it, ":URI"), "/music/file.flac"));
+    XCTAssert(!strcmp (pl_find_meta (it, "title"), "First"));
+    XCTAssert(pl_get_item_flags (it) == 0);
+    it = it->next[PL_MAIN];
+    XCTAssert(!strcmp (pl_find_meta (it, "title"), "Second"));
+    XCTAssert(pl_item_get_startsample (it) == 44100);
+    XCTAssert(pl_item_get_endsample (it) == 88199);
+    XCTAssert(pl_get_item_flags (it) == DDB_IS_SUBTRACK);
+    XCTAssert(pl_get_item_duration (it) == 1);
+
+    const char *shuffle = plt_find_meta (plt, "shuffle");
+    XCTAssert(shuffle && !strcmp (shuffle, "1"));
+
+    plt_free (plt);
+}
+
+- (void)test_CorruptedItemsOffset_Rejected {
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < 10; i++) {
+        add_track (plt, i);
+    }
+    int res = dbpl2_save (plt, fname, NULL, NULL);
+    XCTAssert(res == 0);
+    plt_free (plt);
+
+    FILE *fp = fopen (fname, "rb");
+    uint64_t items_offset;
+    fseek (fp, DBPL2_ITEMS_OFFSET_POS, SEEK_SET);
+    fread (&items_offset, 8, 1, fp);
+    fseek (fp, 0, SEEK_END);
+    uint64_t size = ftell (fp);
+    fclose (fp);
+
+    // past the end of the file
+    uint64_t offset = size + 8;
+    patch_file (fname, DBPL2_ITEMS_OFFSET_POS, &offset, 8);
+    plt = plt_alloc ("test");
+    res = dbpl2_read (plt, fname);
+    XCTAssert(res == -1);
+    XCTAssert(plt->count[PL_MAIN] == 0);
+    plt_free (plt);
+
+    // misaligned
+    offset = items_offset + 4;
+    patch_file (fname, DBPL2_ITEMS_OFFSET_POS, &offset, 8);
+    plt = plt_alloc ("test");
+    res = dbpl2_read (plt, fname);
+    XCTAssert(res == -1);
+    XCTAssert(plt->count[PL_MAIN] == 0);
+    plt_free (plt);
+
+    // truncated
+    patch_file (fname, DBPL2_ITEMS_OFFSET_POS, &items_offset, 8);
+    truncate (fname, size - 4);
+    plt = plt_alloc ("test");
+    res = dbpl2_read (plt, fname);
+    XCTAssert(res == -1);
+    XCTAssert(plt->count[PL_MAIN] == 0);
+    plt_free (plt);
+}
+
+- (void)test_JournaledEdits_ReloadSamePlaylist {
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < 100; i++) {
+        add_track (plt, i);
+    }
+    int res = journal_save (plt);
+    XCTAssert(res == 0);
+    long size = file_size (fname);
+    XCTAssert(file_size (journal) == -1);
+
+    for (int i = 0; i < 3; i++) {
+        edit_playlist (plt, i);
+        plt_replace_meta (plt, "shuffle", i ? "2" : "1");
+        res = journal_save (plt);
+        XCTAssert(res == 0);
+    }
+
+    // the edits were appended to the journal, without rewriting the playlist file
+    XCTAssert(file_size (fname) == size);
+    XCTAssert(file_size (journal) > 0);
+
+    playlist_t *loaded = read_playlist ();
+    XCTAssert(loaded != NULL);
+    int diff = playlist_compare (plt, loaded);
+    XCTAssert(diff == -1, @"The actual output is: %d", diff);
+    XCTAssert(loaded->totaltime == plt->totaltime);
+
+    plt_free (loaded);
+    plt_free (plt);
+}
+
+- (void)test_BrokenLastBatch_Ignored {
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < 100; i++) {
+        add_track (plt, i);
+    }
+    journal_save (plt);
+    edit_playlist (plt, 0);
+    journal_save (plt);
+    long size = file_size (journal);
+    playlist_t *expected = read_playlist ();
+    XCTAssert(expected != NULL);
+
+    edit_playlist (plt, 1);
+    journal_save (plt);
+    XCTAssert(file_size (journal) > size);
+
+    // corrupt the last batch
+    long last = file_size (journal) - 1;
+    uint8_t byte = 0xff;
+    patch_file (journal, last, &byte, 1);
+    playlist_t *loaded = read_playlist ();
+    int diff = playlist_compare (expected, loaded);
+    XCTAssert(diff == -1, @"The actual output is: %d", diff);
+    plt_free (loaded);
+
+    // truncate the last batch
+    truncate (journal, size + (last + 1 - size) / 2);
+    loaded = read_playlist ();
+    diff = playlist_compare (expected, loaded);
+    XCTAssert(diff == -1, @"The actual output is: %d", diff);
+
+    // the broken batch is dropped by compacting on the next save
+    int res = journal_save (loaded);
+    XCTAssert(res == 0);
+    XCTAssert(file_size (journal) == -1);
+    plt_free (loaded);
+    loaded = read_playlist ();
+    diff = playlist_compare (expected, loaded);
+    XCTAssert(diff == -1, @"The actual output is: %d", diff);
+
+    plt_free (loaded);
+    plt_free (expected);
+    plt_free (plt);
+}
+
+- (void)test_GenerationMismatch_JournalDiscarded {
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < 100; i++) {
+        add_track (plt, i);
+    }
+    journal_save (plt);
+    playlist_t *expected = read_playlist ();
+    XCTAssert(expected != NULL);
+
+    edit_playlist (plt, 0);
+    journal_save (plt);
+    XCTAssert(file_size (journal) > 0);
+
+    uint64_t generation;
+    FILE *fp = fopen (fname, "rb");
+    fseek (fp, DBPL2_GENERATION_POS, SEEK_SET);
+    fread (&generation, 8, 1, fp);
+    fclose (fp);
+    generation++;
+    patch_file (fname, DBPL2_GENERATION_POS, &generation, 8);
+
+    playlist_t *loaded = read_playlist ();
+    XCTAssert(loaded != NULL);
+    int diff = playlist_compare (expected, loaded);
+    XCTAssert(diff == -1, @"The actual output is: %d", diff);
+
+    plt_free (loaded);
+    plt_free (expected);
+    plt_free (plt);
+}
+
+- (void)test_Compaction_RemovesJournal {
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < 100; i++) {
+        add_track (plt, i);
+    }
+    journal_save (plt);
+    edit_playlist (plt, 0);
+    journal_save (plt);
+    XCTAssert(file_size (journal) > 0);
+
+    // unjournaled changes, such as sorting, rewrite the playlist file
+    dbpl2_journal_invalidate (plt);
+    edit_playlist (plt, 1);
+    int res = journal_save (plt);
+    XCTAssert(res == 0);
+    XCTAssert(file_size (journal) == -1);
+
+    playlist_t *loaded = read_playlist ();
+    XCTAssert(loaded != NULL);
+    int diff = playlist_compare (plt, loaded);
+    XCTAssert(diff == -1, @"The actual output is: %d", diff);
+
+    plt_free (loaded);
+    plt_free (plt);
+}
+
+@end
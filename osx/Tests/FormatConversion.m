@@ -93,4 +93,124 @@
     XCTAssert(outsamples[3] == 0x4000, @"sample3 is %d", outsamples[3]);
 }
 
+- (void)testConvertFloatToInt16_RoundsAndClips {
+    // long enough to go through both the vectorized and the scalar code
+    float samples[19];
+    int16_t outsamples[19];
+    for (int i = 0; i < 19; i++) {
+        samples[i] = i / 32768.f;
+    }
+    samples[0] = 1.5f;
+    samples[1] = -1.5f;
+    samples[3] = 1.5f / 32768.f;
+    samples[18] = 1.f;
+
+    ddb_waveformat_t inputfmt = {
+        .bps = 32,
+        .is_float = 1,
+        .channels = 1,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT
+    };
+
+    ddb_waveformat_t outputfmt = {
+        .bps = 16,
+        .channels = 1,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT
+    };
+
+    int res = pcm_convert (&inputfmt, (char *)samples, &outputfmt, (char *)outsamples, sizeof (samples));
+    XCTAssert(res == sizeof (outsamples), @"The result is %d", res);
+    XCTAssert(outsamples[0] == 0x7fff, @"sample0 is %d", outsamples[0]);
+    XCTAssert(outsamples[1] == -0x8000, @"sample1 is %d", outsamples[1]);
+    XCTAssert(outsamples[2] == 2, @"sample2 is %d", outsamples[2]);
+    XCTAssert(outsamples[3] == 2, @"sample3 is %d", outsamples[3]);
+    for (int i = 4; i < 18; i++) {
+        XCTAssert(outsamples[i] == i, @"sample%d is %d", i, outsamples[i]);
+    }
+    XCTAssert(outsamples[18] == 0x7fff, @"sample18 is %d", outsamples[18]);
+}
+
+- (void)testConvertFloatToInt32_PositiveFullScaleClipsToMax {
+    float samples[10] = { 1.f, -1.f, 2.f, -2.f, 0.5f, 1.f, 1.f, 1.f, 1.f, 1.f };
+    int32_t outsamples[10];
+
+    ddb_waveformat_t inputfmt = {
+        .bps = 32,
+        .is_float = 1,
+        .channels = 2,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT|DDB_SPEAKER_FRONT_RIGHT
+    };
+
+    ddb_waveformat_t outputfmt = {
+        .bps = 32,
+        .channels = 2,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT|DDB_SPEAKER_FRONT_RIGHT
+    };
+
+    pcm_convert (&inputfmt, (char *)samples, &outputfmt, (char *)outsamples, sizeof (samples));
+    XCTAssert(outsamples[0] == 0x7fffffff, @"sample0 is %d", outsamples[0]);
+    XCTAssert(outsamples[1] == INT32_MIN, @"sample1 is %d", outsamples[1]);
+    XCTAssert(outsamples[2] == 0x7fffffff, @"sample2 is %d", outsamples[2]);
+    XCTAssert(outsamples[3] == INT32_MIN, @"sample3 is %d", outsamples[3]);
+    XCTAssert(outsamples[4] == 0x40000000, @"sample4 is %d", outsamples[4]);
+    XCTAssert(outsamples[9] == 0x7fffffff, @"sample9 is %d", outsamples[9]);
+}
+
+- (void)testApplyVolumeInt16_RoundsTowardsZeroAndClips {
+    int16_t samples[11] = { 1000, -1000, 0x7fff, -0x8000, 3, -3, 1999, -1999, 0x4000, 0x7000, -0x7000 };
+    pcm_apply_volume_int16 (samples, 11, 1500);
+    XCTAssert(samples[0] == 1500, @"sample0 is %d", samples[0]);
+    XCTAssert(samples[1] == -1500, @"sample1 is %d", samples[1]);
+    XCTAssert(samples[2] == 0x7fff, @"sample2 is %d", samples[2]);
+    XCTAssert(samples[3] == -0x8000, @"sample3 is %d", samples[3]);
+    XCTAssert(samples[4] == 4, @"sample4 is %d", samples[4]);
+    XCTAssert(samples[5] == -4, @"sample5 is %d", samples[5]);
+    XCTAssert(samples[6] == 2998, @"sample6 is %d", samples[6]);
+    XCTAssert(samples[7] == -2998, @"sample7 is %d", samples[7]);
+    XCTAssert(samples[8] == 0x6000, @"sample8 is %d", samples[8]);
+    XCTAssert(samples[9] == 0x7fff, @"sample9 is %d", samples[9]);
+    XCTAssert(samples[10] == -0x8000, @"sample10 is %d", samples[10]);
+}
+
+// Converts 1 second of 8 channel audio between all supported sample formats
+- (void)test_AllFormats_Performance {
+    static const int bps[] = { 8, 16, 24, 32, 32 };
+    static const int is_float[] = { 0, 0, 0, 0, 1 };
+    const int nsamples = 44100 * 8;
+    char *input = calloc (nsamples, 4);
+    char *output = calloc (nsamples, 4);
+    for (int i = 0; i < nsamples; i++) {
+        ((float *)input)[i] = (i % 2000 - 1000) / 1000.f;
+    }
+
+    [self measureBlock:^{
+        for (int i = 0; i < 5; i++) {
+            for (int o = 0; o < 5; o++) {
+                ddb_waveformat_t inputfmt = {
+                    .bps = bps[i],
+                    .is_float = is_float[i],
+                    .channels = 8,
+                    .samplerate = 44100,
+                    .channelmask = 0xff
+                };
+                ddb_waveformat_t outputfmt = {
+                    .bps = bps[o],
+                    .is_float = is_float[o],
+                    .channels = 8,
+                    .samplerate = 44100,
+                    .channelmask = 0xff
+                };
+                pcm_convert (&inputfmt, input, &outputfmt, output, nsamples * bps[i] / 8);
+            }
+        }
+    }];
+
+    free (input);
+    free (output);
+}
+
 @end
@@ -0,0 +1,206 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include "deadbeef.h"
+#include "playlist.h"
+#include "threading.h"
+#include "messagepump.h"
+
+#define NUM_PRODUCERS 4
+#define NUM_PRODUCER_MESSAGES 100000
+
+typedef struct {
+    uint32_t id;
+    uintptr_t ctx;
+    uint32_t p1;
+    uint32_t p2;
+} test_message_t;
+
+static void
+producer (void *ctx) {
+    uint32_t producer_id = (uint32_t)(intptr_t)ctx;
+    for (uint32_t i = 0; i < NUM_PRODUCER_MESSAGES; i++) {
+        messagepump_push (DB_EV_NEXT, 0, producer_id, i);
+    }
+}
+
+// pops everything queued so far, and frees the event payloads
+static int
+pop_all (test_message_t *msgs, int max) {
+    int n = 0;
+    test_message_t m;
+    while (messagepump_pop (&m.id, &m.ctx, &m.p1, &m.p2) != -1) {
+        if (n < max) {
+            msgs[n] = m;
+        }
+        n++;
+        if (m.id >= DB_EV_FIRST && m.ctx) {
+            messagepump_event_free ((ddb_event_t *)m.ctx);
+        }
+    }
+    return n;
+}
+
+static void
+push_trackinfochanged (playItem_t *it) {
+    ddb_event_track_t *ev = (ddb_event_track_t *)messagepump_event_alloc (DB_EV_TRACKINFOCHANGED);
+    ev->track = DB_PLAYITEM (it);
+    pl_item_ref (it);
+    messagepump_push_event ((ddb_event_t *)ev, 0, 0);
+}
+
+@interface MessagePumpTest : XCTestCase
+
+@end
+
+@implementation MessagePumpTest
+
+- (void)setUp {
+    [super setUp];
+    pl_init ();
+    messagepump_init ();
+}
+
+- (void)tearDown {
+    messagepump_free ();
+    pl_free ();
+    [super tearDown];
+}
+
+- (void)test_MultipleProducers_AllMessagesReceivedInOrder {
+    intptr_t tids[NUM_PRODUCERS];
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        tids[i] = thread_start (producer, (void *)(intptr_t)i);
+    }
+
+    uint32_t next[NUM_PRODUCERS] = {0};
+    int total = 0;
+    int misordered = 0;
+    while (total < NUM_PRODUCERS * NUM_PRODUCER_MESSAGES) {
+        test_message_t m;
+        if (messagepump_pop (&m.id, &m.ctx, &m.p1, &m.p2) == -1) {
+            messagepump_wait ();
+            continue;
+        }
+        if (m.id != DB_EV_NEXT || m.p1 >= NUM_PRODUCERS || m.p2 != next[m.p1]) {
+            misordered++;
+        }
+        else {
+            next[m.p1]++;
+        }
+        total++;
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        thread_join (tids[i]);
+    }
+
+    XCTAssert(misordered == 0, @"The actual output is: %d", misordered);
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        XCTAssert(next[i] == NUM_PRODUCER_MESSAGES, @"The actual output is: %d", (int)next[i]);
+    }
+    XCTAssert(!messagepump_hasmessages ());
+}
+
+- (void)test_DuplicatePlaylistChanged_LastOneKept {
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    messagepump_push (DB_EV_NEXT, 0, 1, 0);
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_TITLE, 0);
+    messagepump_push (DB_EV_NEXT, 0, 2, 0);
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+
+    test_message_t msgs[10];
+    int n = pop_all (msgs, 10);
+
+    XCTAssert(n == 4, @"The actual output is: %d", n);
+    XCTAssert(msgs[0].id == DB_EV_NEXT && msgs[0].p1 == 1);
+    XCTAssert(msgs[1].id == DB_EV_PLAYLISTCHANGED && msgs[1].p1 == DDB_PLAYLIST_CHANGE_TITLE);
+    XCTAssert(msgs[2].id == DB_EV_NEXT && msgs[2].p1 == 2);
+    XCTAssert(msgs[3].id == DB_EV_PLAYLISTCHANGED && msgs[3].p1 == DDB_PLAYLIST_CHANGE_CONTENT);
+}
+
+- (void)test_DuplicateTrackInfoChanged_LastOneKeptPerTrack {
+    playItem_t *a = pl_item_alloc ();
+    playItem_t *b = pl_item_alloc ();
+
+    push_trackinfochanged (a);
+    push_trackinfochanged (b);
+    push_trackinfochanged (a);
+    push_trackinfochanged (a);
+
+    test_message_t msgs[10];
+    int n = 0;
+    test_message_t m;
+    while (messagepump_pop (&m.id, &m.ctx, &m.p1, &m.p2) != -1) {
+        // keep the payloads alive until the tracks are checked
+        msgs[n++] = m;
+    }
+
+    XCTAssert(n == 2, @"The actual output is: %d", n);
+    XCTAssert(((ddb_event_track_t *)msgs[0].ctx)->track == DB_PLAYITEM (b));
+    XCTAssert(((ddb_event_track_t *)msgs[1].ctx)->track == DB_PLAYITEM (a));
+
+    // the payloads of the dropped events have released their refs
+    XCTAssert(a->_refc == 2, @"The actual output is: %d", a->_refc);
+    XCTAssert(b->_refc == 2, @"The actual output is: %d", b->_refc);
+
+    for (int i = 0; i < n; i++) {
+        messagepump_event_free ((ddb_event_t *)msgs[i].ctx);
+    }
+    XCTAssert(a->_refc == 1, @"The actual output is: %d", a->_refc);
+    XCTAssert(b->_refc == 1, @"The actual output is: %d", b->_refc);
+
+    pl_item_unref (a);
+    pl_item_unref (b);
+}
+
+- (void)test_AdjacentSeeks_LastOneKept {
+    messagepump_push (DB_EV_SEEK, 0, 100, 0);
+    messagepump_push (DB_EV_SEEK, 0, 200, 0);
+    messagepump_push (DB_EV_SEEK, 0, 300, 0);
+    messagepump_push (DB_EV_NEXT, 0, 0, 0);
+    messagepump_push (DB_EV_SEEK, 0, 400, 0);
+
+    test_message_t msgs[10];
+    int n = pop_all (msgs, 10);
+
+    XCTAssert(n == 3, @"The actual output is: %d", n);
+    XCTAssert(msgs[0].id == DB_EV_SEEK && msgs[0].p1 == 300);
+    XCTAssert(msgs[1].id == DB_EV_NEXT);
+    XCTAssert(msgs[2].id == DB_EV_SEEK && msgs[2].p1 == 400);
+}
+
+- (void)test_NonIdempotentMessages_NotCoalesced {
+    for (int i = 0; i < 1000; i++) {
+        messagepump_push (DB_EV_NEXT, 0, 0, 0);
+    }
+
+    test_message_t msgs[1];
+    int n = pop_all (msgs, 1);
+
+    XCTAssert(n == 1000, @"The actual output is: %d", n);
+}
+
+@end
@@ -0,0 +1,251 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include <stdlib.h>
+#include <string.h>
+#include "deadbeef.h"
+#include "playlist.h"
+
+#define NUM_LOOKUPS 1000
+#define NUM_EDITS 100
+
+static playlist_t *
+fill_playlist (int count) {
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < count; i++) {
+        playItem_t *it = pl_item_alloc ();
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        pl_item_unref (it);
+    }
+    return plt;
+}
+
+// compares both lookup directions with a walk of the linked list
+static int
+check_lookups (playlist_t *plt, int iter) {
+    int errors = 0;
+    int idx = 0;
+    for (playItem_t *it = plt->head[iter]; it; it = it->next[iter], idx++) {
+        playItem_t *found = plt_get_item_for_idx (plt, idx, iter);
+        if (found != it) {
+            errors++;
+        }
+        if (found) {
+            pl_item_unref (found);
+        }
+        if (plt_get_item_idx (plt, it, iter) != idx) {
+            errors++;
+        }
+    }
+    if (idx != plt->count[iter] || plt_get_item_for_idx (plt, idx, iter)) {
+        errors++;
+    }
+    return errors;
+}
+
+// random index to item and item to index lookups, without edits
+static void
+random_lookups (playlist_t *plt) {
+    srand (1);
+    for (int i = 0; i < NUM_LOOKUPS; i++) {
+        playItem_t *it = plt_get_item_for_idx (plt, rand () % plt->count[PL_MAIN], PL_MAIN);
+        plt_get_item_idx (plt, it, PL_MAIN);
+        pl_item_unref (it);
+    }
+}
+
+// inserts and removes an item in the middle, then looks up the last item,
+// which is the worst case: the tail of the index has to be walked again
+static void
+mid_list_edits (playlist_t *plt) {
+    for (int i = 0; i < NUM_EDITS; i++) {
+        playItem_t *mid = plt_get_item_for_idx (plt, plt->count[PL_MAIN] / 2, PL_MAIN);
+        playItem_t *it = pl_item_alloc ();
+        plt_insert_item (plt, mid, it);
+        playItem_t *last = plt_get_item_for_idx (plt, plt->count[PL_MAIN] - 1, PL_MAIN);
+        plt_remove_item (plt, it);
+        pl_item_unref (it);
+        pl_item_unref (last);
+        pl_item_unref (mid);
+    }
+}
+
+// compares the search results with a scan of the titles, returns the number of mismatches
+static int
+check_search (playlist_t *plt, const char *text) {
+    plt_search_process2 (plt, text, 0);
+    int errors = 0;
+    playItem_t *found = plt->head[PL_SEARCH];
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        if (strstr (pl_find_meta_raw (it, "title"), text)) {
+            if (found != it) {
+                errors++;
+                continue;
+            }
+            found = found->next[PL_SEARCH];
+        }
+    }
+    return errors + (found != NULL);
+}
+
+@interface PlaylistIndexTest : XCTestCase
+
+@end
+
+@implementation PlaylistIndexTest
+
+- (void)setUp {
+    [super setUp];
+    pl_init ();
+}
+
+- (void)tearDown {
+    pl_free ();
+    [super tearDown];
+}
+
+- (void)test_LookupsAfterEdits_MatchLinkedList {
+    playlist_t *plt = fill_playlist (1000);
+    XCTAssert(check_lookups (plt, PL_MAIN) == 0);
+
+    srand (1);
+    for (int i = 0; i < 100; i++) {
+        // insert after a random item, or at the head
+        int idx = rand () % (plt->count[PL_MAIN] + 1) - 1;
+        playItem_t *after = plt_get_item_for_idx (plt, idx, PL_MAIN);
+        playItem_t *it = pl_item_alloc ();
+        plt_insert_item (plt, after, it);
+        pl_item_unref (it);
+        if (after) {
+            pl_item_unref (after);
+        }
+
+        // remove a random item
+        it = plt_get_item_for_idx (plt, rand () % plt->count[PL_MAIN], PL_MAIN);
+        plt_remove_item (plt, it);
+        pl_item_unref (it);
+
+        // move a random item before another one
+        uint32_t from = rand () % plt->count[PL_MAIN];
+        playItem_t *moved = plt_get_item_for_idx (plt, from, PL_MAIN);
+        playItem_t *drop_before = plt_get_item_for_idx (plt, rand () % plt->count[PL_MAIN], PL_MAIN);
+        if (drop_before != moved) {
+            plt_move_items (plt, PL_MAIN, plt, drop_before, &from, 1);
+        }
+        pl_item_unref (moved);
+        pl_item_unref (drop_before);
+
+        if (i % 10 == 0) {
+            XCTAssert(check_lookups (plt, PL_MAIN) == 0, @"Mismatch after %d edits", i);
+        }
+    }
+    XCTAssert(check_lookups (plt, PL_MAIN) == 0);
+    XCTAssert(plt->count[PL_MAIN] == 1000, @"The actual output is: %d", plt->count[PL_MAIN]);
+    plt_unref (plt);
+}
+
+- (void)test_SearchAfterEdits_MatchesScan {
+    playlist_t *plt = fill_playlist (1000);
+    char title[20];
+    int idx = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], idx++) {
+        snprintf (title, sizeof (title), "track %d", idx);
+        pl_add_meta (it, "title", title);
+    }
+    XCTAssert(check_search (plt, "track 1") == 0);
+
+    srand (1);
+    for (int i = 0; i < 100; i++) {
+        // retitle, remove and append tracks, between the searches which update the index
+        playItem_t *it = plt_get_item_for_idx (plt, rand () % plt->count[PL_MAIN], PL_MAIN);
+        snprintf (title, sizeof (title), "track %d", rand () % 2000);
+        pl_replace_meta (it, "title", title);
+        pl_item_unref (it);
+
+        it = plt_get_item_for_idx (plt, rand () % plt->count[PL_MAIN], PL_MAIN);
+        plt_remove_item (plt, it);
+        pl_item_unref (it);
+
+        it = pl_item_alloc ();
+        snprintf (title, sizeof (title), "track %d", rand () % 2000);
+        pl_add_meta (it, "title", title);
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        pl_item_unref (it);
+
+        snprintf (title, sizeof (title), "track %d", rand () % 20);
+        XCTAssert(check_search (plt, title) == 0, @"Mismatch after %d edits", i);
+    }
+    plt_search_reset (plt);
+    plt_unref (plt);
+}
+
+- (void)test_RandomLookups10k_Performance {
+    playlist_t *plt = fill_playlist (10000);
+    [self measureBlock:^{
+        random_lookups (plt);
+    }];
+    plt_unref (plt);
+}
+
+- (void)test_RandomLookups100k_Performance {
+    playlist_t *plt = fill_playlist (100000);
+    [self measureBlock:^{
+        random_lookups (plt);
+    }];
+    plt_unref (plt);
+}
+
+- (void)test_RandomLookups1M_Performance {
+    playlist_t *plt = fill_playlist (1000000);
+    [self measureBlock:^{
+        random_lookups (plt);
+    }];
+    plt_unref (plt);
+}
+
+- (void)test_MidListEditThenLookup10k_Performance {
+    playlist_t *plt = fill_playlist (10000);
+    [self measureBlock:^{
+        mid_list_edits (plt);
+    }];
+    plt_unref (plt);
+}
+
+- (void)test_MidListEditThenLookup100k_Performance {
+    playlist_t *plt = fill_playlist (100000);
+    [self measureBlock:^{
+        mid_list_edits (plt);
+    }];
+    plt_unref (plt);
+}
+
+- (void)test_MidListEditThenLookup1M_Performance {
+    playlist_t *plt = fill_playlist (1000000);
+    [self measureBlock:^{
+        mid_list_edits (plt);
+    }];
+    plt_unref (plt);
+}
+
+@end
@@ -39,6 +39,60 @@ static DB_output_t fake_out = {
     .state = fake_out_state,
 };
 
+// the default playlist column formats of the gtkui plugin
+#define NUM_DEFAULT_COLUMN_FORMATS 10
+static const char *default_column_formats[NUM_DEFAULT_COLUMN_FORMATS + 1] = {
+    "$if(%artist%,%artist%,Unknown Artist)[ - %album%]",
+    "$if(%artist%,%artist%,Unknown Artist)",
+    "%album%",
+    "%title%",
+    "%year%",
+    "%length%",
+    "%tracknumber%",
+    "$if(%album artist%,%album artist%,Unknown Artist)",
+    "%codec%",
+    "%bitrate%",
+    NULL
+};
+
+static void
+set_default_columns_meta (playItem_t *it) {
+    pl_replace_meta (it, "artist", "Artist Name");
+    pl_replace_meta (it, "album", "Album Title");
+    pl_replace_meta (it, "title", "Track Title");
+    pl_replace_meta (it, "track", "2");
+    pl_replace_meta (it, "year", "1999");
+    pl_replace_meta (it, ":FILETYPE", "FLAC");
+    pl_replace_meta (it, ":BITRATE", "900");
+    plt_set_item_duration (NULL, it, 200);
+}
+
+static void
+compile_default_column_formats (char **bc, int flags) {
+    for (int i = 0; i < NUM_DEFAULT_COLUMN_FORMATS; i++) {
+        bc[i] = tf_compile_with_flags (default_column_formats[i], flags);
+    }
+}
+
+static void
+free_default_column_formats (char **bc) {
+    for (int i = 0; i < NUM_DEFAULT_COLUMN_FORMATS; i++) {
+        tf_free (bc[i]);
+    }
+}
+
+// formats 1000 rows
+static void
+eval_default_column_formats (ddb_tf_context_t *ctx, playItem_t *it, char **bc, char *buffer, int size) {
+    for (int n = 0; n < 1000; n++) {
+        // new modification stamp, to measure the interpreter rather than the result cache
+        pl_item_modified (it);
+        for (int i = 0; i < NUM_DEFAULT_COLUMN_FORMATS; i++) {
+            tf_eval (ctx, bc[i], buffer, size);
+        }
+    }
+}
+
 @interface TitleFormatting : XCTestCase {
     playItem_t *it;
     ddb_tf_context_t ctx;
@@ -175,6 +229,165 @@ static DB_output_t fake_out = {
     tf_free (bc);
 }
 
+- (void)test_ColumnFormats_Performance {
+    pl_replace_meta (it, "artist", "Artist Name");
+    pl_replace_meta (it, "album", "Album Title");
+    pl_replace_meta (it, "title", "Track Title");
+    pl_replace_meta (it, "track", "2");
+    pl_replace_meta (it, "year", "1999");
+    pl_replace_meta (it, "genre", "Rock");
+    pl_replace_meta (it, ":FILETYPE", "FLAC");
+    pl_replace_meta (it, ":CHANNELS", "2");
+    pl_replace_meta (it, ":SAMPLERATE", "44100");
+
+    static const char *formats[] = {
+        "%tracknumber%",
+        "%title%",
+        "%artist% - %album%",
+        "%length%",
+        "$if(%album artist%,%album artist%,%artist%) - ['['%year%']' ]%album%",
+        "%genre% | %codec% | %samplerate%Hz | %channels%",
+        NULL
+    };
+    char **bc = calloc (6, sizeof (char *));
+    for (int i = 0; formats[i]; i++) {
+        bc[i] = tf_compile (formats[i]);
+    }
+
+    [self measureBlock:^{
+        for (int n = 0; n < 1000; n++) {
+            // new modification stamp, to measure the interpreter rather than the result cache
+            pl_item_modified (it);
+            for (int i = 0; formats[i]; i++) {
+                tf_eval (&ctx, bc[i], buffer, sizeof (buffer));
+            }
+        }
+    }];
+
+    for (int i = 0; formats[i]; i++) {
+        tf_free (bc[i]);
+    }
+    free (bc);
+}
+
+- (void)test_DefaultColumnFormats_Performance {
+    set_default_columns_meta (it);
+    char *bc[NUM_DEFAULT_COLUMN_FORMATS];
+    compile_default_column_formats (bc, 0);
+
+    [self measureBlock:^{
+        eval_default_column_formats (&ctx, it, bc, buffer, sizeof (buffer));
+    }];
+
+    free_default_column_formats (bc);
+}
+
+- (void)test_DefaultColumnFormatsNoLowering_Performance {
+    set_default_columns_meta (it);
+    char *bc[NUM_DEFAULT_COLUMN_FORMATS];
+    compile_default_column_formats (bc, TF_COMPILE_NO_LOWERING);
+
+    [self measureBlock:^{
+        eval_default_column_formats (&ctx, it, bc, buffer, sizeof (buffer));
+    }];
+
+    free_default_column_formats (bc);
+}
+
+- (void)test_NoLowering_SameOutput {
+    set_default_columns_meta (it);
+    pl_replace_meta (it, "album artist", "Album Artist");
+    pl_replace_meta (it, "comment", "Some long comment text");
+
+    static const char *scripts[] = {
+        "%album artist% - ($left($meta(year),4)) %album%",
+        "[%tracknumber%. ]%title% // %ALBUM% %nonexistent%",
+        "plain text, long enough for a text block: %length% %codec%/%bitrate%",
+        "$if(%comment%,'['%comment%']',no comment) $upper(%artist%)",
+        "%track artist%|%discnumber%|%filename%|%directoryname%|%path%",
+        NULL
+    };
+    const char **lists[] = { default_column_formats, scripts };
+
+    for (int l = 0; l < 2; l++) {
+        for (int i = 0; lists[l][i]; i++) {
+            char *bc = tf_compile (lists[l][i]);
+            char *bc_unlowered = tf_compile_with_flags (lists[l][i], TF_COMPILE_NO_LOWERING);
+            char expected[1000];
+            int expected_len = tf_eval (&ctx, bc, expected, sizeof (expected));
+            int len = tf_eval (&ctx, bc_unlowered, buffer, sizeof (buffer));
+            tf_free (bc);
+            tf_free (bc_unlowered);
+            XCTAssert(len == expected_len && !strcmp (buffer, expected), @"The actual output is: %s, expected: %s", buffer, expected);
+        }
+    }
+}
+
+- (void)test_ColumnFormatOver100kItems_Performance {
+    const int count = 100000;
+    playItem_t **items = calloc (count, sizeof (playItem_t *));
+    char s[100];
+    for (int i = 0; i < count; i++) {
+        snprintf (s, sizeof (s), "/music/%d.flac", i);
+        playItem_t *item = pl_item_alloc_init (s, "stdflac");
+        snprintf (s, sizeof (s), "Artist %d", i / 100);
+        pl_add_meta (item, "artist", s);
+        pl_add_meta (item, "album artist", s);
+        snprintf (s, sizeof (s), "Album %d", i / 10);
+        pl_add_meta (item, "album", s);
+        snprintf (s, sizeof (s), "Title %d", i);
+        pl_add_meta (item, "title", s);
+        snprintf (s, sizeof (s), "%d", i % 10 + 1);
+        pl_add_meta (item, "track", s);
+        pl_add_meta (item, "numtracks", "10");
+        snprintf (s, sizeof (s), "%d", 1960 + i % 60);
+        pl_add_meta (item, "year", s);
+        pl_add_meta (item, "genre", i % 2 ? "Rock" : "Jazz");
+        pl_add_meta (item, "composer", "Composer");
+        pl_add_meta (item, "comment", "Comment");
+        pl_add_meta (item, "disc", "1");
+        pl_add_meta (item, ":FILETYPE", "FLAC");
+        pl_add_meta (item, ":BPS", "16");
+        pl_add_meta (item, ":CHANNELS", "2");
+        pl_add_meta (item, ":SAMPLERATE", "44100");
+        pl_add_meta (item, ":BITRATE", "900");
+        items[i] = item;
+    }
+
+    char *bc = tf_compile ("%tracknumber%. %title% | $if(%album artist%,%album artist%,%artist%) - ['['%year%']' ]%album% | %genre% | %codec% | %samplerate%Hz");
+
+    [self measureBlock:^{
+        for (int i = 0; i < count; i++) {
+            // new modification stamp, to measure the interpreter rather than the result cache
+            pl_item_modified (items[i]);
+            ctx.it = (DB_playItem_t *)items[i];
+            tf_eval (&ctx, bc, buffer, sizeof (buffer));
+        }
+    }];
+
+    ctx.it = (DB_playItem_t *)it;
+    tf_free (bc);
+    for (int i = 0; i < count; i++) {
+        pl_item_unref (items[i]);
+    }
+    free (items);
+}
+
+- (void)test_LongLiteralInSmallBuffer_GivesTruncatedLiteral {
+    char *bc = tf_compile("hello world");
+    tf_eval (&ctx, bc, buffer, 8);
+    tf_free (bc);
+    XCTAssert(!strcmp (buffer, "hello w"), @"The actual output is: %s", buffer);
+}
+
+- (void)test_UppercaseMetaField_GivesValue {
+    pl_replace_meta (it, "genre", "Rock");
+    char *bc = tf_compile("%GENRE%");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp (buffer, "Rock"), @"The actual output is: %s", buffer);
+}
+
 - (void)test_LongCommentOverflowBuffer_DoesntCrash {
     char longcomment[2048];
     for (int i = 0; i < sizeof (longcomment) - 1; i++) {
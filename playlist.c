@@ -66,6 +66,7 @@
 #include "strdupa.h"
 #include "tf.h"
 #include "playqueue.h"
+#include "dbpl.h"
 
 #include "cueutil.h"
 
@@ -87,12 +88,10 @@
 //    removed legacy data used for compat with 0.4.4
 //    note: ddb-0.5.0 should keep using 1.2 playlist format
 //    1.3 support is designed for transition to ddb-0.6.0
+// 1.x->2.0 changelog:
+//    indexed format with a string table, see dbpl.c
+//    1.x playlists are still loaded, and are saved as 2.0
 #define PLAYLIST_MAJOR_VER 1
-#define PLAYLIST_MINOR_VER 2
-
-#if (PLAYLIST_MINOR_VER<2)
-#error writing playlists in format <1.2 is not supported
-#endif
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
@@ -103,6 +102,8 @@ static int plt_loading = 0; // disable sending event about playlist switch, conf
 
 #if !DISABLE_LOCKING
 static uintptr_t mutex;
+static intptr_t mutex_owner; // thread holding the mutex, used by pl_is_locked
+static int mutex_depth;
 #endif
 
 #define LOCK {pl_lock();}
@@ -172,6 +173,7 @@ pl_init (void) {
     if (playlist) {
         return 0; // avoid double init
     }
+    metacache_init ();
     playlist = &dummy_playlist;
 #if !DISABLE_LOCKING
     mutex = mutex_create ();
@@ -219,6 +221,9 @@ void
 pl_lock (void) {
 #if !DISABLE_LOCKING
     mutex_lock (mutex);
+    if (mutex_depth++ == 0) {
+        mutex_owner = thread_self ();
+    }
 #if DETECT_PL_LOCK_RC
     pl_lock_tid = pthread_self ();
     tids[ntids++] = pl_lock_tid;
@@ -245,6 +250,9 @@ pl_unlock (void) {
         pl_lock_tid = 0;
     }
 #endif
+    if (--mutex_depth == 0) {
+        mutex_owner = 0;
+    }
     mutex_unlock (mutex);
 #if DEBUG_LOCKING
     pl_lock_cnt--;
@@ -253,6 +261,15 @@ pl_unlock (void) {
 #endif
 }
 
+int
+pl_is_locked (void) {
+#if !DISABLE_LOCKING
+    return mutex_owner == thread_self ();
+#else
+    return 0;
+#endif
+}
+
 static void
 pl_item_free (playItem_t *it);
 
@@ -473,6 +490,9 @@ plt_remove (int plt) {
             if (err != 0) {
                 fprintf (stderr, "playlist rename failed: %s\n", strerror (errno));
             }
+            else {
+                dbpl2_journal_rename (path2, path1);
+            }
         }
     }
 
@@ -645,6 +665,15 @@ plt_get_modification_idx (playlist_t *plt) {
     return idx;
 }
 
+static void
+_search_index_free (struct pl_search_index_s *index);
+
+static void
+plt_search_index_inserted (playlist_t *plt, playItem_t *it);
+
+static void
+plt_search_index_will_remove (playlist_t *plt, playItem_t *it);
+
 void
 plt_free (playlist_t *plt) {
     LOCK;
@@ -663,6 +692,14 @@ plt_free (playlist_t *plt) {
         free (m);
     }
 
+    dbpl2_journal_free (plt);
+
+    for (int iter = 0; iter < PL_MAX_ITERATORS; iter++) {
+        free (plt->index[iter]);
+    }
+    free (plt->search_text);
+    _search_index_free (plt->search_index);
+
     free (plt);
     UNLOCK;
 }
@@ -702,6 +739,7 @@ plt_move (int from, int to) {
             UNLOCK;
             return;
         }
+        dbpl2_journal_rename (path1, temp);
     }
 
     // remove 'from' from list
@@ -737,6 +775,9 @@ plt_move (int from, int to) {
             if (err != 0) {
                 fprintf (stderr, "playlist rename %s->%s failed: %s\n", path2, path1, strerror (errno));
             }
+            else {
+                dbpl2_journal_rename (path2, path1);
+            }
         }
     }
     // open new gap
@@ -756,6 +797,9 @@ plt_move (int from, int to) {
             if (err != 0) {
                 fprintf (stderr, "playlist rename %s->%s failed: %s\n", path1, path2, strerror (errno));
             }
+            else {
+                dbpl2_journal_rename (path1, path2);
+            }
         }
     }
     // move temp file
@@ -769,6 +813,9 @@ plt_move (int from, int to) {
             if (err != 0) {
                 fprintf (stderr, "playlist rename %s->%s failed: %s\n", temp, path1, strerror (errno));
             }
+            else {
+                dbpl2_journal_rename (temp, path1);
+            }
         }
     }
 
@@ -1278,6 +1325,79 @@ pl_add_files_end (void) {
     return plt_add_files_end (addfiles_playlist, 0);
 }
 
+// The index is a flat array of item pointers, where the first index_valid
+// entries are known to match the linked list.
+// Inserting or removing an item only shortens the valid prefix,
+// and the prefix is extended from the last valid entry on demand,
+// so that appending or scrolling costs O(1) amortized per item.
+void
+plt_index_invalidate (playlist_t *plt, int iter) {
+    plt->index_valid[iter] = 0;
+}
+
+static int
+plt_index_find (playlist_t *plt, int iter, playItem_t *it) {
+    int idx = it->_index[iter];
+    if (idx >= 0 && idx < plt->index_valid[iter] && plt->index[iter][idx] == it) {
+        return idx;
+    }
+    return -1;
+}
+
+// fill the index until it contains the item at position upto, or the end of the list
+static void
+plt_index_extend (playlist_t *plt, int iter, int upto) {
+    int valid = plt->index_valid[iter];
+    if (valid > upto || valid >= plt->count[iter]) {
+        return;
+    }
+
+    if (plt->index_size[iter] < plt->count[iter]) {
+        int size = plt->index_size[iter] ? plt->index_size[iter] : 256;
+        while (size < plt->count[iter]) {
+            size *= 2;
+        }
+        playItem_t **index = realloc (plt->index[iter], size * sizeof (playItem_t *));
+        if (!index) {
+            return;
+        }
+        plt->index[iter] = index;
+        plt->index_size[iter] = size;
+    }
+
+    playItem_t *it = valid ? plt->index[iter][valid-1]->next[iter] : plt->head[iter];
+    while (it && valid <= upto && valid < plt->index_size[iter]) {
+        plt->index[iter][valid] = it;
+        it->_index[iter] = valid;
+        valid++;
+        it = it->next[iter];
+    }
+    plt->index_valid[iter] = valid;
+}
+
+// must be called before the item is linked after the specified item
+static void
+plt_index_will_insert (playlist_t *plt, int iter, playItem_t *after) {
+    if (!after) {
+        plt->index_valid[iter] = 0;
+        return;
+    }
+    int idx = plt_index_find (plt, iter, after);
+    if (idx >= 0) {
+        plt->index_valid[iter] = idx + 1;
+    }
+    // otherwise the insertion point is past the valid part of the index
+}
+
+// must be called before the item is unlinked
+static void
+plt_index_will_remove (playlist_t *plt, int iter, playItem_t *it) {
+    int idx = plt_index_find (plt, iter, it);
+    if (idx >= 0) {
+        plt->index_valid[iter] = idx;
+    }
+}
+
 int
 plt_remove_item (playlist_t *playlist, playItem_t *it) {
     if (!it)
@@ -1290,8 +1410,15 @@ plt_remove_item (playlist_t *playlist, playItem_t *it) {
 
     // remove from both lists
     LOCK;
+    if (playlist->journal && (it->prev[PL_MAIN] || it->next[PL_MAIN] || playlist->head[PL_MAIN] == it)) {
+        dbpl2_journal_remove (playlist, it == playlist->tail[PL_MAIN] ? playlist->count[PL_MAIN] - 1 : plt_get_item_idx (playlist, it, PL_MAIN));
+    }
+    if (it->prev[PL_MAIN] || it->next[PL_MAIN] || playlist->head[PL_MAIN] == it) {
+        plt_search_index_will_remove (playlist, it);
+    }
     for (int iter = PL_MAIN; iter <= PL_SEARCH; iter++) {
         if (it->prev[iter] || it->next[iter] || playlist->head[iter] == it || playlist->tail[iter] == it) {
+            plt_index_will_remove (playlist, iter, it);
             playlist->count[iter]--;
         }
 
@@ -1379,13 +1506,14 @@ pl_getselcount (void) {
 playItem_t *
 plt_get_item_for_idx (playlist_t *playlist, int idx, int iter) {
     LOCK;
-    playItem_t *it = playlist->head[iter];
-    while (idx--) {
-        if (!it) {
-            UNLOCK;
-            return NULL;
-        }
-        it = it->next[iter];
+    if (idx < 0 || idx >= playlist->count[iter]) {
+        UNLOCK;
+        return NULL;
+    }
+    plt_index_extend (playlist, iter, idx);
+    playItem_t *it = NULL;
+    if (idx < playlist->index_valid[iter]) {
+        it = playlist->index[iter][idx];
     }
     if (it) {
         pl_item_ref (it);
@@ -1409,17 +1537,15 @@ pl_get_for_idx (int idx) {
 
 int
 plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter) {
-    LOCK;
-    playItem_t *c = playlist->head[iter];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[iter];
-        idx++;
-    }
-    if (!c) {
-        UNLOCK;
+    if (!it) {
         return -1;
     }
+    LOCK;
+    int idx = plt_index_find (playlist, iter, it);
+    if (idx < 0) {
+        plt_index_extend (playlist, iter, playlist->count[iter]-1);
+        idx = plt_index_find (playlist, iter, it);
+    }
     UNLOCK;
     return idx;
 }
@@ -1437,10 +1563,46 @@ pl_get_idx_of_iter (playItem_t *it, int iter) {
     return idx;
 }
 
+// tracks of the same album inherit the rating of the previous track,
+// so that they stay together in the album shuffle mode
+static void
+plt_item_init_shufflerating (playItem_t *it) {
+    playItem_t *prev = it->prev[PL_MAIN];
+    const char *aa = NULL, *prev_aa = NULL;
+    if (pl_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS && prev) {
+        aa = pl_find_meta_raw (it, "band");
+        if (!aa) {
+            aa = pl_find_meta_raw (it, "album artist");
+        }
+        if (!aa) {
+            aa = pl_find_meta_raw (it, "albumartist");
+        }
+        prev_aa = pl_find_meta_raw (prev, "band");
+        if (!prev_aa) {
+            prev_aa = pl_find_meta_raw (prev, "album artist");
+        }
+        if (!prev_aa) {
+            prev_aa = pl_find_meta_raw (prev, "albumartist");
+        }
+    }
+    if (pl_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS && prev && pl_find_meta_raw (prev, "album") == pl_find_meta_raw (it, "album") && ((aa && prev_aa && aa == prev_aa) || pl_find_meta_raw (prev, "artist") == pl_find_meta_raw (it, "artist"))) {
+        it->shufflerating = prev->shufflerating;
+    }
+    else {
+        it->shufflerating = rand ();
+    }
+    it->played = 0;
+}
+
 playItem_t *
 plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     LOCK;
     pl_item_ref (it);
+    if (playlist->journal) {
+        int idx = !after ? 0 : (after == playlist->tail[PL_MAIN] ? playlist->count[PL_MAIN] : plt_get_item_idx (playlist, after, PL_MAIN) + 1);
+        dbpl2_journal_insert (playlist, it, idx);
+    }
+    plt_index_will_insert (playlist, PL_MAIN, after);
     if (!after) {
         it->next[PL_MAIN] = playlist->head[PL_MAIN];
         it->prev[PL_MAIN] = NULL;
@@ -1466,33 +1628,9 @@ plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     it->in_playlist = 1;
 
     playlist->count[PL_MAIN]++;
+    plt_search_index_inserted (playlist, it);
 
-    // shuffle
-    playItem_t *prev = it->prev[PL_MAIN];
-    const char *aa = NULL, *prev_aa = NULL;
-    if (prev) {
-        aa = pl_find_meta_raw (it, "band");
-        if (!aa) {
-            aa = pl_find_meta_raw (it, "album artist");
-        }
-        if (!aa) {
-            aa = pl_find_meta_raw (it, "albumartist");
-        }
-        prev_aa = pl_find_meta_raw (prev, "band");
-        if (!prev_aa) {
-            prev_aa = pl_find_meta_raw (prev, "album artist");
-        }
-        if (!prev_aa) {
-            prev_aa = pl_find_meta_raw (prev, "albumartist");
-        }
-    }
-    if (pl_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS && prev && pl_find_meta_raw (prev, "album") == pl_find_meta_raw (it, "album") && ((aa && prev_aa && aa == prev_aa) || pl_find_meta_raw (prev, "artist") == pl_find_meta_raw (it, "artist"))) {
-        it->shufflerating = prev->shufflerating;
-    }
-    else {
-        it->shufflerating = rand ();
-    }
-    it->played = 0;
+    plt_item_init_shufflerating (it);
 
     // totaltime
     float dur = pl_get_item_duration (it);
@@ -1506,6 +1644,45 @@ plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     return it;
 }
 
+playItem_t *
+plt_append_detached (playlist_t *playlist, playlist_t *from) {
+    LOCK;
+    playItem_t *head = from->head[PL_MAIN];
+    playItem_t *tail = from->tail[PL_MAIN];
+    if (head) {
+        plt_index_will_insert (playlist, PL_MAIN, playlist->tail[PL_MAIN]);
+        head->prev[PL_MAIN] = playlist->tail[PL_MAIN];
+        if (playlist->tail[PL_MAIN]) {
+            playlist->tail[PL_MAIN]->next[PL_MAIN] = head;
+        }
+        else {
+            playlist->head[PL_MAIN] = head;
+        }
+        playlist->tail[PL_MAIN] = tail;
+        playlist->count[PL_MAIN] += from->count[PL_MAIN];
+        playlist->totaltime += from->totaltime;
+
+        for (playItem_t *it = head; it; it = it->next[PL_MAIN]) {
+            it->in_playlist = 1;
+            plt_item_init_shufflerating (it);
+        }
+
+        from->head[PL_MAIN] = from->tail[PL_MAIN] = NULL;
+        from->count[PL_MAIN] = 0;
+        from->totaltime = 0;
+        plt_search_index_invalidate (playlist);
+        plt_search_index_invalidate (from);
+        plt_modified (playlist);
+        dbpl2_journal_invalidate (playlist);
+    }
+    for (DB_metaInfo_t *m = from->meta; m; m = m->next) {
+        plt_add_meta (playlist, m->key, m->value);
+    }
+    UNLOCK;
+    return tail;
+}
+
+
 playItem_t *
 pl_insert_item (playItem_t *after, playItem_t *it) {
     return plt_insert_item (addfiles_playlist ? addfiles_playlist : playlist, after, it);
@@ -1538,6 +1715,7 @@ pl_item_alloc (void) {
     memset (it, 0, sizeof (playItem_t));
     it->_duration = -1;
     it->_refc = 1;
+    pl_item_modified (it);
     return it;
 }
 
@@ -1664,191 +1842,9 @@ plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fnam
         }
     }
 
-    char tempfile[PATH_MAX];
-    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
-    const char magic[] = "DBPL";
-    uint8_t majorver = PLAYLIST_MAJOR_VER;
-    uint8_t minorver = PLAYLIST_MINOR_VER;
-    FILE *fp = fopen (tempfile, "w+b");
-    if (!fp) {
-        UNLOCK;
-        return -1;
-    }
-    if (fwrite (magic, 1, 4, fp) != 4) {
-        goto save_fail;
-    }
-    if (fwrite (&majorver, 1, 1, fp) != 1) {
-        goto save_fail;
-    }
-    if (fwrite (&minorver, 1, 1, fp) != 1) {
-        goto save_fail;
-    }
-    uint32_t cnt = plt->count[PL_MAIN];
-    if (fwrite (&cnt, 1, 4, fp) != 4) {
-        goto save_fail;
-    }
-    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
-        uint16_t l;
-        uint8_t ll;
-        if (cb) {
-            cb(it, user_data);
-        }
-#if (PLAYLIST_MINOR_VER==2)
-        const char *fname = pl_find_meta_raw (it, ":URI");
-        l = strlen (fname);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (fwrite (fname, 1, l, fp) != l) {
-            goto save_fail;
-        }
-        const char *decoder_id = pl_find_meta_raw (it, ":DECODER");
-        if (decoder_id) {
-            ll = strlen (decoder_id);
-            if (fwrite (&ll, 1, 1, fp) != 1) {
-                goto save_fail;
-            }
-            if (fwrite (decoder_id, 1, ll, fp) != ll) {
-                goto save_fail;
-            }
-        }
-        else
-        {
-            ll = 0;
-            if (fwrite (&ll, 1, 1, fp) != 1) {
-                goto save_fail;
-            }
-        }
-        l = pl_find_meta_int (it, ":TRACKNUM", 0);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-#endif
-        if (fwrite (&it->startsample, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&it->endsample, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&it->_duration, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-#if (PLAYLIST_MINOR_VER==2)
-        const char *filetype = pl_find_meta_raw (it, ":FILETYPE");
-        if (!filetype) {
-            filetype = "";
-        }
-        uint8_t ft = strlen (filetype);
-        if (fwrite (&ft, 1, 1, fp) != 1) {
-            goto save_fail;
-        }
-        if (ft) {
-            if (fwrite (filetype, 1, ft, fp) != ft) {
-                goto save_fail;
-            }
-        }
-        float rg_albumgain = pl_get_item_replaygain (it, DDB_REPLAYGAIN_ALBUMGAIN);
-        float rg_albumpeak = pl_get_item_replaygain (it, DDB_REPLAYGAIN_ALBUMPEAK);
-        float rg_trackgain = pl_get_item_replaygain (it, DDB_REPLAYGAIN_TRACKGAIN);
-        float rg_trackpeak = pl_get_item_replaygain (it, DDB_REPLAYGAIN_TRACKPEAK);
-        if (fwrite (&rg_albumgain, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&rg_albumpeak, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&rg_trackgain, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&rg_trackpeak, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-#endif
-        if (fwrite (&it->_flags, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-
-        int16_t nm = 0;
-        DB_metaInfo_t *m;
-        for (m = it->meta; m; m = m->next) {
-            if (m->key[0] == '_' || m->key[0] == '!') {
-                continue; // skip reserved names
-            }
-            nm++;
-        }
-        if (fwrite (&nm, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        for (m = it->meta; m; m = m->next) {
-            if (m->key[0] == '_' || m->key[0] == '!') {
-                continue; // skip reserved names
-            }
-
-            l = strlen (m->key);
-            if (fwrite (&l, 1, 2, fp) != 2) {
-                goto save_fail;
-            }
-            if (l) {
-                if (fwrite (m->key, 1, l, fp) != l) {
-                    goto save_fail;
-                }
-            }
-            l = m->valuesize-1;
-            if (fwrite (&l, 1, 2, fp) != 2) {
-                goto save_fail;
-            }
-            if (l) {
-                if (fwrite (m->value, 1, l, fp) != l) {
-                    goto save_fail;
-                }
-            }
-        }
-    }
-
-    // write playlist metadata
-    int16_t nm = 0;
-    DB_metaInfo_t *m;
-    for (m = plt->meta; m; m = m->next) {
-        nm++;
-    }
-    if (fwrite (&nm, 1, 2, fp) != 2) {
-        goto save_fail;
-    }
-
-    for (m = plt->meta; m; m = m->next) {
-        uint16_t l;
-        l = strlen (m->key);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (l) {
-            if (fwrite (m->key, 1, l, fp) != l) {
-                goto save_fail;
-            }
-        }
-        l = strlen (m->value);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (l) {
-            if (fwrite (m->value, 1, l, fp) != l) {
-                goto save_fail;
-            }
-        }
-    }
-
-    UNLOCK;
-    fclose (fp);
-    if (rename (tempfile, fname) != 0) {
-        fprintf (stderr, "playlist rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
-        return -1;
-    }
-    return 0;
-save_fail:
+    int res = dbpl2_save (plt, fname, cb, user_data);
     UNLOCK;
-    fclose (fp);
-    unlink (tempfile);
-    return -1;
+    return res;
 }
 
 int
@@ -1874,7 +1870,7 @@ plt_save_n (int n) {
     int i;
     playlist_t *plt;
     for (i = 0, plt = playlists_head; plt && i < n; i++, plt = plt->next);
-    err = plt_save (plt, NULL, NULL, path, NULL, NULL, NULL);
+    err = dbpl2_journal_save (plt, path);
     plt_loading = 0;
     UNLOCK;
     return err;
@@ -1912,7 +1908,7 @@ pl_save_all (void) {
         if (p->last_save_modification_idx == p->modification_idx) {
             continue;
         }
-        err = plt_save (p, NULL, NULL, path, NULL, NULL, NULL);
+        err = dbpl2_journal_save (p, path);
         if (err < 0) {
             break;
         }
@@ -1974,6 +1970,10 @@ plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fn
     if (fread (&majorver, 1, 1, fp) != 1) {
         goto load_fail;
     }
+    if (majorver == DBPL2_MAJOR_VER) {
+        fclose (fp);
+        return dbpl2_load (plt, fname);
+    }
     if (majorver != PLAYLIST_MAJOR_VER) {
         trace ("bad majorver=%d\n", majorver);
         goto load_fail;
@@ -2230,11 +2230,70 @@ plt_load (playlist_t *plt, playItem_t *after, const char *fname, int *pabort, in
     return plt_load_int (0, plt, after, fname, pabort, cb, user_data);
 }
 
+#define PL_LOAD_MAX_THREADS 8
+
+typedef struct {
+    char path[PATH_MAX];
+    playlist_t *plt; // detached playlist with the tracks, or NULL if the file needs plt_load
+} pl_load_job_t;
+
+typedef struct {
+    pl_load_job_t *jobs;
+    int count;
+    int next;
+} pl_load_ctx_t;
+
+static void
+pl_load_worker (void *ctx) {
+    pl_load_ctx_t *c = ctx;
+    for (;;) {
+        int i = __atomic_fetch_add (&c->next, 1, __ATOMIC_RELAXED);
+        if (i >= c->count) {
+            break;
+        }
+        pl_load_job_t *job = &c->jobs[i];
+        if (!job->path[0]) {
+            continue;
+        }
+        playlist_t *plt = plt_alloc ("");
+        if (dbpl2_read (plt, job->path)) {
+            plt_free (plt);
+            plt = NULL;
+        }
+        job->plt = plt;
+    }
+}
+
+// reads DBPL 2.x playlists into detached playlists, on up to one thread per core
+static void
+pl_load_read_all (pl_load_job_t *jobs, int count) {
+    pl_load_ctx_t ctx = {
+        .jobs = jobs,
+        .count = count,
+    };
+    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+    int num_threads = ncpu < 1 ? 1 : (ncpu > PL_LOAD_MAX_THREADS ? PL_LOAD_MAX_THREADS : (int)ncpu);
+    if (num_threads > count) {
+        num_threads = count;
+    }
+
+    // the calling thread is one of the workers, and picks up any jobs left by threads which failed to start
+    intptr_t tids[PL_LOAD_MAX_THREADS];
+    for (int i = 1; i < num_threads; i++) {
+        tids[i] = thread_start (pl_load_worker, &ctx);
+    }
+    pl_load_worker (&ctx);
+    for (int i = 1; i < num_threads; i++) {
+        if (tids[i]) {
+            thread_join (tids[i]);
+        }
+    }
+}
+
 int
 pl_load_all (void) {
     int i = 0;
     int err = 0;
-    char path[1024];
     DB_conf_item_t *it = conf_find ("playlist.tab.", NULL);
     if (!it) {
         // legacy (0.3.3 and earlier)
@@ -2252,45 +2311,67 @@ pl_load_all (void) {
         plt_unref (plt);
         return 0;
     }
-    LOCK;
-    plt_loading = 1;
-    while (it) {
-        if (!err) {
-            if (plt_add (plt_get_count (), it->value) < 0) {
-                return -1;
-            }
-            plt_set_curr_idx (plt_get_count () - 1);
-        }
-        err = 0;
-        if (snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, i) > sizeof (path)) {
+
+    int count = 0;
+    for (DB_conf_item_t *tab = it; tab; tab = conf_find ("playlist.tab.", tab)) {
+        count++;
+    }
+    pl_load_job_t *jobs = calloc (count, sizeof (pl_load_job_t));
+    for (i = 0; i < count; i++) {
+        if (snprintf (jobs[i].path, sizeof (jobs[i].path), "%s/playlists/%d.dbpl", dbconfdir, i) >= sizeof (jobs[i].path)) {
             fprintf (stderr, "error: failed to make path string for playlist filename\n");
+            jobs[i].path[0] = 0;
             err = -1;
         }
-        else {
-            fprintf (stderr, "INFO: from file %s\n", path);
+    }
 
-            playlist_t *plt = plt_get_curr ();
-            /* playItem_t *trk = */ plt_load (plt, NULL, path, NULL, NULL, NULL);
-            char conf[100];
-            snprintf (conf, sizeof (conf), "playlist.cursor.%d", i);
-            plt->current_row[PL_MAIN] = deadbeef->conf_get_int (conf, -1);
-            snprintf (conf, sizeof (conf), "playlist.scroll.%d", i);
-            plt->scroll = deadbeef->conf_get_int (conf, 0);
-            plt->last_save_modification_idx = plt->modification_idx = 0;
-            plt_unref (plt);
+    // read the playlist files in parallel, and only lock to attach the tracks
+    pl_load_read_all (jobs, count);
 
-            if (!it) {
-                fprintf (stderr, "WARNING: there were errors while loading playlist '%s' (%s)\n", it->value, path);
-            }
+    LOCK;
+    plt_loading = 1;
+    for (i = 0; it && i < count; i++, it = conf_find ("playlist.tab.", it)) {
+        if (plt_add (plt_get_count (), it->value) < 0) {
+            err = -1;
+            break;
         }
-        it = conf_find ("playlist.tab.", it);
-        i++;
-    }
-    plt_set_curr_idx (0);
-    plt_loading = 0;
-    plt_gen_conf ();
-    messagepump_push (DB_EV_PLAYLISTSWITCHED, 0, 0, 0);
+        plt_set_curr_idx (plt_get_count () - 1);
+        if (!jobs[i].path[0]) {
+            continue;
+        }
+        fprintf (stderr, "INFO: from file %s\n", jobs[i].path);
+
+        playlist_t *plt = plt_get_curr ();
+        if (jobs[i].plt) {
+            plt_append_detached (plt, jobs[i].plt);
+            // the journal belongs to the playlist file
+            plt->journal = jobs[i].plt->journal;
+            jobs[i].plt->journal = NULL;
+        }
+        else {
+            // DBPL 1.x, which is upgraded on the next save
+            plt_load (plt, NULL, jobs[i].path, NULL, NULL, NULL);
+        }
+        char conf[100];
+        snprintf (conf, sizeof (conf), "playlist.cursor.%d", i);
+        plt->current_row[PL_MAIN] = deadbeef->conf_get_int (conf, -1);
+        snprintf (conf, sizeof (conf), "playlist.scroll.%d", i);
+        plt->scroll = deadbeef->conf_get_int (conf, 0);
+        plt->last_save_modification_idx = plt->modification_idx = 0;
+        plt_unref (plt);
+    }
+    plt_set_curr_idx (0);
+    plt_loading = 0;
+    plt_gen_conf ();
+    messagepump_push (DB_EV_PLAYLISTSWITCHED, 0, 0, 0);
     UNLOCK;
+
+    for (i = 0; i < count; i++) {
+        if (jobs[i].plt) {
+            plt_free (jobs[i].plt);
+        }
+    }
+    free (jobs);
     return err;
 }
 
@@ -3223,10 +3304,7 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
 
     playItem_t **items = malloc (cnt * sizeof(playItem_t *));
     for (int i = 0; i < cnt; i++) {
-        playItem_t *it = from->head[iter];
-        for (int idx = 0; it && idx < indices[i]; idx++) {
-            it = it->next[iter];
-        }
+        playItem_t *it = plt_get_item_for_idx (from, indices[i], iter);
         items[i] = it;
         if (!it) {
             trace ("plt_copy_items: warning: item %d not found in source plt_to\n", indices[i]);
@@ -3239,6 +3317,7 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
             pl_item_copy (new_it, items[i]);
             pl_insert_item (after, new_it);
             pl_item_unref (new_it);
+            pl_item_unref (items[i]);
             after = new_it;
         }
     }
@@ -3261,19 +3340,855 @@ plt_search_reset_int (playlist_t *playlist, int clear_selection) {
     }
     playlist->tail[PL_SEARCH] = NULL;
     playlist->count[PL_SEARCH] = 0;
+    plt_index_invalidate (playlist, PL_SEARCH);
     UNLOCK;
 }
 
 void
 plt_search_reset (playlist_t *playlist) {
+    LOCK;
     plt_search_reset_int (playlist, 1);
+    plt_search_forget (playlist);
+    UNLOCK;
+}
+
+// Search index:
+// The first search in a playlist builds an index of the distinct searchable values
+// of its tracks, deduplicated by their metacache pointers, with the slots of the tracks
+// using each value, a mask of the characters of each lowercased value, and a posting list
+// of value ids for each hashed byte trigram of the lowercased values.
+// The slots are the positions of the tracks when the index was built,
+// the posting lists and track slots are delta coded as varints.
+// A search intersects the posting lists of the trigrams of the query, verifies the remaining
+// values, and marks the tracks of the matching values in a bitmap, which is then walked
+// in playlist order. Single letters and digits are matched by the character masks alone.
+// When the query is refined (the new text contains the previous one), the values
+// which matched the previous query are verified instead, if there are fewer of them.
+// The index is kept up to date as the playlist changes: removed tracks leave an empty slot,
+// while tracks appended to the playlist, or whose searchable metadata changes, are marked stale,
+// and matched against their metadata by each search, until the next rebuild.
+// The values of the removed and changed tracks are referenced by the index until then.
+// Other changes to the order of the tracks drop the index of the playlist.
+#define PL_SEARCH_BUCKET_BITS 16
+#define PL_SEARCH_NUM_BUCKETS (1 << PL_SEARCH_BUCKET_BITS)
+#define PL_SEARCH_EXACT_CHARS 36 // bits of the character masks which belong to a single letter or digit
+#define PL_SEARCH_MAX_STALE(num_items) ((num_items) / 4 + 1024) // stale and empty slots which trigger a rebuild
+
+typedef struct pl_search_index_s {
+    playItem_t **items; // by slot, in playlist order, NULL for removed tracks, not referenced
+    int num_items;
+    int items_alloc;
+    int num_built; // slots which have values in the posting lists, the others were appended
+    int num_removed;
+
+    const char **values;
+    uint64_t *value_chars; // see _search_char_bit, all bits are set for unfiltered values
+    uint32_t num_values;
+    uint32_t *value_tracks_offsets; // num_values+1 entries
+    uint8_t *value_tracks; // slots of the tracks using each value
+
+    uint32_t *bucket_counts;
+    uint32_t *bucket_offsets; // PL_SEARCH_NUM_BUCKETS+1 entries
+    uint8_t *postings;
+
+    // values which can't be filtered, see _search_value_trigrams
+    uint32_t *unfiltered;
+    uint32_t num_unfiltered;
+
+    uint32_t *matched; // values matched by the last search
+    uint32_t num_matched;
+
+    uint64_t *stale; // bitmap of the removed slots, and the ones which are not up to date in the posting lists
+    uint32_t *pending; // stale slots, matched against the metadata of their tracks
+    int num_pending;
+    int pending_alloc;
+
+    uint32_t *slots; // hash table of the slot+1 of each track, built on the first change
+    uint32_t slots_size;
+
+    DB_metaInfo_t *retained; // copies of the metadata of the removed and changed tracks
+
+    uint64_t *track_bits; // results of the last search
+    int num_results;
+
+    playlist_t *playlist;
+    struct pl_search_index_s *next; // in search_indexes
+} pl_search_index_t;
+
+// all indexes, which are updated when the metadata of their tracks changes
+static pl_search_index_t *search_indexes;
+
+typedef struct {
+    uint32_t *buckets; // distinct buckets of the current value
+    uint32_t count;
+    uint32_t *stamps; // of the last value which added each bucket
+    uint32_t stamp;
+    uint64_t chars;
+} pl_search_trigrams_t;
+
+typedef struct {
+    const char *value;
+    uint32_t id; // UINT32_MAX for values which are never matched
+} pl_search_value_slot_t;
+
+static inline uint32_t
+_search_trigram_bucket (uint32_t window) {
+    return ((window & 0xffffff) * 2654435761u) >> (32 - PL_SEARCH_BUCKET_BITS);
+}
+
+static inline int
+_search_char_bit (uint8_t c) {
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a';
+    }
+    if (c >= '0' && c <= '9') {
+        return 26 + c - '0';
+    }
+    return PL_SEARCH_EXACT_CHARS + c % (64 - PL_SEARCH_EXACT_CHARS);
+}
+
+static inline void
+_search_trigrams_add_bytes (pl_search_trigrams_t *t, uint32_t *window, int *count, const char *s, int len) {
+    for (int i = 0; i < len; i++) {
+        t->chars |= 1ULL << _search_char_bit ((uint8_t)s[i]);
+        *window = (*window << 8) | (uint8_t)s[i];
+        if (++(*count) >= 3) {
+            uint32_t b = _search_trigram_bucket (*window);
+            if (t->stamps[b] != t->stamp) {
+                t->stamps[b] = t->stamp;
+                t->buckets[t->count++] = b;
+            }
+        }
+    }
+}
+
+// collects the trigram buckets and the character mask of the lowercased value;
+// returns -1 if the value lowercases into multi-character sequences,
+// which utfcasestr_fast matches loosely, so it can't be filtered
+static int
+_search_value_trigrams (pl_search_trigrams_t *t, const char *value) {
+    t->count = 0;
+    t->stamp++;
+    t->chars = 0;
+    uint32_t window = 0;
+    int count = 0;
+    const char *p = value;
+    while (*p) {
+        if ((uint8_t)*p < 0x80) {
+            char c = (*p >= 'A' && *p <= 'Z') ? *p + 0x20 : *p;
+            _search_trigrams_add_bytes (t, &window, &count, &c, 1);
+            p++;
+            continue;
+        }
+        int32_t i = 0;
+        char s[10];
+        u8_nextchar (p, &i);
+        int l = u8_tolower ((const signed char *)p, i, s);
+        if (l > 1) {
+            int32_t j = 0;
+            u8_nextchar (s, &j);
+            if (j < l) {
+                return -1;
+            }
+        }
+        _search_trigrams_add_bytes (t, &window, &count, s, l);
+        p += i;
+    }
+    return 0;
+}
+
+// returns the value which is matched against the search text,
+// or NULL if the search stops at this key
+static const char *
+_search_value (DB_metaInfo_t *m) {
+    int is_uri = !strcmp (m->key, ":URI");
+    if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
+        return NULL;
+    }
+    if (is_uri) {
+        const char *value = strrchr (m->value, '/');
+        if (value) {
+            return value + 1;
+        }
+    }
+    return m->value;
+}
+
+static inline uint32_t
+_varint_size (uint32_t value) {
+    uint32_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static inline uint8_t *
+_varint_put (uint8_t *p, uint32_t value) {
+    while (value >= 0x80) {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+static inline const uint8_t *
+_varint_get (const uint8_t *p, uint32_t *value) {
+    uint32_t v = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        v |= (uint32_t)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *value = v | ((uint32_t)*p++ << shift);
+    return p;
+}
+
+static void
+_search_index_free (struct pl_search_index_s *index) {
+    if (!index) {
+        return;
+    }
+    for (pl_search_index_t **p = &search_indexes; *p; p = &(*p)->next) {
+        if (*p == index) {
+            *p = index->next;
+            break;
+        }
+    }
+    free (index->items);
+    free (index->values);
+    free (index->value_chars);
+    free (index->value_tracks_offsets);
+    free (index->value_tracks);
+    free (index->bucket_counts);
+    free (index->bucket_offsets);
+    free (index->postings);
+    free (index->unfiltered);
+    free (index->matched);
+    free (index->stale);
+    free (index->pending);
+    free (index->slots);
+    while (index->retained) {
+        DB_metaInfo_t *m = index->retained;
+        index->retained = m->next;
+        metacache_remove_value (m->value, m->valuesize);
+        free (m);
+    }
+    free (index->track_bits);
+    free (index);
+}
+
+// returns the id of the value, adding it to the index if needed,
+// UINT32_MAX if it's never matched, or UINT32_MAX-1 on error
+static uint32_t
+_search_index_add_value (pl_search_index_t *index, pl_search_value_slot_t **hash, uint32_t *hash_size, uint32_t *values_alloc, const char *value) {
+    if (index->num_values * 2 >= *hash_size) {
+        uint32_t size = *hash_size ? *hash_size * 2 : 4096;
+        pl_search_value_slot_t *h = calloc (size, sizeof (pl_search_value_slot_t));
+        if (!h) {
+            return UINT32_MAX - 1;
+        }
+        for (uint32_t i = 0; i < *hash_size; i++) {
+            if ((*hash)[i].value) {
+                uint32_t k = (uint32_t)(((uintptr_t)(*hash)[i].value >> 3) * 2654435761u) & (size-1);
+                while (h[k].value) {
+                    k = (k + 1) & (size-1);
+                }
+                h[k] = (*hash)[i];
+            }
+        }
+        free (*hash);
+        *hash = h;
+        *hash_size = size;
+    }
+
+    uint32_t k = (uint32_t)(((uintptr_t)value >> 3) * 2654435761u) & (*hash_size-1);
+    while ((*hash)[k].value) {
+        if ((*hash)[k].value == value) {
+            return (*hash)[k].id;
+        }
+        k = (k + 1) & (*hash_size-1);
+    }
+
+    uint32_t id = UINT32_MAX;
+    // invalid utf8 never matches, see utfcasestr_fast
+    if (u8_valid (value, (int)strlen (value), NULL)) {
+        if (index->num_values == *values_alloc) {
+            uint32_t alloc = *values_alloc ? *values_alloc * 2 : 4096;
+            const char **values = realloc (index->values, alloc * sizeof (const char *));
+            if (!values) {
+                return UINT32_MAX - 1;
+            }
+            index->values = values;
+            *values_alloc = alloc;
+        }
+        id = index->num_values++;
+        index->values[id] = value;
+    }
+    (*hash)[k].value = value;
+    (*hash)[k].id = id;
+    return id;
+}
+
+static pl_search_index_t *
+_search_index_build (playlist_t *playlist) {
+    pl_search_index_t *index = calloc (1, sizeof (pl_search_index_t));
+    pl_search_value_slot_t *hash = NULL;
+    uint32_t hash_size = 0;
+    uint32_t values_alloc = 0;
+    uint32_t *track_values = NULL; // value ids of each track
+    uint32_t num_track_values = 0;
+    uint32_t track_values_alloc = 0;
+    uint32_t *track_first = NULL;
+    uint32_t *last = NULL;
+    uint32_t unfiltered_alloc = 0;
+    pl_search_trigrams_t t;
+    memset (&t, 0, sizeof (t));
+    if (!index) {
+        return NULL;
+    }
+
+    int n = playlist->count[PL_MAIN];
+    index->items_alloc = n ? n : 1;
+    index->items = malloc (index->items_alloc * sizeof (playItem_t *));
+    track_first = malloc ((n + 1) * sizeof (uint32_t));
+    index->track_bits = calloc ((index->items_alloc + 63) / 64, sizeof (uint64_t));
+    index->stale = calloc ((index->items_alloc + 63) / 64, sizeof (uint64_t));
+    if (!index->items || !track_first || !index->track_bits || !index->stale) {
+        goto error;
+    }
+
+    uint32_t cuesheet_atom = metacache_get_key_atom ("cuesheet");
+    uint32_t log_atom = metacache_get_key_atom ("log");
+
+    int idx = 0;
+    for (playItem_t *it = playlist->head[PL_MAIN]; it && idx < n; it = it->next[PL_MAIN], idx++) {
+        index->items[idx] = it;
+        track_first[idx] = num_track_values;
+        for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+            const char *value = _search_value (m);
+            if (!value) {
+                break;
+            }
+            uint32_t key_atom = metacache_key_atom_of (m->key);
+            if (key_atom == cuesheet_atom || key_atom == log_atom) {
+                continue;
+            }
+            uint32_t id = _search_index_add_value (index, &hash, &hash_size, &values_alloc, value);
+            if (id == UINT32_MAX - 1) {
+                goto error;
+            }
+            if (id == UINT32_MAX) {
+                continue;
+            }
+            if (num_track_values == track_values_alloc) {
+                track_values_alloc = track_values_alloc ? track_values_alloc * 2 : 16384;
+                uint32_t *tv = realloc (track_values, track_values_alloc * sizeof (uint32_t));
+                if (!tv) {
+                    goto error;
+                }
+                track_values = tv;
+            }
+            track_values[num_track_values++] = id;
+        }
+    }
+    n = index->num_items = index->num_built = idx;
+    track_first[n] = num_track_values;
+    free (hash);
+    hash = NULL;
+
+    // positions of the tracks using each value, sized by the first pass, and filled by the second one
+    uint32_t num_values = index->num_values;
+    index->value_tracks_offsets = calloc (num_values + 1, sizeof (uint32_t));
+    index->value_chars = malloc ((num_values ? num_values : 1) * sizeof (uint64_t));
+    index->matched = malloc ((num_values ? num_values : 1) * sizeof (uint32_t));
+    last = malloc ((num_values > PL_SEARCH_NUM_BUCKETS ? num_values : PL_SEARCH_NUM_BUCKETS) * sizeof (uint32_t));
+    if (!index->value_tracks_offsets || !index->value_chars || !index->matched || !last) {
+        goto error;
+    }
+    uint32_t *offsets = index->value_tracks_offsets;
+    memset (last, 0xff, num_values * sizeof (uint32_t));
+    for (int i = 0; i < n; i++) {
+        for (uint32_t k = track_first[i]; k < track_first[i + 1]; k++) {
+            uint32_t id = track_values[k];
+            if (last[id] != i) {
+                offsets[id + 1] += _varint_size (i - last[id] - 1);
+                last[id] = i;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < num_values; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    index->value_tracks = malloc (offsets[num_values] ? offsets[num_values] : 1);
+    if (!index->value_tracks) {
+        goto error;
+    }
+    // offsets[id] is used as the write position, ending up shifted by one value
+    memset (last, 0xff, num_values * sizeof (uint32_t));
+    for (int i = 0; i < n; i++) {
+        for (uint32_t k = track_first[i]; k < track_first[i + 1]; k++) {
+            uint32_t id = track_values[k];
+            if (last[id] != i) {
+                offsets[id] = (uint32_t)(_varint_put (index->value_tracks + offsets[id], i - last[id] - 1) - index->value_tracks);
+                last[id] = i;
+            }
+        }
+    }
+    memmove (offsets + 1, offsets, num_values * sizeof (uint32_t));
+    offsets[0] = 0;
+    free (track_values);
+    track_values = NULL;
+    free (track_first);
+    track_first = NULL;
+
+    // trigram posting lists, in the same way
+    index->bucket_counts = calloc (PL_SEARCH_NUM_BUCKETS, sizeof (uint32_t));
+    index->bucket_offsets = calloc (PL_SEARCH_NUM_BUCKETS + 1, sizeof (uint32_t));
+    t.buckets = malloc (PL_SEARCH_NUM_BUCKETS * sizeof (uint32_t));
+    t.stamps = calloc (PL_SEARCH_NUM_BUCKETS, sizeof (uint32_t));
+    if (!index->bucket_counts || !index->bucket_offsets || !t.buckets || !t.stamps) {
+        goto error;
+    }
+    uint32_t *bucket_offsets = index->bucket_offsets;
+    memset (last, 0xff, PL_SEARCH_NUM_BUCKETS * sizeof (uint32_t));
+    for (uint32_t id = 0; id < num_values; id++) {
+        if (_search_value_trigrams (&t, index->values[id]) < 0) {
+            if (index->num_unfiltered == unfiltered_alloc) {
+                unfiltered_alloc = unfiltered_alloc ? unfiltered_alloc * 2 : 64;
+                uint32_t *u = realloc (index->unfiltered, unfiltered_alloc * sizeof (uint32_t));
+                if (!u) {
+                    goto error;
+                }
+                index->unfiltered = u;
+            }
+            index->unfiltered[index->num_unfiltered++] = id;
+            index->value_chars[id] = UINT64_MAX;
+            continue;
+        }
+        index->value_chars[id] = t.chars;
+        for (uint32_t i = 0; i < t.count; i++) {
+            uint32_t b = t.buckets[i];
+            bucket_offsets[b + 1] += _varint_size (id - last[b] - 1);
+            last[b] = id;
+            index->bucket_counts[b]++;
+        }
+    }
+    uint64_t total = 0;
+    for (int b = 0; b < PL_SEARCH_NUM_BUCKETS; b++) {
+        total += bucket_offsets[b + 1];
+        if (total > UINT32_MAX) {
+            goto error;
+        }
+        bucket_offsets[b + 1] = (uint32_t)total;
+    }
+    index->postings = malloc (total ? total : 1);
+    if (!index->postings) {
+        goto error;
+    }
+    memset (last, 0xff, PL_SEARCH_NUM_BUCKETS * sizeof (uint32_t));
+    for (uint32_t id = 0; id < num_values; id++) {
+        if (_search_value_trigrams (&t, index->values[id]) < 0) {
+            continue;
+        }
+        for (uint32_t i = 0; i < t.count; i++) {
+            uint32_t b = t.buckets[i];
+            bucket_offsets[b] = (uint32_t)(_varint_put (index->postings + bucket_offsets[b], id - last[b] - 1) - index->postings);
+            last[b] = id;
+        }
+    }
+    memmove (bucket_offsets + 1, bucket_offsets, PL_SEARCH_NUM_BUCKETS * sizeof (uint32_t));
+    bucket_offsets[0] = 0;
+
+    free (last);
+    free (t.buckets);
+    free (t.stamps);
+    index->playlist = playlist;
+    index->next = search_indexes;
+    search_indexes = index;
+    return index;
+
+error:
+    trace_err ("plt_search: failed to build the search index\n");
+    free (hash);
+    free (track_values);
+    free (track_first);
+    free (last);
+    free (t.buckets);
+    free (t.stamps);
+    _search_index_free (index);
+    return NULL;
+}
+
+static inline uint32_t
+_search_item_hash (playItem_t *it, uint32_t size) {
+    return (uint32_t)(((uintptr_t)it >> 4) * 2654435761u) & (size-1);
+}
+
+static int
+_search_index_hash_items (pl_search_index_t *index) {
+    uint32_t size = 1024;
+    while (size < (uint32_t)index->items_alloc * 2) {
+        size *= 2;
+    }
+    uint32_t *slots = calloc (size, sizeof (uint32_t));
+    if (!slots) {
+        return -1;
+    }
+    for (int i = 0; i < index->num_items; i++) {
+        if (index->items[i]) {
+            uint32_t k = _search_item_hash (index->items[i], size);
+            while (slots[k]) {
+                k = (k + 1) & (size-1);
+            }
+            slots[k] = i + 1;
+        }
+    }
+    free (index->slots);
+    index->slots = slots;
+    index->slots_size = size;
+    return 0;
+}
+
+// returns the slot of the track, -1 if it's not in the index, or -2 on error
+static int
+_search_index_find (pl_search_index_t *index, playItem_t *it) {
+    if (!index->slots && _search_index_hash_items (index) < 0) {
+        return -2;
+    }
+    // the entries of the removed tracks are kept, and skipped
+    uint32_t k = _search_item_hash (it, index->slots_size);
+    while (index->slots[k]) {
+        if (index->items[index->slots[k] - 1] == it) {
+            return index->slots[k] - 1;
+        }
+        k = (k + 1) & (index->slots_size-1);
+    }
+    return -1;
+}
+
+// keep the values of the track, which are in the posting lists, until the index is freed
+static int
+_search_index_retain (pl_search_index_t *index, playItem_t *it) {
+    for (DB_metaInfo_t *m = it->meta; m && _search_value (m); m = m->next) {
+        DB_metaInfo_t *r = malloc (sizeof (DB_metaInfo_t));
+        if (!r) {
+            return -1;
+        }
+        metacache_ref (m->value);
+        r->key = NULL;
+        r->value = m->value;
+        r->valuesize = m->valuesize;
+        r->next = index->retained;
+        index->retained = r;
+    }
+    return 0;
+}
+
+// returns -1 if the index should be rebuilt instead
+static int
+_search_index_mark_stale (pl_search_index_t *index, int slot) {
+    uint64_t bit = 1ULL << (slot & 63);
+    if (index->stale[slot >> 6] & bit) {
+        return 0;
+    }
+    if (index->num_pending + index->num_removed >= PL_SEARCH_MAX_STALE (index->num_items)) {
+        return -1;
+    }
+    if (slot < index->num_built && _search_index_retain (index, index->items[slot]) < 0) {
+        return -1;
+    }
+    if (index->num_pending == index->pending_alloc) {
+        int alloc = index->pending_alloc ? index->pending_alloc * 2 : 64;
+        uint32_t *pending = realloc (index->pending, alloc * sizeof (uint32_t));
+        if (!pending) {
+            return -1;
+        }
+        index->pending = pending;
+        index->pending_alloc = alloc;
+    }
+    index->stale[slot >> 6] |= bit;
+    index->pending[index->num_pending++] = slot;
+    return 0;
+}
+
+static int
+_search_index_grow (pl_search_index_t *index) {
+    int alloc = index->items_alloc * 2;
+    size_t words = (index->items_alloc + 63) / 64;
+    size_t new_words = (alloc + 63) / 64;
+    playItem_t **items = realloc (index->items, alloc * sizeof (playItem_t *));
+    if (!items) {
+        return -1;
+    }
+    index->items = items;
+    uint64_t *track_bits = realloc (index->track_bits, new_words * sizeof (uint64_t));
+    if (!track_bits) {
+        return -1;
+    }
+    memset (track_bits + words, 0, (new_words - words) * sizeof (uint64_t));
+    index->track_bits = track_bits;
+    uint64_t *stale = realloc (index->stale, new_words * sizeof (uint64_t));
+    if (!stale) {
+        return -1;
+    }
+    memset (stale + words, 0, (new_words - words) * sizeof (uint64_t));
+    index->stale = stale;
+    index->items_alloc = alloc;
+    if (index->slots) {
+        return _search_index_hash_items (index);
+    }
+    return 0;
+}
+
+void
+plt_search_index_invalidate (playlist_t *plt) {
+    LOCK;
+    _search_index_free (plt->search_index);
+    plt->search_index = NULL;
+    UNLOCK;
+}
+
+// must be called after the track is linked into the playlist
+static void
+plt_search_index_inserted (playlist_t *plt, playItem_t *it) {
+    pl_search_index_t *index = plt->search_index;
+    if (!index) {
+        return;
+    }
+    // the slots follow the playlist order, so only appended tracks can get a new one
+    if (it != plt->tail[PL_MAIN]
+        || (index->num_items == index->items_alloc && _search_index_grow (index) < 0)) {
+        plt_search_index_invalidate (plt);
+        return;
+    }
+    int slot = index->num_items++;
+    index->items[slot] = it;
+    if (index->slots) {
+        uint32_t k = _search_item_hash (it, index->slots_size);
+        while (index->slots[k]) {
+            k = (k + 1) & (index->slots_size-1);
+        }
+        index->slots[k] = slot + 1;
+    }
+    if (_search_index_mark_stale (index, slot) < 0) {
+        plt_search_index_invalidate (plt);
+    }
+}
+
+// must be called before the track is unlinked from the playlist
+static void
+plt_search_index_will_remove (playlist_t *plt, playItem_t *it) {
+    pl_search_index_t *index = plt->search_index;
+    if (!index) {
+        return;
+    }
+    int slot = _search_index_find (index, it);
+    if (slot < 0 || index->num_pending + index->num_removed >= PL_SEARCH_MAX_STALE (index->num_items)) {
+        plt_search_index_invalidate (plt);
+        return;
+    }
+    if (slot < index->num_built && !(index->stale[slot >> 6] & (1ULL << (slot & 63)))
+        && _search_index_retain (index, it) < 0) {
+        plt_search_index_invalidate (plt);
+        return;
+    }
+    index->items[slot] = NULL;
+    index->num_removed++;
+    // the track is also removed from the search results
+    uint64_t bit = 1ULL << (slot & 63);
+    index->stale[slot >> 6] |= bit;
+    if (index->track_bits[slot >> 6] & bit) {
+        index->track_bits[slot >> 6] &= ~bit;
+        index->num_results--;
+    }
+}
+
+void
+pl_search_index_item_will_change (playItem_t *it) {
+    LOCK;
+    pl_search_index_t *next;
+    for (pl_search_index_t *index = search_indexes; index; index = next) {
+        next = index->next;
+        int slot = _search_index_find (index, it);
+        if (slot == -2 || (slot >= 0 && _search_index_mark_stale (index, slot) < 0)) {
+            plt_search_index_invalidate (index->playlist);
+        }
+    }
+    UNLOCK;
+}
+
+static void
+plt_search_append (playlist_t *playlist, playItem_t *it, int select_results) {
+    it->next[PL_SEARCH] = NULL;
+    it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
+    if (playlist->tail[PL_SEARCH]) {
+        playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
+        playlist->tail[PL_SEARCH] = it;
+    }
+    else {
+        playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
+    }
+    if (select_results) {
+        pl_set_selected_in_playlist(playlist, it, 1);
+    }
+    playlist->count[PL_SEARCH]++;
+}
+
+// same as utfcasestr_fast for an ascii search text;
+// returns -1 if the value is not ascii, and the slow path is needed
+static int
+_search_ascii (const char *value, const char *lc, int lc_len) {
+    for (const char *p = value; *p; p++) {
+        if ((uint8_t)*p >= 0x80) {
+            return -1;
+        }
+        int i;
+        for (i = 0; i < lc_len; i++) {
+            char c = p[i];
+            if (c >= 'A' && c <= 'Z') {
+                c += 0x20;
+            }
+            if (c != lc[i]) {
+                break;
+            }
+        }
+        if (i == lc_len) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    const char *lc;
+    int lc_len;
+    int lc_is_ascii;
+    uint64_t chars; // character mask of the search text
+    int exact; // the search text is a single letter or digit
+} pl_search_query_t;
+
+static inline int
+_search_match_text (const char *value, const pl_search_query_t *q) {
+    int res = q->lc_is_ascii ? _search_ascii (value, q->lc, q->lc_len) : -1;
+    if (res >= 0) {
+        return res;
+    }
+    return utfcasestr_fast (value, q->lc) != NULL;
+}
+
+static inline int
+_search_match_value (pl_search_index_t *index, uint32_t id, const pl_search_query_t *q) {
+    uint64_t chars = index->value_chars[id];
+    if ((chars & q->chars) != q->chars) {
+        return 0;
+    }
+    if (q->exact && chars != UINT64_MAX) {
+        return 1;
+    }
+    return _search_match_text (index->values[id], q);
+}
+
+// matches the current metadata of a stale track, skipping the same values as _search_index_build
+static int
+_search_match_track (playItem_t *it, const pl_search_query_t *q, uint32_t cuesheet_atom, uint32_t log_atom) {
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        const char *value = _search_value (m);
+        if (!value) {
+            break;
+        }
+        uint32_t key_atom = metacache_key_atom_of (m->key);
+        if (key_atom == cuesheet_atom || key_atom == log_atom) {
+            continue;
+        }
+        if (_search_match_text (value, q) && u8_valid (value, (int)strlen (value), NULL)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// returns the buckets of the trigrams of the search text, and the index of the one with the shortest posting list
+static int
+_search_index_query_buckets (pl_search_index_t *index, const char *lc, int lc_len, uint32_t *buckets, int *shortest) {
+    int num_buckets = 0;
+    uint32_t window = 0;
+    *shortest = 0;
+    for (int i = 0; i < lc_len; i++) {
+        window = (window << 8) | (uint8_t)lc[i];
+        if (i >= 2) {
+            uint32_t b = _search_trigram_bucket (window);
+            if (num_buckets && index->bucket_counts[b] < index->bucket_counts[buckets[*shortest]]) {
+                *shortest = num_buckets;
+            }
+            buckets[num_buckets++] = b;
+        }
+    }
+    return num_buckets;
+}
+
+// collects the ids of the values which may contain all trigrams of the search text into index->matched,
+// returns their number
+static uint32_t
+_search_index_candidates (pl_search_index_t *index, const uint32_t *buckets, int num_buckets, int shortest) {
+    uint32_t count = 0;
+    uint32_t id = UINT32_MAX;
+    uint32_t b = buckets[shortest];
+    const uint8_t *p = index->postings + index->bucket_offsets[b];
+    const uint8_t *end = index->postings + index->bucket_offsets[b + 1];
+    while (p < end) {
+        uint32_t delta;
+        p = _varint_get (p, &delta);
+        id += delta + 1;
+        index->matched[count++] = id;
+    }
+
+    // intersect with the other lists, unless they're much longer than the candidates
+    for (int i = 0; i < num_buckets && count; i++) {
+        b = buckets[i];
+        if (b == buckets[shortest] || index->bucket_counts[b] > count * 16) {
+            continue;
+        }
+        p = index->postings + index->bucket_offsets[b];
+        end = index->postings + index->bucket_offsets[b + 1];
+        id = UINT32_MAX;
+        uint32_t k = 0;
+        uint32_t n = 0;
+        while (p < end && k < count) {
+            uint32_t delta;
+            p = _varint_get (p, &delta);
+            id += delta + 1;
+            while (k < count && index->matched[k] < id) {
+                k++;
+            }
+            if (k < count && index->matched[k] == id) {
+                index->matched[n++] = id;
+                k++;
+            }
+        }
+        count = n;
+    }
+
+    for (uint32_t i = 0; i < index->num_unfiltered; i++) {
+        index->matched[count++] = index->unfiltered[i];
+    }
+    return count;
+}
+
+void
+plt_search_forget (playlist_t *playlist) {
+    LOCK;
+    free (playlist->search_text);
+    playlist->search_text = NULL;
+    UNLOCK;
 }
 
 // FIXME: multivalue support
 void
 plt_search_process2 (playlist_t *playlist, const char *text, int select_results) {
     LOCK;
-    plt_search_reset_int (playlist, select_results);
 
     // convert text to lowercase, to save some cycles
     char lc[1000];
@@ -3295,82 +4210,142 @@ plt_search_process2 (playlist_t *playlist, const char *text, int select_results)
     }
     *out = 0;
 
-    int lc_is_valid_u8 = u8_valid (lc, (int)strlen (lc), NULL);
-
-    static int cmpidx = 0;
-    cmpidx++;
-    if (cmpidx > 127) {
-        cmpidx = 1;
+    pl_search_index_t *index = playlist->search_index;
+    if (index && index->num_items - index->num_removed != playlist->count[PL_MAIN]) {
+        // changed in a way which wasn't tracked
+        plt_search_index_invalidate (playlist);
+        index = NULL;
+    }
+
+    // a refined query can only match a subset of the values matched by the previous one
+    int refined = index && *text && playlist->search_text && strstr (lc, playlist->search_text);
+
+    // unlink the previous results through the index, which doesn't need to wait for
+    // each track to be loaded before the next one, unlike walking the list
+    if (index && index->num_results && index->num_results == playlist->count[PL_SEARCH]) {
+        uint64_t *bits = index->track_bits;
+        int num_words = (index->num_items + 63) / 64;
+        for (int w = 0; w < num_words; w++) {
+            uint64_t word = bits[w];
+            while (word) {
+                playItem_t *it = index->items[w * 64 + __builtin_ctzll (word)];
+                if (select_results) {
+                    pl_set_selected_in_playlist (playlist, it, 0);
+                }
+                it->next[PL_SEARCH] = NULL;
+                it->prev[PL_SEARCH] = NULL;
+                word &= word - 1;
+            }
+        }
+        playlist->head[PL_SEARCH] = NULL;
+    }
+    plt_search_reset_int (playlist, select_results);
+    if (index) {
+        index->num_results = 0;
     }
 
-    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
-        if (select_results) {
+    free (playlist->search_text);
+    playlist->search_text = NULL;
+
+    if (select_results) {
+        for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
             pl_set_selected_in_playlist(playlist, it, 0);
         }
-        if (*text) {
-            DB_metaInfo_t *m = NULL;
-            for (m = it->meta; m; m = m->next) {
-                int is_uri = !strcmp (m->key, ":URI");
-                if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
-                    break;
-                }
-                const char *value = m->value;
-                if (is_uri) {
-                    value = strrchr (value, '/');
-                    if (value) {
-                        value++;
-                    }
-                    else {
-                        value = m->value;
-                    }
-                }
-                if (strcasecmp(m->key, "cuesheet") && strcasecmp (m->key, "log")) {
-                    char cmp = *(m->value-1);
-
-                    if (abs (cmp) == cmpidx) {
-                        if (cmp > 0) {
-                            it->next[PL_SEARCH] = NULL;
-                            it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
-                            if (playlist->tail[PL_SEARCH]) {
-                                playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
-                                playlist->tail[PL_SEARCH] = it;
-                            }
-                            else {
-                                playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
-                            }
-                            if (select_results) {
-                                pl_set_selected_in_playlist(playlist, it, 1);
-                            }
-                            playlist->count[PL_SEARCH]++;
-                            break;
-                        }
-                    }
-                    else if (lc_is_valid_u8 && u8_valid(value, (int)strlen(value), NULL) && utfcasestr_fast (value, lc)) {
-                        //fprintf (stderr, "%s -> %s match (%s.%s)\n", text, value, pl_find_meta_raw (it, ":URI"), m->key);
-                        // add to list
-                        it->next[PL_SEARCH] = NULL;
-                        it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
-                        if (playlist->tail[PL_SEARCH]) {
-                            playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
-                            playlist->tail[PL_SEARCH] = it;
-                        }
-                        else {
-                            playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
-                        }
-                        if (select_results) {
-                            pl_set_selected_in_playlist(playlist, it, 1);
-                        }
-                        playlist->count[PL_SEARCH]++;
-                        *((char *)m->value-1) = cmpidx;
-                        break;
-                    }
-                    else {
-                        *((char *)m->value-1) = -cmpidx;
-                    }
-                }
+    }
+
+    int lc_len = (int)strlen (lc);
+    // invalid utf8 never matches
+    if (!*text || !u8_valid (lc, lc_len, NULL)) {
+        UNLOCK;
+        return;
+    }
+
+    if (!index) {
+        index = playlist->search_index = _search_index_build (playlist);
+        if (!index) {
+            UNLOCK;
+            return;
+        }
+    }
+
+    pl_search_query_t q = {
+        .lc = lc,
+        .lc_len = lc_len,
+        .lc_is_ascii = 1,
+    };
+    for (int i = 0; i < lc_len; i++) {
+        if ((uint8_t)lc[i] >= 0x80) {
+            q.lc_is_ascii = 0;
+        }
+        q.chars |= 1ULL << _search_char_bit ((uint8_t)lc[i]);
+    }
+    q.exact = lc_len == 1 && _search_char_bit ((uint8_t)lc[0]) < PL_SEARCH_EXACT_CHARS;
+
+    // the candidates are either all values, or a list of value ids in index->matched,
+    // where the matching ones are collected in place
+    uint32_t num_candidates = index->num_values;
+    int from_list = 0;
+    uint32_t buckets[lc_len];
+    int shortest = 0;
+    int num_buckets = _search_index_query_buckets (index, lc, lc_len, buckets, &shortest);
+    if (num_buckets && (!refined || index->bucket_counts[buckets[shortest]] + index->num_unfiltered < index->num_matched)) {
+        num_candidates = _search_index_candidates (index, buckets, num_buckets, shortest);
+        from_list = 1;
+    }
+    else if (refined) {
+        num_candidates = index->num_matched;
+        from_list = 1;
+    }
+    uint32_t num_matched = 0;
+    for (uint32_t i = 0; i < num_candidates; i++) {
+        uint32_t id = from_list ? index->matched[i] : i;
+        if (i + 16 < num_candidates) {
+            __builtin_prefetch (index->values[from_list ? index->matched[i + 16] : i + 16]);
+        }
+        if (_search_match_value (index, id, &q)) {
+            index->matched[num_matched++] = id;
+        }
+    }
+    index->num_matched = num_matched;
+    playlist->search_text = strdup (lc);
+
+    uint64_t *bits = index->track_bits;
+    int num_words = (index->num_items + 63) / 64;
+    memset (bits, 0, num_words * sizeof (uint64_t));
+    for (uint32_t i = 0; i < num_matched; i++) {
+        uint32_t id = index->matched[i];
+        const uint8_t *p = index->value_tracks + index->value_tracks_offsets[id];
+        const uint8_t *end = index->value_tracks + index->value_tracks_offsets[id + 1];
+        uint32_t pos = UINT32_MAX;
+        while (p < end) {
+            uint32_t delta;
+            p = _varint_get (p, &delta);
+            pos += delta + 1;
+            bits[pos >> 6] |= 1ULL << (pos & 63);
+        }
+    }
+    if (index->num_pending || index->num_removed) {
+        uint32_t cuesheet_atom = metacache_get_key_atom ("cuesheet");
+        uint32_t log_atom = metacache_get_key_atom ("log");
+        for (int w = 0; w < num_words; w++) {
+            bits[w] &= ~index->stale[w];
+        }
+        for (int i = 0; i < index->num_pending; i++) {
+            uint32_t slot = index->pending[i];
+            playItem_t *it = index->items[slot];
+            if (it && _search_match_track (it, &q, cuesheet_atom, log_atom)) {
+                bits[slot >> 6] |= 1ULL << (slot & 63);
             }
         }
     }
+    for (int w = 0; w < num_words; w++) {
+        uint64_t word = bits[w];
+        while (word) {
+            plt_search_append (playlist, index->items[w * 64 + __builtin_ctzll (word)], select_results);
+            word &= word - 1;
+        }
+    }
+    index->num_results = playlist->count[PL_SEARCH];
     UNLOCK;
 }
 
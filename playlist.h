@@ -54,6 +54,8 @@ typedef struct playItem_s {
     struct playItem_s *next[PL_MAX_ITERATORS]; // next item in linked list
     struct playItem_s *prev[PL_MAX_ITERATORS]; // prev item in linked list
     struct DB_metaInfo_s *meta; // linked list storing metainfo
+    int _index[PL_MAX_ITERATORS]; // position in the owning playlist's random access index
+    uint32_t _modification_idx; // unique stamp, changed whenever the metadata changes, see pl_item_modified
     unsigned selected : 1;
     unsigned played : 1; // mark as played in shuffle mode
     unsigned in_playlist : 1; // 1 if item is in playlist
@@ -71,9 +73,15 @@ typedef struct playlist_s {
     int last_save_modification_idx;
     playItem_t *head[PL_MAX_ITERATORS]; // head of linked list
     playItem_t *tail[PL_MAX_ITERATORS]; // tail of linked list
+    playItem_t **index[PL_MAX_ITERATORS]; // random access index, filled lazily from head
+    int index_size[PL_MAX_ITERATORS]; // allocated size of index
+    int index_valid[PL_MAX_ITERATORS]; // number of leading index entries matching the linked list
     int current_row[PL_MAX_ITERATORS]; // current row (cursor)
+    char *search_text; // lowercase text of the last search, used to narrow down refined searches
+    struct pl_search_index_s *search_index; // built by plt_search_process2
     int scroll;
     struct DB_metaInfo_s *meta; // linked list storing metainfo
+    struct dbpl2_journal_s *journal; // changes since the last save of the playlist file, see dbpl.c
     int refc;
     int files_add_visibility;
 
@@ -101,6 +109,10 @@ pl_lock (void);
 void
 pl_unlock (void);
 
+// returns 1 if pl_lock is held by the calling thread
+int
+pl_is_locked (void);
+
 //void
 //plt_lock (void);
 //
@@ -211,6 +223,11 @@ pl_insert_item (playItem_t *after, playItem_t *it);
 playItem_t *
 plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it);
 
+// Moves all tracks and metadata from a detached playlist, which is not in the playlist list,
+// to the end of the playlist. Returns the last moved track, or NULL if there were none
+playItem_t *
+plt_append_detached (playlist_t *playlist, playlist_t *from);
+
 int
 plt_remove_item (playlist_t *playlist, playItem_t *it);
 
@@ -256,6 +273,11 @@ plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter);
 int
 pl_get_idx_of (playItem_t *it);
 
+// must be called after relinking the list of the specified iterator
+// directly, instead of through plt_insert_item / plt_remove_item
+void
+plt_index_invalidate (playlist_t *plt, int iter);
+
 int
 pl_get_idx_of_iter (playItem_t *it, int iter);
 
@@ -451,6 +473,14 @@ plt_search_process (playlist_t *plt, const char *text);
 void
 plt_search_process2 (playlist_t *plt, const char *text, int select_results);
 
+// forget the last search text, so that the next search scans the whole playlist
+void
+plt_search_forget (playlist_t *plt);
+
+// drop the search index, after the order of the tracks changed
+void
+plt_search_index_invalidate (playlist_t *plt);
+
 void
 plt_sort (playlist_t *plt, int iter, int id, const char *format, int order);
 
@@ -565,9 +595,26 @@ pl_configchanged (void);
 DB_metaInfo_t *
 pl_meta_for_key (playItem_t *it, const char *key);
 
+// atom is a key atom returned by metacache_get_key_atom / metacache_add_key_atom
+DB_metaInfo_t *
+pl_meta_for_atom (playItem_t *it, uint32_t atom);
+
 void
 pl_meta_free_values (DB_metaInfo_t *meta);
 
+// update the search indexes which contain the track, before its searchable metadata changes,
+// while the old values are still referenced by the track
+void
+pl_search_index_item_will_change (playItem_t *it);
+
+// assign a new modification stamp to the track, invalidating its cached title formatting results
+void
+pl_item_modified (playItem_t *it);
+
+// the most recently assigned track modification stamp
+uint32_t
+pl_get_item_modification_idx (void);
+
 void
 pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta);
 
@@ -25,6 +25,12 @@
   Alexey Yakovenko waker@users.sourceforge.net
 */
 
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#ifdef HAVE_ALLOCA_H
+#  include <alloca.h>
+#endif
 #include <string.h>
 #include <stdlib.h>
 #include "playlist.h"
@@ -34,13 +40,71 @@
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
 
+// source of track modification stamps, unique across all tracks,
+// so that caches keyed by track pointer never mistake a new track for a freed one
+static uint32_t pl_item_modification_idx;
+
+void
+pl_item_modified (playItem_t *it) {
+    // atomic, since tracks are also allocated by the playlist loader threads without pl_lock
+    it->_modification_idx = __atomic_add_fetch (&pl_item_modification_idx, 1, __ATOMIC_RELAXED);
+}
+
+uint32_t
+pl_get_item_modification_idx (void) {
+    return __atomic_load_n (&pl_item_modification_idx, __ATOMIC_RELAXED);
+}
+
+// bump the modification stamp used by the title formatting cache, and update the search indexes,
+// which must happen before an old value is released, adding values can be reported afterwards;
+// properties other than :URI are never searched, and tracks which are not in a playlist yet
+// are added to the indexes when they're inserted
+static void
+_meta_will_change (playItem_t *it, const char *key) {
+    pl_item_modified (it);
+    if (!it->in_playlist || (key[0] == ':' && strcmp (key, ":URI")) || key[0] == '_' || key[0] == '!') {
+        return;
+    }
+    pl_search_index_item_will_change (it);
+}
+
+// item metadata keys are interned as key atoms (see metacache_add_key),
+// so that lookups compare integers instead of calling strcasecmp
+static inline int
+_meta_key_matches (DB_metaInfo_t *m, uint32_t atom, const char *key) {
+    uint32_t m_atom = metacache_key_atom_of (m->key);
+    if (m_atom) {
+        return m_atom == atom;
+    }
+    return !strcasecmp (key, m->key);
+}
+
+DB_metaInfo_t *
+pl_meta_for_atom (playItem_t *it, uint32_t atom) {
+    pl_ensure_lock ();
+    if (!atom) {
+        return NULL;
+    }
+    DB_metaInfo_t *m = it->meta;
+    while (m) {
+        if (metacache_key_atom_of (m->key) == atom) {
+            return m;
+        }
+        m = m->next;
+    }
+    return NULL;
+}
 
 DB_metaInfo_t *
 pl_meta_for_key (playItem_t *it, const char *key) {
     pl_ensure_lock ();
+    uint32_t atom = metacache_get_key_atom (key);
+    if (!atom) {
+        return NULL;
+    }
     DB_metaInfo_t *m = it->meta;
     while (m) {
-        if (!strcasecmp (key, m->key)) {
+        if (_meta_key_matches (m, atom, key)) {
             return m;
         }
         m = m->next;
@@ -62,8 +126,9 @@ pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
     DB_metaInfo_t *propstart = NULL;
     DB_metaInfo_t *tail = NULL;
     DB_metaInfo_t *m = it->meta;
+    uint32_t atom = metacache_add_key_atom (key);
     while (m) {
-        if (!strcasecmp (key, m->key)) {
+        if (_meta_key_matches (m, atom, key)) {
             // duplicate key
             return NULL;
         }
@@ -81,7 +146,7 @@ pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
     }
     // add
     m = calloc (1, sizeof (DB_metaInfo_t));
-    m->key = metacache_add_string (key);
+    m->key = metacache_add_key (key);
 
     if (key[0] == ':' || key[0] == '_' || key[0] == '!') {
         if (tail) {
@@ -162,6 +227,7 @@ pl_add_meta_full (playItem_t *it, const char *key, const char *value, int values
     }
 
     _meta_set_value (meta, value, valuesize);
+    _meta_will_change (it, key);
 }
 
 void
@@ -225,6 +291,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
 
     if (!m->value) {
         _meta_set_value (m, value, size);
+        _meta_will_change (it, key);
         pl_unlock ();
         return;
     }
@@ -237,6 +304,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
         return;
     }
 
+    _meta_will_change (it, key);
     metacache_remove_value (m->value, m->valuesize);
     m->value = metacache_add_value (buf, buflen);
     m->valuesize = (int)buflen;
@@ -256,6 +324,7 @@ pl_replace_meta (playItem_t *it, const char *key, const char *value) {
     DB_metaInfo_t *m = pl_meta_for_key (it, key);
 
     if (m) {
+        _meta_will_change (it, key);
         pl_meta_free_values (m);
         int l = (int)strlen (value) + 1;
         m->value = metacache_add_value(value, l);
@@ -293,10 +362,16 @@ pl_set_meta_float (playItem_t *it, const char *key, float value) {
 void
 pl_delete_meta (playItem_t *it, const char *key) {
     pl_lock ();
+    uint32_t atom = metacache_get_key_atom (key);
+    if (!atom) {
+        pl_unlock ();
+        return;
+    }
     DB_metaInfo_t *prev = NULL;
     DB_metaInfo_t *m = it->meta;
     while (m) {
-        if (!strcasecmp (key, m->key)) {
+        if (_meta_key_matches (m, atom, key)) {
+            _meta_will_change (it, m->key);
             if (prev) {
                 prev->next = m->next;
             }
@@ -317,26 +392,21 @@ pl_delete_meta (playItem_t *it, const char *key) {
 const char *
 pl_find_meta (playItem_t *it, const char *key) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
 
     if (key && key[0] == ':') {
         // try to find an override
-        while (m) {
-            if (m->key[0] == '!' && !strcasecmp (key+1, m->key+1)) {
-                return m->value;
-            }
-            m = m->next;
-        }
-    }
-
-    m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
+        size_t len = strlen (key);
+        char *override = alloca (len + 1);
+        memcpy (override, key, len + 1);
+        override[0] = '!';
+        DB_metaInfo_t *m = pl_meta_for_atom (it, metacache_get_key_atom (override));
+        if (m) {
             return m->value;
         }
-        m = m->next;
     }
-    return NULL;
+
+    DB_metaInfo_t *m = pl_meta_for_key (it, key);
+    return m ? m->value : NULL;
 }
 
 const char *
@@ -384,6 +454,7 @@ pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
     DB_metaInfo_t *m = it->meta;
     while (m) {
         if (m == meta) {
+            _meta_will_change (it, m->key);
             if (prev) {
                 prev->next = m->next;
             }
@@ -412,6 +483,7 @@ pl_delete_all_meta (playItem_t *it) {
             prev = m;
         }
         else {
+            _meta_will_change (it, m->key);
             if (prev) {
                 prev->next = next;
             }
@@ -475,4 +547,5 @@ pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta) {
 
     m->value = metacache_add_value (meta->value, meta->valuesize);
     m->valuesize = meta->valuesize;
+    _meta_will_change (it, meta->key);
 }
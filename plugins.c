@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #ifndef __linux__
 #define _POSIX_C_SOURCE 1
@@ -47,6 +48,8 @@
 #include "playlist.h"
 #include "volume.h"
 #include "streamer.h"
+#include "vis.h"
+#include "seektable.h"
 #include "common.h"
 #include "conf.h"
 #include "junklib.h"
@@ -128,6 +131,188 @@ static DB_playlist_t *g_playlist_plugins[MAX_PLAYLIST_PLUGINS+1];
 static uintptr_t background_jobs_mutex;
 static int num_background_jobs;
 
+// message dispatch
+// plugins which never called plug_message_subscribe receive all messages,
+// others only receive the subscribed ids, and ids outside of the mask ranges.
+#define MSG_MASK_SLOTS 64
+#define MSG_SLOT_OTHER (MSG_MASK_SLOTS * 2)
+#define MSG_NUM_SLOTS (MSG_SLOT_OTHER + 1)
+#define MSG_SLOW_HANDLER_MS 100
+
+typedef struct {
+    DB_plugin_t *plugin;
+    int subscribed;
+    uint64_t mask[2]; // DB_EV_NEXT.. and DB_EV_FIRST..
+    // time spent in the message callback
+    uint64_t calls;
+    uint64_t total_us;
+    uint64_t max_us;
+} plug_msg_t;
+
+static plug_msg_t g_msg_plugins[MAX_PLUGINS];
+static int g_num_msg_plugins;
+static int msg_dispatch_dirty = 1;
+
+// per-slot subscriber lists, only accessed from the dispatching thread
+static int msg_dispatch_first[MSG_NUM_SLOTS+1];
+static plug_msg_t **msg_dispatch_list;
+
+static int
+msg_slot (uint32_t id) {
+    if (id < MSG_MASK_SLOTS) {
+        return id;
+    }
+    if (id >= DB_EV_FIRST && id < DB_EV_FIRST + MSG_MASK_SLOTS) {
+        return MSG_MASK_SLOTS + id - DB_EV_FIRST;
+    }
+    return MSG_SLOT_OTHER;
+}
+
+static void
+plug_message_invalidate (void) {
+    __atomic_store_n (&msg_dispatch_dirty, 1, __ATOMIC_RELEASE);
+}
+
+// must be called with pl_lock held
+static plug_msg_t *
+plug_msg_get (DB_plugin_t *plugin, int create) {
+    for (int i = 0; i < g_num_msg_plugins; i++) {
+        if (g_msg_plugins[i].plugin == plugin) {
+            return &g_msg_plugins[i];
+        }
+    }
+    if (!create || g_num_msg_plugins >= MAX_PLUGINS) {
+        return NULL;
+    }
+    plug_msg_t *pm = &g_msg_plugins[g_num_msg_plugins++];
+    memset (pm, 0, sizeof (plug_msg_t));
+    pm->plugin = plugin;
+    return pm;
+}
+
+static void
+plug_msg_remove (DB_plugin_t *plugin) {
+    pl_lock ();
+    for (int i = 0; i < g_num_msg_plugins; i++) {
+        if (g_msg_plugins[i].plugin == plugin) {
+            memmove (&g_msg_plugins[i], &g_msg_plugins[i+1], (g_num_msg_plugins-i-1) * sizeof (plug_msg_t));
+            g_num_msg_plugins--;
+            break;
+        }
+    }
+    plug_message_invalidate ();
+    pl_unlock ();
+}
+
+static void
+plug_message_set_mask (DB_plugin_t *plugin, const uint32_t *ids, int count, int subscribe) {
+    pl_lock ();
+    plug_msg_t *pm = plug_msg_get (plugin, 1);
+    if (pm) {
+        pm->subscribed = 1;
+        for (int i = 0; i < count; i++) {
+            int slot = msg_slot (ids[i]);
+            if (slot == MSG_SLOT_OTHER) {
+                continue;
+            }
+            uint64_t bit = 1ULL << (slot % MSG_MASK_SLOTS);
+            if (subscribe) {
+                pm->mask[slot / MSG_MASK_SLOTS] |= bit;
+            }
+            else {
+                pm->mask[slot / MSG_MASK_SLOTS] &= ~bit;
+            }
+        }
+        plug_message_invalidate ();
+    }
+    pl_unlock ();
+}
+
+void
+plug_message_subscribe (DB_plugin_t *plugin, const uint32_t *ids, int count) {
+    plug_message_set_mask (plugin, ids, count, 1);
+}
+
+void
+plug_message_unsubscribe (DB_plugin_t *plugin, const uint32_t *ids, int count) {
+    plug_message_set_mask (plugin, ids, count, 0);
+}
+
+static void
+plug_message_rebuild (void) {
+    pl_lock ();
+    __atomic_store_n (&msg_dispatch_dirty, 0, __ATOMIC_RELAXED);
+
+    plug_msg_t *subs[MAX_PLUGINS];
+    int nsubs = 0;
+    for (int i = 0; g_plugins[i]; i++) {
+        if (g_plugins[i]->message) {
+            plug_msg_t *pm = plug_msg_get (g_plugins[i], 1);
+            if (pm) {
+                subs[nsubs++] = pm;
+            }
+        }
+    }
+
+    free (msg_dispatch_list);
+    msg_dispatch_list = malloc (MSG_NUM_SLOTS * (nsubs + 1) * sizeof (plug_msg_t *));
+    int n = 0;
+    for (int slot = 0; slot < MSG_NUM_SLOTS; slot++) {
+        msg_dispatch_first[slot] = n;
+        if (!msg_dispatch_list) {
+            continue;
+        }
+        for (int i = 0; i < nsubs; i++) {
+            plug_msg_t *pm = subs[i];
+            if (slot == MSG_SLOT_OTHER || !pm->subscribed || (pm->mask[slot / MSG_MASK_SLOTS] & (1ULL << (slot % MSG_MASK_SLOTS)))) {
+                msg_dispatch_list[n++] = pm;
+            }
+        }
+    }
+    msg_dispatch_first[MSG_NUM_SLOTS] = n;
+    pl_unlock ();
+}
+
+void
+plug_message_dispatch (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    if (__atomic_load_n (&msg_dispatch_dirty, __ATOMIC_ACQUIRE)) {
+        plug_message_rebuild ();
+    }
+    int slot = msg_slot (id);
+    for (int i = msg_dispatch_first[slot]; i < msg_dispatch_first[slot+1]; i++) {
+        plug_msg_t *pm = msg_dispatch_list[i];
+        // monotonic, so that clock adjustments don't show up as slow handlers
+        struct timespec tm1, tm2;
+        clock_gettime (CLOCK_MONOTONIC, &tm1);
+        pm->plugin->message (id, ctx, p1, p2);
+        clock_gettime (CLOCK_MONOTONIC, &tm2);
+        uint64_t us = (uint64_t)(tm2.tv_sec - tm1.tv_sec) * 1000000 + (tm2.tv_nsec - tm1.tv_nsec) / 1000;
+        pm->calls++;
+        pm->total_us += us;
+        if (us > pm->max_us) {
+            pm->max_us = us;
+            if (us >= MSG_SLOW_HANDLER_MS * 1000) {
+                trace_err ("plugin %s took %d ms to handle message %d\n", pm->plugin->id, (int)(us / 1000), id);
+            }
+        }
+    }
+}
+
+static void
+plug_message_free (void) {
+    for (int i = 0; i < g_num_msg_plugins; i++) {
+        plug_msg_t *pm = &g_msg_plugins[i];
+        if (pm->calls) {
+            trace ("%s: %lld messages, %lld ms total, %lld ms max\n", pm->plugin->id, (long long)pm->calls, (long long)(pm->total_us / 1000), (long long)(pm->max_us / 1000));
+        }
+    }
+    g_num_msg_plugins = 0;
+    free (msg_dispatch_list);
+    msg_dispatch_list = NULL;
+    memset (msg_dispatch_first, 0, sizeof (msg_dispatch_first));
+    plug_message_invalidate ();
+}
+
 // deadbeef api
 static DB_functions_t deadbeef_api = {
     .vmajor = DB_API_VERSION_MAJOR,
@@ -497,6 +682,15 @@ static DB_functions_t deadbeef_api = {
     .junk_get_tag_offsets = junk_get_tag_offsets,
 
     .plt_is_loading_cue = (int (*)(ddb_playlist_t *))plt_is_loading_cue,
+    .streamer_get_buffer_stats = streamer_get_buffer_stats,
+    .vis_subscribe = vis_subscribe,
+    .vis_unsubscribe = vis_unsubscribe,
+    .vis_poll = vis_poll,
+    .seektable_load = seektable_load,
+    .seektable_save = seektable_save,
+    .seektable_find = seektable_find,
+    .plug_message_subscribe = plug_message_subscribe,
+    .plug_message_unsubscribe = plug_message_unsubscribe,
 
 };
 
@@ -702,6 +896,7 @@ static int dirent_alphasort (const struct dirent **a, const struct dirent **b) {
 void
 plug_remove_plugin (void *p) {
     int i;
+    plug_msg_remove (p);
     for (i = 0; g_plugins[i]; i++) {
         if (g_plugins[i] == p) {
             memmove (&g_plugins[i], &g_plugins[i+1], (MAX_PLUGINS+1-i-1) * sizeof (void*));
@@ -1188,6 +1383,7 @@ plug_load_all (void) {
     g_output_plugins[numoutput] = NULL;
     g_dsp_plugins[numdsp] = NULL;
     g_playlist_plugins[numplaylist] = NULL;
+    plug_message_invalidate ();
 
     // select output plugin
 #ifndef XCTEST
@@ -1294,6 +1490,7 @@ plug_unload_all (void) {
     memset (g_output_plugins, 0, sizeof (g_output_plugins));
     output_plugin = NULL;
     memset (g_playlist_plugins, 0, sizeof (g_playlist_plugins));
+    plug_message_free ();
 
     trace ("all plugins had been unloaded\n");
     if (background_jobs_mutex) {
@@ -1530,6 +1727,7 @@ plug_register_in (DB_plugin_t *inplug) {
     for (i = 0; g_plugins[i]; i++);
     g_plugins[i++] = inplug;
     g_plugins[i] = NULL;
+    plug_message_invalidate ();
 
     for (i = 0; g_decoder_plugins[i]; i++);
     g_decoder_plugins[i++] = (DB_decoder_t *)inplug;
@@ -1543,6 +1741,7 @@ plug_register_out (DB_plugin_t *outplug) {
     for (i = 0; g_plugins[i]; i++);
     g_plugins[i++] = outplug;
     g_plugins[i] = NULL;
+    plug_message_invalidate ();
 
     for (i = 0; g_output_plugins[i]; i++);
     g_output_plugins[i++] = (DB_output_t *)outplug;
@@ -139,6 +139,16 @@ plug_get_gui_names (void);
 void
 plug_event_call (ddb_event_t *ev);
 
+void
+plug_message_subscribe (DB_plugin_t *plugin, const uint32_t *ids, int count);
+
+void
+plug_message_unsubscribe (DB_plugin_t *plugin, const uint32_t *ids, int count);
+
+// call the message callbacks of the plugins subscribed to the message id
+void
+plug_message_dispatch (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2);
+
 void
 background_job_increment (void);
 
@@ -44,6 +44,9 @@ DB_functions_t *deadbeef;
 #define AAC_BUFFER_SIZE 768*8
 #define OUT_BUFFER_SIZE 100000
 
+// number of frames between the seek points of raw streams
+#define SEEKTABLE_INTERVAL 50
+
 #define MP4FILE mp4ff_t *
 #define MP4FILE_CB mp4ff_callback_t
 
@@ -85,6 +88,12 @@ typedef struct {
     int noremap;
     int eof;
     int junk;
+
+    // seek points of a local raw stream, loaded from the cache, or built on the first seek
+    char *fname;
+    ddb_seekpoint_t *seekpoints;
+    int nseekpoints;
+    int seektable_checked;
 } aac_info_t;
 
 // allocate codec control structure
@@ -407,6 +416,12 @@ aac_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
         }
         trace ("found aac stream (junk: %d, offs: %d)\n", info->junk, offs);
 
+        if (!info->file->vfs->is_streaming ()) {
+            deadbeef->pl_lock ();
+            info->fname = strdup (deadbeef->pl_find_meta (it, ":URI"));
+            deadbeef->pl_unlock ();
+        }
+
         _info->fmt.channels = channels;
         _info->fmt.samplerate = samplerate;
 
@@ -486,6 +501,8 @@ aac_free (DB_fileinfo_t *_info) {
         if (info->dec) {
             NeAACDecClose (info->dec);
         }
+        free (info->fname);
+        free (info->seekpoints);
         free (info);
     }
 }
@@ -744,6 +761,62 @@ seek_raw_aac (aac_info_t *info, int sample) {
     return sample - curr_sample;
 }
 
+// collect the positions of every SEEKTABLE_INTERVAL-th frame, starting from the current position,
+// and count the samples the same way as seek_raw_aac
+static void
+build_raw_aac_seektable (aac_info_t *info) {
+    uint8_t buf[ADTS_HEADER_SIZE*8];
+    int bufsize = 0;
+    int frame = 0;
+    int64_t curr_sample = 0;
+    int size_alloc = 0;
+
+    for (;;) {
+        int64_t framepos = deadbeef->ftell (info->file) - bufsize;
+        int size = sizeof (buf) - bufsize;
+        if (deadbeef->fread (buf + bufsize, 1, size, info->file) != size) {
+            break;
+        }
+        bufsize = sizeof (buf);
+
+        int channels, samplerate, bitrate, frame_samples;
+        size = aac_sync (buf, &channels, &samplerate, &bitrate, &frame_samples);
+        if (size == 0) {
+            memmove (buf, buf+1, sizeof (buf)-1);
+            bufsize--;
+            continue;
+        }
+
+        if (frame % SEEKTABLE_INTERVAL == 0) {
+            if (info->nseekpoints == size_alloc) {
+                size_alloc = size_alloc ? size_alloc * 2 : 256;
+                ddb_seekpoint_t *points = realloc (info->seekpoints, size_alloc * sizeof (ddb_seekpoint_t));
+                if (!points) {
+                    break;
+                }
+                info->seekpoints = points;
+            }
+            info->seekpoints[info->nseekpoints].sample = curr_sample;
+            info->seekpoints[info->nseekpoints].offset = framepos;
+            info->nseekpoints++;
+        }
+        frame++;
+
+        if (deadbeef->fseek (info->file, size-(int)sizeof(buf), SEEK_CUR) == -1) {
+            break;
+        }
+        bufsize = 0;
+        if (samplerate <= 24000) {
+            frame_samples *= 2;
+        }
+        curr_sample += frame_samples;
+    }
+
+    if (info->nseekpoints > 0) {
+        deadbeef->seektable_save (info->fname, plugin.plugin.id, info->seekpoints, info->nseekpoints, curr_sample);
+    }
+}
+
 static int
 aac_seek_sample (DB_fileinfo_t *_info, int sample) {
     aac_info_t *info = (aac_info_t *)_info;
@@ -784,7 +857,24 @@ aac_seek_sample (DB_fileinfo_t *_info, int sample) {
             deadbeef->fseek (info->file, 0, SEEK_SET);
         }
 
-        int res = seek_raw_aac (info, sample);
+        // continue scanning from the nearest seek point
+        int64_t basesample = 0;
+        if (info->fname && sample > 0) {
+            if (!info->seektable_checked) {
+                info->seektable_checked = 1;
+                int64_t totalsamples;
+                if (deadbeef->seektable_load (info->fname, plugin.plugin.id, &info->seekpoints, &info->nseekpoints, &totalsamples)) {
+                    build_raw_aac_seektable (info);
+                }
+            }
+            int idx = deadbeef->seektable_find (info->seekpoints, info->nseekpoints, sample - 1);
+            if (idx > 0) {
+                basesample = info->seekpoints[idx].sample;
+            }
+            deadbeef->fseek (info->file, idx > 0 ? info->seekpoints[idx].offset : (skip >= 0 ? skip : 0), SEEK_SET);
+        }
+
+        int res = seek_raw_aac (info, (int)(sample - basesample));
         if (res < 0) {
             return -1;
         }
@@ -758,6 +758,8 @@ alsa_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
 
 static int
 alsa_start (void) {
+    static const uint32_t events[] = { DB_EV_CONFIGCHANGED };
+    deadbeef->plug_message_subscribe (DB_PLUGIN (&plugin), events, 1);
     mutex = deadbeef->mutex_create ();
     return 0;
 }
@@ -442,6 +442,8 @@ dumb_register_db_vfs (void) {
 
 int
 cdumb_start (void) {
+    static const uint32_t events[] = { DB_EV_CONFIGCHANGED };
+    deadbeef->plug_message_subscribe (DB_PLUGIN (&plugin), events, 1);
     dumb_register_db_vfs ();
     conf_bps = deadbeef->conf_get_int ("dumb.8bitoutput", 0) ? 8 : 16;
     conf_samplerate = deadbeef->conf_get_int ("synth.samplerate", 44100);
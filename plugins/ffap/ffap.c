@@ -285,6 +285,11 @@ typedef struct {
     int64_t endsample;
     APEContext ape_ctx;
     DB_FILE *fp;
+
+    // buffers of the previous track, for reuse by ffap_init (see ffap_reinit)
+    uint8_t *spare_packet_data;
+    int16_t *spare_filterbuf[APE_FILTER_LEVELS];
+    int spare_filterbuf_size[APE_FILTER_LEVELS];
 } ape_info_t;
 
 
@@ -677,11 +682,27 @@ ape_free_ctx (APEContext *ape_ctx) {
     memset (ape_ctx, 0, sizeof (APEContext));
 }
 
+static void
+ffap_free_spare_buffers (ape_info_t *info) {
+    if (info->spare_packet_data) {
+        free (info->spare_packet_data);
+        info->spare_packet_data = NULL;
+    }
+    for (int i = 0; i < APE_FILTER_LEVELS; i++) {
+        if (info->spare_filterbuf[i]) {
+            free (info->spare_filterbuf[i]);
+            info->spare_filterbuf[i] = NULL;
+            info->spare_filterbuf_size[i] = 0;
+        }
+    }
+}
+
 static void
 ffap_free (DB_fileinfo_t *_info)
 {
     ape_info_t *info = (ape_info_t *)_info;
     ape_free_ctx (&info->ape_ctx);
+    ffap_free_spare_buffers (info);
     if (info->fp) {
         deadbeef->fclose (info->fp);
     }
@@ -736,6 +757,12 @@ ffap_init (DB_fileinfo_t *_info, DB_playItem_t *it)
         if (!ape_filter_orders[info->ape_ctx.fset][i])
             break;
         info->ape_ctx.filterbuf_size[i] = (ape_filter_orders[info->ape_ctx.fset][i] * 3 + HISTORY_SIZE) * 4;
+        if (info->spare_filterbuf[i] && info->spare_filterbuf_size[i] >= info->ape_ctx.filterbuf_size[i]) {
+            info->ape_ctx.filterbuf[i] = info->spare_filterbuf[i];
+            info->ape_ctx.filterbuf_size[i] = info->spare_filterbuf_size[i];
+            info->spare_filterbuf[i] = NULL;
+            continue;
+        }
         int err = posix_memalign ((void **)&info->ape_ctx.filterbuf[i], 16, info->ape_ctx.filterbuf_size[i]);
         if (err) {
             trace ("ffap: out of memory (posix_memalign)\n");
@@ -750,7 +777,13 @@ ffap_init (DB_fileinfo_t *_info, DB_playItem_t *it)
     _info->fmt.channelmask = _info->fmt.channels == 1 ? DDB_SPEAKER_FRONT_LEFT : (DDB_SPEAKER_FRONT_LEFT | DDB_SPEAKER_FRONT_RIGHT);
     _info->readpos = 0;
 
-    info->ape_ctx.packet_data = malloc (PACKET_BUFFER_SIZE);
+    if (info->spare_packet_data) {
+        info->ape_ctx.packet_data = info->spare_packet_data;
+        info->spare_packet_data = NULL;
+    }
+    else {
+        info->ape_ctx.packet_data = malloc (PACKET_BUFFER_SIZE);
+    }
     if (!info->ape_ctx.packet_data) {
         fprintf (stderr, "ape: failed to allocate memory for packet data\n");
         return -1;
@@ -768,9 +801,38 @@ ffap_init (DB_fileinfo_t *_info, DB_playItem_t *it)
         info->endsample = info->ape_ctx.totalsamples-1;
     }
 
+    // the buffers which weren't needed for this track
+    ffap_free_spare_buffers (info);
+
     return 0;
 }
 
+static int
+ffap_reinit (DB_fileinfo_t *_info, DB_playItem_t *it)
+{
+    ape_info_t *info = (ape_info_t *)_info;
+
+    // keep the packet buffer and the filter buffers, the rest depends on the file
+    info->spare_packet_data = info->ape_ctx.packet_data;
+    info->ape_ctx.packet_data = NULL;
+    for (int i = 0; i < APE_FILTER_LEVELS; i++) {
+        info->spare_filterbuf[i] = info->ape_ctx.filterbuf[i];
+        info->spare_filterbuf_size[i] = info->ape_ctx.filterbuf_size[i];
+        info->ape_ctx.filterbuf[i] = NULL;
+    }
+    ape_free_ctx (&info->ape_ctx);
+
+    if (info->fp) {
+        deadbeef->fclose (info->fp);
+        info->fp = NULL;
+    }
+    memset (&_info->fmt, 0, sizeof (_info->fmt));
+    info->startsample = 0;
+    info->endsample = 0;
+
+    return ffap_init (_info, it);
+}
+
 /**
  * @defgroup rangecoder APE range decoder
  * @{
@@ -1943,6 +2005,7 @@ static DB_decoder_t plugin = {
     .read_metadata = ffap_read_metadata,
     .write_metadata = ffap_write_metadata,
     .exts = exts,
+    .reinit = ffap_reinit,
 };
 
 #if HAVE_SSE2 && !ARCH_UNKNOWN
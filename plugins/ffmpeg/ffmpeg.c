@@ -908,6 +908,8 @@ ffmpeg_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
 
 static int
 ffmpeg_start (void) {
+    static const uint32_t events[] = { DB_EV_CONFIGCHANGED };
+    deadbeef->plug_message_subscribe (DB_PLUGIN (&plugin), events, 1);
     ffmpeg_init_exts ();
 #if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(54, 6, 0)
     avcodec_register_all ();
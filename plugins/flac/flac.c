@@ -281,6 +281,8 @@ cflac_open2 (uint32_t hints, DB_playItem_t *it) {
     if (!info->file) {
         trace("cflac_open2 failed to open file %s\n", deadbeef->pl_find_meta(it, ":URI"));
     }
+    // published for streamer_abort_files
+    info->info.file = info->file;
     deadbeef->pl_unlock();
 
     return (DB_fileinfo_t *)info;
@@ -299,6 +301,7 @@ cflac_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
             trace ("cflac_init failed to open file %s\n", deadbeef->pl_find_meta(it, ":URI"));
             return -1;
         }
+        info->info.file = info->file;
     }
 
     deadbeef->pl_lock();
@@ -336,7 +339,9 @@ cflac_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
     }
 
     FLAC__StreamDecoderInitStatus status;
-    info->decoder = FLAC__stream_decoder_new ();
+    if (!info->decoder) {
+        info->decoder = FLAC__stream_decoder_new ();
+    }
     if (!info->decoder) {
         trace ("FLAC__stream_decoder_new failed\n");
         return -1;
@@ -380,7 +385,9 @@ cflac_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
     }
     deadbeef->pl_unlock ();
 
-    info->buffer = malloc (BUFFERSIZE);
+    if (!info->buffer) {
+        info->buffer = malloc (BUFFERSIZE);
+    }
     info->remaining = 0;
     int64_t endsample = deadbeef->pl_item_get_endsample (it);
     if (endsample > 0) {
@@ -407,6 +414,33 @@ cflac_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
     return 0;
 }
 
+static int
+cflac_reinit (DB_fileinfo_t *_info, DB_playItem_t *it) {
+    flac_info_t *info = (flac_info_t *)_info;
+
+    // close the previous track, the stream decoder and the buffer are reused
+    if (info->decoder) {
+        FLAC__stream_decoder_finish (info->decoder);
+    }
+    if (info->file) {
+        // unpublish before closing, the streamer may abort info->info.file at any time
+        info->info.file = NULL;
+        deadbeef->fclose (info->file);
+        info->file = NULL;
+    }
+    memset (&_info->fmt, 0, sizeof (_info->fmt));
+    info->remaining = 0;
+    info->startsample = 0;
+    info->endsample = 0;
+    info->currentsample = 0;
+    info->totalsamples = 0;
+    info->flac_critical_error = 0;
+    info->init_stop_decoding = 0;
+    info->bitrate = 0;
+
+    return cflac_init (_info, it);
+}
+
 static void
 cflac_free (DB_fileinfo_t *_info) {
     if (_info) {
@@ -421,6 +455,7 @@ cflac_free (DB_fileinfo_t *_info) {
             free (info->buffer);
         }
         if (info->file) {
+            info->info.file = NULL;
             deadbeef->fclose (info->file);
         }
         free (_info);
@@ -1316,6 +1351,7 @@ static DB_decoder_t plugin = {
     .read_metadata = cflac_read_metadata,
     .write_metadata = cflac_write_metadata,
     .exts = exts,
+    .reinit = cflac_reinit,
 };
 
 DB_plugin_t *
@@ -485,6 +485,8 @@ static const char * exts[]=
 
 static int
 cgme_start (void) {
+    static const uint32_t events[] = { DB_EV_CONFIGCHANGED };
+    deadbeef->plug_message_subscribe (DB_PLUGIN (&plugin), events, 1);
     conf_fadeout = deadbeef->conf_get_int ("gme.fadeout", 10);
     conf_loopcount = deadbeef->conf_get_int ("gme.loopcount", 2);
     conf_play_forever = deadbeef->conf_get_int ("playback.loop", PLAYBACK_MODE_LOOP_ALL) == PLAYBACK_MODE_LOOP_SINGLE;
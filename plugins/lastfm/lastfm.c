@@ -767,6 +767,8 @@ lfm_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
 
 static int
 lastfm_start (void) {
+    static const uint32_t events[] = { DB_EV_SONGSTARTED, DB_EV_SONGCHANGED };
+    deadbeef->plug_message_subscribe (DB_PLUGIN (&plugin), events, 2);
     if (lfm_mutex) {
         return -1;
     }
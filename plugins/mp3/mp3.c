@@ -37,7 +37,7 @@
 #include "mp3_mpg123.h"
 #endif
 
-#define trace(...) { deadbeef->log_detailed (&plugin.plugin, 0, __VA_ARGS__); }
+#define trace(...) { deadbeef->log_detailed (&plugin.decoder.plugin, 0, __VA_ARGS__); }
 
 //#define WRITE_DUMP 1
 
@@ -47,13 +47,22 @@ FILE *out;
 
 #define MAX_INVALID_BYTES 100000
 
+// allow at least 10 lead-in frames, to fill bit-reservoir
+#define MAX_LEAD_IN_FRAMES 10
+
+// number of frames between the seek points
+#define SEEKTABLE_INTERVAL 50
+
+// set on the tracks whose duration is estimated, until the background scan gets the exact one
+#define SCAN_PENDING_KEY ":MP3_DURATION_ESTIMATED"
+
 #define min(x,y) ((x)<(y)?(x):(y))
 #define max(x,y) ((x)>(y)?(x):(y))
 
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
 
-static DB_decoder_t plugin;
+static ddb_mp3_plugin_t plugin;
 DB_functions_t *deadbeef;
 
 static uint32_t
@@ -430,15 +439,84 @@ _scan_mpeg_header (buffer_t *buffer, int64_t offs, int64_t fsize, mpeg_frame_inf
     return offs + mpeg_frame->packetlength;
 }
 
-// sample=-1: scan entire stream, calculate precise duration
+static void
+_seektable_append (buffer_t *buffer, int64_t sample, int64_t offset) {
+    if (buffer->nseekpoints == buffer->seekpoints_size) {
+        int size = buffer->seekpoints_size ? buffer->seekpoints_size * 2 : 256;
+        ddb_seekpoint_t *points = realloc (buffer->seekpoints, size * sizeof (ddb_seekpoint_t));
+        if (!points) {
+            return;
+        }
+        buffer->seekpoints = points;
+        buffer->seekpoints_size = size;
+    }
+    buffer->seekpoints[buffer->nseekpoints].sample = sample;
+    buffer->seekpoints[buffer->nseekpoints].offset = offset;
+    buffer->nseekpoints++;
+}
+
+static void
+_seektable_free (buffer_t *buffer) {
+    free (buffer->seekpoints);
+    buffer->seekpoints = NULL;
+    buffer->nseekpoints = 0;
+    buffer->seekpoints_size = 0;
+}
+
+// the table is only valid for the same file and tag sizes
+static void
+_seektable_save (buffer_t *buffer, const char *fname, int64_t totalsamples) {
+    if (buffer->nseekpoints > 0 && !buffer->file->vfs->is_streaming ()) {
+        deadbeef->seektable_save (fname, plugin.decoder.plugin.id, buffer->seekpoints, buffer->nseekpoints, totalsamples);
+    }
+}
+
+// collect the seek points, by scanning the frame headers from startoffset until the end
+static void
+_seektable_build (buffer_t *buffer) {
+    int64_t fsize = deadbeef->fgetlength (buffer->file) - buffer->endoffset;
+    int64_t offs = buffer->startoffset;
+    int64_t nsamples = 0;
+    int nframe = 0;
+
+    buffer->nseekpoints = 0;
+    while (offs < fsize) {
+        deadbeef->fseek (buffer->file, offs, SEEK_SET);
+        mpeg_frame_info_t frame;
+        int64_t new_offs = _scan_mpeg_header (buffer, offs, fsize, &frame);
+        if (new_offs == -2) {
+            break;
+        }
+        if (new_offs == -1) {
+            offs++;
+            if (offs - buffer->startoffset > MAX_INVALID_BYTES) {
+                break;
+            }
+            continue;
+        }
+        if (nframe % SEEKTABLE_INTERVAL == 0) {
+            _seektable_append (buffer, nsamples, offs);
+        }
+        nsamples += frame.samples_per_frame;
+        nframe++;
+        offs = new_offs;
+    }
+
+    char fname[PATH_MAX];
+    deadbeef->pl_get_meta (buffer->it, ":URI", fname, sizeof (fname));
+    _seektable_save (buffer, fname, nsamples);
+}
+
+// sample=-1: scan entire stream, calculate precise duration, collect seek points
 // sample=0: read headers/tags, calculate approximate duration
-// sample>0: seek to the frame with the sample, update skipsamples
+// sample>0: seek to the frame with the sample, counting from the current position, update skipsamples
 // return value: -1 on error
 static int
 cmp3_scan_stream (buffer_t *buffer, int sample) {
     trace ("cmp3_scan_stream %d (offs: %lld)\n", sample, deadbeef->ftell (buffer->file));
 
     _scan_init (buffer, sample);
+    int64_t scan_startpos = sample > 0 ? deadbeef->ftell (buffer->file) : buffer->startoffset;
     int lastframe_valid = 0;
     int64_t offs = -1;
     int nframe = 0;
@@ -456,13 +534,16 @@ cmp3_scan_stream (buffer_t *buffer, int sample) {
         buffer->duration = -1;
     }
 
-    int64_t lead_in_frame_pos = buffer->startoffset;
+    int64_t lead_in_frame_pos = scan_startpos;
     int64_t lead_in_frame_no = 0;
 
-#define MAX_LEAD_IN_FRAMES 10
     int64_t frame_positions[MAX_LEAD_IN_FRAMES]; // positions of nframe-9, nframe-8, nframe-7, ...
     for (int i = 0; i < MAX_LEAD_IN_FRAMES; i++) {
-        frame_positions[i] = buffer->startoffset;
+        frame_positions[i] = scan_startpos;
+    }
+
+    if (sample < 0) {
+        buffer->nseekpoints = 0;
     }
 
     for (;;) {
@@ -487,7 +568,7 @@ cmp3_scan_stream (buffer_t *buffer, int sample) {
                 valid_frames = 0;
             }
             offs++;
-            if (offs - buffer->startoffset > MAX_INVALID_BYTES) {
+            if (offs - scan_startpos > MAX_INVALID_BYTES) {
                 break;
             }
             continue;
@@ -535,7 +616,6 @@ cmp3_scan_stream (buffer_t *buffer, int sample) {
 
         lastframe_valid = 1;
 
-        // allow at least 10 lead-in frames, to fill bit-reservoir
         if (nframe - lead_in_frame_no > MAX_LEAD_IN_FRAMES) {
             lead_in_frame_pos = frame_positions[0];
             lead_in_frame_no++;
@@ -606,6 +686,9 @@ cmp3_scan_stream (buffer_t *buffer, int sample) {
                 trace ("scan: cursample=%d, frame: %d, skipsamples: %d, filepos: %llX, lead-in frames: %d\n", buffer->currentsample, nframe, buffer->skipsamples, deadbeef->ftell (buffer->file), buffer->lead_in_frames);
                 return 0;
             }
+            if (sample < 0 && nframe % SEEKTABLE_INTERVAL == 0) {
+                _seektable_append (buffer, scansamples, framepos);
+            }
         }
         scansamples += frame.samples_per_frame;
         nframe++;
@@ -630,6 +713,7 @@ end_scan:
             else {
                 buffer->totalsamples = buffer->nframes * buffer->avg_samples_per_frame;
                 buffer->duration = (buffer->totalsamples - buffer->delay - buffer->padding) / (float)buffer->avg_samplerate;
+                buffer->duration_estimated = 1;
             }
         }
         buffer->bitrate = (fsize - buffer->startoffset - buffer->endoffset) / buffer->duration * 8;
@@ -661,7 +745,37 @@ cmp3_seek_stream (DB_fileinfo_t *_info, int sample) {
     }
 #endif
 
-    int res = cmp3_scan_stream (&info->buffer, sample);
+    buffer_t *buffer = &info->buffer;
+
+    // start scanning from the nearest seek point, leaving enough frames for the lead-in
+    int64_t basesample = 0;
+    int64_t target = sample - (MAX_LEAD_IN_FRAMES + 1) * 1152;
+    if (target > 0) {
+        // the table is built on the first seek, if it wasn't loaded from the cache, or collected by the full scan
+        if (!buffer->seektable_checked) {
+            buffer->seektable_checked = 1;
+            if (!buffer->nseekpoints) {
+                _seektable_build (buffer);
+            }
+        }
+        int idx = deadbeef->seektable_find (buffer->seekpoints, buffer->nseekpoints, target);
+        if (idx > 0) {
+            basesample = buffer->seekpoints[idx].sample;
+        }
+        deadbeef->fseek (buffer->file, idx > 0 ? buffer->seekpoints[idx].offset : buffer->startoffset, SEEK_SET);
+    }
+
+    int res = cmp3_scan_stream (buffer, (int)(sample - basesample));
+    if (res == 0 && basesample > 0) {
+        if (buffer->currentsample > 0) {
+            buffer->currentsample += basesample;
+        }
+        else {
+            // reached the end of stream
+            buffer->totalsamples += basesample;
+            buffer->duration = (buffer->totalsamples - buffer->delay - buffer->padding) / (float)buffer->samplerate;
+        }
+    }
     return res;
 }
 
@@ -783,32 +897,41 @@ static int
 cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
     mp3_info_t *info = (mp3_info_t *)_info;
 
+    mp3_decoder_api_t *dec;
 #if defined(USE_LIBMAD) && defined(USE_LIBMPG123)
     int backend = deadbeef->conf_get_int ("mp3.backend", 0);
     switch (backend) {
     case 0:
-        info->dec = &mpg123_api;
+        dec = &mpg123_api;
         break;
     case 1:
-        info->dec = &mad_api;
+        dec = &mad_api;
         break;
     default:
-        info->dec = &mpg123_api;
+        dec = &mpg123_api;
         break;
     }
 #else
 #if defined(USE_LIBMAD)
-    info->dec = &mad_api;
+    dec = &mad_api;
 #else
-    info->dec = &mpg123_api;
+    dec = &mpg123_api;
 #endif
 #endif
 
-    _info->plugin = &plugin;
+    // the backend may have changed since the previous track (see cmp3_reinit)
+    if (info->dec_initialized && info->dec != dec) {
+        info->dec->free (info);
+        info->dec_initialized = 0;
+    }
+    info->dec = dec;
+
+    _info->plugin = &plugin.decoder;
+    _seektable_free (&info->buffer);
     memset (&info->buffer, 0, sizeof (info->buffer));
-    deadbeef->pl_lock ();
-    info->buffer.file = deadbeef->fopen (deadbeef->pl_find_meta (it, ":URI"));
-    deadbeef->pl_unlock ();
+    char fname[PATH_MAX];
+    deadbeef->pl_get_meta (it, ":URI", fname, sizeof (fname));
+    info->buffer.file = deadbeef->fopen (fname);
     if (!info->buffer.file) {
         return -1;
     }
@@ -826,7 +949,25 @@ cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
             trace ("mp3: skipping %d(%xH) bytes of junk\n", start, start);
             deadbeef->fseek (info->buffer.file, start, SEEK_SET);
         }
-        int res = cmp3_scan_stream (&info->buffer, -1);
+        // with a cached seek table, the precise duration is already known
+        int64_t totalsamples;
+        int res;
+        if (!deadbeef->seektable_load (fname, plugin.decoder.plugin.id, &info->buffer.seekpoints, &info->buffer.nseekpoints, &totalsamples)) {
+            info->buffer.seekpoints_size = info->buffer.nseekpoints;
+            info->buffer.seektable_checked = 1;
+            res = cmp3_scan_stream (&info->buffer, 0);
+            if (!res && !info->buffer.have_xing_header) {
+                info->buffer.totalsamples = totalsamples;
+                info->buffer.duration = (totalsamples - info->buffer.delay - info->buffer.padding) / (float)info->buffer.samplerate;
+            }
+        }
+        else {
+            res = cmp3_scan_stream (&info->buffer, -1);
+            if (!res && !info->buffer.have_xing_header) {
+                info->buffer.seektable_checked = 1;
+                _seektable_save (&info->buffer, fname, info->buffer.totalsamples);
+            }
+        }
         if (res < 0) {
             trace ("mp3: cmp3_init: initial cmp3_scan_stream failed\n");
             return -1;
@@ -845,6 +986,8 @@ cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
         else {
             ddb_playlist_t *plt = deadbeef->pl_get_playlist (it);
             deadbeef->plt_set_item_duration (plt, it, info->buffer.duration);
+            // the duration is exact now, the background scan can skip the track
+            deadbeef->pl_delete_meta (it, SCAN_PENDING_KEY);
             if (plt) {
                 deadbeef->plt_unref (plt);
             }
@@ -912,13 +1055,39 @@ cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
         deadbeef->pl_replace_meta (it, ":BPS", "32");
     }
 
-    info->dec->init (info);
+    if (info->dec_initialized) {
+        info->dec->reset (info);
+    }
+    else {
+        info->dec->init (info);
+        info->dec_initialized = 1;
+    }
     if (!info->buffer.file->vfs->is_streaming ()) {
-        plugin.seek_sample (_info, 0);
+        plugin.decoder.seek_sample (_info, 0);
     }
     return 0;
 }
 
+static int
+cmp3_reinit (DB_fileinfo_t *_info, DB_playItem_t *it) {
+    mp3_info_t *info = (mp3_info_t *)_info;
+
+    // close the previous track, keeping the decoder and the conversion buffer
+    if (info->buffer.it) {
+        deadbeef->pl_item_unref (info->buffer.it);
+        info->buffer.it = NULL;
+    }
+    if (info->buffer.file) {
+        // unpublish before closing, the streamer may abort info->file at any time
+        info->info.file = NULL;
+        deadbeef->fclose (info->buffer.file);
+        info->buffer.file = NULL;
+    }
+    memset (&_info->fmt, 0, sizeof (_info->fmt));
+
+    return cmp3_init (_info, it);
+}
+
 static inline void
 cmp3_skip (mp3_info_t *info) {
     if (info->buffer.skipsamples > 0) {
@@ -1017,8 +1186,11 @@ cmp3_free (DB_fileinfo_t *_info) {
         deadbeef->fclose (info->buffer.file);
         info->buffer.file = NULL;
         info->info.file = NULL;
+    }
+    if (info->dec_initialized) {
         info->dec->free (info);
     }
+    _seektable_free (&info->buffer);
     free (info);
 }
 
@@ -1119,10 +1291,9 @@ cmp3_seek_sample (DB_fileinfo_t *_info, int sample) {
                 info->buffer.currentsample = sample;
                 _info->readpos = (float)(info->buffer.currentsample - info->buffer.startsample) / info->buffer.samplerate;
 
-                info->dec->free (info);
                 info->buffer.remaining = 0;
                 info->buffer.decode_remaining = 0;
-                info->dec->init (info);
+                info->dec->reset (info);
                 return 0;
             }
             trace ("seek failed!\n");
@@ -1144,9 +1315,8 @@ cmp3_seek_sample (DB_fileinfo_t *_info, int sample) {
     info->buffer.readsize = 0;
     info->buffer.decode_remaining = 0;
 
-    // force flush the decoder by reinitializing it
-    info->dec->free (info);
-    info->dec->init (info);
+    // force flush the decoder
+    info->dec->reset (info);
 
 //    struct timeval tm1;
 //    gettimeofday (&tm1, NULL);
@@ -1171,6 +1341,199 @@ cmp3_seek (DB_fileinfo_t *_info, float time) {
     return cmp3_seek_sample (_info, sample);
 }
 
+// {{{ background duration scanning, for tracks added in fast import mode
+// The tracks waiting for the scan are marked with SCAN_PENDING_KEY, which is saved with the playlists,
+// so that the scan is resumed after restart.
+typedef struct scan_queue_item_s {
+    DB_playItem_t *it;
+    struct scan_queue_item_s *next;
+} scan_queue_item_t;
+
+static uintptr_t scan_mutex;
+static scan_queue_item_t *scan_queue;
+static scan_queue_item_t *scan_queue_tail;
+static int scan_thread_running;
+static int scan_abort;
+static ddb_mp3_scan_stats_t scan_stats;
+
+// notify about the updated durations every SCAN_NOTIFY_INTERVAL tracks, and when done
+#define SCAN_NOTIFY_INTERVAL 50
+
+static void
+cmp3_scan_duration (DB_playItem_t *it) {
+    char fname[PATH_MAX];
+    deadbeef->pl_get_meta (it, ":URI", fname, sizeof (fname));
+    DB_FILE *fp = deadbeef->fopen (fname);
+    if (!fp) {
+        return;
+    }
+
+    buffer_t buffer;
+    memset (&buffer, 0, sizeof (buffer));
+    buffer.file = fp;
+    uint32_t start;
+    uint32_t end;
+    deadbeef->junk_get_tag_offsets (buffer.file, &start, &end);
+    buffer.startoffset = start;
+    buffer.endoffset = end;
+    if (start > 0) {
+        deadbeef->fseek (buffer.file, start, SEEK_SET);
+    }
+    int res = cmp3_scan_stream (&buffer, -1);
+    if (!res && !buffer.have_xing_header) {
+        _seektable_save (&buffer, fname, buffer.totalsamples);
+    }
+    _seektable_free (&buffer);
+
+    // the track may have been removed meanwhile
+    ddb_playlist_t *plt = deadbeef->pl_get_playlist (it);
+    if (!res && plt) {
+        buffer.it = it;
+        cmp3_set_extra_properties (&buffer, 0);
+        deadbeef->plt_set_item_duration (plt, it, buffer.duration);
+        deadbeef->pl_delete_meta (it, SCAN_PENDING_KEY);
+        deadbeef->plt_modified (plt);
+    }
+    if (plt) {
+        deadbeef->plt_unref (plt);
+    }
+    deadbeef->fclose (fp);
+}
+
+static void
+cmp3_scan_thread (void *ctx) {
+    int notify = 0;
+    for (;;) {
+        deadbeef->mutex_lock (scan_mutex);
+        scan_queue_item_t *item = scan_queue;
+        if (!item || scan_abort) {
+            scan_thread_running = 0;
+            deadbeef->mutex_unlock (scan_mutex);
+            break;
+        }
+        scan_queue = item->next;
+        if (!scan_queue) {
+            scan_queue_tail = NULL;
+        }
+        deadbeef->mutex_unlock (scan_mutex);
+
+        // unless it was played meanwhile
+        if (deadbeef->pl_meta_exists (item->it, SCAN_PENDING_KEY)) {
+            cmp3_scan_duration (item->it);
+        }
+        deadbeef->pl_item_unref (item->it);
+        free (item);
+
+        deadbeef->mutex_lock (scan_mutex);
+        scan_stats.queued--;
+        scan_stats.scanned++;
+        int done = !scan_queue;
+        deadbeef->mutex_unlock (scan_mutex);
+
+        if (++notify == SCAN_NOTIFY_INTERVAL || done) {
+            notify = 0;
+            deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+        }
+        if (done) {
+            trace ("mp3: scanned the duration of %d tracks\n", scan_stats.scanned);
+        }
+    }
+}
+
+static void
+_scan_queue_push (DB_playItem_t *it) {
+    scan_queue_item_t *item = calloc (1, sizeof (scan_queue_item_t));
+    deadbeef->pl_item_ref (it);
+    item->it = it;
+
+    deadbeef->mutex_lock (scan_mutex);
+    if (scan_queue_tail) {
+        scan_queue_tail->next = item;
+    }
+    else {
+        scan_queue = item;
+    }
+    scan_queue_tail = item;
+    scan_stats.queued++;
+    if (!scan_thread_running && !scan_abort) {
+        intptr_t tid = deadbeef->thread_start_low_priority (cmp3_scan_thread, NULL);
+        if (tid) {
+            scan_thread_running = 1;
+            deadbeef->thread_detach (tid);
+        }
+    }
+    deadbeef->mutex_unlock (scan_mutex);
+}
+
+static void
+cmp3_get_scan_stats (ddb_mp3_scan_stats_t *stats) {
+    deadbeef->mutex_lock (scan_mutex);
+    *stats = scan_stats;
+    deadbeef->mutex_unlock (scan_mutex);
+}
+
+static int
+cmp3_start (void) {
+    scan_mutex = deadbeef->mutex_create ();
+    return 0;
+}
+
+// requeue the tracks which were not scanned before the last exit, the playlists are loaded by now
+static int
+cmp3_connect (void) {
+    deadbeef->pl_lock ();
+    int count = deadbeef->plt_get_count ();
+    for (int i = 0; i < count; i++) {
+        ddb_playlist_t *plt = deadbeef->plt_get_for_idx (i);
+        if (!plt) {
+            continue;
+        }
+        DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_MAIN);
+        while (it) {
+            if (deadbeef->pl_find_meta (it, SCAN_PENDING_KEY)) {
+                _scan_queue_push (it);
+            }
+            DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+            deadbeef->pl_item_unref (it);
+            it = next;
+        }
+        deadbeef->plt_unref (plt);
+    }
+    deadbeef->pl_unlock ();
+    return 0;
+}
+
+static int
+cmp3_stop (void) {
+    deadbeef->mutex_lock (scan_mutex);
+    scan_abort = 1;
+    deadbeef->mutex_unlock (scan_mutex);
+
+    // the thread finishes the current track
+    for (;;) {
+        deadbeef->mutex_lock (scan_mutex);
+        int running = scan_thread_running;
+        deadbeef->mutex_unlock (scan_mutex);
+        if (!running) {
+            break;
+        }
+        usleep (10000);
+    }
+
+    while (scan_queue) {
+        scan_queue_item_t *next = scan_queue->next;
+        deadbeef->pl_item_unref (scan_queue->it);
+        free (scan_queue);
+        scan_queue = next;
+    }
+    scan_queue_tail = NULL;
+
+    deadbeef->mutex_free (scan_mutex);
+    scan_mutex = 0;
+    return 0;
+}
+// }}}
+
 static DB_playItem_t *
 cmp3_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
     trace ("cmp3_insert %s\n", fname);
@@ -1180,7 +1543,7 @@ cmp3_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
         return NULL;
     }
     if (fp->vfs->is_streaming ()) {
-        DB_playItem_t *it = deadbeef->pl_item_alloc_init (fname, plugin.plugin.id);
+        DB_playItem_t *it = deadbeef->pl_item_alloc_init (fname, plugin.decoder.plugin.id);
         deadbeef->fclose (fp);
         deadbeef->pl_add_meta (it, "title", NULL);
         deadbeef->plt_set_item_duration (plt, it, -1);
@@ -1200,15 +1563,35 @@ cmp3_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
         trace ("mp3: skipping %d bytes (tag)\n", start);
         deadbeef->fseek(buffer.file, start, SEEK_SET);
     }
-    // calc approx. mp3 duration 
-    int res = cmp3_scan_stream (&buffer, -1);
+    // in fast import mode, estimate the duration from the first frames,
+    // unless it's known from the cached seek table, and get the exact one in background
+    int fast_import = deadbeef->conf_get_int ("mp3.fast_import", 0) && !deadbeef->plt_is_loading_cue (plt);
+    int res;
+    if (fast_import) {
+        int64_t totalsamples;
+        int cached = !deadbeef->seektable_load (fname, plugin.decoder.plugin.id, &buffer.seekpoints, &buffer.nseekpoints, &totalsamples);
+        res = cmp3_scan_stream (&buffer, 0);
+        if (!res && cached && !buffer.have_xing_header) {
+            buffer.totalsamples = totalsamples;
+            buffer.duration = (totalsamples - buffer.delay - buffer.padding) / (float)buffer.samplerate;
+            buffer.duration_estimated = 0;
+        }
+    }
+    else {
+        // calc approx. mp3 duration 
+        res = cmp3_scan_stream (&buffer, -1);
+        if (!res && !buffer.have_xing_header) {
+            _seektable_save (&buffer, fname, buffer.totalsamples);
+        }
+    }
+    _seektable_free (&buffer);
     if (res < 0) {
         trace ("mp3: cmp3_scan_stream returned error\n");
         deadbeef->fclose (fp);
         return NULL;
     }
 
-    DB_playItem_t *it = deadbeef->pl_item_alloc_init (fname, plugin.plugin.id);
+    DB_playItem_t *it = deadbeef->pl_item_alloc_init (fname, plugin.decoder.plugin.id);
 
     deadbeef->rewind (fp);
     // reset tags
@@ -1221,6 +1604,16 @@ cmp3_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
     deadbeef->pl_set_meta_int (it, ":MP3_DELAY", buffer.delay);
     deadbeef->pl_set_meta_int (it, ":MP3_PADDING", buffer.padding);
 
+    // the embedded cuesheet needs the exact number of samples
+    if (buffer.duration_estimated && deadbeef->pl_find_meta (it, "cuesheet")) {
+        deadbeef->fseek (fp, buffer.startoffset, SEEK_SET);
+        if (!cmp3_scan_stream (&buffer, -1)) {
+            buffer.duration_estimated = 0;
+            _seektable_save (&buffer, fname, buffer.totalsamples);
+        }
+        _seektable_free (&buffer);
+    }
+
     buffer.it = it;
     cmp3_set_extra_properties (&buffer, 0);
 
@@ -1233,7 +1626,13 @@ cmp3_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
         return cue;
     }
 
+    if (buffer.duration_estimated) {
+        deadbeef->pl_replace_meta (it, SCAN_PENDING_KEY, "1");
+    }
     after = deadbeef->plt_insert_item (plt, after, it);
+    if (buffer.duration_estimated) {
+        _scan_queue_push (it);
+    }
     deadbeef->pl_item_unref (it);
     return after;
 }
@@ -1302,21 +1701,23 @@ static const char *exts[] = {
 
 static const char settings_dlg[] =
     "property \"Force 16 bit output\" checkbox mp3.force16bit 0;\n"
+    "property \"Fast import: estimate the duration, and scan it in background\" checkbox mp3.fast_import 0;\n"
 #if defined(USE_LIBMAD) && defined(USE_LIBMPG123)
     "property \"Backend\" select[2] mp3.backend 0 mpg123 mad;\n"
 #endif
 ;
 
 // define plugin interface
-static DB_decoder_t plugin = {
-    DDB_PLUGIN_SET_API_VERSION
-    .plugin.version_major = 1,
-    .plugin.version_minor = 0,
-    .plugin.type = DB_PLUGIN_DECODER,
-    .plugin.flags = DDB_PLUGIN_FLAG_REPLAYGAIN,
-    .plugin.id = "stdmpg",
-    .plugin.name = "MP3 player",
-    .plugin.descr = "MPEG v1/2 layer1/2/3 decoder\n\n"
+static ddb_mp3_plugin_t plugin = {
+    .decoder.plugin.api_vmajor = DB_API_VERSION_MAJOR,
+    .decoder.plugin.api_vminor = DB_API_VERSION_MINOR,
+    .decoder.plugin.version_major = 1,
+    .decoder.plugin.version_minor = 1,
+    .decoder.plugin.type = DB_PLUGIN_DECODER,
+    .decoder.plugin.flags = DDB_PLUGIN_FLAG_REPLAYGAIN,
+    .decoder.plugin.id = "stdmpg",
+    .decoder.plugin.name = "MP3 player",
+    .decoder.plugin.descr = "MPEG v1/2 layer1/2/3 decoder\n\n"
 #if defined(USE_LIBMPG123) && defined(USE_LIBMAD)
     "Can use libmad and libmpg123 backends.\n"
     "Changing the backend will take effect when the next track starts.\n"
@@ -1326,7 +1727,7 @@ static DB_decoder_t plugin = {
     "Using libmpg123 backend.\n"
 #endif
     ,
-    .plugin.copyright = 
+    .decoder.plugin.copyright = 
         "MPEG decoder plugin for DeaDBeeF Player\n"
         "Copyright (C) 2009-2014 Alexey Yakovenko\n"
         "\n"
@@ -1348,22 +1749,27 @@ static DB_decoder_t plugin = {
         "\n"
         "3. This notice may not be removed or altered from any source distribution.\n"
     ,
-    .plugin.website = "http://deadbeef.sf.net",
-    .plugin.configdialog = settings_dlg,
-    .open = cmp3_open,
-    .init = cmp3_init,
-    .free = cmp3_free,
-    .read = cmp3_read,
-    .seek = cmp3_seek,
-    .seek_sample = cmp3_seek_sample,
-    .insert = cmp3_insert,
-    .read_metadata = cmp3_read_metadata,
-    .write_metadata = cmp3_write_metadata,
-    .exts = exts,
+    .decoder.plugin.website = "http://deadbeef.sf.net",
+    .decoder.plugin.configdialog = settings_dlg,
+    .decoder.plugin.start = cmp3_start,
+    .decoder.plugin.connect = cmp3_connect,
+    .decoder.plugin.stop = cmp3_stop,
+    .decoder.open = cmp3_open,
+    .decoder.init = cmp3_init,
+    .decoder.free = cmp3_free,
+    .decoder.read = cmp3_read,
+    .decoder.seek = cmp3_seek,
+    .decoder.seek_sample = cmp3_seek_sample,
+    .decoder.insert = cmp3_insert,
+    .decoder.read_metadata = cmp3_read_metadata,
+    .decoder.write_metadata = cmp3_write_metadata,
+    .decoder.exts = exts,
+    .decoder.reinit = cmp3_reinit,
+    .get_scan_stats = cmp3_get_scan_stats,
 };
 
 DB_plugin_t *
 mp3_load (DB_functions_t *api) {
     deadbeef = api;
-    return DB_PLUGIN (&plugin);
+    return DB_PLUGIN (&plugin.decoder);
 }
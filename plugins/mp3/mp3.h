@@ -53,6 +53,18 @@ extern DB_functions_t *deadbeef;
 #define TOC_FLAG        0x0004
 #define VBR_SCALE_FLAG  0x0008
 
+// statistics of the background duration scanning, see mp3.fast_import
+typedef struct {
+    int queued; // tracks waiting to be scanned
+    int scanned; // tracks scanned since the player started
+} ddb_mp3_scan_stats_t;
+
+// the plugin returned by plug_get_for_id ("stdmpg"), since plugin version 1.1
+typedef struct {
+    DB_decoder_t decoder;
+    void (*get_scan_stats) (ddb_mp3_scan_stats_t *stats);
+} ddb_mp3_plugin_t;
+
 struct mp3_decoder_api_s;
 
 typedef struct {
@@ -103,6 +115,14 @@ typedef struct {
     uint16_t lamepreset;
     int have_xing_header;
     int lead_in_frames;
+    int duration_estimated; // the quick scan calculated the duration from the average frame size
+
+    // positions of every SEEKTABLE_INTERVAL-th frame, used for seeking,
+    // collected by the full scan, or loaded from the cache
+    ddb_seekpoint_t *seekpoints;
+    int nseekpoints;
+    int seekpoints_size;
+    int seektable_checked; // don't try to build the seek table again
 } buffer_t;
 
 typedef struct {
@@ -135,6 +155,7 @@ typedef struct {
     int want_16bit;
     int raw_signal;
     struct mp3_decoder_api_s *dec;
+    int dec_initialized; // dec->init was called, and dec->free wasn't
 } mp3_info_t;
 
 typedef struct mp3_decoder_api_s {
@@ -144,6 +165,9 @@ typedef struct mp3_decoder_api_s {
     // free the decoder
     void (*free)(mp3_info_t *info);
 
+    // flush the decoder, and get ready to receive a new stream, keeping the allocated resources
+    void (*reset)(mp3_info_t *info);
+
     // read samples from decoder, convert into output format, and write into output buffer
     void (*decode)(mp3_info_t *info);
 
@@ -42,6 +42,13 @@ mp3_mad_free (mp3_info_t *info) {
     mad_stream_finish (&info->mad_stream);
 }
 
+void
+mp3_mad_reset (mp3_info_t *info) {
+    // libmad state is cheap to set up
+    mp3_mad_free (info);
+    mp3_mad_init (info);
+}
+
 /****************************************************************************
  * Converts a sample from libmad's fixed point number format to a signed	*
  * short (16 bits).															*
@@ -283,6 +290,7 @@ mp3_mad_stream_frame (mp3_info_t *info) {
 mp3_decoder_api_t mad_api = {
     .init = mp3_mad_init,
     .free = mp3_mad_free,
+    .reset = mp3_mad_reset,
     .decode = mp3_mad_decode,
     .stream_frame = mp3_mad_stream_frame,
 };
@@ -54,6 +54,21 @@ mp3_mpg123_free (mp3_info_t *info) {
 //    mpg123_exit();
 }
 
+void
+mp3_mpg123_reset (mp3_info_t *info) {
+    if (!info->mpg123_handle) {
+        mp3_mpg123_init (info);
+        return;
+    }
+    // the handle can be reused for another stream, possibly with another samplerate
+    mpg123_close (info->mpg123_handle);
+    mpg123_format_none (info->mpg123_handle);
+    mpg123_format (info->mpg123_handle, info->info.fmt.samplerate, MPG123_MONO | MPG123_STEREO, MPG123_ENC_FLOAT_32);
+    mpg123_open_feed (info->mpg123_handle);
+
+    info->mpg123_status = MPG123_NEED_MORE;
+}
+
 void
 mp3_mpg123_decode (mp3_info_t *info) {
     int samplesize = (info->info.fmt.bps>>3)*info->info.fmt.channels;
@@ -133,6 +148,7 @@ mp3_mpg123_stream_frame (mp3_info_t *info) {
 mp3_decoder_api_t mpg123_api = {
     .init = mp3_mpg123_init,
     .free = mp3_mpg123_free,
+    .reset = mp3_mpg123_reset,
     .decode = mp3_mpg123_decode,
     .stream_frame = mp3_mpg123_stream_frame,
 };
@@ -304,6 +304,8 @@ import_legacy_tf (const char *key_from, const char *key_to) {
 
 int
 notify_start (void) {
+    static const uint32_t events[] = { DB_EV_SONGSTARTED, DB_EV_CONFIGCHANGED };
+    deadbeef->plug_message_subscribe (DB_PLUGIN (&plugin), events, 2);
     import_legacy_tf ("notify.format", "notify.format_title_tf");
     import_legacy_tf ("notify.format_content", "notify.format_content_tf");
     return 0;
@@ -348,6 +348,8 @@ oss_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
 
 static int
 oss_plugin_start (void) {
+    static const uint32_t events[] = { DB_EV_CONFIGCHANGED };
+    deadbeef->plug_message_subscribe (DB_PLUGIN (&plugin), events, 1);
     deadbeef->conf_get_str ("oss.device", "/dev/dsp", oss_device, sizeof (oss_device));
     return 0;
 }
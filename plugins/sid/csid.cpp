@@ -626,6 +626,8 @@ sid_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
 
 int
 csid_start (void) {
+    static const uint32_t events[] = { DB_EV_CONFIGCHANGED };
+    deadbeef->plug_message_subscribe (DB_PLUGIN (&sid_plugin), events, 1);
     sid_configchanged ();
     return 0;
 }
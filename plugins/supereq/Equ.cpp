@@ -19,6 +19,7 @@
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 #include "paramlist.hpp"
@@ -338,13 +339,17 @@ extern "C" void equ_clearbuf(SuperEqState *state)
 	for(i=0;i<state->tabsize*state->channels;i++) state->outbuf[i] = 0;
 }
 
-extern "C" int equ_modifySamples_float (SuperEqState *state, char *buf,int nsamples,int nch)
+// The state buffers are planar, with one channel after another.
+// The samples are accessed with the stride of nch for interleaved data, or 1 for planar.
+template <bool planar> static int
+equ_modifySamples_internal (SuperEqState *state, float **bufs, int nsamples, int nch)
 {
   int i,p,ch;
   REAL *ires;
   float amax = 1.0f;
   float amin = -1.0f;
-  static float hm1 = 0, hm2 = 0;
+  static float hm1 = 0;
+  const int stride = planar ? 1 : nch;
 
   if (state->chg_ires) {
 	  state->cur_ires = state->chg_ires;
@@ -356,29 +361,33 @@ extern "C" int equ_modifySamples_float (SuperEqState *state, char *buf,int nsamp
 
   while(state->nbufsamples+nsamples >= state->winlen)
     {
-		for(i=0;i<(state->winlen-state->nbufsamples)*nch;i++)
+      int n = state->winlen-state->nbufsamples;
+      for(ch=0;ch<nch;ch++)
+		{
+          REAL *fin = state->finbuf + ch*state->winlen + state->nbufsamples;
+          REAL *out = state->outbuf + ch*state->tabsize;
+          float *b = bufs[ch] + p*stride;
+		  for(i=0;i<n;i++)
 			{
-                state->finbuf[state->nbufsamples*nch+i] = ((float *)buf)[i+p*nch];
-				float s = state->outbuf[state->nbufsamples*nch+i];
-				//if (dither) s += ditherbuf[(ditherptr++) & (DITHERLEN-1)];
-				if (s < amin) s = amin;
-				if (amax < s) s = amax;
-				((float *)buf)[i+p*nch] = s;
+              fin[i] = b[i*stride];
+              float s = out[state->nbufsamples+i];
+              if (s < amin) s = amin;
+              if (amax < s) s = amax;
+              b[i*stride] = s;
 			}
-		for(i=state->winlen*nch;i<state->tabsize*nch;i++)
-			state->outbuf[i-state->winlen*nch] = state->outbuf[i];
-
+          memmove (out, out+state->winlen, (state->tabsize-state->winlen)*sizeof(REAL));
+		}
 
-      p += state->winlen-state->nbufsamples;
-      nsamples -= state->winlen-state->nbufsamples;
+      p += n;
+      nsamples -= n;
       state->nbufsamples = 0;
 
       for(ch=0;ch<nch;ch++)
 		{
             ires = state->lires + ch * state->tabsize;
+            REAL *out = state->outbuf + ch*state->tabsize;
 
-            for(i=0;i<state->winlen;i++)
-                state->fsamples[i] = state->finbuf[nch*i+ch];
+            memcpy (state->fsamples, state->finbuf + ch*state->winlen, state->winlen*sizeof(REAL));
 
 			for(i=state->winlen;i<state->tabsize;i++)
 				state->fsamples[i] = 0;
@@ -406,29 +415,31 @@ extern "C" int equ_modifySamples_float (SuperEqState *state, char *buf,int nsamp
 				for(;i>=0;i--) state->fsamples[i] = 0;
 			}
 
-			for(i=0;i<state->winlen;i++) state->outbuf[i*nch+ch] += state->fsamples[i]/state->tabsize*2;
+			for(i=0;i<state->winlen;i++) out[i] += state->fsamples[i]/state->tabsize*2;
 
-			for(i=state->winlen;i<state->tabsize;i++) state->outbuf[i*nch+ch] = state->fsamples[i]/state->tabsize*2;
+			for(i=state->winlen;i<state->tabsize;i++) out[i] = state->fsamples[i]/state->tabsize*2;
 		}
     }
 
-		for(i=0;i<nsamples*nch;i++)
+  // frame by frame, so that the dither error is carried over the channels in the same order as before
+		for(i=0;i<nsamples;i++)
+			for(ch=0;ch<nch;ch++)
 			{
-				state->finbuf[state->nbufsamples*nch+i] = ((float *)buf)[i+p*nch];
-				float s = state->outbuf[state->nbufsamples*nch+i];
+				float *b = bufs[ch] + (p+i)*stride;
+				state->finbuf[ch*state->winlen+state->nbufsamples+i] = *b;
+				float s = state->outbuf[ch*state->tabsize+state->nbufsamples+i];
 				if (state->dither) {
 					float u;
 					s -= hm1;
 					u = s;
-//					s += ditherbuf[(ditherptr++) & (DITHERLEN-1)];
 					if (s < amin) s = amin;
 					if (amax < s) s = amax;
 					hm1 = s - u;
-					((float *)buf)[i+p*nch] = s;
+					*b = s;
 				} else {
 					if (s < amin) s = amin;
 					if (amax < s) s = amax;
-					((float *)buf)[i+p*nch] = s;
+					*b = s;
 				}
 			}
 
@@ -438,6 +449,19 @@ extern "C" int equ_modifySamples_float (SuperEqState *state, char *buf,int nsamp
   return p;
 }
 
+extern "C" int equ_modifySamples_float (SuperEqState *state, char *buf,int nsamples,int nch)
+{
+  float *bufs[32]; // channelmask limits the number of channels to 32
+  assert (nch <= 32);
+  for (int ch = 0; ch < nch; ch++) bufs[ch] = (float *)buf + ch;
+  return equ_modifySamples_internal<false> (state, bufs, nsamples, nch);
+}
+
+extern "C" int equ_modifySamples_planar (SuperEqState *state, float **bufs,int nsamples,int nch)
+{
+  return equ_modifySamples_internal<true> (state, bufs, nsamples, nch);
+}
+
 extern "C" void *paramlist_alloc (void) {
     return (void *)(new paramlist);
 }
@@ -45,6 +45,7 @@ void paramlist_free (void *);
 void equ_makeTable(SuperEqState *state, float *lbc,void *param,float fs);
 int equ_modifySamples(SuperEqState *state, char *buf,int nsamples,int nch,int bps);
 int equ_modifySamples_float (SuperEqState *state, char *buf,int nsamples,int nch);
+int equ_modifySamples_planar (SuperEqState *state, float **bufs,int nsamples,int nch);
 void equ_clearbuf(SuperEqState *state);
 void equ_init(SuperEqState *state, int wb, int channels);
 void equ_quit(SuperEqState *state);
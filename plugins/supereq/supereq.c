@@ -72,9 +72,9 @@ supereq_plugin_stop (void) {
     return 0;
 }
 
-int
-supereq_process (ddb_dsp_context_t *ctx, float *samples, int frames, int maxframes, ddb_waveformat_t *fmt, float *r) {
-    ddb_supereq_ctx_t *supereq = (ddb_supereq_ctx_t *)ctx;
+static void
+supereq_update_state (ddb_supereq_ctx_t *supereq, ddb_waveformat_t *fmt) {
+    ddb_dsp_context_t *ctx = &supereq->ctx;
     if (supereq->enabled != ctx->enabled) {
         if (ctx->enabled && !supereq->enabled) {
             supereq_reset (ctx);
@@ -94,10 +94,24 @@ supereq_process (ddb_dsp_context_t *ctx, float *samples, int frames, int maxfram
 		equ_clearbuf(&supereq->state);
         deadbeef->mutex_unlock (supereq->mutex);
     }
+}
+
+int
+supereq_process (ddb_dsp_context_t *ctx, float *samples, int frames, int maxframes, ddb_waveformat_t *fmt, float *r) {
+    ddb_supereq_ctx_t *supereq = (ddb_supereq_ctx_t *)ctx;
+    supereq_update_state (supereq, fmt);
 	equ_modifySamples_float(&supereq->state, (char *)samples,frames,fmt->channels);
 	return frames;
 }
 
+int
+supereq_process_planar (ddb_dsp_context_t *ctx, float **channels, int frames, int maxframes, ddb_waveformat_t *fmt, float *r) {
+    ddb_supereq_ctx_t *supereq = (ddb_supereq_ctx_t *)ctx;
+    supereq_update_state (supereq, fmt);
+    equ_modifySamples_planar (&supereq->state, channels, frames, fmt->channels);
+    return frames;
+}
+
 float
 supereq_get_band (ddb_dsp_context_t *ctx, int band) {
     ddb_supereq_ctx_t *supereq = (ddb_supereq_ctx_t *)ctx;
@@ -332,6 +346,7 @@ static DB_dsp_t plugin = {
     .open = supereq_open,
     .close = supereq_close,
     .process = supereq_process,
+    .process_planar = supereq_process_planar,
     .reset = supereq_reset,
     .num_params = supereq_num_params,
     .get_param_name = supereq_get_param_name,
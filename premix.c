@@ -32,6 +32,14 @@
 #include "premix.h"
 #include "fastftoi.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PREMIX_X86_SIMD 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define PREMIX_NEON 1
+#include <arm_neon.h>
+#endif
+
 #define trace(...) { fprintf(stderr, __VA_ARGS__); }
 //#define trace(fmt,...)
 
@@ -449,13 +457,17 @@ pcm_write_samples_float_to_32 (const ddb_waveformat_t * restrict inputfmt, const
                 continue;
             }
             float fsample = (*((float*)(input + channelmap[c] * 4)));
-            if (fsample > (float)0x7fffffff/0x80000000) {
-                fsample = (float)0x7fffffff/0x80000000;
+            int32_t sample;
+            // 0x7fffffff can't be represented as float, so the positive full scale needs to be clipped as integer
+            if (fsample >= 1.f) {
+                sample = 0x7fffffff;
             }
             else if (fsample < -1.f) {
-                fsample = -1.f;
+                sample = -0x7fffffff - 1;
+            }
+            else {
+                sample = fsample * (float)0x80000000;
             }
-            int32_t sample = fsample * (float)0x80000000;
             *((int32_t *)(output + 4 * c)) = sample;
         }
         input += 4 * inputfmt->channels;
@@ -525,6 +537,441 @@ remap_fn_t remappers[8][8] = {
     }
 };
 
+// Vectorized converters, used when the channel layout doesn't change,
+// so that the interleaved buffer can be converted as a flat array of samples.
+// Each converter handles as many samples as it can, and returns the number of samples converted,
+// the remainder is converted by the regular code.
+// The results are bit-exact with the scalar code on the same platform.
+typedef int (*convert_fn_t) (const char * restrict input, char * restrict output, int count);
+
+static convert_fn_t converters[8][8];
+static int simd_initialized;
+
+#if PREMIX_X86_SIMD
+__attribute__((target("sse2"))) static int
+pcm_convert_16_to_float_sse2 (const char * restrict input, char * restrict output, int count) {
+    const __m128 mul = _mm_set1_ps (1.f / 0x8000);
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(input + i * 2));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (s, s), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (s, s), 16);
+        _mm_storeu_ps ((float *)(output + i * 4), _mm_mul_ps (_mm_cvtepi32_ps (lo), mul));
+        _mm_storeu_ps ((float *)(output + i * 4 + 16), _mm_mul_ps (_mm_cvtepi32_ps (hi), mul));
+    }
+    return n;
+}
+
+// rounds to nearest, same as ftoi, and saturates the same way as the clipping in the scalar code
+__attribute__((target("sse2"))) static int
+pcm_convert_float_to_16_sse2 (const char * restrict input, char * restrict output, int count) {
+    const __m128 mul = _mm_set1_ps (0x8000);
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        __m128i lo = _mm_cvtps_epi32 (_mm_mul_ps (_mm_loadu_ps ((const float *)(input + i * 4)), mul));
+        __m128i hi = _mm_cvtps_epi32 (_mm_mul_ps (_mm_loadu_ps ((const float *)(input + i * 4 + 16)), mul));
+        _mm_storeu_si128 ((__m128i *)(output + i * 2), _mm_packs_epi32 (lo, hi));
+    }
+    return n;
+}
+
+__attribute__((target("sse2"))) static int
+pcm_convert_32_to_float_sse2 (const char * restrict input, char * restrict output, int count) {
+    const __m128 mul = _mm_set1_ps (1.f / 0x80000000);
+    int n = count & ~3;
+    for (int i = 0; i < n; i += 4) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(input + i * 4));
+        _mm_storeu_ps ((float *)(output + i * 4), _mm_mul_ps (_mm_cvtepi32_ps (s), mul));
+    }
+    return n;
+}
+
+__attribute__((target("sse2"))) static int
+pcm_convert_float_to_32_sse2 (const char * restrict input, char * restrict output, int count) {
+    const __m128 mul = _mm_set1_ps ((float)0x80000000);
+    const __m128 one = _mm_set1_ps (1.f);
+    const __m128 minval = _mm_set1_ps (-1.f);
+    int n = count & ~3;
+    for (int i = 0; i < n; i += 4) {
+        __m128 s = _mm_loadu_ps ((const float *)(input + i * 4));
+        // positive overflow converts to 0x80000000, flip it to 0x7fffffff
+        __m128i over = _mm_castps_si128 (_mm_cmpge_ps (s, one));
+        __m128i res = _mm_cvttps_epi32 (_mm_mul_ps (_mm_max_ps (s, minval), mul));
+        _mm_storeu_si128 ((__m128i *)(output + i * 4), _mm_xor_si128 (res, over));
+    }
+    return n;
+}
+
+__attribute__((target("sse2"))) static int
+pcm_convert_16_to_32_sse2 (const char * restrict input, char * restrict output, int count) {
+    const __m128i zero = _mm_setzero_si128 ();
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(input + i * 2));
+        _mm_storeu_si128 ((__m128i *)(output + i * 4), _mm_unpacklo_epi16 (zero, s));
+        _mm_storeu_si128 ((__m128i *)(output + i * 4 + 16), _mm_unpackhi_epi16 (zero, s));
+    }
+    return n;
+}
+
+__attribute__((target("sse2"))) static int
+pcm_convert_32_to_16_sse2 (const char * restrict input, char * restrict output, int count) {
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        __m128i lo = _mm_srai_epi32 (_mm_loadu_si128 ((const __m128i *)(input + i * 4)), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_loadu_si128 ((const __m128i *)(input + i * 4 + 16)), 16);
+        _mm_storeu_si128 ((__m128i *)(output + i * 2), _mm_packs_epi32 (lo, hi));
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static int
+pcm_convert_16_to_float_avx2 (const char * restrict input, char * restrict output, int count) {
+    const __m256 mul = _mm256_set1_ps (1.f / 0x8000);
+    int n = count & ~15;
+    for (int i = 0; i < n; i += 16) {
+        __m256i lo = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(input + i * 2)));
+        __m256i hi = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(input + i * 2 + 16)));
+        _mm256_storeu_ps ((float *)(output + i * 4), _mm256_mul_ps (_mm256_cvtepi32_ps (lo), mul));
+        _mm256_storeu_ps ((float *)(output + i * 4 + 32), _mm256_mul_ps (_mm256_cvtepi32_ps (hi), mul));
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static int
+pcm_convert_float_to_16_avx2 (const char * restrict input, char * restrict output, int count) {
+    const __m256 mul = _mm256_set1_ps (0x8000);
+    int n = count & ~15;
+    for (int i = 0; i < n; i += 16) {
+        __m256i lo = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_loadu_ps ((const float *)(input + i * 4)), mul));
+        __m256i hi = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_loadu_ps ((const float *)(input + i * 4 + 32)), mul));
+        // packs works within 128 bit lanes, so the 64 bit quarters need to be put back in order
+        __m256i packed = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (lo, hi), 0xd8);
+        _mm256_storeu_si256 ((__m256i *)(output + i * 2), packed);
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static int
+pcm_convert_32_to_float_avx2 (const char * restrict input, char * restrict output, int count) {
+    const __m256 mul = _mm256_set1_ps (1.f / 0x80000000);
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        __m256i s = _mm256_loadu_si256 ((const __m256i *)(input + i * 4));
+        _mm256_storeu_ps ((float *)(output + i * 4), _mm256_mul_ps (_mm256_cvtepi32_ps (s), mul));
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static int
+pcm_convert_float_to_32_avx2 (const char * restrict input, char * restrict output, int count) {
+    const __m256 mul = _mm256_set1_ps ((float)0x80000000);
+    const __m256 one = _mm256_set1_ps (1.f);
+    const __m256 minval = _mm256_set1_ps (-1.f);
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        __m256 s = _mm256_loadu_ps ((const float *)(input + i * 4));
+        __m256i over = _mm256_castps_si256 (_mm256_cmp_ps (s, one, _CMP_GE_OQ));
+        __m256i res = _mm256_cvttps_epi32 (_mm256_mul_ps (_mm256_max_ps (s, minval), mul));
+        _mm256_storeu_si256 ((__m256i *)(output + i * 4), _mm256_xor_si256 (res, over));
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static int
+pcm_convert_16_to_32_avx2 (const char * restrict input, char * restrict output, int count) {
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        __m256i s = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(input + i * 2)));
+        _mm256_storeu_si256 ((__m256i *)(output + i * 4), _mm256_slli_epi32 (s, 16));
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static int
+pcm_convert_32_to_16_avx2 (const char * restrict input, char * restrict output, int count) {
+    int n = count & ~15;
+    for (int i = 0; i < n; i += 16) {
+        __m256i lo = _mm256_srai_epi32 (_mm256_loadu_si256 ((const __m256i *)(input + i * 4)), 16);
+        __m256i hi = _mm256_srai_epi32 (_mm256_loadu_si256 ((const __m256i *)(input + i * 4 + 32)), 16);
+        __m256i packed = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (lo, hi), 0xd8);
+        _mm256_storeu_si256 ((__m256i *)(output + i * 2), packed);
+    }
+    return n;
+}
+#endif
+
+#if PREMIX_NEON
+static int
+pcm_convert_16_to_float_neon (const char * restrict input, char * restrict output, int count) {
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        int16x8_t s = vld1q_s16 ((const int16_t *)(input + i * 2));
+        float32x4_t lo = vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (s)));
+        float32x4_t hi = vcvtq_f32_s32 (vmovl_high_s16 (s));
+        vst1q_f32 ((float *)(output + i * 4), vmulq_n_f32 (lo, 1.f / 0x8000));
+        vst1q_f32 ((float *)(output + i * 4 + 16), vmulq_n_f32 (hi, 1.f / 0x8000));
+    }
+    return n;
+}
+
+// ftoi rounds half up on this platform: floor(x+.5), computed without the intermediate rounding of x+.5
+static inline int32x4_t
+_ftoi_neon (float32x4_t x) {
+    float32x4_t r = vrndmq_f32 (x);
+    uint32x4_t up = vcgeq_f32 (vsubq_f32 (x, r), vdupq_n_f32 (.5f));
+    r = vaddq_f32 (r, vreinterpretq_f32_u32 (vandq_u32 (up, vreinterpretq_u32_f32 (vdupq_n_f32 (1.f)))));
+    return vcvtq_s32_f32 (r);
+}
+
+static int
+pcm_convert_float_to_16_neon (const char * restrict input, char * restrict output, int count) {
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        int32x4_t lo = _ftoi_neon (vmulq_n_f32 (vld1q_f32 ((const float *)(input + i * 4)), 0x8000));
+        int32x4_t hi = _ftoi_neon (vmulq_n_f32 (vld1q_f32 ((const float *)(input + i * 4 + 16)), 0x8000));
+        vst1q_s16 ((int16_t *)(output + i * 2), vcombine_s16 (vqmovn_s32 (lo), vqmovn_s32 (hi)));
+    }
+    return n;
+}
+
+static int
+pcm_convert_32_to_float_neon (const char * restrict input, char * restrict output, int count) {
+    int n = count & ~3;
+    for (int i = 0; i < n; i += 4) {
+        int32x4_t s = vld1q_s32 ((const int32_t *)(input + i * 4));
+        vst1q_f32 ((float *)(output + i * 4), vmulq_n_f32 (vcvtq_f32_s32 (s), 1.f / 0x80000000));
+    }
+    return n;
+}
+
+// the conversion saturates, which gives the same clipping as the scalar code
+static int
+pcm_convert_float_to_32_neon (const char * restrict input, char * restrict output, int count) {
+    int n = count & ~3;
+    for (int i = 0; i < n; i += 4) {
+        float32x4_t s = vld1q_f32 ((const float *)(input + i * 4));
+        vst1q_s32 ((int32_t *)(output + i * 4), vcvtq_s32_f32 (vmulq_n_f32 (s, (float)0x80000000)));
+    }
+    return n;
+}
+
+static int
+pcm_convert_16_to_32_neon (const char * restrict input, char * restrict output, int count) {
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        int16x8_t s = vld1q_s16 ((const int16_t *)(input + i * 2));
+        vst1q_s32 ((int32_t *)(output + i * 4), vshll_n_s16 (vget_low_s16 (s), 16));
+        vst1q_s32 ((int32_t *)(output + i * 4 + 16), vshll_high_n_s16 (s, 16));
+    }
+    return n;
+}
+
+static int
+pcm_convert_32_to_16_neon (const char * restrict input, char * restrict output, int count) {
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        int16x4_t lo = vshrn_n_s32 (vld1q_s32 ((const int32_t *)(input + i * 4)), 16);
+        int16x4_t hi = vshrn_n_s32 (vld1q_s32 ((const int32_t *)(input + i * 4 + 16)), 16);
+        vst1q_s16 ((int16_t *)(output + i * 2), vcombine_s16 (lo, hi));
+    }
+    return n;
+}
+#endif
+
+// Gain kernels, see pcm_apply_volume_*.
+// Integer samples are scaled in double precision, which gives the exact result of (sample*vol/1000),
+// i.e. the same as the integer math they replace: the product is exact, and truncation after
+// multiplying by 0.001 can't cross an integer boundary.
+typedef int (*volume_int16_fn_t) (int16_t *samples, int count, int vol);
+typedef int (*volume_int32_fn_t) (int32_t *samples, int count, int vol);
+typedef int (*volume_float_fn_t) (float *samples, int count, float vol, int clip);
+
+static volume_int16_fn_t volume_int16;
+static volume_int32_fn_t volume_int32;
+static volume_float_fn_t volume_float;
+
+#if PREMIX_X86_SIMD
+__attribute__((target("sse2"))) static inline __m128i
+_scale_int32x4_sse2 (__m128i s, __m128d vol, __m128d scale) {
+    __m128d lo = _mm_mul_pd (_mm_mul_pd (_mm_cvtepi32_pd (s), vol), scale);
+    __m128d hi = _mm_mul_pd (_mm_mul_pd (_mm_cvtepi32_pd (_mm_shuffle_epi32 (s, 0xee)), vol), scale);
+    // values out of the int32 range convert to 0x80000000, so clip before converting
+    const __m128d maxval = _mm_set1_pd (0x7fffffff);
+    const __m128d minval = _mm_set1_pd (-(double)0x80000000);
+    lo = _mm_max_pd (_mm_min_pd (lo, maxval), minval);
+    hi = _mm_max_pd (_mm_min_pd (hi, maxval), minval);
+    return _mm_unpacklo_epi64 (_mm_cvttpd_epi32 (lo), _mm_cvttpd_epi32 (hi));
+}
+
+__attribute__((target("sse2"))) static int
+pcm_apply_volume_int16_sse2 (int16_t *samples, int count, int vol) {
+    const __m128d v = _mm_set1_pd (vol);
+    const __m128d scale = _mm_set1_pd (0.001);
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(samples + i));
+        __m128i lo = _scale_int32x4_sse2 (_mm_srai_epi32 (_mm_unpacklo_epi16 (s, s), 16), v, scale);
+        __m128i hi = _scale_int32x4_sse2 (_mm_srai_epi32 (_mm_unpackhi_epi16 (s, s), 16), v, scale);
+        _mm_storeu_si128 ((__m128i *)(samples + i), _mm_packs_epi32 (lo, hi));
+    }
+    return n;
+}
+
+__attribute__((target("sse2"))) static int
+pcm_apply_volume_int32_sse2 (int32_t *samples, int count, int vol) {
+    const __m128d v = _mm_set1_pd (vol);
+    const __m128d scale = _mm_set1_pd (0.001);
+    int n = count & ~3;
+    for (int i = 0; i < n; i += 4) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(samples + i));
+        _mm_storeu_si128 ((__m128i *)(samples + i), _scale_int32x4_sse2 (s, v, scale));
+    }
+    return n;
+}
+
+__attribute__((target("sse2"))) static int
+pcm_apply_volume_float_sse2 (float *samples, int count, float vol, int clip) {
+    const __m128 v = _mm_set1_ps (vol);
+    int n = count & ~3;
+    if (!clip) {
+        for (int i = 0; i < n; i += 4) {
+            _mm_storeu_ps (samples + i, _mm_mul_ps (_mm_loadu_ps (samples + i), v));
+        }
+        return n;
+    }
+    // min/max return the second operand if either is NaN, so NaNs pass through like in the scalar code
+    const __m128 maxval = _mm_set1_ps (1.f);
+    const __m128 minval = _mm_set1_ps (-1.f);
+    for (int i = 0; i < n; i += 4) {
+        __m128 s = _mm_mul_ps (_mm_loadu_ps (samples + i), v);
+        _mm_storeu_ps (samples + i, _mm_max_ps (minval, _mm_min_ps (maxval, s)));
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static inline __m128i
+_scale_int32x4_avx2 (__m128i s, __m256d vol, __m256d scale) {
+    const __m256d maxval = _mm256_set1_pd (0x7fffffff);
+    const __m256d minval = _mm256_set1_pd (-(double)0x80000000);
+    __m256d d = _mm256_mul_pd (_mm256_mul_pd (_mm256_cvtepi32_pd (s), vol), scale);
+    d = _mm256_max_pd (_mm256_min_pd (d, maxval), minval);
+    return _mm256_cvttpd_epi32 (d);
+}
+
+__attribute__((target("avx2"))) static int
+pcm_apply_volume_int16_avx2 (int16_t *samples, int count, int vol) {
+    const __m256d v = _mm256_set1_pd (vol);
+    const __m256d scale = _mm256_set1_pd (0.001);
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        __m256i s = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(samples + i)));
+        __m128i lo = _scale_int32x4_avx2 (_mm256_castsi256_si128 (s), v, scale);
+        __m128i hi = _scale_int32x4_avx2 (_mm256_extracti128_si256 (s, 1), v, scale);
+        _mm_storeu_si128 ((__m128i *)(samples + i), _mm_packs_epi32 (lo, hi));
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static int
+pcm_apply_volume_int32_avx2 (int32_t *samples, int count, int vol) {
+    const __m256d v = _mm256_set1_pd (vol);
+    const __m256d scale = _mm256_set1_pd (0.001);
+    int n = count & ~7;
+    for (int i = 0; i < n; i += 8) {
+        __m128i lo = _scale_int32x4_avx2 (_mm_loadu_si128 ((const __m128i *)(samples + i)), v, scale);
+        __m128i hi = _scale_int32x4_avx2 (_mm_loadu_si128 ((const __m128i *)(samples + i + 4)), v, scale);
+        _mm_storeu_si128 ((__m128i *)(samples + i), lo);
+        _mm_storeu_si128 ((__m128i *)(samples + i + 4), hi);
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static int
+pcm_apply_volume_float_avx2 (float *samples, int count, float vol, int clip) {
+    const __m256 v = _mm256_set1_ps (vol);
+    int n = count & ~7;
+    if (!clip) {
+        for (int i = 0; i < n; i += 8) {
+            _mm256_storeu_ps (samples + i, _mm256_mul_ps (_mm256_loadu_ps (samples + i), v));
+        }
+        return n;
+    }
+    // min/max return the second operand if either is NaN, so NaNs pass through like in the scalar code
+    const __m256 maxval = _mm256_set1_ps (1.f);
+    const __m256 minval = _mm256_set1_ps (-1.f);
+    for (int i = 0; i < n; i += 8) {
+        __m256 s = _mm256_mul_ps (_mm256_loadu_ps (samples + i), v);
+        _mm256_storeu_ps (samples + i, _mm256_max_ps (minval, _mm256_min_ps (maxval, s)));
+    }
+    return n;
+}
+#endif
+
+#if PREMIX_NEON
+static int
+pcm_apply_volume_float_neon (float *samples, int count, float vol, int clip) {
+    int n = count & ~3;
+    if (!clip) {
+        for (int i = 0; i < n; i += 4) {
+            vst1q_f32 (samples + i, vmulq_n_f32 (vld1q_f32 (samples + i), vol));
+        }
+        return n;
+    }
+    // NaNs propagate through vminq/vmaxq, same as in the scalar code
+    const float32x4_t maxval = vdupq_n_f32 (1.f);
+    const float32x4_t minval = vdupq_n_f32 (-1.f);
+    for (int i = 0; i < n; i += 4) {
+        float32x4_t s = vmulq_n_f32 (vld1q_f32 (samples + i), vol);
+        vst1q_f32 (samples + i, vmaxq_f32 (vminq_f32 (s, maxval), minval));
+    }
+    return n;
+}
+#endif
+
+// indices are the same as in the remappers table
+#define FMT_16 1
+#define FMT_32 3
+#define FMT_FLOAT 7
+
+static void
+_init_simd (void) {
+#if PREMIX_X86_SIMD
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2")) {
+        converters[FMT_16][FMT_FLOAT] = pcm_convert_16_to_float_avx2;
+        converters[FMT_FLOAT][FMT_16] = pcm_convert_float_to_16_avx2;
+        converters[FMT_32][FMT_FLOAT] = pcm_convert_32_to_float_avx2;
+        converters[FMT_FLOAT][FMT_32] = pcm_convert_float_to_32_avx2;
+        converters[FMT_16][FMT_32] = pcm_convert_16_to_32_avx2;
+        converters[FMT_32][FMT_16] = pcm_convert_32_to_16_avx2;
+        volume_int16 = pcm_apply_volume_int16_avx2;
+        volume_int32 = pcm_apply_volume_int32_avx2;
+        volume_float = pcm_apply_volume_float_avx2;
+    }
+    else if (__builtin_cpu_supports ("sse2")) {
+        converters[FMT_16][FMT_FLOAT] = pcm_convert_16_to_float_sse2;
+        converters[FMT_FLOAT][FMT_16] = pcm_convert_float_to_16_sse2;
+        converters[FMT_32][FMT_FLOAT] = pcm_convert_32_to_float_sse2;
+        converters[FMT_FLOAT][FMT_32] = pcm_convert_float_to_32_sse2;
+        converters[FMT_16][FMT_32] = pcm_convert_16_to_32_sse2;
+        converters[FMT_32][FMT_16] = pcm_convert_32_to_16_sse2;
+        volume_int16 = pcm_apply_volume_int16_sse2;
+        volume_int32 = pcm_apply_volume_int32_sse2;
+        volume_float = pcm_apply_volume_float_sse2;
+    }
+#elif PREMIX_NEON
+    converters[FMT_16][FMT_FLOAT] = pcm_convert_16_to_float_neon;
+    converters[FMT_FLOAT][FMT_16] = pcm_convert_float_to_16_neon;
+    converters[FMT_32][FMT_FLOAT] = pcm_convert_32_to_float_neon;
+    converters[FMT_FLOAT][FMT_32] = pcm_convert_float_to_32_neon;
+    converters[FMT_16][FMT_32] = pcm_convert_16_to_32_neon;
+    converters[FMT_32][FMT_16] = pcm_convert_32_to_16_neon;
+    volume_float = pcm_apply_volume_float_neon;
+#endif
+    simd_initialized = 1;
+}
+
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize) {
     // calculate output size
@@ -581,7 +1028,34 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
 
         int outidx = ((outputfmt->bps >> 3) - 1) | (outputfmt->is_float << 2);
         int inidx = ((inputfmt->bps >> 3) - 1) | (inputfmt->is_float << 2);
-        if (remappers[inidx][outidx]) {
+
+        int identity = inputfmt->channels == outputfmt->channels;
+        for (int i = 0; identity && i < outputfmt->channels; i++) {
+            if (channelmap[i] != i) {
+                identity = 0;
+            }
+        }
+
+        if (!simd_initialized) {
+            _init_simd ();
+        }
+
+        if (identity && inidx == outidx && remappers[inidx][outidx]) {
+            memcpy (output, input, nsamples * outputsamplesize);
+        }
+        else if (identity && converters[inidx][outidx]) {
+            // same channel layout: convert as a single channel stream
+            int count = nsamples * inputfmt->channels;
+            int done = converters[inidx][outidx] (input, output, count);
+            if (done < count) {
+                ddb_waveformat_t infmt_mono = *inputfmt;
+                ddb_waveformat_t outfmt_mono = *outputfmt;
+                infmt_mono.channels = outfmt_mono.channels = 1;
+                int monomap[1] = { 0 };
+                remappers[inidx][outidx] (&infmt_mono, input + done * (inputfmt->bps >> 3), &outfmt_mono, output + done * (outputfmt->bps >> 3), count - done, monomap, outputfmt->bps >> 3);
+            }
+        }
+        else if (remappers[inidx][outidx]) {
             remappers[inidx][outidx] (inputfmt, input, outputfmt, output, nsamples, channelmap, outputsamplesize);
         }
         else {
@@ -591,3 +1065,58 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
     return nsamples * outputsamplesize;
 }
 
+void
+pcm_apply_volume_int16 (int16_t *samples, int count, int vol) {
+    if (!simd_initialized) {
+        _init_simd ();
+    }
+    int i = volume_int16 ? volume_int16 (samples, count, vol) : 0;
+    for (; i < count; i++) {
+        int32_t sample = ((int32_t)samples[i]) * vol / 1000;
+        if (sample > 0x7fff) {
+            sample = 0x7fff;
+        }
+        else if (sample < -0x8000) {
+            sample = -0x8000;
+        }
+        samples[i] = (int16_t)sample;
+    }
+}
+
+void
+pcm_apply_volume_int32 (int32_t *samples, int count, int vol) {
+    if (!simd_initialized) {
+        _init_simd ();
+    }
+    int i = volume_int32 ? volume_int32 (samples, count, vol) : 0;
+    for (; i < count; i++) {
+        int64_t sample = ((int64_t)samples[i]) * vol / 1000;
+        if (sample > 0x7fffffff) {
+            sample = 0x7fffffff;
+        }
+        else if (sample < -0x7fffffff - 1) {
+            sample = -0x7fffffff - 1;
+        }
+        samples[i] = (int32_t)sample;
+    }
+}
+
+void
+pcm_apply_volume_float (float *samples, int count, float vol, int clip) {
+    if (!simd_initialized) {
+        _init_simd ();
+    }
+    int i = volume_float ? volume_float (samples, count, vol, clip) : 0;
+    for (; i < count; i++) {
+        float sample = samples[i] * vol;
+        if (clip) {
+            if (sample > 1.f) {
+                sample = 1.f;
+            }
+            else if (sample < -1.f) {
+                sample = -1.f;
+            }
+        }
+        samples[i] = sample;
+    }
+}
@@ -32,4 +32,15 @@
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize);
 
+// Multiply the samples by vol/1000, rounding towards zero, with clipping to the sample range
+void
+pcm_apply_volume_int16 (int16_t *samples, int count, int vol);
+
+void
+pcm_apply_volume_int32 (int32_t *samples, int count, int vol);
+
+// Multiply the samples by vol, optionally clipping to [-1..1]
+void
+pcm_apply_volume_float (float *samples, int count, float vol, int clip);
+
 #endif
@@ -31,6 +31,7 @@
 #include "replaygain.h"
 #include "conf.h"
 #include "common.h"
+#include "premix.h"
 
 static ddb_replaygain_settings_t current_settings;
 
@@ -203,18 +204,7 @@ apply_replay_gain_int16 (ddb_replaygain_settings_t *settings, char *bytes, int s
     if (vol < 0) {
         return;
     }
-    int16_t *s = (int16_t*)bytes;
-    for (int j = 0; j < size/2; j++) {
-        int32_t sample = ((int32_t)(*s)) * vol / 1000;
-        if (sample > 0x7fff) {
-            sample = 0x7fff;
-        }
-        else if (sample < -0x8000) {
-            sample = -0x8000;
-        }
-        *s = (int16_t)sample;
-        s++;
-    }
+    pcm_apply_volume_int16 ((int16_t *)bytes, size/2, vol);
 }
 
 void
@@ -242,16 +232,11 @@ apply_replay_gain_int24 (ddb_replaygain_settings_t *settings, char *bytes, int s
 
 void
 apply_replay_gain_int32 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    int64_t vol = get_int_volume (settings);
+    int vol = get_int_volume (settings);
     if (vol < 0) {
         return;
     }
-    int32_t *s = (int32_t*)bytes;
-    for (int j = 0; j < size/4; j++) {
-        int64_t sample = ((int32_t)(*s)) * vol / 1000;
-        *s = (int32_t)sample;
-        s++;
-    }
+    pcm_apply_volume_int32 ((int32_t *)bytes, size/4, vol);
 }
 
 void
@@ -291,16 +276,5 @@ apply_replay_gain_float32 (ddb_replaygain_settings_t *settings, char *bytes, int
         return;
     }
 
-    float *s = (float*)bytes;
-    for (int j = 0; j < size/4; j++) {
-        float sample = ((float)*s) * vol;
-        if (sample > 1.f) {
-            sample = 1.f;
-        }
-        else if (sample < -1.f) {
-            sample = -1.f;
-        }
-        *s = sample;
-        s++;
-    }
+    pcm_apply_volume_float ((float *)bytes, size/4, vol, 1);
 }
@@ -2,7 +2,7 @@
   This file is part of Deadbeef Player source code
   http://deadbeef.sourceforge.net
 
-  basic ring buffer implementation
+  lock-free single producer / single consumer ring buffer
 
   Copyright (C) 2009-2013 Alexey Yakovenko
 
@@ -26,68 +26,94 @@
 */
 
 #include <string.h>
+#include <assert.h>
 #include "ringbuf.h"
 
+#define load_acquire(ptr) __atomic_load_n (ptr, __ATOMIC_ACQUIRE)
+#define store_release(ptr, val) __atomic_store_n (ptr, val, __ATOMIC_RELEASE)
+
 void
 ringbuf_init (ringbuf_t *p, char *buffer, size_t size) {
+    assert (size && !(size & (size - 1)));
     memset (p, 0, sizeof (ringbuf_t));
     p->bytes = buffer;
-    p->cursor = 0;
     p->size = size;
-    p->remaining = 0;
+}
+
+size_t
+ringbuf_get_read_available (ringbuf_t *p) {
+    size_t tail = load_acquire (&p->tail);
+    size_t head = load_acquire (&p->head);
+    return head - tail;
+}
+
+size_t
+ringbuf_get_write_available (ringbuf_t *p) {
+    size_t tail = load_acquire (&p->tail);
+    return p->size - (p->head - tail);
 }
 
 int
-ringbuf_write (ringbuf_t *p, char *bytes, size_t size) {
-    if (p->size - p->remaining < size) {
+ringbuf_write (ringbuf_t *p, const char *bytes, size_t size) {
+    if (ringbuf_get_write_available (p) < size) {
         return -1;
     }
 
-    size_t cursor = p->cursor + p->remaining;
-    cursor %= p->size;
-
-    if (p->size - cursor >= size) { // split
+    size_t cursor = p->head & (p->size - 1);
+    size_t n = p->size - cursor;
+    if (n >= size) {
         memcpy (p->bytes + cursor, bytes, size);
-        p->remaining += size;
     }
-    else {
-        size_t n = p->size - cursor;
-        if (n > 0) {
-            memcpy (p->bytes + cursor, bytes, n);
-            p->remaining += n;
-            size -= n;
-            bytes += n;
-        }
-        memcpy (p->bytes, bytes, size);
-        p->remaining += size;
+    else { // split
+        memcpy (p->bytes + cursor, bytes, n);
+        memcpy (p->bytes, bytes + n, size - n);
     }
+    store_release (&p->head, p->head + size);
     return 0;
 }
 
+char *
+ringbuf_write_ptr (ringbuf_t *p, size_t *size) {
+    size_t cursor = p->head & (p->size - 1);
+    size_t avail = ringbuf_get_write_available (p);
+    *size = p->size - cursor < avail ? p->size - cursor : avail;
+    return p->bytes + cursor;
+}
+
+void
+ringbuf_write_commit (ringbuf_t *p, size_t size) {
+    store_release (&p->head, p->head + size);
+}
+
 int
 ringbuf_read (ringbuf_t *p, char *bytes, size_t size) {
-    if (p->remaining < size) {
-        size = p->remaining;
+    size_t tail = load_acquire (&p->tail);
+    size_t head = load_acquire (&p->head);
+    if (head - tail < size) {
+        size = head - tail;
+    }
+    if (!size) {
+        return 0;
     }
-    int rb = size;
 
-    if (p->size - p->cursor >= size) {
-        memcpy (bytes, p->bytes + p->cursor, size);
-        p->cursor += size;
-        p->remaining -= size;
+    size_t cursor = tail & (p->size - 1);
+    size_t n = p->size - cursor;
+    if (n >= size) {
+        memcpy (bytes, p->bytes + cursor, size);
+    }
+    else { // split
+        memcpy (bytes, p->bytes + cursor, n);
+        memcpy (bytes + n, p->bytes, size - n);
     }
-    else {
-        size_t n = p->size - p->cursor;
-        if (n > 0) {
-            memcpy (bytes, p->bytes + p->cursor, n);
-            p->cursor += n;
-            p->remaining -= n;
-            bytes += n;
-            size -= n;
-        }
-        memcpy (bytes, p->bytes, size);
-        p->cursor = size;
-        p->remaining -= size;
+
+    // fails if ringbuf_flush was called meanwhile, and the data is stale
+    if (!__atomic_compare_exchange_n (&p->tail, &tail, tail + size, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        return 0;
     }
-    return rb;
+    return (int)size;
+}
+
+void
+ringbuf_flush (ringbuf_t *p) {
+    store_release (&p->tail, load_acquire (&p->head));
 }
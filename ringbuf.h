@@ -2,7 +2,7 @@
   This file is part of Deadbeef Player source code
   http://deadbeef.sourceforge.net
 
-  basic ring buffer implementation
+  lock-free single producer / single consumer ring buffer
 
   Copyright (C) 2009-2013 Alexey Yakovenko
 
@@ -29,20 +29,48 @@
 
 #include <sys/types.h>
 
+// Lock-free ring buffer for one producer thread and one consumer thread.
+// head and tail are running byte counters, which are never wrapped,
+// so that the ring can be filled up completely.
+// Only the producer modifies head, and only the consumer (or ringbuf_flush) modifies tail.
 typedef struct {
     char *bytes;
-    size_t size;
-    size_t cursor;
-    size_t remaining;
+    size_t size; // must be a power of 2
+    size_t head; // total number of bytes written
+    size_t tail; // total number of bytes read
 } ringbuf_t;
 
 void
 ringbuf_init (ringbuf_t *p, char *buffer, size_t size);
 
+// number of bytes which can be read
+size_t
+ringbuf_get_read_available (ringbuf_t *p);
+
+// number of bytes which can be written
+size_t
+ringbuf_get_write_available (ringbuf_t *p);
+
+// producer: write all bytes, or nothing and return -1 if there's not enough space
 int
-ringbuf_write (ringbuf_t *p, char *bytes, size_t size);
+ringbuf_write (ringbuf_t *p, const char *bytes, size_t size);
 
+// producer: returns the contiguous writable region, and its size in *size;
+// the data becomes visible to the consumer after ringbuf_write_commit
+char *
+ringbuf_write_ptr (ringbuf_t *p, size_t *size);
+
+void
+ringbuf_write_commit (ringbuf_t *p, size_t size);
+
+// consumer: read up to size bytes, returns the number of bytes read;
+// returns 0 if the buffer was flushed while reading
 int
 ringbuf_read (ringbuf_t *p, char *bytes, size_t size);
 
+// discard all written data, may be called from any thread,
+// but must not race with the producer
+void
+ringbuf_flush (ringbuf_t *p);
+
 #endif
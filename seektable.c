@@ -0,0 +1,435 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2017 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "seektable.h"
+#include "common.h"
+
+// Persistent seek tables.
+//
+// Decoders which can only seek by scanning the stream from the start
+// (e.g. mp3 without an index, raw ADTS aac) can save the positions of
+// some packets once, and reuse them later, instead of scanning again.
+//
+// Each table is stored in a separate file in $CACHE/seektables,
+// named after a hash of the codec name and the file path.
+// The file size and modification time are stored with the table,
+// and it is discarded when the file changes.
+//
+// The points are stored as unsigned LEB128 deltas, typically 4-5 bytes per point.
+//
+// The first save in a session, and every SEEKTABLE_PRUNE_INTERVAL saves after it,
+// prune the directory: the tables of the files which were deleted or changed are removed,
+// followed by the oldest ones, while the total size is above SEEKTABLE_CACHE_MAX_SIZE.
+
+#define SEEKTABLE_MAGIC "DBST"
+#define SEEKTABLE_VERSION 1
+#define SEEKTABLE_MAX_POINTS 10000000
+#define SEEKTABLE_CACHE_MAX_SIZE (64*1024*1024)
+#define SEEKTABLE_PRUNE_INTERVAL 1000
+#define SEEKTABLE_TMP_MAX_AGE (60*60) // temporary files of interrupted saves
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    int64_t filesize;
+    int64_t mtime;
+    int64_t totalsamples;
+    uint32_t count;
+    uint32_t datasize; // size of the encoded points
+    uint16_t codeclen;
+    uint16_t fnamelen;
+} seektable_header_t;
+
+static int
+_seektable_path (const char *fname, const char *codec, char *path, size_t size, int create) {
+    if (!dbcachedir[0]) {
+        return -1;
+    }
+
+    // only local files can be validated
+    if (strstr (fname, "://")) {
+        return -1;
+    }
+
+    if (create) {
+        mkdir (dbcachedir, 0755);
+    }
+    if (snprintf (path, size, "%s/seektables", dbcachedir) >= size) {
+        return -1;
+    }
+    if (create) {
+        mkdir (path, 0755);
+    }
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *s = codec; ; s++) {
+        hash ^= (uint8_t)*s;
+        hash *= 1099511628211ULL;
+        if (!*s) {
+            break;
+        }
+    }
+    for (const char *s = fname; *s; s++) {
+        hash ^= (uint8_t)*s;
+        hash *= 1099511628211ULL;
+    }
+
+    if (snprintf (path, size, "%s/seektables/%016llx", dbcachedir, (unsigned long long)hash) >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+static int
+_seektable_stat (const char *fname, int64_t *filesize, int64_t *mtime) {
+    struct stat st;
+    if (stat (fname, &st) || !S_ISREG (st.st_mode)) {
+        return -1;
+    }
+    *filesize = st.st_size;
+    *mtime = st.st_mtime;
+    return 0;
+}
+
+static uint8_t *
+_put_varint (uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static const uint8_t *
+_get_varint (const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    uint64_t res = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        res |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = res;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Loads the seek table of a file, if it was saved before, and the file didn't change since then.
+// The points must be increasing, and are returned in a malloc'd array.
+// Returns 0 on success, or -1 if there's no valid table.
+int
+seektable_load (const char *fname, const char *codec, ddb_seekpoint_t **points, int *count, int64_t *totalsamples) {
+    char path[PATH_MAX];
+    int64_t filesize, mtime;
+    if (_seektable_path (fname, codec, path, sizeof (path), 0) || _seektable_stat (fname, &filesize, &mtime)) {
+        return -1;
+    }
+
+    FILE *fp = fopen (path, "rb");
+    if (!fp) {
+        return -1;
+    }
+
+    size_t codeclen = strlen (codec);
+    size_t fnamelen = strlen (fname);
+    uint8_t *data = NULL;
+    ddb_seekpoint_t *res = NULL;
+    char *names = NULL;
+    seektable_header_t hdr;
+
+    if (fread (&hdr, sizeof (hdr), 1, fp) != 1
+        || memcmp (hdr.magic, SEEKTABLE_MAGIC, 4)
+        || hdr.version != SEEKTABLE_VERSION
+        || hdr.filesize != filesize
+        || hdr.mtime != mtime
+        || hdr.codeclen != codeclen
+        || hdr.fnamelen != fnamelen
+        || !hdr.count
+        || hdr.count > SEEKTABLE_MAX_POINTS
+        || hdr.datasize > hdr.count * 20) {
+        trace ("seektable: %s is stale or invalid\n", path);
+        goto error;
+    }
+
+    // the hash may collide
+    names = malloc (codeclen + fnamelen);
+    if (fread (names, 1, codeclen + fnamelen, fp) != codeclen + fnamelen
+        || memcmp (names, codec, codeclen)
+        || memcmp (names + codeclen, fname, fnamelen)) {
+        goto error;
+    }
+
+    data = malloc (hdr.datasize);
+    res = malloc (hdr.count * sizeof (ddb_seekpoint_t));
+    if (!data || !res || fread (data, 1, hdr.datasize, fp) != hdr.datasize) {
+        goto error;
+    }
+
+    const uint8_t *p = data;
+    const uint8_t *end = data + hdr.datasize;
+    int64_t sample = 0;
+    int64_t offset = 0;
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        uint64_t ds, doffs;
+        if (!(p = _get_varint (p, end, &ds)) || !(p = _get_varint (p, end, &doffs))) {
+            goto error;
+        }
+        sample += ds;
+        offset += doffs;
+        res[i].sample = sample;
+        res[i].offset = offset;
+    }
+
+    free (names);
+    free (data);
+    fclose (fp);
+    *points = res;
+    *count = hdr.count;
+    *totalsamples = hdr.totalsamples;
+    return 0;
+
+error:
+    free (names);
+    free (data);
+    free (res);
+    fclose (fp);
+    return -1;
+}
+
+typedef struct {
+    char name[32];
+    int64_t size;
+    time_t mtime;
+} seektable_entry_t;
+
+static int
+_seektable_entry_cmp (const void *a, const void *b) {
+    time_t ta = ((const seektable_entry_t *)a)->mtime;
+    time_t tb = ((const seektable_entry_t *)b)->mtime;
+    return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+// Returns 1 if the table at path belongs to a file which still exists, and didn't change since it was saved
+static int
+_seektable_is_current (const char *path) {
+    FILE *fp = fopen (path, "rb");
+    if (!fp) {
+        return 0;
+    }
+    int res = 0;
+    char *names = NULL;
+    seektable_header_t hdr;
+    if (fread (&hdr, sizeof (hdr), 1, fp) == 1
+        && !memcmp (hdr.magic, SEEKTABLE_MAGIC, 4)
+        && hdr.version == SEEKTABLE_VERSION
+        && (names = malloc (hdr.codeclen + hdr.fnamelen + 1))
+        && fread (names, 1, hdr.codeclen + hdr.fnamelen, fp) == hdr.codeclen + hdr.fnamelen) {
+        names[hdr.codeclen + hdr.fnamelen] = 0;
+        int64_t filesize, mtime;
+        res = !_seektable_stat (names + hdr.codeclen, &filesize, &mtime)
+            && filesize == hdr.filesize
+            && mtime == hdr.mtime;
+    }
+    free (names);
+    fclose (fp);
+    return res;
+}
+
+static void
+_seektable_prune (void) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    if (snprintf (dir, sizeof (dir), "%s/seektables", dbcachedir) >= sizeof (dir)) {
+        return;
+    }
+    DIR *d = opendir (dir);
+    if (!d) {
+        return;
+    }
+
+    seektable_entry_t *entries = NULL;
+    size_t count = 0;
+    size_t alloc = 0;
+    int64_t total = 0;
+    time_t now = time (NULL);
+    struct dirent *de;
+    while ((de = readdir (d))) {
+        if (de->d_name[0] == '.' || snprintf (path, sizeof (path), "%s/%s", dir, de->d_name) >= sizeof (path)) {
+            continue;
+        }
+        struct stat st;
+        if (stat (path, &st) || !S_ISREG (st.st_mode)) {
+            continue;
+        }
+        if (strstr (de->d_name, ".tmp")) {
+            if (now - st.st_mtime > SEEKTABLE_TMP_MAX_AGE) {
+                unlink (path);
+            }
+            continue;
+        }
+        if (strlen (de->d_name) >= sizeof (entries->name)) {
+            continue;
+        }
+        if (!_seektable_is_current (path)) {
+            trace ("seektable: removing %s, the file was changed or deleted\n", path);
+            unlink (path);
+            continue;
+        }
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 256;
+            seektable_entry_t *e = realloc (entries, alloc * sizeof (seektable_entry_t));
+            if (!e) {
+                break;
+            }
+            entries = e;
+        }
+        strcpy (entries[count].name, de->d_name);
+        entries[count].size = st.st_size;
+        entries[count].mtime = st.st_mtime;
+        count++;
+        total += st.st_size;
+    }
+    closedir (d);
+
+    if (total > SEEKTABLE_CACHE_MAX_SIZE) {
+        // remove the oldest tables, leaving some room for the new ones
+        qsort (entries, count, sizeof (seektable_entry_t), _seektable_entry_cmp);
+        for (size_t i = 0; i < count && total > SEEKTABLE_CACHE_MAX_SIZE / 4 * 3; i++) {
+            snprintf (path, sizeof (path), "%s/%s", dir, entries[i].name);
+            if (!unlink (path)) {
+                total -= entries[i].size;
+            }
+        }
+    }
+    free (entries);
+}
+
+// Saves the seek table of a file, replacing the previous one.
+// The points must be increasing.
+// Returns 0 on success, -1 on error.
+int
+seektable_save (const char *fname, const char *codec, const ddb_seekpoint_t *points, int count, int64_t totalsamples) {
+    static int tmp_counter;
+    static int save_counter;
+    char path[PATH_MAX];
+    char tempfile[PATH_MAX];
+    int64_t filesize, mtime;
+
+    if (count <= 0 || count > SEEKTABLE_MAX_POINTS) {
+        return -1;
+    }
+    if (_seektable_path (fname, codec, path, sizeof (path), 1) || _seektable_stat (fname, &filesize, &mtime)) {
+        return -1;
+    }
+
+    if (__atomic_fetch_add (&save_counter, 1, __ATOMIC_RELAXED) % SEEKTABLE_PRUNE_INTERVAL == 0) {
+        _seektable_prune ();
+    }
+
+    // several decoders may save the same table at once
+    if (snprintf (tempfile, sizeof (tempfile), "%s.%d.%d.tmp", path, (int)getpid (), __atomic_add_fetch (&tmp_counter, 1, __ATOMIC_RELAXED)) >= sizeof (tempfile)) {
+        return -1;
+    }
+
+    uint8_t *data = malloc (count * 20);
+    if (!data) {
+        return -1;
+    }
+    uint8_t *p = data;
+    int64_t sample = 0;
+    int64_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        if (points[i].sample < sample || points[i].offset < offset) {
+            free (data);
+            return -1;
+        }
+        p = _put_varint (p, points[i].sample - sample);
+        p = _put_varint (p, points[i].offset - offset);
+        sample = points[i].sample;
+        offset = points[i].offset;
+    }
+
+    seektable_header_t hdr;
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, SEEKTABLE_MAGIC, 4);
+    hdr.version = SEEKTABLE_VERSION;
+    hdr.filesize = filesize;
+    hdr.mtime = mtime;
+    hdr.totalsamples = totalsamples;
+    hdr.count = count;
+    hdr.datasize = (uint32_t)(p - data);
+    hdr.codeclen = (uint16_t)strlen (codec);
+    hdr.fnamelen = (uint16_t)strlen (fname);
+
+    FILE *fp = fopen (tempfile, "w+b");
+    if (!fp) {
+        free (data);
+        return -1;
+    }
+    int err = fwrite (&hdr, sizeof (hdr), 1, fp) != 1
+        || fwrite (codec, 1, hdr.codeclen, fp) != hdr.codeclen
+        || fwrite (fname, 1, hdr.fnamelen, fp) != hdr.fnamelen
+        || fwrite (data, 1, hdr.datasize, fp) != hdr.datasize;
+    free (data);
+    if (fclose (fp) || err) {
+        unlink (tempfile);
+        return -1;
+    }
+    if (rename (tempfile, path) != 0) {
+        trace ("seektable rename %s -> %s failed: %s\n", tempfile, path, strerror (errno));
+        unlink (tempfile);
+        return -1;
+    }
+    return 0;
+}
+
+// Returns the index of the last point at or before the sample, or -1
+int
+seektable_find (const ddb_seekpoint_t *points, int count, int64_t sample) {
+    int lo = 0;
+    int hi = count - 1;
+    int res = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (points[mid].sample <= sample) {
+            res = mid;
+            lo = mid + 1;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    return res;
+}
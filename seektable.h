@@ -0,0 +1,39 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2017 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#ifndef seektable_h
+#define seektable_h
+
+#include "deadbeef.h"
+
+int
+seektable_load (const char *fname, const char *codec, ddb_seekpoint_t **points, int *count, int64_t *totalsamples);
+
+int
+seektable_save (const char *fname, const char *codec, const ddb_seekpoint_t *points, int count, int64_t totalsamples);
+
+int
+seektable_find (const ddb_seekpoint_t *points, int count, int64_t sample);
+
+#endif /* seektable_h */
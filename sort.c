@@ -25,9 +25,13 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
 #include "utf8.h"
 #include "sort.h"
 #include "tf.h"
+#include "threading.h"
+#include "dbpl.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
@@ -46,94 +50,375 @@ plt_sort (playlist_t *playlist, int iter, int id, const char *format, int order)
     plt_sort_internal (playlist, iter, id, format, order, 0);
 }
 
-static int pl_sort_is_duration;
-static int pl_sort_is_track;
-static int pl_sort_ascending;
-static int pl_sort_id;
-static int pl_sort_version; // 0: use pl_sort_format, 1: use pl_sort_tf_bytecode
-static const char *pl_sort_format;
-static char *pl_sort_tf_bytecode;
-static ddb_tf_context_t pl_sort_tf_ctx;
-
-static int
-strcasecmp_numeric (const char *a, const char *b) {
-    if (isdigit (*a) && isdigit (*b)) {
-        int anum = *a-'0';
-        const char *ae = a+1;
-        while (*ae && isdigit (*ae)) {
-            anum *= 10;
-            anum += *ae-'0';
-            ae++;
-        }
-        int bnum = *b-'0';
-        const char *be = b+1;
-        while (*be && isdigit (*be)) {
-            bnum *= 10;
-            bnum += *be-'0';
-            be++;
+// playlists with at least this many tracks are sorted on multiple threads
+#define PARALLEL_SORT_MIN_TRACKS 5000
+#define PARALLEL_SORT_MAX_THREADS 8
+
+typedef struct {
+    int is_duration;
+    int is_track;
+    int ascending;
+    int id;
+    int version; // 0: use format, 1: use tf_bytecode
+    const char *format;
+    char *tf_bytecode;
+    playlist_t *playlist;
+} pl_sort_settings_t;
+
+// Sort keys are computed once per track before sorting,
+// instead of formatting both tracks on every comparison.
+typedef struct {
+    playItem_t *it;
+    int idx; // original position, used to make the sort stable
+    int has_num; // the key starts with a number
+    int64_t num; // value of the leading number
+    const char *str; // case folded key
+    const char *rest; // part of str after the leading number
+    float duration;
+    int track;
+} pl_sort_key_t;
+
+// storage for the case folded key strings
+typedef struct {
+    char *data;
+    size_t size;
+    size_t used;
+} pl_sort_arena_t;
+
+// each worker computes and sorts the keys of one range of tracks
+typedef struct {
+    const pl_sort_settings_t *settings;
+    playItem_t **tracks;
+    pl_sort_key_t *keys;
+    pl_sort_key_t **sorted;
+    pl_sort_key_t **tmp;
+    int start;
+    int end;
+    pl_sort_arena_t arena;
+    intptr_t tid;
+} pl_sort_worker_t;
+
+static size_t
+pl_sort_arena_reserve (pl_sort_arena_t *arena, size_t size) {
+    if (arena->used + size > arena->size) {
+        size_t newsize = arena->size ? arena->size : 65536;
+        while (arena->used + size > newsize) {
+            newsize *= 2;
         }
-        if (anum == bnum) {
-            return u8_strcasecmp (ae, be);
+        arena->data = realloc (arena->data, newsize);
+        arena->size = newsize;
+    }
+    return arena->used;
+}
+
+// appends the lowercase version of str to the arena, returns its offset
+static size_t
+pl_sort_arena_append_folded (pl_sort_arena_t *arena, const char *str) {
+    size_t start = pl_sort_arena_reserve (arena, strlen (str) * 4 + 1);
+    char *out = arena->data + start;
+    const char *p = str;
+    while (*p) {
+        int32_t i = 0;
+        char s[10];
+        u8_nextchar (p, &i);
+        int l = u8_tolower ((const signed char *)p, i, s);
+        if (out + l >= arena->data + arena->size) {
+            // lowercase version is longer than expected
+            arena->used = out - arena->data;
+            pl_sort_arena_reserve (arena, l + strlen (p) * 4 + 1);
+            out = arena->data + arena->used;
         }
-        return anum - bnum;
+        memcpy (out, s, l);
+        out += l;
+        p += i;
     }
-    return u8_strcasecmp (a,b);
+    *out++ = 0;
+    arena->used = out - arena->data;
+    return start;
 }
 
-static int
-pl_sort_compare_str (playItem_t *a, playItem_t *b) {
-    if (pl_sort_is_duration) {
-        float dur_a = a->_duration * 100000;
-        float dur_b = b->_duration * 100000;
-        return !pl_sort_ascending ? dur_b - dur_a : dur_a - dur_b;
-    }
-    else if (pl_sort_is_track) {
-        int t1;
-        int t2;
-        const char *t;
-        t = pl_find_meta_raw (a, "track");
+// tf_eval and pl_format_title take pl_lock internally,
+// so this can be called without holding the lock, as long as the track is referenced
+static void
+pl_sort_make_key (const pl_sort_settings_t *settings, ddb_tf_context_t *ctx, pl_sort_arena_t *arena, pl_sort_key_t *key, playItem_t *it, int idx) {
+    memset (key, 0, sizeof (pl_sort_key_t));
+    key->it = it;
+    key->idx = idx;
+    if (settings->is_duration) {
+        key->duration = it->_duration;
+    }
+    else if (settings->is_track) {
+        pl_lock ();
+        const char *t = pl_find_meta_raw (it, "track");
         if (t && !isdigit (*t)) {
-            t1 = 999999;
+            key->track = 999999;
         }
         else {
-            t1 = t ? atoi (t) : -1;
+            key->track = t ? atoi (t) : -1;
         }
-        t = pl_find_meta_raw (b, "track");
-        if (t && !isdigit (*t)) {
-            t2 = 999999;
+        pl_unlock ();
+    }
+    else {
+        char tmp[1024];
+        if (settings->version == 0) {
+            pl_format_title (it, -1, tmp, sizeof (tmp), settings->id, settings->format);
+        }
+        else {
+            ctx->it = (ddb_playItem_t *)it;
+            tf_eval (ctx, settings->tf_bytecode, tmp, sizeof (tmp));
+        }
+        // store the offset until the arena stops moving, see pl_sort_fixup_keys
+        size_t offs = pl_sort_arena_append_folded (arena, tmp);
+        key->str = (const char *)(uintptr_t)offs;
+        const char *p = tmp;
+        if (isdigit (*p)) {
+            key->has_num = 1;
+            while (isdigit (*p)) {
+                key->num = key->num * 10 + (*p - '0');
+                p++;
+            }
+        }
+        key->rest = (const char *)(uintptr_t)(offs + (p - tmp));
+    }
+}
+
+static void
+pl_sort_fixup_keys (const pl_sort_settings_t *settings, pl_sort_arena_t *arena, pl_sort_key_t *keys, int count) {
+    if (settings->is_duration || settings->is_track) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        keys[i].str = arena->data + (uintptr_t)keys[i].str;
+        keys[i].rest = arena->data + (uintptr_t)keys[i].rest;
+    }
+}
+
+// same ordering as u8_strcasecmp, with leading numbers compared by value
+static int
+pl_sort_compare_keys (const pl_sort_settings_t *settings, const pl_sort_key_t *a, const pl_sort_key_t *b) {
+    int res;
+    if (settings->is_duration) {
+        res = a->duration < b->duration ? -1 : (a->duration > b->duration ? 1 : 0);
+    }
+    else if (settings->is_track) {
+        res = a->track - b->track;
+    }
+    else if (a->has_num && b->has_num) {
+        if (a->num == b->num) {
+            res = strcmp (a->rest, b->rest);
         }
         else {
-            t2 = t ? atoi (t) : -1;
+            res = a->num < b->num ? -1 : 1;
         }
-        return !pl_sort_ascending ? t2 - t1 : t1 - t2;
     }
     else {
-        char tmp1[1024];
-        char tmp2[1024];
-        if (pl_sort_version == 0) {
-            pl_format_title (a, -1, tmp1, sizeof (tmp1), pl_sort_id, pl_sort_format);
-            pl_format_title (b, -1, tmp2, sizeof (tmp2), pl_sort_id, pl_sort_format);
+        res = strcmp (a->str, b->str);
+    }
+    if (!settings->ascending) {
+        res = -res;
+    }
+    if (!res) {
+        res = a->idx - b->idx;
+    }
+    return res;
+}
+
+// merges the sorted runs a and b into out, which must not overlap them
+static void
+pl_sort_merge (const pl_sort_settings_t *settings, pl_sort_key_t **out, pl_sort_key_t **a, int na, pl_sort_key_t **b, int nb) {
+    int ia = 0, ib = 0;
+    while (ia < na && ib < nb) {
+        if (pl_sort_compare_keys (settings, b[ib], a[ia]) < 0) {
+            *out++ = b[ib++];
         }
         else {
-            pl_sort_tf_ctx.id = pl_sort_id;
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)a;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp1, sizeof(tmp1));
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)b;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp2, sizeof(tmp2));
+            *out++ = a[ia++];
         }
-        int res = strcasecmp_numeric (tmp1, tmp2);
-        if (!pl_sort_ascending) {
-            res = -res;
+    }
+    memcpy (out, a + ia, (na - ia) * sizeof (pl_sort_key_t *));
+    out += na - ia;
+    memcpy (out, b + ib, (nb - ib) * sizeof (pl_sort_key_t *));
+}
+
+// merge sort, tmp must have the same size as keys
+static void
+pl_sort_mergesort (const pl_sort_settings_t *settings, pl_sort_key_t **keys, pl_sort_key_t **tmp, int count) {
+    if (count <= 16) {
+        for (int i = 1; i < count; i++) {
+            pl_sort_key_t *k = keys[i];
+            int j = i;
+            for (; j > 0 && pl_sort_compare_keys (settings, k, keys[j-1]) < 0; j--) {
+                keys[j] = keys[j-1];
+            }
+            keys[j] = k;
         }
-        return res;
+        return;
+    }
+    int half = count / 2;
+    pl_sort_mergesort (settings, keys, tmp, half);
+    pl_sort_mergesort (settings, keys + half, tmp + half, count - half);
+    if (pl_sort_compare_keys (settings, keys[half-1], keys[half]) <= 0) {
+        return; // already in order
+    }
+    memcpy (tmp, keys, count * sizeof (pl_sort_key_t *));
+    pl_sort_merge (settings, keys, tmp, half, tmp + half, count - half);
+}
+
+static void
+pl_sort_worker (void *ctx) {
+    pl_sort_worker_t *w = ctx;
+    const pl_sort_settings_t *settings = w->settings;
+
+    ddb_tf_context_t tf_ctx;
+    memset (&tf_ctx, 0, sizeof (tf_ctx));
+    tf_ctx._size = sizeof (tf_ctx);
+    tf_ctx.plt = (ddb_playlist_t *)settings->playlist;
+    tf_ctx.idx = -1;
+    tf_ctx.id = settings->id;
+
+    for (int i = w->start; i < w->end; i++) {
+        pl_sort_make_key (settings, &tf_ctx, &w->arena, &w->keys[i], w->tracks[i], i);
     }
+    pl_sort_fixup_keys (settings, &w->arena, w->keys + w->start, w->end - w->start);
+
+    for (int i = w->start; i < w->end; i++) {
+        w->sorted[i] = &w->keys[i];
+    }
+    pl_sort_mergesort (settings, w->sorted + w->start, w->tmp + w->start, w->end - w->start);
+}
+
+// merges two adjacent sorted ranges of the previous merge pass
+static void
+pl_sort_merge_worker (void *ctx) {
+    pl_sort_worker_t *w = ctx;
+    pl_sort_worker_t *next = w + 1;
+    int na = w->end - w->start;
+    int nb = next->end - next->start;
+    memcpy (w->tmp + w->start, w->sorted + w->start, (na + nb) * sizeof (pl_sort_key_t *));
+    pl_sort_merge (w->settings, w->sorted + w->start, w->tmp + w->start, na, w->tmp + next->start, nb);
 }
 
 static int
-qsort_cmp_func (const void *a, const void *b) {
-    playItem_t *aa = *((playItem_t **)a);
-    playItem_t *bb = *((playItem_t **)b);
-    return pl_sort_compare_str (aa, bb);
+pl_sort_get_num_threads (int count) {
+    if (count < PARALLEL_SORT_MIN_TRACKS || pl_is_locked ()) {
+        // workers need pl_lock for formatting
+        return 1;
+    }
+    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) {
+        return 1;
+    }
+    return ncpu > PARALLEL_SORT_MAX_THREADS ? PARALLEL_SORT_MAX_THREADS : (int)ncpu;
+}
+
+// sorts tracks in place
+// the tracks must be referenced by the caller;
+// when called without pl_lock held, the keys are computed and sorted on several threads
+static void
+pl_sort_tracks (const pl_sort_settings_t *settings, playItem_t **tracks, int count) {
+    int num_threads = pl_sort_get_num_threads (count);
+
+    pl_sort_key_t *keys = malloc (count * sizeof (pl_sort_key_t));
+    pl_sort_key_t **sorted = malloc (count * sizeof (pl_sort_key_t *));
+    pl_sort_key_t **tmp = malloc (count * sizeof (pl_sort_key_t *));
+    pl_sort_worker_t workers[PARALLEL_SORT_MAX_THREADS];
+    memset (workers, 0, sizeof (workers));
+
+    for (int i = 0; i < num_threads; i++) {
+        pl_sort_worker_t *w = &workers[i];
+        w->settings = settings;
+        w->tracks = tracks;
+        w->keys = keys;
+        w->sorted = sorted;
+        w->tmp = tmp;
+        w->start = (int)((int64_t)count * i / num_threads);
+        w->end = (int)((int64_t)count * (i+1) / num_threads);
+    }
+
+    // the first range is processed on the calling thread
+    for (int i = 1; i < num_threads; i++) {
+        workers[i].tid = thread_start (pl_sort_worker, &workers[i]);
+    }
+    pl_sort_worker (&workers[0]);
+    for (int i = 1; i < num_threads; i++) {
+        if (workers[i].tid) {
+            thread_join (workers[i].tid);
+        }
+        else {
+            pl_sort_worker (&workers[i]);
+        }
+    }
+
+    // merge the ranges pairwise, until there's only one left
+    int num_ranges = num_threads;
+    while (num_ranges > 1) {
+        for (int i = 2; i + 1 < num_ranges; i += 2) {
+            workers[i].tid = thread_start (pl_sort_merge_worker, &workers[i]);
+        }
+        pl_sort_merge_worker (&workers[0]);
+        int n = 0;
+        for (int i = 0; i < num_ranges; i += 2) {
+            if (i > 0 && i + 1 < num_ranges) {
+                if (workers[i].tid) {
+                    thread_join (workers[i].tid);
+                }
+                else {
+                    pl_sort_merge_worker (&workers[i]);
+                }
+            }
+            workers[n].start = workers[i].start;
+            workers[n].end = i + 1 < num_ranges ? workers[i+1].end : workers[i].end;
+            n++;
+        }
+        num_ranges = n;
+    }
+
+    for (int i = 0; i < count; i++) {
+        tracks[i] = sorted[i]->it;
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        free (workers[i].arena.data);
+    }
+    free (keys);
+    free (sorted);
+    free (tmp);
+}
+
+static void
+pl_sort_init_settings (pl_sort_settings_t *settings, playlist_t *playlist, int id, const char *format, int ascending, int version) {
+    memset (settings, 0, sizeof (pl_sort_settings_t));
+    settings->ascending = ascending;
+    settings->id = id;
+    settings->version = version;
+    settings->playlist = playlist;
+    if (version == 0) {
+        settings->format = format;
+    }
+    else {
+        settings->tf_bytecode = tf_compile (format);
+    }
+
+    if (format && id == -1
+        && ((version == 0 && !strcmp (format, "%l"))
+            || (version == 1 && !strcmp (format, "%length%")))
+        ) {
+        settings->is_duration = 1;
+    }
+    if (format && id == -1
+        && ((version == 0 && !strcmp (format, "%n"))
+            || (version == 1 && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))))
+        ) {
+        settings->is_track = 1;
+    }
+}
+
+static void
+pl_sort_free_settings (pl_sort_settings_t *settings) {
+    if (settings->tf_bytecode) {
+        tf_free (settings->tf_bytecode);
+        settings->tf_bytecode = NULL;
+    }
 }
 
 void
@@ -178,6 +463,12 @@ plt_sort_random (playlist_t *playlist, int iter) {
         prev = it;
     }
     playlist->tail[iter] = array[playlist->count[iter]-1];
+    plt_index_invalidate (playlist, iter);
+    if (iter == PL_MAIN) {
+        dbpl2_journal_invalidate (playlist);
+    }
+    plt_search_forget (playlist);
+    plt_search_index_invalidate (playlist);
 
     free (array);
 
@@ -186,8 +477,48 @@ plt_sort_random (playlist_t *playlist, int iter) {
     pl_unlock ();
 }
 
+// returns a referenced array of the tracks in the list
+static playItem_t **
+plt_sort_get_tracks (playlist_t *playlist, int iter, int *count) {
+    *count = playlist->count[iter];
+    playItem_t **array = malloc (*count * sizeof (playItem_t *));
+    int idx = 0;
+    for (playItem_t *it = playlist->head[iter]; it && idx < *count; it = it->next[iter], idx++) {
+        pl_item_ref (it);
+        array[idx] = it;
+    }
+    *count = idx;
+    return array;
+}
+
+static void
+plt_sort_free_tracks (playItem_t **array, int count) {
+    for (int i = 0; i < count; i++) {
+        pl_item_unref (array[i]);
+    }
+    free (array);
+}
+
+// checks that the list contains exactly the tracks in the array
+static int
+plt_sort_tracks_unchanged (playlist_t *playlist, int iter, int modification_idx, playItem_t **array, int count) {
+    if (playlist->modification_idx != modification_idx || playlist->count[iter] != count) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        playItem_t *it = array[i];
+        if (!it->prev[iter] && !it->next[iter] && playlist->head[iter] != it) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 // version 0: title formatting v1
 // version 1: title formatting v2
+//
+// The keys are computed and sorted without holding pl_lock,
+// which is only taken to get the tracks and to relink them in the sorted order.
 void
 plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, int order, int version) {
     if (order == DDB_SORT_RANDOM) {
@@ -199,106 +530,78 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
     if (format == NULL || id == DB_COLUMN_FILENUMBER || !playlist->head[iter] || !playlist->head[iter]->next[iter]) {
         return;
     }
-    pl_lock ();
     struct timeval tm1;
     gettimeofday (&tm1, NULL);
-    pl_sort_ascending = ascending;
     trace ("ascending: %d\n", ascending);
-    pl_sort_id = id;
 
-    pl_sort_version = version;
-    if (version == 0) {
-        pl_sort_format = format;
-        pl_sort_tf_bytecode = NULL;
-    }
-    else {
-        pl_sort_format = NULL;
-        pl_sort_tf_bytecode = tf_compile (format);
-        pl_sort_tf_ctx._size = sizeof (pl_sort_tf_ctx);
-        pl_sort_tf_ctx.it = NULL;
-        pl_sort_tf_ctx.plt = (ddb_playlist_t *)playlist;
-        pl_sort_tf_ctx.idx = -1;
-        pl_sort_tf_ctx.id = id;
-    }
+    pl_sort_settings_t settings;
+    pl_sort_init_settings (&settings, playlist, id, format, ascending, version);
 
-    if (format && id == -1
-        && ((version == 0 && !strcmp (format, "%l"))
-            || (version == 1 && !strcmp (format, "%length%")))
-        ) {
-        pl_sort_is_duration = 1;
-    }
-    else {
-        pl_sort_is_duration = 0;
-    }
-    if (format && id == -1
-        && ((version == 0 && !strcmp (format, "%n"))
-            || (version == 1 && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))))
-        ) {
-        pl_sort_is_track = 1;
-    }
-    else {
-        pl_sort_is_track = 0;
-    }
+    pl_lock ();
+    int modification_idx = playlist->modification_idx;
+    int count;
+    playItem_t **array = plt_sort_get_tracks (playlist, iter, &count);
+    pl_unlock ();
 
-    int cursor = plt_get_cursor (playlist, PL_MAIN);
-    playItem_t *track_under_cursor = NULL;
-    if (cursor != -1) {
-        track_under_cursor = plt_get_item_for_idx (playlist, cursor, PL_MAIN);
-    }
-    playItem_t **array = malloc (playlist->count[iter] * sizeof (playItem_t *));
-    int idx = 0;
-    for (playItem_t *it = playlist->head[iter]; it; it = it->next[iter], idx++) {
-        array[idx] = it;
+    pl_sort_tracks (&settings, array, count);
+
+    pl_lock ();
+    if (!plt_sort_tracks_unchanged (playlist, iter, modification_idx, array, count)) {
+        // the playlist was modified while sorting, sort again with the lock held
+        trace ("playlist modified during sort, retrying\n");
+        plt_sort_free_tracks (array, count);
+        array = plt_sort_get_tracks (playlist, iter, &count);
+        pl_sort_tracks (&settings, array, count);
     }
 
-#if HAVE_MERGESORT
-    mergesort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#endif
-    playItem_t *prev = NULL;
-    playlist->head[iter] = 0;
-    for (idx = 0; idx < playlist->count[iter]; idx++) {
-        playItem_t *it = array[idx];
-        it->prev[iter] = prev;
-        it->next[iter] = NULL;
-        if (!prev) {
-            playlist->head[iter] = it;
+    if (count > 0) {
+        int cursor = plt_get_cursor (playlist, PL_MAIN);
+        playItem_t *track_under_cursor = NULL;
+        if (cursor != -1) {
+            track_under_cursor = plt_get_item_for_idx (playlist, cursor, PL_MAIN);
         }
-        else {
-            prev->next[iter] = it;
+
+        playItem_t *prev = NULL;
+        playlist->head[iter] = 0;
+        for (int idx = 0; idx < count; idx++) {
+            playItem_t *it = array[idx];
+            it->prev[iter] = prev;
+            it->next[iter] = NULL;
+            if (!prev) {
+                playlist->head[iter] = it;
+            }
+            else {
+                prev->next[iter] = it;
+            }
+            prev = it;
         }
-        prev = it;
-    }
 
-    playlist->tail[iter] = array[playlist->count[iter]-1];
+        playlist->tail[iter] = array[count-1];
+        plt_index_invalidate (playlist, iter);
+        if (iter == PL_MAIN) {
+            dbpl2_journal_invalidate (playlist);
+        }
+        plt_search_forget (playlist);
+        plt_search_index_invalidate (playlist);
 
-    free (array);
+        if (track_under_cursor) {
+            cursor = plt_get_item_idx (playlist, track_under_cursor, PL_MAIN);
+            plt_set_cursor (playlist, PL_MAIN, cursor);
+            pl_item_unref (track_under_cursor);
+        }
 
-    if (track_under_cursor) {
-        cursor = plt_get_item_idx (playlist, track_under_cursor, PL_MAIN);
-        plt_set_cursor (playlist, PL_MAIN, cursor);
-        pl_item_unref (track_under_cursor);
+        plt_modified (playlist);
     }
 
+    plt_sort_free_tracks (array, count);
+    pl_unlock ();
+
+    pl_sort_free_settings (&settings);
+
     struct timeval tm2;
     gettimeofday (&tm2, NULL);
     int ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
     trace ("sort time: %f seconds\n", ms / 1000.f);
-
-    plt_modified (playlist);
-
-    if (version == 0) {
-        pl_sort_format = NULL;
-    }
-
-    if (version == 1) {
-        tf_free (pl_sort_tf_bytecode);
-        pl_sort_tf_bytecode = NULL;
-        memset (&pl_sort_tf_ctx, 0, sizeof (pl_sort_tf_ctx));
-    }
-
-    pl_unlock ();
 }
 
 void
@@ -313,44 +616,8 @@ sort_track_array (playlist_t *playlist, playItem_t **tracks, int num_tracks, con
         return;
     }
 
-    pl_lock ();
-    pl_sort_ascending = ascending;
-    pl_sort_id = -1;
-
-    pl_sort_version = 1;
-    pl_sort_format = NULL;
-    pl_sort_tf_bytecode = tf_compile (format);
-    pl_sort_tf_ctx._size = sizeof (pl_sort_tf_ctx);
-    pl_sort_tf_ctx.it = NULL;
-    pl_sort_tf_ctx.plt = (ddb_playlist_t *)playlist;
-    pl_sort_tf_ctx.idx = -1;
-    pl_sort_tf_ctx.id = -1;
-
-    if (format
-        && !strcmp (format, "%length%")) {
-        pl_sort_is_duration = 1;
-    }
-    else {
-        pl_sort_is_duration = 0;
-    }
-    if (format
-        && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))) {
-        pl_sort_is_track = 1;
-    }
-    else {
-        pl_sort_is_track = 0;
-    }
-
-#if HAVE_MERGESORT
-    mergesort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#endif
-
-    tf_free (pl_sort_tf_bytecode);
-    pl_sort_tf_bytecode = NULL;
-    memset (&pl_sort_tf_ctx, 0, sizeof (pl_sort_tf_ctx));
-
-    pl_unlock ();
+    pl_sort_settings_t settings;
+    pl_sort_init_settings (&settings, playlist, -1, format, ascending, 1);
+    pl_sort_tracks (&settings, tracks, num_tracks);
+    pl_sort_free_settings (&settings);
 }
-
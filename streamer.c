@@ -45,7 +45,8 @@
 #include "volume.h"
 #include "vfs.h"
 #include "premix.h"
-#include "fft.h"
+#include "ringbuf.h"
+#include "vis.h"
 #include "handler.h"
 #include "plugins/libparser/parser.h"
 #include "strdupa.h"
@@ -70,6 +71,43 @@ FILE *out;
 
 static intptr_t streamer_tid;
 
+// DSP runs on its own thread, up to DSP_RUNAHEAD_MS ahead of the output
+#define DSP_RUNAHEAD_MS 200
+static intptr_t dsp_tid;
+static uintptr_t dsp_mutex;
+static uintptr_t dsp_cond;
+static int dsp_wakeup;
+static int dsp_terminate;
+static int last_read_size; // size of the last streamer_read request
+static int last_block_bitrate = -1;
+
+// Gapless playback: when less than PRELOAD_SECONDS of the streaming track
+// are left to decode, the predicted next track is opened on a separate thread,
+// and its first PRELOAD_PREROLL_MS are decoded.
+// The prediction is re-checked every second, in case the queue or the playlist changes.
+#define PRELOAD_SECONDS 10
+#define PRELOAD_PREROLL_MS 500
+// how long the streamer waits for a preload in progress, before opening the track itself
+#define PRELOAD_WAIT_MS 2000
+enum {
+    PRELOAD_NONE, // nothing is preloaded, or the preload has failed
+    PRELOAD_PENDING,
+    PRELOAD_RUNNING,
+    PRELOAD_READY,
+};
+static uintptr_t preload_mutex;
+static uintptr_t preload_cond; // signalled when the preload thread has finished opening a track
+static intptr_t preload_tid;
+static int preload_thread_running;
+static int preload_state;
+static int preload_generation; // incremented every time the preload is discarded
+static playItem_t *preload_track;
+static DB_fileinfo_t *preload_fileinfo;
+static DB_FILE *preload_file; // for aborting the preload in progress
+static char *preload_preroll;
+static int preload_preroll_size;
+static float preload_checked_pos = -1; // read position of the streaming track at the last prediction
+
 static int autoconv_8_to_16 = 1;
 
 static int autoconv_16_to_24 = 0;
@@ -89,7 +127,6 @@ static int stop_after_album = 0;
 static int streaming_terminate;
 
 static uintptr_t mutex;
-static uintptr_t wdl_mutex; // wavedata listener
 
 static float last_seekpos = -1;
 
@@ -107,6 +144,8 @@ static playItem_t *streaming_track;
 static playItem_t *last_played; // this is the last track that was played, should avoid setting this to NULL
 
 static int _format_change_wait;
+// set by the DSP thread when the playback has stopped and the output buffer is drained
+static int _output_ended;
 static ddb_waveformat_t prev_output_format; // last format that was sent to output via streamer_set_output_format
 static ddb_waveformat_t last_block_fmt; // input file format corresponding to the current output
 
@@ -114,6 +153,7 @@ static DB_fileinfo_t *fileinfo;
 static DB_FILE *fileinfo_file;
 static DB_fileinfo_t *new_fileinfo;
 static DB_FILE *new_fileinfo_file;
+static DB_fileinfo_t *reinit_fileinfo; // decoder in dec->reinit, its current file can be aborted
 
 // This counter is incremented by one for each streamer_read call, which returns -1,
 // which means audio should stop, but we need to wait a bit until buffered data has finished playing,
@@ -128,24 +168,9 @@ static DB_FILE *streamer_file;
 #include "equalizer.h"
 #endif
 
-static float freq_data[DDB_FREQ_BANDS * DDB_FREQ_MAX_CHANNELS];
-static float audio_data[DDB_FREQ_BANDS * 2 * DDB_FREQ_MAX_CHANNELS];
-static int audio_data_fill = 0;
-static int audio_data_channels = 0;
-
 // message queue
 static struct handler_s *handler;
 
-// visualization stuff
-typedef struct wavedata_listener_s {
-    void *ctx;
-    void (*callback)(void *ctx, ddb_audio_data_t *data);
-    struct wavedata_listener_s *next;
-} wavedata_listener_t;
-
-static wavedata_listener_t *waveform_listeners;
-static wavedata_listener_t *spectrum_listeners;
-
 #if DETECT_PL_LOCK_RC
 volatile pthread_t streamer_lock_tid = 0;
 #endif
@@ -187,10 +212,18 @@ stream_track (playItem_t *track, int startpaused);
 static void
 _handle_playback_stopped (void);
 
+static void
+_dsp_thread_wakeup (void);
+
+static void
+dsp_thread (void *unused);
+
 static void
 streamer_abort_files (void) {
     DB_FILE *file = fileinfo_file;
     DB_FILE *newfile = new_fileinfo_file;
+    DB_fileinfo_t *reinit = reinit_fileinfo;
+    DB_FILE *reinitfile = reinit ? reinit->file : NULL;
     DB_FILE *strfile = streamer_file;
     trace ("\033[0;33mstreamer_abort_files\033[37;0m\n");
     trace ("%p %p %p\n", file, newfile, strfile);
@@ -201,9 +234,19 @@ streamer_abort_files (void) {
     if (newfile) {
         deadbeef->fabort (newfile);
     }
+    if (reinitfile) {
+        deadbeef->fabort (reinitfile);
+    }
     if (strfile) {
         deadbeef->fabort (strfile);
     }
+    if (preload_mutex) {
+        mutex_lock (preload_mutex);
+        if (preload_file) {
+            deadbeef->fabort (preload_file);
+        }
+        mutex_unlock (preload_mutex);
+    }
 
 }
 
@@ -327,16 +370,7 @@ str_get_idx_of (playItem_t *it) {
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
     }
-    playItem_t *c = streamer_playlist->head[PL_MAIN];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[PL_MAIN];
-        idx++;
-    }
-    if (!c) {
-        pl_unlock ();
-        return -1;
-    }
+    int idx = plt_get_item_idx (streamer_playlist, it, PL_MAIN);
     pl_unlock ();
     return idx;
 }
@@ -349,17 +383,7 @@ str_get_for_idx (int idx) {
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
     }
-    playItem_t *it = streamer_playlist->head[PL_MAIN];
-    while (idx--) {
-        if (!it) {
-            pl_unlock ();
-            return NULL;
-        }
-        it = it->next[PL_MAIN];
-    }
-    if (it) {
-        pl_item_ref (it);
-    }
+    playItem_t *it = plt_get_item_for_idx (streamer_playlist, idx, PL_MAIN);
     pl_unlock ();
     return it;
 }
@@ -448,8 +472,10 @@ get_random_track (void) {
     return plt_get_item_for_idx (plt, r, PL_MAIN);
 }
 
+// With predict=1, the playback state is not changed,
+// and NULL is returned if the next track can't be known in advance.
 static playItem_t *
-get_next_track (playItem_t *curr) {
+get_next_track_real (playItem_t *curr, int predict) {
     pl_lock ();
     if (!streamer_playlist) {
         playlist_t *plt = plt_get_curr ();
@@ -505,7 +531,7 @@ get_next_track (playItem_t *curr) {
             it = pmin;
             if (!it) {
                 // all songs played, reshuffle and try again
-                if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL) { // loop
+                if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL && !predict) { // loop
                     plt_reshuffle (streamer_playlist, &it, NULL);
                 }
             }
@@ -527,6 +553,10 @@ get_next_track (playItem_t *curr) {
                 }
             }
             it = pmin;
+            if (!it && predict) {
+                pl_unlock ();
+                return NULL;
+            }
             if (!it) {
                 // all songs played, reshuffle and try again
                 if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL) { // loop
@@ -581,12 +611,17 @@ get_next_track (playItem_t *curr) {
     }
     else if (pl_order == PLAYBACK_ORDER_RANDOM) { // random
         pl_unlock ();
-        return get_random_track ();
+        return predict ? NULL : get_random_track ();
     }
     pl_unlock ();
     return NULL;
 }
 
+static playItem_t *
+get_next_track (playItem_t *curr) {
+    return get_next_track_real (curr, 0);
+}
+
 static playItem_t *
 get_prev_track (playItem_t *curr) {
     pl_lock ();
@@ -836,6 +871,234 @@ static DB_fileinfo_t *dec_open (DB_decoder_t *dec, uint32_t hints, playItem_t *i
     return dec->open (hints);
 }
 
+// Opens and initializes the decoder on the preload thread.
+// Tracks without a known decoder need content-type detection, which is left to stream_track.
+static DB_fileinfo_t *
+_preload_open (playItem_t *track, char **preroll, int *preroll_size) {
+    char decoder_id[100] = "";
+    pl_lock ();
+    const char *decoder = pl_find_meta (track, ":DECODER");
+    if (decoder) {
+        strncpy (decoder_id, decoder, sizeof (decoder_id) - 1);
+    }
+    pl_unlock ();
+
+    DB_decoder_t *dec = decoder_id[0] ? plug_get_decoder_for_id (decoder_id) : NULL;
+    if (!dec) {
+        return NULL;
+    }
+
+    trace ("preloading %s (%s)\n", pl_find_meta (track, ":URI"), dec->plugin.id);
+    DB_fileinfo_t *fi = dec_open (dec, STREAMER_HINTS, track);
+    if (!fi) {
+        return NULL;
+    }
+    mutex_lock (preload_mutex);
+    preload_file = fi->file;
+    mutex_unlock (preload_mutex);
+    int res = dec->init (fi, DB_PLAYITEM (track));
+    // the file may have been opened by init, keep it published only while it's valid
+    mutex_lock (preload_mutex);
+    preload_file = res == 0 ? fi->file : NULL;
+    mutex_unlock (preload_mutex);
+    if (res != 0) {
+        dec->free (fi);
+        return NULL;
+    }
+
+    // decoders which apply replaygain themselves depend on the settings of the streaming track
+    if (!(dec->plugin.flags & DDB_PLUGIN_FLAG_REPLAYGAIN)) {
+        int samplesize = fi->fmt.channels * (fi->fmt.bps >> 3);
+        int size = fi->fmt.samplerate * PRELOAD_PREROLL_MS / 1000 * samplesize;
+        char *buf = size > 0 ? malloc (size) : NULL;
+        if (buf) {
+            int rb = fi->plugin->read (fi, buf, size);
+            if (rb > 0) {
+                *preroll = buf;
+                *preroll_size = rb - rb % samplesize;
+            }
+            else {
+                free (buf);
+            }
+        }
+    }
+    return fi;
+}
+
+static void
+preload_thread (void *unused) {
+#if defined(__linux__) && !defined(ANDROID)
+    prctl (PR_SET_NAME, "deadbeef-preload", 0, 0, 0, 0);
+#endif
+
+    for (;;) {
+        mutex_lock (preload_mutex);
+        if (preload_state != PRELOAD_PENDING) {
+            preload_thread_running = 0;
+            mutex_unlock (preload_mutex);
+            break;
+        }
+        preload_state = PRELOAD_RUNNING;
+        int generation = preload_generation;
+        playItem_t *track = preload_track;
+        pl_item_ref (track);
+        mutex_unlock (preload_mutex);
+
+        char *preroll = NULL;
+        int preroll_size = 0;
+        DB_fileinfo_t *fi = _preload_open (track, &preroll, &preroll_size);
+
+        mutex_lock (preload_mutex);
+        preload_file = NULL;
+        if (generation == preload_generation) {
+            if (fi) {
+                preload_fileinfo = fi;
+                preload_preroll = preroll;
+                preload_preroll_size = preroll_size;
+                preload_state = PRELOAD_READY;
+                fi = NULL;
+                preroll = NULL;
+            }
+            else {
+                preload_state = PRELOAD_NONE;
+            }
+        }
+        cond_broadcast (preload_cond);
+        mutex_unlock (preload_mutex);
+
+        // discarded while opening
+        if (fi) {
+            fi->plugin->free (fi);
+        }
+        free (preroll);
+        pl_item_unref (track);
+    }
+}
+
+// Discards the preloaded track.
+// Must be called with preload_mutex locked,
+// the returned decoder and preroll buffer must be freed after unlocking.
+static void
+_preload_discard (DB_fileinfo_t **fi, char **preroll) {
+    *fi = preload_fileinfo;
+    *preroll = preload_preroll;
+    preload_fileinfo = NULL;
+    preload_preroll = NULL;
+    preload_preroll_size = 0;
+    if (preload_track) {
+        pl_item_unref (preload_track);
+        preload_track = NULL;
+    }
+    if (preload_file) {
+        deadbeef->fabort (preload_file);
+    }
+    preload_state = PRELOAD_NONE;
+    preload_generation++;
+}
+
+// Starts preloading the track, discarding the previously preloaded one.
+// Passing NULL only discards.
+static void
+_preload_request (playItem_t *track) {
+    DB_fileinfo_t *fi;
+    char *preroll;
+    int start = 0;
+
+    mutex_lock (preload_mutex);
+    if (track == preload_track) {
+        mutex_unlock (preload_mutex);
+        return;
+    }
+    _preload_discard (&fi, &preroll);
+    if (track) {
+        preload_track = track;
+        pl_item_ref (preload_track);
+        preload_state = PRELOAD_PENDING;
+        if (!preload_thread_running) {
+            preload_thread_running = 1;
+            start = 1;
+        }
+    }
+    mutex_unlock (preload_mutex);
+
+    if (fi) {
+        fi->plugin->free (fi);
+    }
+    free (preroll);
+
+    if (start) {
+        if (preload_tid) {
+            thread_join (preload_tid); // has already finished
+        }
+        preload_tid = thread_start (preload_thread, NULL);
+    }
+}
+
+// Returns the preloaded decoder if the track matches, and discards the preload in any case.
+// The preroll data is passed to streamreader.
+static DB_fileinfo_t *
+_preload_take (playItem_t *track) {
+    DB_fileinfo_t *fi = NULL;
+    char *preroll = NULL;
+    int preroll_size = 0;
+
+    mutex_lock (preload_mutex);
+    // the track is still being opened, which is usually going to be faster than starting over;
+    // but don't wait for a stalled open, it's discarded (and aborted) below
+    while (track && track == preload_track
+           && (preload_state == PRELOAD_PENDING || preload_state == PRELOAD_RUNNING)) {
+        if (cond_timedwait (preload_cond, preload_mutex, PRELOAD_WAIT_MS) == ETIMEDOUT) {
+            trace ("preloading %s timed out\n", pl_find_meta (track, ":URI"));
+            break;
+        }
+    }
+    if (track && track == preload_track && preload_state == PRELOAD_READY) {
+        fi = preload_fileinfo;
+        preroll = preload_preroll;
+        preroll_size = preload_preroll_size;
+        preload_fileinfo = NULL;
+        preload_preroll = NULL;
+    }
+    DB_fileinfo_t *discard_fi;
+    char *discard_preroll;
+    _preload_discard (&discard_fi, &discard_preroll);
+    mutex_unlock (preload_mutex);
+
+    if (discard_fi) {
+        discard_fi->plugin->free (discard_fi);
+    }
+    free (discard_preroll);
+
+    if (fi) {
+        trace ("using preloaded decoder for %s\n", pl_find_meta (track, ":URI"));
+        streamreader_set_preroll (fi, preroll, preroll_size);
+    }
+    return fi;
+}
+
+// Called by the streamer thread after each block, to preload the next track in time.
+static void
+_preload_update (void) {
+    if (!streaming_track || !fileinfo || stop_after_current) {
+        return;
+    }
+    float dur = pl_get_item_duration (streaming_track);
+    float pos = fileinfo->readpos;
+    if (dur <= 0 || dur - pos > PRELOAD_SECONDS) {
+        return;
+    }
+    if (preload_checked_pos >= 0 && pos >= preload_checked_pos && pos - preload_checked_pos < 1) {
+        return;
+    }
+    preload_checked_pos = pos;
+
+    playItem_t *next = get_next_track_real (streaming_track, 1);
+    _preload_request (next);
+    if (next) {
+        pl_item_unref (next);
+    }
+}
+
 static playItem_t *first_failed_track;
 
 static void
@@ -863,11 +1126,15 @@ streamer_play_failed (playItem_t *failed_track) {
 
 static int
 stream_track (playItem_t *it, int startpaused) {
+    // the decoder of the previous track is reused if the new track has the same decoder,
+    // and freed otherwise
+    DB_fileinfo_t *prev_fileinfo = fileinfo;
     if (fileinfo) {
-        fileinfo->plugin->free (fileinfo);
+        streamreader_set_preroll (NULL, NULL, 0);
         fileinfo = NULL;
         fileinfo_file = NULL;
     }
+    preload_checked_pos = -1;
     trace ("stream_track %s\n", playing_track ? pl_find_meta (playing_track, ":URI") : "null");
     int err = 0;
     playItem_t *from = NULL;
@@ -888,6 +1155,15 @@ stream_track (playItem_t *it, int startpaused) {
         pl_item_ref (to);
     }
 
+    int paused_stream = 0;
+    if (it && startpaused) {
+        paused_stream = is_remote_stream (it);
+    }
+
+    // this may wait for the preload to finish, which is done before resetting streaming_track,
+    // so that the output doesn't consider the playback stopped meanwhile
+    DB_fileinfo_t *preloaded = _preload_take (paused_stream ? NULL : it);
+
     streamer_lock ();
     if (streaming_track) {
         pl_item_unref (streaming_track);
@@ -895,12 +1171,14 @@ stream_track (playItem_t *it, int startpaused) {
     }
     streamer_unlock ();
 
-    int paused_stream = 0;
-    if (it && startpaused) {
-        paused_stream = is_remote_stream (it);
+    if (preloaded) {
+        new_fileinfo = preloaded;
+        new_fileinfo_file = new_fileinfo->file;
+        streaming_track = it;
+        pl_item_ref (streaming_track);
+        goto success;
     }
 
-
     if (!it || paused_stream) {
         goto success;
     }
@@ -1078,6 +1356,9 @@ stream_track (playItem_t *it, int startpaused) {
                     free (buf);
                 }
                 unlink (tempfile);
+                if (prev_fileinfo) {
+                    prev_fileinfo->plugin->free (prev_fileinfo);
+                }
                 return res;
             }
 
@@ -1174,17 +1455,40 @@ m3u_error:
             goto error;
         }
 
-        trace ("\033[0;33minit decoder for %s (%s)\033[37;0m\n", pl_find_meta (it, ":URI"), dec->plugin.id);
-        new_fileinfo = dec_open (dec, STREAMER_HINTS, it);
-        if (new_fileinfo && new_fileinfo->file) {
-            new_fileinfo_file = new_fileinfo->file;
+        new_fileinfo = NULL;
+        if (prev_fileinfo && prev_fileinfo->plugin == dec && dec->plugin.api_vminor >= 10 && dec->reinit) {
+            trace ("\033[0;33mreinit decoder for %s (%s)\033[37;0m\n", pl_find_meta (it, ":URI"), dec->plugin.id);
+            DB_fileinfo_t *reused = prev_fileinfo;
+            prev_fileinfo = NULL;
+            // reinit replaces reused->file, which is followed by streamer_abort_files,
+            // as new_fileinfo_file is in the dec_open path
+            reinit_fileinfo = reused;
+            int res = dec->reinit (reused, DB_PLAYITEM (it));
+            reinit_fileinfo = NULL;
+            if (res == 0) {
+                new_fileinfo = reused;
+                new_fileinfo_file = reused->file;
+            }
+            else {
+                // try again from scratch
+                trace ("\033[0;31mfailed to reinit decoder\033[37;0m\n");
+                dec->free (reused);
+            }
         }
-        if (new_fileinfo && dec->init (new_fileinfo, DB_PLAYITEM (it)) != 0) {
-            trace ("\033[0;31mfailed to init decoder\033[37;0m\n");
-            pl_delete_meta (it, "!DECODER");
-            dec->free (new_fileinfo);
-            new_fileinfo = NULL;
-            new_fileinfo_file = NULL;
+
+        if (!new_fileinfo) {
+            trace ("\033[0;33minit decoder for %s (%s)\033[37;0m\n", pl_find_meta (it, ":URI"), dec->plugin.id);
+            new_fileinfo = dec_open (dec, STREAMER_HINTS, it);
+            if (new_fileinfo && new_fileinfo->file) {
+                new_fileinfo_file = new_fileinfo->file;
+            }
+            if (new_fileinfo && dec->init (new_fileinfo, DB_PLAYITEM (it)) != 0) {
+                trace ("\033[0;31mfailed to init decoder\033[37;0m\n");
+                pl_delete_meta (it, "!DECODER");
+                dec->free (new_fileinfo);
+                new_fileinfo = NULL;
+                new_fileinfo_file = NULL;
+            }
         }
 
         if (!new_fileinfo) {
@@ -1214,6 +1518,9 @@ success:
     }
 
 error:
+    if (prev_fileinfo) {
+        prev_fileinfo->plugin->free (prev_fileinfo);
+    }
     if (from) {
         pl_item_unref (from);
     }
@@ -1238,6 +1545,18 @@ streamer_get_apx_bitrate (void) {
     return avg_bitrate;
 }
 
+void
+streamer_get_buffer_stats (ddb_streamer_buffer_stats_t *stats) {
+    ddb_streamer_buffer_stats_t st;
+    memset (&st, 0, sizeof (st));
+    streamer_lock ();
+    streamreader_get_stats (&st);
+    streamer_unlock ();
+    size_t size = min ((size_t)stats->_size, sizeof (st));
+    st._size = stats->_size;
+    memcpy (stats, &st, size);
+}
+
 void
 streamer_set_nextsong (int song, int startpaused) {
     if (song == -1) {
@@ -1300,6 +1619,7 @@ streamer_seek_real (float seekpos) {
 
         if (fileinfo && track && dur > 0) {
             streamer_lock ();
+            streamreader_set_preroll (NULL, NULL, 0);
             if (fileinfo->plugin->seek (fileinfo, playpos) >= 0) {
                 streamer_reset (1);
             }
@@ -1490,6 +1810,7 @@ streamer_thread (void *unused) {
             }
             _format_change_wait = 0;
             streamer_unlock ();
+            _dsp_thread_wakeup ();
         }
 
         _update_buffering_state ();
@@ -1511,7 +1832,15 @@ streamer_thread (void *unused) {
             continue;
         }
 
+        streamer_lock ();
         streamblock_t *block = streamreader_get_next_block ();
+        streamer_unlock ();
+
+        if (trace_bufferfill) {
+            ddb_streamer_buffer_stats_t stats = { ._size = sizeof (stats) };
+            streamer_get_buffer_stats (&stats);
+            fprintf (stderr, "streamer: buffer fill %.2f/%.2f sec, %d blocks ready, %d allocated (%lld bytes)\n", stats.seconds_ready, stats.seconds_readahead, stats.blocks_ready, stats.blocks_allocated, (long long)stats.bytes_allocated);
+        }
 
         if (!block) {
             usleep (50000); // all blocks are full
@@ -1526,6 +1855,10 @@ streamer_thread (void *unused) {
             streamreader_enqueue_block (block);
             last = block->last;
             streamer_unlock ();
+            _dsp_thread_wakeup ();
+            if (!last) {
+                _preload_update ();
+            }
         }
 
         if (res < 0 || last) {
@@ -1559,7 +1892,9 @@ streamer_thread (void *unused) {
     while (!handler_pop (handler, &id, &ctx, &p1, &p2));
 
     // stop streaming song
+    _preload_request (NULL);
     if (fileinfo) {
+        streamreader_set_preroll (NULL, NULL, 0);
         fileinfo->plugin->free (fileinfo);
         fileinfo = NULL;
         fileinfo_file = NULL;
@@ -1589,7 +1924,7 @@ streamer_init (void) {
     out = fopen ("out.raw", "w+b");
 #endif
     mutex = mutex_create ();
-    wdl_mutex = mutex_create ();
+    vis_init ();
 
     streamreader_init();
     pl_set_order (conf_get_int ("playback.order", 0));
@@ -1600,10 +1935,39 @@ streamer_init (void) {
     deadbeef->conf_get_str ("network.ctmapping", DDB_DEFAULT_CTMAPPING, conf_network_ctmapping, sizeof (conf_network_ctmapping));
     ctmap_init ();
 
+    preload_mutex = mutex_create_nonrecursive ();
+    preload_cond = cond_create ();
     streamer_tid = thread_start (streamer_thread, NULL);
+
+    dsp_terminate = 0;
+    dsp_wakeup = 0;
+    dsp_mutex = mutex_create_nonrecursive ();
+    dsp_cond = cond_create ();
+    dsp_tid = thread_start (dsp_thread, NULL);
     return 0;
 }
 
+// We always decode the entire block, 16384 bytes of input PCM
+// after DSP that can become really big.
+// Think converting from 8KHz/8 bit to 192KHz/32 bit, thats 96x size increase,
+// which gives us the need of 1.5MB buffer.
+//
+// It's guaranteed that outbuffer contains only samples from the files with same wave format.
+//
+// The output buffer is a lock-free ring: it's filled under streamer_lock,
+// but consumed without the lock, and without moving the remaining data.
+//
+// FIXME: this BSS allocation is temporary, needs to be on heap, and allocated on demand.
+static char outbuffer_data[512*1024];
+static ringbuf_t outbuffer = {
+    .bytes = outbuffer_data,
+    .size = sizeof (outbuffer_data),
+};
+
+// converted data goes here when it doesn't fit before the end of the ring
+static char *outbuffer_wrap;
+static int outbuffer_wrap_size;
+
 void
 streamer_free (void) {
 #if WRITE_DUMP
@@ -1614,8 +1978,32 @@ streamer_free (void) {
     streaming_terminate = 1;
     thread_join (streamer_tid);
 
+    // the streamer thread has discarded the preload on exit
+    if (preload_tid) {
+        thread_join (preload_tid);
+        preload_tid = 0;
+    }
+    mutex_free (preload_mutex);
+    preload_mutex = 0;
+    cond_free (preload_cond);
+    preload_cond = 0;
+
+    mutex_lock (dsp_mutex);
+    dsp_terminate = 1;
+    mutex_unlock (dsp_mutex);
+    cond_signal (dsp_cond);
+    thread_join (dsp_tid);
+    cond_free (dsp_cond);
+    dsp_cond = 0;
+    mutex_free (dsp_mutex);
+    dsp_mutex = 0;
+
     streamreader_free ();
 
+    free (outbuffer_wrap);
+    outbuffer_wrap = NULL;
+    outbuffer_wrap_size = 0;
+
     if (first_failed_track) {
         pl_item_unref (first_failed_track);
         first_failed_track = NULL;
@@ -1643,8 +2031,7 @@ streamer_free (void) {
 
     mutex_free (mutex);
     mutex = 0;
-    mutex_free (wdl_mutex);
-    wdl_mutex = 0;
+    vis_free ();
 
     streamer_dsp_chain_save();
 
@@ -1659,17 +2046,6 @@ streamer_free (void) {
     playtime = 0;
 }
 
-// We always decode the entire block, 16384 bytes of input PCM
-// after DSP that can become really big.
-// Think converting from 8KHz/8 bit to 192KHz/32 bit, thats 96x size increase,
-// which gives us the need of 1.5MB buffer.
-//
-// It's guaranteed that outbuffer contains only samples from the files with same wave format.
-//
-// FIXME: this BSS allocation is temporary, needs to be on heap, and allocated on demand.
-static char outbuffer[512*1024];
-static int outbuffer_remaining;
-
 void
 streamer_reset (int full) { // must be called when current song changes by external reasons
     if (!mutex) {
@@ -1680,12 +2056,15 @@ streamer_reset (int full) { // must be called when current song changes by exter
     streamer_lock();
     streamreader_reset ();
     dsp_reset ();
-    outbuffer_remaining = 0;
+    ringbuf_flush (&outbuffer);
+    _output_ended = 0;
     streamer_unlock();
+    _dsp_thread_wakeup ();
 }
 
+// decode the block into outbuffer, returns the number of bytes added
 static int
-process_output_block (streamblock_t *block, char *bytes) {
+process_output_block (streamblock_t *block) {
     DB_output_t *output = plug_get_output ();
 
     // handle change of track
@@ -1758,15 +2137,34 @@ process_output_block (streamblock_t *block, char *bytes) {
 #endif
 
     if (memcmp (&output->fmt, &datafmt, sizeof (ddb_waveformat_t))) {
-        sz = pcm_convert (&datafmt, dspbytes, &output->fmt, bytes, sz);
+        int outsize = sz / ((datafmt.bps >> 3) * datafmt.channels) * ((output->fmt.bps >> 3) * output->fmt.channels);
+        size_t avail;
+        char *bytes = ringbuf_write_ptr (&outbuffer, &avail);
+        if (avail >= outsize) {
+            sz = pcm_convert (&datafmt, dspbytes, &output->fmt, bytes, sz);
+            ringbuf_write_commit (&outbuffer, sz);
+        }
+        else {
+            if (outbuffer_wrap_size < outsize) {
+                free (outbuffer_wrap);
+                outbuffer_wrap = malloc (outsize);
+                outbuffer_wrap_size = outsize;
+            }
+            sz = pcm_convert (&datafmt, dspbytes, &output->fmt, outbuffer_wrap, sz);
+            if (ringbuf_write (&outbuffer, outbuffer_wrap, sz) < 0) {
+                trace ("streamer: output buffer overflow, %d bytes dropped\n", sz);
+            }
+        }
     }
-    else {
-        memcpy (bytes, dspbytes, sz);
+    else if (ringbuf_write (&outbuffer, dspbytes, sz) < 0) {
+        trace ("streamer: output buffer overflow, %d bytes dropped\n", sz);
     }
 
     playpos += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels) * dspratio;
     playtime += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels) * dspratio;
 
+    last_block_bitrate = block->bitrate;
+
     if (block->pos >= block->size) {
         streamreader_next_block ();
         _update_buffering_state ();
@@ -1775,6 +2173,96 @@ process_output_block (streamblock_t *block, char *bytes) {
     return sz;
 }
 
+static void
+_dsp_thread_wakeup (void) {
+    if (!dsp_mutex) {
+        return;
+    }
+    mutex_lock (dsp_mutex);
+    dsp_wakeup = 1;
+    mutex_unlock (dsp_mutex);
+    cond_signal (dsp_cond);
+}
+
+static int
+_dsp_runahead_bytes (DB_output_t *output) {
+    int bytes = output->fmt.samplerate / 1000 * DSP_RUNAHEAD_MS * (output->fmt.bps >> 3) * output->fmt.channels;
+    bytes = max (bytes, last_read_size * 2);
+    // leave room for the output of one more block
+    return min (bytes, (int)outbuffer.size / 2);
+}
+
+// Fills outbuffer with processed blocks, until it has enough data buffered,
+// or until the next format change.
+// It's the only producer of outbuffer: streamer_read only consumes it,
+// and wakes this thread up, without running the DSP chain or taking streamer_lock.
+// Once outbuffer is drained, this thread also requests the format changes,
+// and handles the end of playback.
+static void
+dsp_thread (void *unused) {
+#if defined(__linux__) && !defined(ANDROID)
+    prctl (PR_SET_NAME, "deadbeef-dsp", 0, 0, 0, 0);
+#endif
+
+    for (;;) {
+        // the flags are checked and waited on without releasing dsp_mutex,
+        // so that a wakeup can't be missed
+        mutex_lock (dsp_mutex);
+        while (!dsp_wakeup && !dsp_terminate) {
+            cond_wait_locked (dsp_cond, dsp_mutex);
+        }
+        int terminate = dsp_terminate;
+        dsp_wakeup = 0;
+        mutex_unlock (dsp_mutex);
+
+        if (terminate) {
+            break;
+        }
+
+        DB_output_t *output = plug_get_output ();
+        if (!output || output->state () != OUTPUT_STATE_PLAYING) {
+            continue;
+        }
+
+        // release the lock after each block, to let the streamer thread in
+        for (;;) {
+            streamer_lock ();
+            streamblock_t *block = streamreader_get_curr_block ();
+            size_t avail = ringbuf_get_read_available (&outbuffer);
+            if (!block) {
+                // NULL streaming_track means playback stopped,
+                // otherwise just a buffer starvation (e.g. after seeking)
+                if (!avail && !streaming_track) {
+                    update_stop_after_current ();
+                    _handle_playback_stopped();
+                    playpos = 0;
+                    playtime = 0;
+                    avg_bitrate = -1;
+                    last_seekpos = -1;
+                    _output_ended = 1;
+                }
+                streamer_unlock ();
+                break;
+            }
+            _output_ended = 0;
+            if (memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
+                // empty buffer and the next block format differs? request format change!
+                if (!avail) {
+                    _format_change_wait = 1;
+                }
+                streamer_unlock ();
+                break;
+            }
+            if (_format_change_wait || avail >= _dsp_runahead_bytes (output)) {
+                streamer_unlock ();
+                break;
+            }
+            process_output_block (block);
+            streamer_unlock ();
+        }
+    }
+}
+
 
 static float (*streamer_volume_modifier) (float delta_time);
 
@@ -1804,12 +2292,7 @@ streamer_apply_soft_volume (char *bytes, int sz) {
             mult *= 1000;
             int16_t ivolume = vol * mult;
             if (ivolume != 1000) {
-                int half = bytesread/2;
-                for (int i = 0; i < half; i++) {
-                    int16_t sample = *((int16_t*)stream);
-                    *((int16_t*)stream) = (int16_t)(((int32_t)sample) * ivolume / 1000);
-                    stream += 2;
-                }
+                pcm_apply_volume_int16 ((int16_t *)stream, bytesread/2, ivolume);
             }
         }
         else if (output->fmt.bps == 8) {
@@ -1841,21 +2324,13 @@ streamer_apply_soft_volume (char *bytes, int sz) {
             mult *= 1000;
             int16_t ivolume = vol * mult;
             if (ivolume != 1000) {
-                for (int i = 0; i < bytesread/4; i++) {
-                    int32_t sample = *((int32_t*)stream);
-                    int32_t newsample = (int32_t)((int64_t)sample * ivolume / 1000);
-                    *((int32_t*)stream) = newsample;
-                    stream += 4;
-                }
+                pcm_apply_volume_int32 ((int32_t *)stream, bytesread/4, ivolume);
             }
         }
         else if (output->fmt.bps == 32 && output->fmt.is_float) {
             float fvolume = vol * (1-audio_is_mute ());
             if (fvolume != 1.f) {
-                for (int i = 0; i < bytesread/4; i++) {
-                    *((float*)stream) = (*((float*)stream)) * fvolume;
-                    stream += 4;
-                }
+                pcm_apply_volume_float ((float *)stream, bytesread/4, fvolume, 0);
             }
         }
     }
@@ -1874,65 +2349,26 @@ streamer_read (char *bytes, int size) {
         return size;
     }
 
-    streamer_lock ();
-    streamblock_t *block = streamreader_get_curr_block();
-    if (!block) {
-        // NULL streaming_track means playback stopped,
-        // otherwise just a buffer starvation (e.g. after seeking)
-        if (!streaming_track) {
-            update_stop_after_current ();
-            _handle_playback_stopped();
-            playpos = 0;
-            playtime = 0;
-            avg_bitrate = -1;
-            last_seekpos = -1;
-        }
-        else {
-            // this message is printed in more cases, than if output is broken, so disable it
-            // but keep for reference -- this is a good place to set breakpoint
-//            fprintf (stderr, "streamer: streamer_read has starved. The current output plugin might be broken\n");
-        }
-        streamer_unlock();
+    last_read_size = size;
 
-        if (streaming_track) {
-            memset (bytes, 0, size);
-            return size;
-        }
+    // this runs on the output callback, so it only hands over what the DSP thread
+    // has already processed, and never waits for streamer_lock
+    _dsp_thread_wakeup ();
+
+    int outbuffer_remaining = (int)ringbuf_get_read_available (&outbuffer);
+    if (!outbuffer_remaining && _output_ended) {
+        // playback stopped
         _audio_stall_count++;
         return 0;
     }
 
     _audio_stall_count = 0;
-
-    int block_bitrate = -1;
-
-    // only decode until the next format change
-    if (!memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
-        // decode enough blocks to fill the output buffer
-        while (block && outbuffer_remaining < size && !memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
-            int rb = process_output_block (block, outbuffer + outbuffer_remaining);
-            if (rb <= 0) {
-                break;
-            }
-            outbuffer_remaining += rb;
-            block_bitrate = block->bitrate;
-            block = streamreader_get_curr_block();
-        }
-    }
-    // empty buffer and the next block format differs? request format change!
-
-    if (!outbuffer_remaining && memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
-        _format_change_wait = 1;
-        streamer_unlock();
-        memset (bytes, 0, size);
-        return size;
-    }
-    streamer_unlock ();
+    int block_bitrate = last_block_bitrate;
 
     // consume decoded data
     int sz = min (size, outbuffer_remaining);
     if (!sz) {
-        // no data available
+        // no data available: the DSP thread has fallen behind, or waits for a format change
         memset (bytes, 0, size);
         return size;
     }
@@ -1943,11 +2379,12 @@ streamer_read (char *bytes, int size) {
         sz -= (sz % ss);
     }
 
-    memcpy (bytes, outbuffer, sz);
-    if (sz < outbuffer_remaining) {
-        memmove (outbuffer, outbuffer + sz, outbuffer_remaining - sz);
+    sz = ringbuf_read (&outbuffer, bytes, sz);
+    if (!sz) {
+        // flushed by streamer_reset
+        memset (bytes, 0, size);
+        return size;
     }
-    outbuffer_remaining -= sz;
 
     // approximate bitrate
     if (block_bitrate != -1) {
@@ -1980,72 +2417,17 @@ streamer_read (char *bytes, int size) {
 #endif
 
 #ifndef ANDROID
-
-    if (waveform_listeners || spectrum_listeners) {
-        int in_frame_size = (output->fmt.bps >> 3) * output->fmt.channels;
-        int in_frames = sz / in_frame_size;
-        ddb_waveformat_t out_fmt = {
-            .bps = 32,
-            .channels = output->fmt.channels,
-            .samplerate = output->fmt.samplerate,
-            .channelmask = output->fmt.channelmask,
-            .is_float = 1,
-            .is_bigendian = 0
-        };
-
-        float temp_audio_data[in_frames * out_fmt.channels];
-        pcm_convert (&output->fmt, bytes, &out_fmt, (char *)temp_audio_data, sz);
-        ddb_audio_data_t data;
-        data.fmt = &out_fmt;
-        data.data = temp_audio_data;
-        data.nframes = in_frames;
-        mutex_lock (wdl_mutex);
-        for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
-            l->callback (l->ctx, &data);
-        }
-        mutex_unlock (wdl_mutex);
-
-        if (out_fmt.channels != audio_data_channels || !spectrum_listeners) {
-            audio_data_fill = 0;
-            audio_data_channels = out_fmt.channels;
-        }
-
-        if (spectrum_listeners) {
-            int remaining = in_frames;
-            do {
-                int sz = DDB_FREQ_BANDS * 2 -audio_data_fill;
-                sz = min (sz, remaining);
-                for (int c = 0; c < audio_data_channels; c++) {
-                    for (int s = 0; s < sz; s++) {
-                        audio_data[DDB_FREQ_BANDS * 2 * c + audio_data_fill + s] = temp_audio_data[(in_frames-remaining + s) * audio_data_channels + c];
-                    }
-                }
-                //            memcpy (&audio_data[audio_data_fill], &temp_audio_data[in_frames-remaining], sz * sizeof (float));
-                audio_data_fill += sz;
-                remaining -= sz;
-                if (audio_data_fill == DDB_FREQ_BANDS * 2) {
-                    for (int c = 0; c < audio_data_channels; c++) {
-                        calc_freq (&audio_data[DDB_FREQ_BANDS * 2 * c], &freq_data[DDB_FREQ_BANDS * c]);
-                    }
-                    ddb_audio_data_t data;
-                    data.fmt = &out_fmt;
-                    data.data = freq_data;
-                    data.nframes = DDB_FREQ_BANDS;
-                    mutex_lock (wdl_mutex);
-                    for (wavedata_listener_t *l = spectrum_listeners; l; l = l->next) {
-                        l->callback (l->ctx, &data);
-                    }
-                    mutex_unlock (wdl_mutex);
-                    audio_data_fill = 0;
-                }
-            } while (remaining > 0);
-        }
-    }
+    vis_process (&output->fmt, bytes, sz);
 #endif
 
     streamer_apply_soft_volume (bytes, sz);
 
-    return sz;
+    // pad with silence, instead of making the output wait
+    if (sz < size) {
+        memset (bytes + sz, 0, size - sz);
+    }
+
+    return size;
 }
 
 int
@@ -2120,6 +2502,7 @@ streamer_configchanged (void) {
     streamer_unlock ();
 
     streamreader_configchanged ();
+    vis_configchanged ();
 }
 
 static void
@@ -2379,68 +2762,6 @@ streamer_notify_order_changed (int prev_order, int new_order) {
     handler_push (handler, STR_EV_ORDER_CHANGED, 0, prev_order, new_order);
 }
 
-void
-vis_waveform_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data)) {
-    mutex_lock (wdl_mutex);
-    wavedata_listener_t *l = malloc (sizeof (wavedata_listener_t));
-    memset (l, 0, sizeof (wavedata_listener_t));
-    l->ctx = ctx;
-    l->callback = callback;
-    l->next = waveform_listeners;
-    waveform_listeners = l;
-    mutex_unlock (wdl_mutex);
-}
-
-void
-vis_waveform_unlisten (void *ctx) {
-    mutex_lock (wdl_mutex);
-    wavedata_listener_t *l, *prev = NULL;
-    for (l = waveform_listeners; l; prev = l, l = l->next) {
-        if (l->ctx == ctx) {
-            if (prev) {
-                prev->next = l->next;
-            }
-            else {
-                waveform_listeners = l->next;
-            }
-            free (l);
-            break;
-        }
-    }
-    mutex_unlock (wdl_mutex);
-}
-
-void
-vis_spectrum_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data)) {
-    mutex_lock (wdl_mutex);
-    wavedata_listener_t *l = malloc (sizeof (wavedata_listener_t));
-    memset (l, 0, sizeof (wavedata_listener_t));
-    l->ctx = ctx;
-    l->callback = callback;
-    l->next = spectrum_listeners;
-    spectrum_listeners = l;
-    mutex_unlock (wdl_mutex);
-}
-
-void
-vis_spectrum_unlisten (void *ctx) {
-    mutex_lock (wdl_mutex);
-    wavedata_listener_t *l, *prev = NULL;
-    for (l = spectrum_listeners; l; prev = l, l = l->next) {
-        if (l->ctx == ctx) {
-            if (prev) {
-                prev->next = l->next;
-            }
-            else {
-                spectrum_listeners = l->next;
-            }
-            free (l);
-            break;
-        }
-    }
-    mutex_unlock (wdl_mutex);
-}
-
 void
 streamer_set_streamer_playlist (playlist_t *plt) {
     pl_lock ();
@@ -102,6 +102,9 @@ streamer_set_bitrate (int bitrate);
 int
 streamer_get_apx_bitrate (void);
 
+void
+streamer_get_buffer_stats (ddb_streamer_buffer_stats_t *stats);
+
 // returns -1 if theres no next song, or playlist finished
 // reason 0 means "prev song finished", 1 means "interrupt"
 int
@@ -153,18 +156,6 @@ streamer_set_streamer_playlist (playlist_t *plt);
 struct handler_s *
 streamer_get_handler (void);
 
-void
-vis_waveform_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data));
-
-void
-vis_waveform_unlisten (void *ctx);
-
-void
-vis_spectrum_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data));
-
-void
-vis_spectrum_unlisten (void *ctx);
-
 void
 streamer_set_playing_track (playItem_t *it);
 
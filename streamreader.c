@@ -27,18 +27,36 @@
 #include "streamreader.h"
 #include "replaygain.h"
 #include "threading.h"
+#include "conf.h"
 
-// read ahead about 5 sec at 44100/16/2
-#define BLOCK_SIZE 16384
-#define BLOCK_COUNT 48
+// The readahead is measured in time, so that high resolution / multichannel
+// streams get the same buffering as CD audio.
+// Each block holds about 1/10 sec of audio, within the size limits below.
+#define BLOCKS_PER_SEC 10
+#define MIN_BLOCK_SIZE 4096
+#define MAX_BLOCK_SIZE 65536
+#define MAX_BLOCK_COUNT 4096
+#define MAX_FREE_BLOCKS 16
 
-static streamblock_t *blocks; // list of all blocks
+#define DEFAULT_READAHEAD_SECONDS 5.f
+#define MIN_READAHEAD_SECONDS 1.f
+#define MAX_READAHEAD_SECONDS 30.f
 
-static streamblock_t *block_data; // first available block with data (can be NULL)
+static streamblock_t *block_free; // pool of blocks available for reuse
 
-static streamblock_t *block_next; // next block available to be read into / queued
+static streamblock_t *block_data; // first block with data (can be NULL)
+static streamblock_t *block_data_tail; // last block with data
+
+static streamblock_t *block_next; // the block handed out for reading, not yet queued
 
 static int numblocks_ready;
+static int numblocks_free;
+static int numblocks_allocated;
+static int64_t bytes_ready;
+static int64_t bytes_allocated;
+static int64_t usec_ready;
+
+static int64_t readahead_usec;
 
 static int curr_block_bitrate;
 
@@ -46,33 +64,90 @@ static playItem_t *_prev_rg_track;
 static int _rg_settingschanged = 1;
 static int _firstblock = 0;
 
+static DB_fileinfo_t *_preroll_fileinfo;
+static char *_preroll_buf;
+static int _preroll_size;
+static int _preroll_pos;
+
+static void
+_read_config (void) {
+    float sec = conf_get_float ("streamer.readahead_seconds", DEFAULT_READAHEAD_SECONDS);
+    if (sec < MIN_READAHEAD_SECONDS) {
+        sec = MIN_READAHEAD_SECONDS;
+    }
+    else if (sec > MAX_READAHEAD_SECONDS) {
+        sec = MAX_READAHEAD_SECONDS;
+    }
+    readahead_usec = (int64_t)(sec * 1000000);
+}
+
+static int
+_bytes_per_sec (ddb_waveformat_t *fmt) {
+    return fmt->samplerate * fmt->channels * (fmt->bps >> 3);
+}
+
+static int
+_block_size_for_format (ddb_waveformat_t *fmt) {
+    int size = _bytes_per_sec (fmt) / BLOCKS_PER_SEC;
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
+    }
+    else if (size > MAX_BLOCK_SIZE) {
+        size = MAX_BLOCK_SIZE;
+    }
+    return size;
+}
+
+static void
+_block_release (streamblock_t *b) {
+    if (b->track) {
+        pl_item_unref (b->track);
+        b->track = NULL;
+    }
+    b->pos = -1;
+    b->queued = 0;
+
+    // keep a few blocks around for reuse, and give the rest back, e.g. after a reset, or switching to a lower resolution format
+    if (numblocks_free >= MAX_FREE_BLOCKS) {
+        bytes_allocated -= b->capacity;
+        numblocks_allocated--;
+        free (b->buf);
+        free (b);
+        return;
+    }
+    b->next = block_free;
+    block_free = b;
+    numblocks_free++;
+}
+
 void
 streamreader_init (void) {
     _prev_rg_track = NULL;
     _rg_settingschanged = 1;
-    for (int i = 0; i < BLOCK_COUNT; i++) {
-        streamblock_t *b = calloc (1, sizeof (streamblock_t));
-        b->pos = -1;
-        b->buf = malloc (BLOCK_SIZE);
-        b->next = blocks;
-        blocks = b;
-    }
-    block_next = blocks;
-    numblocks_ready = 0;
+    block_free = block_data = block_data_tail = block_next = NULL;
+    numblocks_ready = numblocks_free = numblocks_allocated = 0;
+    bytes_ready = bytes_allocated = usec_ready = 0;
     _firstblock = 0;
+    _read_config ();
 }
 
 void
 streamreader_free (void) {
     streamreader_reset ();
-    while (blocks) {
-        streamblock_t *next = blocks->next;
-        free (blocks->buf);
-        free (blocks);
-        blocks = next;
+    if (block_next) {
+        block_next->next = block_free;
+        block_free = block_next;
+        block_next = NULL;
     }
-    block_next = block_data = NULL;
-    numblocks_ready = 0;
+    while (block_free) {
+        streamblock_t *next = block_free->next;
+        free (block_free->buf);
+        free (block_free);
+        block_free = next;
+    }
+    numblocks_free = numblocks_allocated = 0;
+    bytes_allocated = 0;
+    streamreader_set_preroll (NULL, NULL, 0);
     _prev_rg_track = NULL;
     _rg_settingschanged = 1;
     _firstblock = 0;
@@ -80,27 +155,60 @@ streamreader_free (void) {
 
 streamblock_t *
 streamreader_get_next_block (void) {
-    if (block_next->pos >= 0) {
-        return NULL; // all buffers full
+    if (block_next) {
+        return block_next;
+    }
+
+    if (usec_ready >= readahead_usec) {
+        return NULL; // readahead is full
     }
+
+    if (block_free) {
+        block_next = block_free;
+        block_free = block_free->next;
+        numblocks_free--;
+    }
+    else {
+        if (numblocks_allocated >= MAX_BLOCK_COUNT) {
+            return NULL;
+        }
+        block_next = calloc (1, sizeof (streamblock_t));
+        block_next->pos = -1;
+        numblocks_allocated++;
+    }
+    block_next->next = NULL;
+
     return block_next;
 }
 
 void
 streamreader_configchanged (void) {
     _rg_settingschanged = 1;
+    _read_config ();
 }
 
 int
 streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t *fileinfo, uint64_t mutex) {
     // clip size to max possible, with current sample format
-    int size = BLOCK_SIZE;
+    int size = _block_size_for_format (&fileinfo->fmt);
     int samplesize = fileinfo->fmt.channels * (fileinfo->fmt.bps>>3);
     int mod = size % samplesize;
     if (mod) {
         size -= mod;
     }
 
+    // the block is not visible to the consumer yet, so it's safe to resize without locking,
+    // shrinking if the format requires much smaller blocks than it was used for previously
+    int prev_capacity = block->capacity;
+    if (block->capacity < size || block->capacity > size * 2) {
+        char *buf = realloc (block->buf, size);
+        if (!buf) {
+            return -1;
+        }
+        block->buf = buf;
+        block->capacity = size;
+    }
+
     // replaygain settings
     if (_rg_settingschanged || _prev_rg_track != track) {
         _prev_rg_track = track;
@@ -113,14 +221,33 @@ streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t
 
     // NOTE: streamer_set_bitrate may be called during decoder->read, and set immediated bitrate of the block
     curr_block_bitrate = -1;
-    int rb = fileinfo->plugin->read (fileinfo, block->buf, size);
-
-    if (rb < 0) {
-        return -1;
+    int rb = 0;
+    if (_preroll_buf && _preroll_fileinfo != fileinfo) {
+        streamreader_set_preroll (NULL, NULL, 0);
+    }
+    if (_preroll_buf) {
+        rb = _preroll_size - _preroll_pos;
+        if (rb > size) {
+            rb = size;
+        }
+        memcpy (block->buf, _preroll_buf + _preroll_pos, rb);
+        _preroll_pos += rb;
+        if (_preroll_pos >= _preroll_size) {
+            streamreader_set_preroll (NULL, NULL, 0);
+        }
+    }
+    if (rb < size) {
+        int res = fileinfo->plugin->read (fileinfo, block->buf + rb, size - rb);
+        if (res < 0) {
+            return -1;
+        }
+        rb += res;
     }
 
     mutex_lock (mutex);
 
+    bytes_allocated += block->capacity - prev_capacity;
+
     block->bitrate = curr_block_bitrate;
 
     block->pos = 0;
@@ -153,21 +280,38 @@ streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t
     return 0;
 }
 
+void
+streamreader_set_preroll (DB_fileinfo_t *fileinfo, char *buf, int size) {
+    free (_preroll_buf);
+    _preroll_fileinfo = buf ? fileinfo : NULL;
+    _preroll_buf = buf;
+    _preroll_size = buf ? size : 0;
+    _preroll_pos = 0;
+}
+
 void
 streamreader_enqueue_block (streamblock_t *block) {
     // block is passed just for sanity checking
     assert (block->track);
-    if (!block_data) {
-        block_data = block_next;
-    }
+    assert (block == block_next);
 
-    block_next = block_next->next;
-    if (!block_next) {
-        block_next = blocks;
+    block_next = NULL;
+    block->next = NULL;
+    if (block_data_tail) {
+        block_data_tail->next = block;
     }
+    else {
+        block_data = block;
+    }
+    block_data_tail = block;
+
+    int bytes_per_sec = _bytes_per_sec (&block->fmt);
+    block->duration_usec = bytes_per_sec ? (int64_t)block->size * 1000000 / bytes_per_sec : 0;
 
     block->queued = 1;
     numblocks_ready++;
+    bytes_ready += block->size;
+    usec_ready += block->duration_usec;
 }
 
 void
@@ -182,43 +326,38 @@ streamreader_get_curr_block (void) {
 
 void
 streamreader_next_block (void) {
-    if (block_data) {
-        block_data->pos = -1;
-        pl_item_unref (block_data->track);
-        block_data->track = NULL;
-        block_data->queued = 0;
-
-        block_data = block_data->next;
-        if (!block_data) {
-            block_data = blocks;
-        }
-
-        numblocks_ready--;
-        if (numblocks_ready < 0) {
-            numblocks_ready = 0;
-        }
+    if (!block_data) {
+        return;
     }
 
-    if (block_data && !block_data->queued) {
-        block_data = NULL; // no available blocks with data
+    streamblock_t *b = block_data;
+    block_data = b->next;
+    if (!block_data) {
+        block_data_tail = NULL;
     }
+
+    numblocks_ready--;
+    bytes_ready -= b->size;
+    usec_ready -= b->duration_usec;
+
+    _block_release (b);
 }
 
 void
 streamreader_reset (void) {
-    streamblock_t *b = blocks;
-    while (b) {
-        b->pos = -1;
-        if (b->track) {
-            pl_item_unref (b->track);
-            b->track = NULL;
+    while (block_data) {
+        streamreader_next_block ();
+    }
+    if (block_next) {
+        if (block_next->track) {
+            pl_item_unref (block_next->track);
+            block_next->track = NULL;
         }
-        b->queued = 0;
-        b = b->next;
+        block_next->pos = -1;
     }
-    block_next = blocks;
-    block_data = NULL;
     numblocks_ready = 0;
+    bytes_ready = 0;
+    usec_ready = 0;
     _firstblock = 0;
 }
 
@@ -226,3 +365,13 @@ int
 streamreader_num_blocks_ready (void) {
     return numblocks_ready;
 }
+
+void
+streamreader_get_stats (ddb_streamer_buffer_stats_t *stats) {
+    stats->blocks_ready = numblocks_ready;
+    stats->blocks_allocated = numblocks_allocated;
+    stats->bytes_ready = bytes_ready;
+    stats->bytes_allocated = bytes_allocated;
+    stats->seconds_ready = usec_ready / 1000000.f;
+    stats->seconds_readahead = readahead_usec / 1000000.f;
+}
@@ -30,11 +30,13 @@
 typedef struct streamblock_s {
     struct streamblock_s *next;
     char *buf;
-    int size; // how much bytes total in the buffer, up to BLOCK_SIZE, but can be less
+    int capacity; // allocated size of the buffer, depends on the format of the stream
+    int size; // how much bytes total in the buffer, up to capacity, but can be less
     int pos; // read position in the buffer
     int first; // set to 1 for the first buffer of the stream, following the block with last=1
     int last; // set to 1 for last buffer of the stream
     int bitrate;
+    int64_t duration_usec; // duration of the data in the block
 
     playItem_t *track;
     ddb_waveformat_t fmt;
@@ -48,7 +50,8 @@ streamreader_init (void);
 void
 streamreader_free (void);
 
-// returns next available (free) block, or NULL.
+// returns next available (free) block, or NULL when the readahead is full.
+// The mutex must be locked when this function is called.
 streamblock_t *
 streamreader_get_next_block (void);
 
@@ -59,6 +62,13 @@ streamreader_get_next_block (void);
 int
 streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t *fileinfo, uint64_t mutex);
 
+// Sets the data decoded ahead of time from the fileinfo, e.g. by the next track preloader,
+// which streamreader_read_block returns before reading from the decoder.
+// The buffer must be allocated with malloc, and is owned by streamreader afterwards.
+// Pass NULL to discard the previous data, e.g. when the fileinfo is freed or seeked.
+void
+streamreader_set_preroll (DB_fileinfo_t *fileinfo, char *buf, int size);
+
 // Appends (enqueues) the block to the list of blocks containing data.
 // The passed block pointer must be the same as returned by `streamreader_get_next_block`.
 void
@@ -81,6 +91,10 @@ streamreader_reset (void);
 int
 streamreader_num_blocks_ready (void);
 
+// Fill level of the readahead buffer
+void
+streamreader_get_stats (ddb_streamer_buffer_stats_t *stats);
+
 // Notify streamreader that some configuration has changed
 void
 streamreader_configchanged (void);
@@ -61,6 +61,7 @@
 #include "gettext.h"
 #include "plugins.h"
 #include "junklib.h"
+#include "metacache.h"
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
@@ -74,12 +75,17 @@ typedef struct {
     const char *i;
     char *o;
     int eol;
+    int uncacheable; // set when the script uses something other than the track data
+    int no_lowering; // TF_COMPILE_NO_LOWERING
 } tf_compiler_t;
 
 typedef int (*tf_func_ptr_t)(ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, const char *args, char *out, int outlen, int fail_on_undef);
 
 #define TF_MAX_FUNCS 0xff
 
+// shorter plain text is stored char by char
+#define TF_MIN_TEXT_BLOCK 4
+
 typedef struct {
     const char *name;
     tf_func_ptr_t func;
@@ -91,6 +97,8 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
 static const char *
 _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free);
 
+static const char *
+_tf_get_combined_meta_value (DB_metaInfo_t *meta, int *needs_free);
 
 #define TF_EVAL_CHECK(res, ctx, arg, arg_len, out, outlen, fail_on_undef)\
 res = tf_eval_int (ctx, arg, arg_len, out, outlen, &bool_out, fail_on_undef);\
@@ -103,6 +111,179 @@ static playlist_t empty_playlist;
 // empty code is used when "code" argumen is null
 static char empty_code[4] = {0};
 
+// fields with special handling, resolved at compile time;
+// any other field is a plain metadata lookup by key atom
+enum {
+    TF_FIELD_META,
+    TF_FIELD_ALBUM_ARTIST,
+    TF_FIELD_ARTIST,
+    TF_FIELD_ALBUM,
+    TF_FIELD_TRACK_ARTIST,
+    TF_FIELD_TRACKNUMBER,
+    TF_FIELD_TITLE,
+    TF_FIELD_DISCNUMBER,
+    TF_FIELD_TOTALDISCS,
+    TF_FIELD_TRACK_NUMBER,
+    TF_FIELD_DATE,
+    TF_FIELD_SAMPLERATE,
+    TF_FIELD_PLAYBACK_BITRATE,
+    TF_FIELD_BITRATE,
+    TF_FIELD_FILESIZE,
+    TF_FIELD_FILESIZE_NATURAL,
+    TF_FIELD_CHANNELS,
+    TF_FIELD_CODEC,
+    TF_FIELD_REPLAYGAIN_ALBUM_GAIN,
+    TF_FIELD_REPLAYGAIN_ALBUM_PEAK,
+    TF_FIELD_REPLAYGAIN_TRACK_GAIN,
+    TF_FIELD_REPLAYGAIN_TRACK_PEAK,
+    TF_FIELD_PLAYBACK_TIME,
+    TF_FIELD_PLAYBACK_TIME_SECONDS,
+    TF_FIELD_PLAYBACK_TIME_REMAINING,
+    TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS,
+    TF_FIELD_LENGTH,
+    TF_FIELD_LENGTH_EX,
+    TF_FIELD_LENGTH_SECONDS,
+    TF_FIELD_LENGTH_SECONDS_FP,
+    TF_FIELD_LENGTH_SAMPLES,
+    TF_FIELD_ISPLAYING,
+    TF_FIELD_ISPAUSED,
+    TF_FIELD_FILENAME,
+    TF_FIELD_FILENAME_EXT,
+    TF_FIELD_DIRECTORYNAME,
+    TF_FIELD_PATH_RAW,
+    TF_FIELD_PATH,
+    TF_FIELD_LIST_INDEX,
+    TF_FIELD_LIST_TOTAL,
+    TF_FIELD_QUEUE_INDEX,
+    TF_FIELD_QUEUE_INDEXES,
+    TF_FIELD_QUEUE_TOTAL,
+    TF_FIELD_DEADBEEF_VERSION,
+    TF_FIELD_PLAYLIST_NAME,
+    TF_FIELD_SELECTION_PLAYBACK_TIME,
+    TF_FIELD_COUNT
+};
+
+static const char *tf_field_names[TF_FIELD_COUNT] = {
+    [TF_FIELD_ALBUM_ARTIST] = "album artist",
+    [TF_FIELD_ARTIST] = "artist",
+    [TF_FIELD_ALBUM] = "album",
+    [TF_FIELD_TRACK_ARTIST] = "track artist",
+    [TF_FIELD_TRACKNUMBER] = "tracknumber",
+    [TF_FIELD_TITLE] = "title",
+    [TF_FIELD_DISCNUMBER] = "discnumber",
+    [TF_FIELD_TOTALDISCS] = "totaldiscs",
+    [TF_FIELD_TRACK_NUMBER] = "track number",
+    [TF_FIELD_DATE] = "date",
+    [TF_FIELD_SAMPLERATE] = "samplerate",
+    [TF_FIELD_PLAYBACK_BITRATE] = "playback_bitrate",
+    [TF_FIELD_BITRATE] = "bitrate",
+    [TF_FIELD_FILESIZE] = "filesize",
+    [TF_FIELD_FILESIZE_NATURAL] = "filesize_natural",
+    [TF_FIELD_CHANNELS] = "channels",
+    [TF_FIELD_CODEC] = "codec",
+    [TF_FIELD_REPLAYGAIN_ALBUM_GAIN] = "replaygain_album_gain",
+    [TF_FIELD_REPLAYGAIN_ALBUM_PEAK] = "replaygain_album_peak",
+    [TF_FIELD_REPLAYGAIN_TRACK_GAIN] = "replaygain_track_gain",
+    [TF_FIELD_REPLAYGAIN_TRACK_PEAK] = "replaygain_track_peak",
+    [TF_FIELD_PLAYBACK_TIME] = "playback_time",
+    [TF_FIELD_PLAYBACK_TIME_SECONDS] = "playback_time_seconds",
+    [TF_FIELD_PLAYBACK_TIME_REMAINING] = "playback_time_remaining",
+    [TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS] = "playback_time_remaining_seconds",
+    [TF_FIELD_LENGTH] = "length",
+    [TF_FIELD_LENGTH_EX] = "length_ex",
+    [TF_FIELD_LENGTH_SECONDS] = "length_seconds",
+    [TF_FIELD_LENGTH_SECONDS_FP] = "length_seconds_fp",
+    [TF_FIELD_LENGTH_SAMPLES] = "length_samples",
+    [TF_FIELD_ISPLAYING] = "isplaying",
+    [TF_FIELD_ISPAUSED] = "ispaused",
+    [TF_FIELD_FILENAME] = "filename",
+    [TF_FIELD_FILENAME_EXT] = "filename_ext",
+    [TF_FIELD_DIRECTORYNAME] = "directoryname",
+    [TF_FIELD_PATH_RAW] = "_path_raw",
+    [TF_FIELD_PATH] = "path",
+    [TF_FIELD_LIST_INDEX] = "list_index",
+    [TF_FIELD_LIST_TOTAL] = "list_total",
+    [TF_FIELD_QUEUE_INDEX] = "queue_index",
+    [TF_FIELD_QUEUE_INDEXES] = "queue_indexes",
+    [TF_FIELD_QUEUE_TOTAL] = "queue_total",
+    [TF_FIELD_DEADBEEF_VERSION] = "_deadbeef_version",
+    [TF_FIELD_PLAYLIST_NAME] = "_playlist_name",
+    [TF_FIELD_SELECTION_PLAYBACK_TIME] = "selection_playback_time",
+};
+
+// field id of scripts compiled with TF_COMPILE_NO_LOWERING,
+// the field is then resolved by name on each evaluation
+#define TF_FIELD_UNRESOLVED 0xff
+
+static int
+tf_field_id (const char *name) {
+    for (int i = TF_FIELD_META + 1; i < TF_FIELD_COUNT; i++) {
+        if (!strcmp (name, tf_field_names[i])) {
+            return i;
+        }
+    }
+    return TF_FIELD_META;
+}
+
+// The results of scripts which depend only on track data are cached,
+// keyed by the track, the script's cache id, and the track's modification stamp.
+// The cache id is stored after the padding of the compiled bytecode,
+// so the bytecode can still be released by free.
+#define TF_CACHE_SETS 4096 // must be a power of 2
+#define TF_CACHE_WAYS 4
+
+typedef struct {
+    playItem_t *it;
+    uint32_t cache_id;
+    uint32_t modification_idx;
+    uint32_t flags;
+    uint32_t last_used;
+    int outlen;
+    int len;
+    int dimmed;
+    char *text;
+} tf_cache_entry_t;
+
+static tf_cache_entry_t tf_cache[TF_CACHE_SETS][TF_CACHE_WAYS];
+static uint32_t tf_cache_id;
+static uint32_t tf_cache_tick;
+
+// these fields depend on playback state or on the track position
+static const char *tf_uncacheable_fields[] = {
+    "playback_bitrate",
+    "playback_time",
+    "playback_time_seconds",
+    "playback_time_remaining",
+    "playback_time_remaining_seconds",
+    "isplaying",
+    "ispaused",
+    "list_index",
+    "list_total",
+    "queue_index",
+    "queue_indexes",
+    "queue_total",
+    "_playlist_name",
+    "selection_playback_time",
+    NULL
+};
+
+// returns the entry for the track and script, or the least recently used entry of its set
+static tf_cache_entry_t *
+tf_cache_entry (playItem_t *it, uint32_t cache_id) {
+    uint32_t h = (uint32_t)((uintptr_t)it >> 4) * 2654435761u ^ cache_id * 40503u;
+    tf_cache_entry_t *set = tf_cache[(h ^ (h >> 16)) & (TF_CACHE_SETS-1)];
+    tf_cache_entry_t *lru = set;
+    for (int i = 0; i < TF_CACHE_WAYS; i++) {
+        if (set[i].it == it && set[i].cache_id == cache_id) {
+            return &set[i];
+        }
+        if (set[i].last_used < lru->last_used) {
+            lru = &set[i];
+        }
+    }
+    return lru;
+}
+
 static int
 snprintf_clip (char *buf, size_t len, const char *fmt, ...) {
     va_list ap;
@@ -145,8 +326,6 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
     }
 
     int32_t codelen = *((int32_t *)code);
-    code += 4;
-    memset (out, 0, outlen);
     int l = 0;
 
     int bool_out = 0;
@@ -155,9 +334,41 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         id = ctx->id;
     }
 
+    uint32_t cache_id = 0;
+    uint32_t cache_flags = ctx->flags & (DDB_TF_CONTEXT_MULTILINE|DDB_TF_CONTEXT_TEXT_DIM);
+    uint32_t modification_idx = 0;
+    if (code != empty_code && !null_it && id != DB_COLUMN_FILENUMBER && id != DB_COLUMN_PLAYING) {
+        memcpy (&cache_id, code + 4 + codelen + 4, sizeof (cache_id));
+    }
+    if (cache_id) {
+        pl_lock ();
+        modification_idx = ((playItem_t *)ctx->it)->_modification_idx;
+        tf_cache_entry_t *e = tf_cache_entry ((playItem_t *)ctx->it, cache_id);
+        if (e->it == (playItem_t *)ctx->it && e->cache_id == cache_id && e->modification_idx == modification_idx
+            && e->flags == cache_flags && e->outlen == outlen) {
+            e->last_used = ++tf_cache_tick;
+            strcpy (out, e->text);
+            if (HAS_DIMMED (ctx)) {
+                ctx->dimmed = e->dimmed;
+            }
+            l = e->len;
+            pl_unlock ();
+            if (null_plt) {
+                ctx->plt = NULL;
+            }
+            return l;
+        }
+        pl_unlock ();
+    }
+
+    code += 4;
+    memset (out, 0, outlen);
+    char *init_out = out;
+
     if (HAS_DIMMED (ctx)) {
         ctx->dimmed = 0;
     }
+    int update = ctx->update;
 
     switch (id) {
     case DB_COLUMN_FILENUMBER:
@@ -190,6 +401,22 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         }
     }
 
+    if (cache_id && l >= 0 && ctx->update == update) {
+        pl_lock ();
+        tf_cache_entry_t *e = tf_cache_entry ((playItem_t *)ctx->it, cache_id);
+        free (e->text);
+        e->it = (playItem_t *)ctx->it;
+        e->cache_id = cache_id;
+        e->modification_idx = modification_idx;
+        e->flags = cache_flags;
+        e->outlen = outlen;
+        e->len = l;
+        e->dimmed = HAS_DIMMED (ctx) ? ctx->dimmed : 0;
+        e->last_used = ++tf_cache_tick;
+        e->text = strdup (init_out);
+        pl_unlock ();
+    }
+
     if (null_it) {
         ctx->it = NULL;
     }
@@ -1772,8 +1999,11 @@ tf_func_def tf_funcs[TF_MAX_FUNCS] = {
 
 static const char *
 _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
-    DB_metaInfo_t *meta = pl_meta_for_key (it, key);
+    return _tf_get_combined_meta_value (pl_meta_for_key (it, key), needs_free);
+}
 
+static const char *
+_tf_get_combined_meta_value (DB_metaInfo_t *meta, int *needs_free) {
     if (!meta) {
         *needs_free = 0;
         return NULL;
@@ -1903,9 +2133,17 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 code++;
                 size--;
 
-                char name[len+1];
-                memcpy (name, code, len);
-                name[len] = 0;
+                // the name is followed by the field id and the key atom
+                int field = (uint8_t)code[len];
+                uint32_t atom;
+                memcpy (&atom, code + len + 1, sizeof (atom));
+                if (field == TF_FIELD_UNRESOLVED) {
+                    char name[len+1];
+                    memcpy (name, code, len);
+                    name[len] = 0;
+                    field = tf_field_id (name);
+                    atom = field == TF_FIELD_META ? metacache_get_key_atom (name) : 0;
+                }
 
                 // special cases
                 // most if not all of this stuff is to make tf scripts
@@ -1923,22 +2161,22 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 // temp vars used for strcmp optimizations
                 int tmp_a = 0, tmp_b = 0, tmp_c = 0, tmp_d = 0;
 
-                if (!strcmp (name, aa_fields[0])) {
+                if (field == TF_FIELD_ALBUM_ARTIST) {
                     for (int i = 0; !val && aa_fields[i]; i++) {
                         val = _tf_get_combined_value(it, aa_fields[i], &needs_free);
                     }
                 }
-                else if (!strcmp (name, a_fields[0])) {
+                else if (field == TF_FIELD_ARTIST) {
                     for (int i = 0; !val && a_fields[i]; i++) {
                         val = _tf_get_combined_value(it, a_fields[i], &needs_free);
                     }
                 }
-                else if (!strcmp (name, "album")) {
+                else if (field == TF_FIELD_ALBUM) {
                     for (int i = 0; !val && alb_fields[i]; i++) {
                         val = _tf_get_combined_value (it, alb_fields[i], &needs_free);
                     }
                 }
-                else if (!strcmp (name, "track artist")) {
+                else if (field == TF_FIELD_TRACK_ARTIST) {
                     const char *aa = NULL;
                     for (int i = 0; !val && aa_fields[i]; i++) {
                         val = _tf_get_combined_value (it, aa_fields[i], &needs_free);
@@ -1952,7 +2190,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         val = NULL;
                     }
                 }
-                else if (!strcmp (name, "tracknumber")) {
+                else if (field == TF_FIELD_TRACKNUMBER) {
                     const char *v = pl_find_meta_raw (it, "track");
                     if (v) {
                         const char *p = v;
@@ -1970,7 +2208,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         }
                     }
                 }
-                else if (!strcmp (name, "title")) {
+                else if (field == TF_FIELD_TITLE) {
                     val = _tf_get_combined_value (it, "title", &needs_free);
                     if (!val) {
                         const char *v = pl_find_meta_raw (it, ":URI");
@@ -1997,13 +2235,13 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         }
                     }
                 }
-                else if (!strcmp (name, "discnumber")) {
+                else if (field == TF_FIELD_DISCNUMBER) {
                     val = pl_find_meta_raw (it, "disc");
                 }
-                else if (!strcmp (name, "totaldiscs")) {
+                else if (field == TF_FIELD_TOTALDISCS) {
                     val = pl_find_meta_raw (it, "numdiscs");
                 }
-                else if (!strcmp (name, "track number")) {
+                else if (field == TF_FIELD_TRACK_NUMBER) {
                     const char *v = pl_find_meta_raw (it, "track");
                     if (v) {
                         const char *p = v;
@@ -2021,15 +2259,15 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         }
                     }
                 }
-                else if (!strcmp (name, "date")) {
+                else if (field == TF_FIELD_DATE) {
                     // NOTE: foobar2000 uses "date" instead of "year"
                     // so for %date% we simply return the content of "year"
                     val = pl_find_meta_raw (it, "year");
                 }
-                else if (!strcmp (name, "samplerate")) {
+                else if (field == TF_FIELD_SAMPLERATE) {
                     val = pl_find_meta_raw (it, ":SAMPLERATE");
                 }
-                else if (!strcmp (name, "playback_bitrate")) {
+                else if (field == TF_FIELD_PLAYBACK_BITRATE) {
                     playItem_t *playing_track = streamer_get_playing_track();
                     if (playing_track) {
                         int br = streamer_get_apx_bitrate();
@@ -2042,13 +2280,13 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         pl_item_unref (playing_track);
                     }
                 }
-                else if (!strcmp (name, "bitrate")) {
+                else if (field == TF_FIELD_BITRATE) {
                     val = pl_find_meta_raw (it, ":BITRATE");
                 }
-                else if (!strcmp (name, "filesize")) {
+                else if (field == TF_FIELD_FILESIZE) {
                     val = pl_find_meta_raw (it, ":FILE_SIZE");
                 }
-                else if (!strcmp (name, "filesize_natural")) {
+                else if (field == TF_FIELD_FILESIZE_NATURAL) {
                     const char *v = pl_find_meta_raw (it, ":FILE_SIZE");
                     if (v) {
                         int64_t bs = atoll (v);
@@ -2073,25 +2311,25 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if (!strcmp (name, "channels")) {
+                else if (field == TF_FIELD_CHANNELS) {
                     val = tf_get_channels_string_for_track (it);
                 }
-                else if (!strcmp (name, "codec")) {
+                else if (field == TF_FIELD_CODEC) {
                     val = pl_find_meta (it, ":FILETYPE");
                 }
-                else if (!strcmp (name, "replaygain_album_gain")) {
+                else if (field == TF_FIELD_REPLAYGAIN_ALBUM_GAIN) {
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_ALBUMGAIN");
                 }
-                else if (!strcmp (name, "replaygain_album_peak")) {
+                else if (field == TF_FIELD_REPLAYGAIN_ALBUM_PEAK) {
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_ALBUMPEAK");
                 }
-                else if (!strcmp (name, "replaygain_track_gain")) {
+                else if (field == TF_FIELD_REPLAYGAIN_TRACK_GAIN) {
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKGAIN");
                 }
-                else if (!strcmp (name, "replaygain_track_peak")) {
+                else if (field == TF_FIELD_REPLAYGAIN_TRACK_PEAK) {
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKPEAK");
                 }
-                else if ((tmp_a = !strcmp (name, "playback_time")) || (tmp_b = !strcmp (name, "playback_time_seconds")) || (tmp_c = !strcmp (name, "playback_time_remaining")) || (tmp_d = !strcmp (name, "playback_time_remaining_seconds"))) {
+                else if ((tmp_a = field == TF_FIELD_PLAYBACK_TIME) || (tmp_b = field == TF_FIELD_PLAYBACK_TIME_SECONDS) || (tmp_c = field == TF_FIELD_PLAYBACK_TIME_REMAINING) || (tmp_d = field == TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS)) {
                     playItem_t *playing = streamer_get_playing_track ();
                     if (it && playing == it && !(ctx->flags & DDB_TF_CONTEXT_NO_DYNAMIC)) {
                         float t = streamer_get_playpos ();
@@ -2128,7 +2366,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         pl_item_unref (playing);
                     }
                 }
-                else if ((tmp_a = !strcmp (name, "length")) || (tmp_b = !strcmp (name, "length_ex"))) {
+                else if ((tmp_a = field == TF_FIELD_LENGTH) || (tmp_b = field == TF_FIELD_LENGTH_EX)) {
                     float t = pl_get_item_duration (it);
                     if (tmp_a) {
                         t = roundf (t);
@@ -2163,7 +2401,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if ((tmp_a = !strcmp (name, "length_seconds") || (tmp_b = !strcmp (name, "length_seconds_fp")))) {
+                else if ((tmp_a = field == TF_FIELD_LENGTH_SECONDS || (tmp_b = field == TF_FIELD_LENGTH_SECONDS_FP))) {
                     float t = pl_get_item_duration (it);
                     if (t >= 0) {
                         int len;
@@ -2178,13 +2416,13 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if (!strcmp (name, "length_samples")) {
+                else if (field == TF_FIELD_LENGTH_SAMPLES) {
                     int len = snprintf_clip (out, outlen, "%lld", pl_item_get_endsample ((playItem_t *)ctx->it) - pl_item_get_startsample ((playItem_t *)ctx->it));
                     out += len;
                     outlen -= len;
                     skip_out = 1;
                 }
-                else if ((tmp_a = !strcmp (name, "isplaying")) || (tmp_b = !strcmp (name, "ispaused"))) {
+                else if ((tmp_a = field == TF_FIELD_ISPLAYING) || (tmp_b = field == TF_FIELD_ISPAUSED)) {
                     playItem_t *playing = streamer_get_playing_track ();
                     
                     if (playing && 
@@ -2200,7 +2438,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         pl_item_unref (playing);
                     }
                 }
-                else if (!strcmp (name, "filename")) {
+                else if (field == TF_FIELD_FILENAME) {
                     const char *v = pl_find_meta_raw (it, ":URI");
                     if (v) {
                         const char *start = strrchr (v, '/');
@@ -2217,7 +2455,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         }
                     }
                 }
-                else if (!strcmp (name, "filename_ext")) {
+                else if (field == TF_FIELD_FILENAME_EXT) {
                     const char *v = pl_find_meta_raw (it, ":URI");
                     if (v) {
                         const char *start = strrchr (v, '/');
@@ -2231,7 +2469,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if (!strcmp (name, "directoryname")) {
+                else if (field == TF_FIELD_DIRECTORYNAME) {
                     const char *v = pl_find_meta_raw (it, ":URI");
                     if (v) {
                         const char *end = strrchr (v, '/');
@@ -2248,10 +2486,10 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         }
                     }
                 }
-                else if (!strcmp (name, "_path_raw")) {
+                else if (field == TF_FIELD_PATH_RAW) {
                     val = pl_find_meta_raw (it, ":URI");
                 }
-                else if (!strcmp (name, "path")) {
+                else if (field == TF_FIELD_PATH) {
                     val = pl_find_meta_raw (it, ":URI");
 
                     // strip file://
@@ -2279,7 +2517,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
 #endif
                 }
                 // index of track in playlist (zero-padded)
-                else if (!strcmp (name, "list_index")) {
+                else if (field == TF_FIELD_LIST_INDEX) {
                     if (it) {
                         int total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
                         int digits = 0;
@@ -2302,7 +2540,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     }
                 }
                 // total number of tracks in playlist
-                else if (!strcmp (name, "list_total")) {
+                else if (field == TF_FIELD_LIST_TOTAL) {
                     int total_tracks = -1;
                     if (ctx->plt) {
                         total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
@@ -2322,7 +2560,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     }
                 }
                 // index of track in queue
-                else if (!strcmp (name, "queue_index")) {
+                else if (field == TF_FIELD_QUEUE_INDEX) {
                     if (it) {
                         int idx = playqueue_test (it) + 1;
                         if (idx >= 1) {
@@ -2334,7 +2572,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     }
                 }
                 // indexes of track in queue
-                else if (!strcmp (name, "queue_indexes")) {
+                else if (field == TF_FIELD_QUEUE_INDEXES) {
                     if (it) {
                         int idx = playqueue_test (it) + 1;
                         if (idx >= 1) {
@@ -2358,7 +2596,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     }
                 }
                 // total amount of tracks in queue
-                else if (!strcmp (name, "queue_total")) {
+                else if (field == TF_FIELD_QUEUE_TOTAL) {
                     int count = playqueue_getcount ();
                     if (count >= 0) {
                         int len = snprintf_clip (out, outlen, "%d", count);
@@ -2367,13 +2605,13 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if (!strcmp (name, "_deadbeef_version")) {
+                else if (field == TF_FIELD_DEADBEEF_VERSION) {
                     val = VERSION;
                 }
-                else if (!strcmp (name, "_playlist_name")) {
+                else if (field == TF_FIELD_PLAYLIST_NAME) {
                     val = ((playlist_t *)ctx->plt)->title;
                 }
-                else if (!strcmp (name, "selection_playback_time")) {
+                else if (field == TF_FIELD_SELECTION_PLAYBACK_TIME) {
                     float seltime = plt_get_selection_playback_time((playlist_t *)ctx->plt);
 
                     int len = format_playback_time (out, outlen, seltime);
@@ -2383,7 +2621,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     skip_out = 1;
                 }
                 else {
-                    val = _tf_get_combined_value (it, name, &needs_free);
+                    val = _tf_get_combined_meta_value (pl_meta_for_atom (it, atom), &needs_free);
                 }
 
                 if (val || (!val && out > init_out)) {
@@ -2405,8 +2643,8 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     free ((char *)val);
                 }
 
-                code += len;
-                size -= len;
+                code += len + 1 + sizeof (atom);
+                size -= len + 1 + sizeof (atom);
             }
             else if (*code == 3) { // conditional expression
                 code++;
@@ -2437,11 +2675,14 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 memcpy (&len, code, 4);
                 code += 4;
                 size -= 4;
-                int32_t l = u8_strnbcpy(out, code, len);
+                int32_t l = u8_strnbcpy(out, code, min (len, outlen));
                 out += l;
                 outlen -= l;
                 code += len;
                 size -= len;
+                if (l < len) {
+                    break; // out of space
+                }
             }
             else if (*code == 5) { // dimming of text
                 code++;
@@ -2548,6 +2789,9 @@ tf_compile_func (tf_compiler_t *c) {
     if (!tf_funcs[i].name) {
         return -1;
     }
+    if (tf_funcs[i].func == tf_func_rand) {
+        c->uncacheable = 1;
+    }
 
     char func_name[c->i - name_start + 1];
     memcpy (func_name, name_start, c->i-name_start);
@@ -2632,6 +2876,24 @@ tf_compile_field (tf_compiler_t *c) {
     char field[len+1];
     memcpy (field, fstart, len);
     field[len] = 0;
+
+    // resolve the field, to avoid name lookups in tf_eval_int
+    uint8_t id = TF_FIELD_UNRESOLVED;
+    uint32_t atom = 0;
+    if (!c->no_lowering) {
+        id = tf_field_id (field);
+        atom = id == TF_FIELD_META ? metacache_add_key_atom (field) : 0;
+    }
+    *(c->o++) = id;
+    memcpy (c->o, &atom, sizeof (atom));
+    c->o += sizeof (atom);
+
+    for (int i = 0; tf_uncacheable_fields[i]; i++) {
+        if (!strcmp (field, tf_uncacheable_fields[i])) {
+            c->uncacheable = 1;
+            break;
+        }
+    }
     return 0;
 }
 
@@ -2805,19 +3067,43 @@ tf_compile_plain (tf_compiler_t *c) {
         }
     }
     else {
-        *(c->o++) = *(c->i++);
+        // runs of plain text are stored as preformatted text blocks,
+        // which are copied at once by tf_eval_int
+        const char *e = c->i;
+        while (*e && !strchr ("$[]%\\'\n<>(),/", *e)) {
+            e++;
+        }
+        int32_t len = (int32_t)(e - c->i);
+        if (len >= TF_MIN_TEXT_BLOCK && !c->no_lowering) {
+            *(c->o++) = 0;
+            *(c->o++) = 4;
+            memcpy (c->o, &len, 4);
+            c->o += 4;
+            memcpy (c->o, c->i, len);
+            c->o += len;
+            c->i = e;
+        }
+        else {
+            *(c->o++) = *(c->i++);
+        }
     }
     return 0;
 }
 
 char *
 tf_compile (const char *script) {
+    return tf_compile_with_flags (script, 0);
+}
+
+char *
+tf_compile_with_flags (const char *script, int flags) {
     tf_compiler_t c;
     memset (&c, 0, sizeof (c));
 
     c.i = script;
+    c.no_lowering = (flags & TF_COMPILE_NO_LOWERING) ? 1 : 0;
 
-    char code[strlen(script) * 3];
+    char code[strlen(script) * 4 + 16];
     memset (code, 0, sizeof (code));
 
     c.o = code;
@@ -2832,10 +3118,21 @@ tf_compile (const char *script) {
     }
 
     size_t size = c.o - code;
-    char *out = malloc (size + 8);
+    char *out = malloc (size + 8 + sizeof (uint32_t));
     memcpy (out + 4, code, size);
     memset (out + 4 + size, 0, 4); // FIXME: this is the padding for possible buffer overflow bug fix
     *((int32_t *)out) = (int32_t)(size);
+
+    uint32_t cache_id = 0;
+    if (!c.uncacheable) {
+        pl_lock ();
+        if (!++tf_cache_id) {
+            tf_cache_id++;
+        }
+        cache_id = tf_cache_id;
+        pl_unlock ();
+    }
+    memcpy (out + 8 + size, &cache_id, sizeof (cache_id));
     return out;
 }
 
@@ -30,6 +30,17 @@
 char *
 tf_compile (const char *script);
 
+enum {
+    // keep field names and plain text as they are in the bytecode,
+    // instead of resolving them at compile time;
+    // evaluation then works like before the lowering, which is useful for benchmarks
+    TF_COMPILE_NO_LOWERING = 1,
+};
+
+// same as tf_compile, flags is a combination of TF_COMPILE_* values
+char *
+tf_compile_with_flags (const char *script, int flags);
+
 void
 tf_free (char *code);
 
@@ -44,6 +44,10 @@ thread_detach (intptr_t tid);
 void
 thread_exit (void *retval);
 
+// returns an identifier of the calling thread, comparable with the result of thread_start
+intptr_t
+thread_self (void);
+
 uintptr_t
 mutex_create (void);
 
@@ -68,6 +72,15 @@ cond_free (uintptr_t cond);
 int
 cond_wait (uintptr_t cond, uintptr_t mutex);
 
+// unlike cond_wait, the mutex must be locked by the caller, and is locked again on return;
+// this allows checking the predicate without missing a signal
+int
+cond_wait_locked (uintptr_t cond, uintptr_t mutex);
+
+// same as cond_wait_locked, but returns ETIMEDOUT if not signalled within timeout_ms
+int
+cond_timedwait (uintptr_t cond, uintptr_t mutex, int timeout_ms);
+
 int
 cond_signal (uintptr_t cond);
 
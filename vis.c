@@ -0,0 +1,612 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2017 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "vis.h"
+#include "threading.h"
+#include "conf.h"
+#include "premix.h"
+#include "ringbuf.h"
+#include "fft.h"
+
+// Visualization data broker.
+//
+// The output thread only converts the played audio to float, and passes it
+// to the vis thread through a lock-free ring. It never waits: if the ring
+// is full, the data is dropped.
+//
+// The vis thread runs while there are any listeners or subscribers.
+// It calls the listeners, calculates the spectrum, and publishes the latest
+// waveform and spectrum into triple buffers, which vis_poll copies from.
+//
+// Spectrum windows of spectrum_fft_size frames overlap, and a new one is
+// analysed every SPECTRUM_HOP frames, or every half window for small sizes.
+// Larger FFT sizes are reduced to DDB_FREQ_BANDS bands, taking the peak.
+
+#define MIN_SPECTRUM_FFT_SIZE (DDB_FREQ_BANDS * 2)
+#define MAX_SPECTRUM_FFT_SIZE 16384
+#define SPECTRUM_HOP (DDB_FREQ_BANDS * 2)
+#define VIS_POLL_USEC 10000
+#define VIS_RING_SIZE (256*1024)
+#define VIS_CHUNK_MAX_SAMPLES 16384 // per chunk, in all channels
+#define VIS_POLL_RETRIES 100
+
+typedef struct wavedata_listener_s {
+    void *ctx;
+    void (*callback)(void *ctx, ddb_audio_data_t *data);
+    struct wavedata_listener_s *next;
+} wavedata_listener_t;
+
+static uintptr_t wdl_mutex; // wavedata listener
+static wavedata_listener_t *waveform_listeners;
+static wavedata_listener_t *spectrum_listeners;
+
+// header of each chunk in vis_ring, followed by interleaved float samples
+typedef struct {
+    int channels;
+    int samplerate;
+    uint32_t channelmask;
+    int nframes;
+} vis_chunk_t;
+
+static uintptr_t vis_thread_mutex; // serializes starting / stopping the thread
+static intptr_t vis_tid;
+static int vis_active;
+static int vis_terminate;
+static int vis_subscribers[2];
+static int spectrum_fft_size = MIN_SPECTRUM_FFT_SIZE;
+
+static float vis_ring_data[VIS_RING_SIZE / sizeof (float)];
+static ringbuf_t vis_ring;
+
+// used by the output thread when a chunk doesn't fit before the end of the ring
+static float vis_chunk_scratch[sizeof (vis_chunk_t) / sizeof (float) + VIS_CHUNK_MAX_SAMPLES];
+
+// Triple buffer with a single writer (the vis thread) and any number of readers.
+// The writer fills the slot after the latest, and then publishes it.
+// Readers copy the latest slot, and retry if it was rewritten meanwhile,
+// which is detected by the slot sequence number (odd while writing).
+typedef struct {
+    uint32_t seq;
+    ddb_waveformat_t fmt;
+    int nframes;
+    uint32_t serial;
+    float data[DDB_VIS_WAVEFORM_FRAMES * DDB_FREQ_MAX_CHANNELS];
+} vis_slot_t;
+
+typedef struct {
+    vis_slot_t slots[3];
+    int latest; // -1 if nothing was published
+    uint32_t serial;
+} vis_triple_buffer_t;
+
+static vis_triple_buffer_t vis_published[2];
+
+static vis_slot_t *
+triple_buffer_begin_write (vis_triple_buffer_t *tb) {
+    int latest = __atomic_load_n (&tb->latest, __ATOMIC_RELAXED);
+    vis_slot_t *slot = &tb->slots[(latest + 1) % 3];
+    __atomic_store_n (&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    return slot;
+}
+
+static void
+triple_buffer_end_write (vis_triple_buffer_t *tb, vis_slot_t *slot) {
+    slot->serial = ++tb->serial;
+    __atomic_store_n (&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n (&tb->latest, (int)(slot - tb->slots), __ATOMIC_RELEASE);
+}
+
+static void
+triple_buffer_reset (vis_triple_buffer_t *tb) {
+    __atomic_store_n (&tb->latest, -1, __ATOMIC_RELEASE);
+}
+
+void
+vis_init (void) {
+    wdl_mutex = mutex_create ();
+    vis_thread_mutex = mutex_create_nonrecursive ();
+    ringbuf_init (&vis_ring, (char *)vis_ring_data, sizeof (vis_ring_data));
+    triple_buffer_reset (&vis_published[DDB_VIS_WAVEFORM]);
+    triple_buffer_reset (&vis_published[DDB_VIS_SPECTRUM]);
+    vis_configchanged ();
+}
+
+static void
+vis_thread_stop (void) {
+    if (vis_tid) {
+        vis_active = 0;
+        vis_terminate = 1;
+        thread_join (vis_tid);
+        vis_tid = 0;
+    }
+}
+
+static void
+free_listeners (wavedata_listener_t *l) {
+    while (l) {
+        wavedata_listener_t *next = l->next;
+        free (l);
+        l = next;
+    }
+}
+
+void
+vis_free (void) {
+    mutex_lock (vis_thread_mutex);
+    vis_thread_stop ();
+    mutex_unlock (vis_thread_mutex);
+
+    free_listeners (waveform_listeners);
+    waveform_listeners = NULL;
+    free_listeners (spectrum_listeners);
+    spectrum_listeners = NULL;
+    memset (vis_subscribers, 0, sizeof (vis_subscribers));
+
+    mutex_free (vis_thread_mutex);
+    vis_thread_mutex = 0;
+    mutex_free (wdl_mutex);
+    wdl_mutex = 0;
+}
+
+void
+vis_configchanged (void) {
+    int size = conf_get_int ("vis.spectrum_fft_size", MIN_SPECTRUM_FFT_SIZE);
+    int fft_size = MIN_SPECTRUM_FFT_SIZE;
+    while (fft_size < size && fft_size < MAX_SPECTRUM_FFT_SIZE) {
+        fft_size <<= 1;
+    }
+    spectrum_fft_size = fft_size;
+}
+
+typedef struct {
+    ddb_waveformat_t fmt;
+    int channels; // number of published channels
+    int fill; // frames in history
+    float history[DDB_VIS_WAVEFORM_FRAMES * DDB_FREQ_MAX_CHANNELS]; // interleaved
+} waveform_state_t;
+
+typedef struct {
+    ddb_fft_t *fft;
+    ddb_waveformat_t fmt;
+    int channels; // number of analysed channels
+    int fill; // frames in window
+    int hop;
+    float *window; // non-interleaved, fft size frames per channel
+    float *bins; // fft size / 2
+    float freq_data[DDB_FREQ_BANDS * DDB_FREQ_MAX_CHANNELS];
+} spectrum_state_t;
+
+static void
+format_from_chunk (ddb_waveformat_t *fmt, const vis_chunk_t *chunk) {
+    memset (fmt, 0, sizeof (ddb_waveformat_t));
+    fmt->bps = 32;
+    fmt->is_float = 1;
+    fmt->channels = chunk->channels;
+    fmt->samplerate = chunk->samplerate;
+    fmt->channelmask = chunk->channelmask;
+}
+
+static int
+format_matches_chunk (const ddb_waveformat_t *fmt, const vis_chunk_t *chunk) {
+    return fmt->channels == chunk->channels
+        && fmt->samplerate == chunk->samplerate
+        && fmt->channelmask == chunk->channelmask;
+}
+
+static void
+waveform_process (waveform_state_t *w, const vis_chunk_t *chunk, const float *samples) {
+    if (!format_matches_chunk (&w->fmt, chunk)) {
+        format_from_chunk (&w->fmt, chunk);
+        w->channels = chunk->channels < DDB_FREQ_MAX_CHANNELS ? chunk->channels : DDB_FREQ_MAX_CHANNELS;
+        w->fill = 0;
+    }
+
+    // keep the last DDB_VIS_WAVEFORM_FRAMES frames
+    int nch = w->channels;
+    int n = chunk->nframes < DDB_VIS_WAVEFORM_FRAMES ? chunk->nframes : DDB_VIS_WAVEFORM_FRAMES;
+    const float *in = samples + (chunk->nframes - n) * chunk->channels;
+    int keep = DDB_VIS_WAVEFORM_FRAMES - n;
+    if (keep > w->fill) {
+        keep = w->fill;
+    }
+    memmove (w->history, w->history + (w->fill - keep) * nch, keep * nch * sizeof (float));
+    float *out = w->history + keep * nch;
+    for (int i = 0; i < n; i++, in += chunk->channels, out += nch) {
+        memcpy (out, in, nch * sizeof (float));
+    }
+    w->fill = keep + n;
+
+    vis_triple_buffer_t *tb = &vis_published[DDB_VIS_WAVEFORM];
+    vis_slot_t *slot = triple_buffer_begin_write (tb);
+    slot->fmt = w->fmt;
+    slot->fmt.channels = nch;
+    slot->nframes = w->fill;
+    memcpy (slot->data, w->history, w->fill * nch * sizeof (float));
+    triple_buffer_end_write (tb, slot);
+}
+
+static void
+spectrum_state_reset (spectrum_state_t *s, const vis_chunk_t *chunk) {
+    int size = spectrum_fft_size;
+    if (!s->fft || fft_get_size (s->fft) != size) {
+        fft_free (s->fft);
+        s->fft = fft_alloc (size);
+        free (s->window);
+        s->window = malloc (size * DDB_FREQ_MAX_CHANNELS * sizeof (float));
+        free (s->bins);
+        s->bins = malloc (size / 2 * sizeof (float));
+    }
+    format_from_chunk (&s->fmt, chunk);
+    s->channels = chunk->channels < DDB_FREQ_MAX_CHANNELS ? chunk->channels : DDB_FREQ_MAX_CHANNELS;
+    s->hop = size / 2 < SPECTRUM_HOP ? size / 2 : SPECTRUM_HOP;
+    s->fill = 0;
+}
+
+static void
+spectrum_calc (spectrum_state_t *s) {
+    int size = fft_get_size (s->fft);
+    int group = size / 2 / DDB_FREQ_BANDS;
+    for (int c = 0; c < s->channels; c++) {
+        float *freq = &s->freq_data[DDB_FREQ_BANDS * c];
+        fft_calc_freq (s->fft, s->window + size * c, s->bins);
+        if (group == 1) {
+            memcpy (freq, s->bins, DDB_FREQ_BANDS * sizeof (float));
+            continue;
+        }
+        const float *bins = s->bins;
+        for (int b = 0; b < DDB_FREQ_BANDS; b++, bins += group) {
+            float peak = bins[0];
+            for (int i = 1; i < group; i++) {
+                if (bins[i] > peak) {
+                    peak = bins[i];
+                }
+            }
+            freq[b] = peak;
+        }
+    }
+
+    // DDB_FREQ_BANDS frames per channel
+    ddb_waveformat_t fmt = s->fmt;
+    fmt.channels = s->channels;
+
+    // the listeners are added and removed under wdl_mutex
+    mutex_lock (wdl_mutex);
+    if (spectrum_listeners) {
+        ddb_audio_data_t data;
+        data.fmt = &fmt;
+        data.data = s->freq_data;
+        data.nframes = DDB_FREQ_BANDS;
+        for (wavedata_listener_t *l = spectrum_listeners; l; l = l->next) {
+            l->callback (l->ctx, &data);
+        }
+    }
+    mutex_unlock (wdl_mutex);
+
+    if (vis_subscribers[DDB_VIS_SPECTRUM]) {
+        vis_triple_buffer_t *tb = &vis_published[DDB_VIS_SPECTRUM];
+        vis_slot_t *slot = triple_buffer_begin_write (tb);
+        slot->fmt = fmt;
+        slot->nframes = DDB_FREQ_BANDS;
+        memcpy (slot->data, s->freq_data, DDB_FREQ_BANDS * s->channels * sizeof (float));
+        triple_buffer_end_write (tb, slot);
+    }
+}
+
+static void
+spectrum_process (spectrum_state_t *s, const vis_chunk_t *chunk, const float *samples) {
+    if (!s->fft
+        || !format_matches_chunk (&s->fmt, chunk)
+        || spectrum_fft_size != fft_get_size (s->fft)) {
+        spectrum_state_reset (s, chunk);
+    }
+
+    int fft_size = fft_get_size (s->fft);
+    const float *in = samples;
+    int remaining = chunk->nframes;
+    while (remaining > 0) {
+        int n = fft_size - s->fill;
+        if (n > remaining) {
+            n = remaining;
+        }
+        for (int c = 0; c < s->channels; c++) {
+            float *out = s->window + fft_size * c + s->fill;
+            const float *src = in + c;
+            for (int i = 0; i < n; i++, src += chunk->channels) {
+                out[i] = *src;
+            }
+        }
+        in += n * chunk->channels;
+        remaining -= n;
+        s->fill += n;
+
+        if (s->fill == fft_size) {
+            spectrum_calc (s);
+            // keep the overlapping part of the window
+            for (int c = 0; c < s->channels; c++) {
+                float *w = s->window + fft_size * c;
+                memmove (w, w + s->hop, (fft_size - s->hop) * sizeof (float));
+            }
+            s->fill -= s->hop;
+        }
+    }
+}
+
+static void
+vis_thread (void *unused) {
+#if defined(__linux__) && !defined(ANDROID)
+    prctl (PR_SET_NAME, "deadbeef-vis", 0, 0, 0, 0);
+#endif
+
+    waveform_state_t *w = calloc (1, sizeof (waveform_state_t));
+    spectrum_state_t s;
+    memset (&s, 0, sizeof (s));
+    float *samples = NULL;
+    int samples_size = 0;
+
+    while (!vis_terminate) {
+        vis_chunk_t chunk;
+        if (ringbuf_get_read_available (&vis_ring) < sizeof (chunk)) {
+            usleep (VIS_POLL_USEC);
+            continue;
+        }
+        // chunks are written at once, so the samples are available with the header
+        ringbuf_read (&vis_ring, (char *)&chunk, sizeof (chunk));
+        int size = chunk.nframes * chunk.channels * sizeof (float);
+        if (samples_size < size) {
+            free (samples);
+            samples = malloc (size);
+            samples_size = size;
+        }
+        ringbuf_read (&vis_ring, (char *)samples, size);
+
+        // the listeners are added and removed under wdl_mutex
+        mutex_lock (wdl_mutex);
+        if (waveform_listeners) {
+            ddb_waveformat_t fmt;
+            format_from_chunk (&fmt, &chunk);
+            ddb_audio_data_t data;
+            data.fmt = &fmt;
+            data.data = samples;
+            data.nframes = chunk.nframes;
+            for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
+                l->callback (l->ctx, &data);
+            }
+        }
+        int have_spectrum_listeners = spectrum_listeners != NULL;
+        mutex_unlock (wdl_mutex);
+
+        if (vis_subscribers[DDB_VIS_WAVEFORM]) {
+            waveform_process (w, &chunk, samples);
+        }
+
+        if (have_spectrum_listeners || vis_subscribers[DDB_VIS_SPECTRUM]) {
+            spectrum_process (&s, &chunk, samples);
+        }
+    }
+
+    free (samples);
+    free (w);
+    fft_free (s.fft);
+    free (s.window);
+    free (s.bins);
+}
+
+// must be called with vis_thread_mutex locked
+static void
+vis_thread_update (void) {
+    int needed = waveform_listeners || spectrum_listeners
+        || vis_subscribers[DDB_VIS_WAVEFORM] || vis_subscribers[DDB_VIS_SPECTRUM];
+    if (needed && !vis_tid) {
+        // anything left in the ring is from the previous session
+        char discard[1024];
+        while (ringbuf_read (&vis_ring, discard, sizeof (discard)) > 0);
+        triple_buffer_reset (&vis_published[DDB_VIS_WAVEFORM]);
+        triple_buffer_reset (&vis_published[DDB_VIS_SPECTRUM]);
+
+        vis_terminate = 0;
+        vis_tid = thread_start (vis_thread, NULL);
+        vis_active = 1;
+    }
+    else if (!needed && vis_tid) {
+        // the thread calls the listeners under wdl_mutex, so it must not be held here
+        vis_thread_stop ();
+    }
+}
+
+void
+vis_process (const ddb_waveformat_t *fmt, const char *bytes, int size) {
+    if (!vis_active) {
+        return;
+    }
+
+    ddb_waveformat_t out_fmt = {
+        .bps = 32,
+        .channels = fmt->channels,
+        .samplerate = fmt->samplerate,
+        .channelmask = fmt->channelmask,
+        .is_float = 1,
+        .is_bigendian = 0
+    };
+    vis_chunk_t chunk = {
+        .channels = fmt->channels,
+        .samplerate = fmt->samplerate,
+        .channelmask = fmt->channelmask,
+    };
+
+    int in_frame_size = (fmt->bps >> 3) * fmt->channels;
+    int max_frames = VIS_CHUNK_MAX_SAMPLES / fmt->channels;
+    while (size >= in_frame_size) {
+        chunk.nframes = size / in_frame_size;
+        if (chunk.nframes > max_frames) {
+            chunk.nframes = max_frames;
+        }
+        int in_size = chunk.nframes * in_frame_size;
+        size_t chunk_size = sizeof (vis_chunk_t) + chunk.nframes * fmt->channels * sizeof (float);
+
+        // convert straight into the ring, when the chunk fits before the end
+        size_t avail;
+        char *ptr = ringbuf_write_ptr (&vis_ring, &avail);
+        if (avail >= chunk_size) {
+            memcpy (ptr, &chunk, sizeof (chunk));
+            pcm_convert (fmt, bytes, &out_fmt, ptr + sizeof (chunk), in_size);
+            ringbuf_write_commit (&vis_ring, chunk_size);
+        }
+        else if (ringbuf_get_write_available (&vis_ring) >= chunk_size) {
+            char *scratch = (char *)vis_chunk_scratch;
+            memcpy (scratch, &chunk, sizeof (chunk));
+            pcm_convert (fmt, bytes, &out_fmt, scratch + sizeof (chunk), in_size);
+            ringbuf_write (&vis_ring, scratch, chunk_size);
+        }
+        else {
+            break; // the vis thread is behind
+        }
+
+        bytes += in_size;
+        size -= in_size;
+    }
+}
+
+static void
+listener_add (wavedata_listener_t **listeners, void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data)) {
+    mutex_lock (wdl_mutex);
+    wavedata_listener_t *l = malloc (sizeof (wavedata_listener_t));
+    memset (l, 0, sizeof (wavedata_listener_t));
+    l->ctx = ctx;
+    l->callback = callback;
+    l->next = *listeners;
+    *listeners = l;
+    mutex_unlock (wdl_mutex);
+}
+
+static void
+listener_remove (wavedata_listener_t **listeners, void *ctx) {
+    mutex_lock (wdl_mutex);
+    wavedata_listener_t *l, *prev = NULL;
+    for (l = *listeners; l; prev = l, l = l->next) {
+        if (l->ctx == ctx) {
+            if (prev) {
+                prev->next = l->next;
+            }
+            else {
+                *listeners = l->next;
+            }
+            free (l);
+            break;
+        }
+    }
+    mutex_unlock (wdl_mutex);
+}
+
+void
+vis_waveform_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data)) {
+    mutex_lock (vis_thread_mutex);
+    listener_add (&waveform_listeners, ctx, callback);
+    vis_thread_update ();
+    mutex_unlock (vis_thread_mutex);
+}
+
+void
+vis_waveform_unlisten (void *ctx) {
+    mutex_lock (vis_thread_mutex);
+    listener_remove (&waveform_listeners, ctx);
+    vis_thread_update ();
+    mutex_unlock (vis_thread_mutex);
+}
+
+void
+vis_spectrum_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data)) {
+    mutex_lock (vis_thread_mutex);
+    listener_add (&spectrum_listeners, ctx, callback);
+    vis_thread_update ();
+    mutex_unlock (vis_thread_mutex);
+}
+
+void
+vis_spectrum_unlisten (void *ctx) {
+    mutex_lock (vis_thread_mutex);
+    listener_remove (&spectrum_listeners, ctx);
+    vis_thread_update ();
+    mutex_unlock (vis_thread_mutex);
+}
+
+void
+vis_subscribe (int type) {
+    if (type != DDB_VIS_WAVEFORM && type != DDB_VIS_SPECTRUM) {
+        return;
+    }
+    mutex_lock (vis_thread_mutex);
+    vis_subscribers[type]++;
+    vis_thread_update ();
+    mutex_unlock (vis_thread_mutex);
+}
+
+void
+vis_unsubscribe (int type) {
+    if (type != DDB_VIS_WAVEFORM && type != DDB_VIS_SPECTRUM) {
+        return;
+    }
+    mutex_lock (vis_thread_mutex);
+    if (vis_subscribers[type] > 0) {
+        vis_subscribers[type]--;
+    }
+    vis_thread_update ();
+    mutex_unlock (vis_thread_mutex);
+}
+
+int
+vis_poll (int type, ddb_vis_frame_t *frame) {
+    if ((type != DDB_VIS_WAVEFORM && type != DDB_VIS_SPECTRUM)
+        || frame->_size < (int)sizeof (ddb_vis_frame_t)) {
+        return -1;
+    }
+
+    vis_triple_buffer_t *tb = &vis_published[type];
+    for (int i = 0; i < VIS_POLL_RETRIES; i++) {
+        int latest = __atomic_load_n (&tb->latest, __ATOMIC_ACQUIRE);
+        if (latest < 0) {
+            return -1;
+        }
+        vis_slot_t *slot = &tb->slots[latest];
+        uint32_t seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        frame->fmt = slot->fmt;
+        frame->nframes = slot->nframes;
+        frame->serial = slot->serial;
+        memcpy (frame->data, slot->data, slot->nframes * slot->fmt.channels * sizeof (float));
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (__atomic_load_n (&slot->seq, __ATOMIC_RELAXED) == seq) {
+            return 0;
+        }
+    }
+    return -1;
+}
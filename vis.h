@@ -0,0 +1,63 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2017 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef vis_h
+#define vis_h
+
+#include "deadbeef.h"
+
+void
+vis_init (void);
+
+void
+vis_free (void);
+
+void
+vis_configchanged (void);
+
+// called from streamer_read with the data which is about to be played
+void
+vis_process (const ddb_waveformat_t *fmt, const char *bytes, int size);
+
+void
+vis_waveform_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data));
+
+void
+vis_waveform_unlisten (void *ctx);
+
+void
+vis_spectrum_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data));
+
+void
+vis_spectrum_unlisten (void *ctx);
+
+void
+vis_subscribe (int type);
+
+void
+vis_unsubscribe (int type);
+
+int
+vis_poll (int type, ddb_vis_frame_t *frame);
+
+#endif /* vis_h */